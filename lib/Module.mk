@@ -51,7 +51,11 @@ endif
 
 LIBCSOURCES := $(MODULE_DIR)/data.c $(MODULE_DIR)/general.c \
                $(MODULE_DIR)/error.c $(MODULE_DIR)/access.c \
-               $(MODULE_DIR)/init.c $(MODULE_DIR)/sysfs.c
+               $(MODULE_DIR)/init.c $(MODULE_DIR)/sysfs.c \
+               $(MODULE_DIR)/expr.c $(MODULE_DIR)/cache.c \
+               $(MODULE_DIR)/snapshot.c $(MODULE_DIR)/table.c \
+               $(MODULE_DIR)/capture.c $(MODULE_DIR)/compiled.c \
+               $(MODULE_DIR)/stats.c $(MODULE_DIR)/deadline.c
 
 LIBOTHEROBJECTS := $(MODULE_DIR)/conf-parse.o $(MODULE_DIR)/conf-lex.o
 LIBSHOBJECTS := $(LIBCSOURCES:.c=.lo) $(LIBOTHEROBJECTS:.o=.lo)
@@ -63,7 +67,7 @@ LIBHEADERFILES := $(MODULE_DIR)/error.h $(MODULE_DIR)/sensors.h
 
 # How to create the shared library
 $(MODULE_DIR)/$(LIBSHLIBNAME): $(LIBSHOBJECTS) $(LIB_DIR)/libsensors.map
-	$(CC) -shared $(LDFLAGS) -Wl,--version-script=$(LIB_DIR)/libsensors.map -Wl,-soname,$(LIBSHSONAME) -o $@ $(LIBSHOBJECTS) -lc -lm
+	$(CC) -shared $(LDFLAGS) -Wl,--version-script=$(LIB_DIR)/libsensors.map -Wl,-soname,$(LIBSHSONAME) -o $@ $(LIBSHOBJECTS) -lc -lm -lpthread -lrt
 
 $(MODULE_DIR)/$(LIBSHSONAME): $(MODULE_DIR)/$(LIBSHLIBNAME)
 	$(RM) $@
@@ -21,20 +21,15 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
 #include "access.h"
 #include "sensors.h"
 #include "data.h"
 #include "error.h"
 #include "sysfs.h"
-
-/* We watch the recursion depth for variables only, as an easy way to
-   detect cycles. */
-#define DEPTH_MAX	8
-
-static int sensors_eval_expr(const sensors_chip_features *chip_features,
-			     const sensors_expr *expr,
-			     double val, int depth, double *result);
+#include "expr.h"
+#include "table.h"
+#include "stats.h"
+#include "deadline.h"
 
 /* Compare two chips name descriptions, to see whether they could match.
    Return 0 if it does not match, return 1 if it does match. */
@@ -65,43 +60,365 @@ static int sensors_match_chip(const sensors_chip_name *chip1,
 }
 
 /* Returns, one by one, a pointer to all sensor_chip structs of the
-   config file which match with the given chip name. Last should be
-   the value returned by the last call, or NULL if this is the first
-   call. Returns NULL if no more matches are found. Do not modify
-   the struct the return value points to! 
+   config file which match with the given chip name. nr should be set to 0
+   before the first call. If features is not NULL, it must be the detected
+   chip matching name, and its precomputed list of configuration chips is
+   used. Returns NULL if no more matches are found. Do not modify the struct
+   the return value points to!
    Note that this visits the list of chips from last to first. Usually,
    you want the match that was latest in the config file. */
 static sensors_chip *
 sensors_for_all_config_chips(const sensors_chip_name *name,
-			     const sensors_chip *last)
+			     const sensors_chip_features *features, int *nr)
 {
-	int nr, i;
+	int i;
 	sensors_chip_name_list chips;
 
-	for (nr = last ? last - sensors_config_chips - 1 :
-			 sensors_config_chips_count - 1; nr >= 0; nr--) {
+	if (features) {
+		if (*nr >= features->config_count)
+			return NULL;
+		return features->config[(*nr)++];
+	}
 
-		chips = sensors_config_chips[nr].chips;
+	for (; *nr < sensors_config_chips_count; (*nr)++) {
+		chips = sensors_config_chips[sensors_config_chips_count - 1 -
+					     *nr].chips;
 		for (i = 0; i < chips.fits_count; i++) {
 			if (sensors_match_chip(&chips.fits[i], name))
-				return sensors_config_chips + nr;
+				return sensors_config_chips +
+				       sensors_config_chips_count - 1 - (*nr)++;
 		}
 	}
 	return NULL;
 }
 
+static char *sensors_find_label(const sensors_chip_name *name,
+				const sensors_chip_features *chip_features,
+				const sensors_feature *feature);
+
+/* Hash table of the detected chips, indexed by name. Slots hold an index
+   in sensors_proc_chips plus one, 0 means empty. */
+#define chip_index	(sensors_ctx->chip_index)
+#define chip_index_mask	(sensors_ctx->chip_index_mask)
+
+static unsigned int sensors_hash_chip_name(const sensors_chip_name *name)
+{
+	const unsigned char *p;
+	unsigned int hash = 2166136261u;
+
+	/* FNV-1a */
+	for (p = (const unsigned char *)name->prefix; *p; p++)
+		hash = (hash ^ *p) * 16777619u;
+	hash = (hash ^ (unsigned short)name->bus.type) * 16777619u;
+	hash = (hash ^ (unsigned short)name->bus.nr) * 16777619u;
+	hash = (hash ^ (unsigned int)name->addr) * 16777619u;
+	return hash;
+}
+
+/* Hash table of the detected busses, indexed by bus type and number, so
+   that getting the name of an adapter doesn't walk all of them. Slots
+   hold an index in sensors_proc_bus plus one, 0 means empty. */
+#define bus_index	(sensors_ctx->bus_index)
+#define bus_index_mask	(sensors_ctx->bus_index_mask)
+
+static unsigned int sensors_hash_bus(const sensors_bus_id *bus)
+{
+	unsigned int hash = 2166136261u;
+
+	/* FNV-1a */
+	hash = (hash ^ (unsigned short)bus->type) * 16777619u;
+	hash = (hash ^ (unsigned short)bus->nr) * 16777619u;
+	return hash;
+}
+
+/* Find the compute statement applying to a given feature, if any */
+static const sensors_compute *
+sensors_find_compute(const sensors_chip_features *chip_features,
+		     const sensors_feature *feature)
+{
+	const sensors_chip *chip;
+	int i, nr;
+
+	for (nr = 0; (chip = sensors_for_all_config_chips(&chip_features->chip,
+							  chip_features,
+							  &nr));)
+		for (i = 0; i < chip->computes_count; i++)
+			if (!strcmp(feature->name, chip->computes[i].name))
+				return &chip->computes[i];
+	return NULL;
+}
+
+void sensors_free_chip_programs(sensors_chip_features *features)
+{
+	int i;
+
+	if (features->compute) {
+		for (i = 0; i < features->feature_count; i++) {
+			sensors_free_program(features->from_proc[i]);
+			sensors_free_program(features->to_proc[i]);
+		}
+	}
+	free(features->from_proc);
+	free(features->to_proc);
+	free(features->compute);
+	features->from_proc = features->to_proc = NULL;
+	features->compute = NULL;
+}
+
+void sensors_free_chip_labels(sensors_chip_features *features)
+{
+	int i;
+
+	if (!features->label)
+		return;
+	for (i = 0; i < features->feature_count; i++)
+		free(features->label[i]);
+	free(features->label);
+	features->label = NULL;
+}
+
+void sensors_free_chip_index(void)
+{
+	free(chip_index);
+	chip_index = NULL;
+	chip_index_mask = 0;
+}
+
+void sensors_hash_chips(void)
+{
+	unsigned int size, slot;
+	int i;
+
+	sensors_free_chip_index();
+	if (!sensors_proc_chips_count)
+		return;
+
+	/* Keep the load factor at or below 50% */
+	size = 8;
+	while (size < 2 * (unsigned int)sensors_proc_chips_count)
+		size <<= 1;
+	chip_index = calloc(size, sizeof(int));
+	if (!chip_index)
+		sensors_fatal_error(__func__, "Out of memory");
+	chip_index_mask = size - 1;
+
+	for (i = 0; i < sensors_proc_chips_count; i++) {
+		slot = sensors_hash_chip_name(&sensors_proc_chips[i].chip);
+		while (chip_index[slot & chip_index_mask])
+			slot++;
+		chip_index[slot & chip_index_mask] = i + 1;
+	}
+}
+
+void sensors_free_bus_index(void)
+{
+	free(bus_index);
+	bus_index = NULL;
+	bus_index_mask = 0;
+}
+
+/* The first of several busses with the same number wins, as it did when
+   they were searched in order */
+static void sensors_hash_busses(void)
+{
+	unsigned int size, slot;
+	int i, j;
+
+	sensors_free_bus_index();
+	if (!sensors_proc_bus_count)
+		return;
+
+	size = 8;
+	while (size < 2 * (unsigned int)sensors_proc_bus_count)
+		size <<= 1;
+	bus_index = calloc(size, sizeof(int));
+	if (!bus_index)
+		sensors_fatal_error(__func__, "Out of memory");
+	bus_index_mask = size - 1;
+
+	for (i = 0; i < sensors_proc_bus_count; i++) {
+		slot = sensors_hash_bus(&sensors_proc_bus[i].bus);
+		while ((j = bus_index[slot & bus_index_mask])) {
+			if (sensors_proc_bus[j - 1].bus.type ==
+			    sensors_proc_bus[i].bus.type &&
+			    sensors_proc_bus[j - 1].bus.nr ==
+			    sensors_proc_bus[i].bus.nr)
+				break;
+			slot++;
+		}
+		if (!j)
+			bus_index[slot & bus_index_mask] = i + 1;
+	}
+}
+
+/* The read deadline of a chip, as set by the latest matching rule */
+static double find_deadline(const sensors_chip_name *chip)
+{
+	int i;
+
+	for (i = sensors_deadline_rules_count - 1; i >= 0; i--)
+		if (sensors_match_chip(&sensors_deadline_rules[i].match, chip))
+			return sensors_deadline_rules[i].deadline;
+	return 0;
+}
+
+void sensors_free_deadline_rules(void)
+{
+	int i;
+
+	for (i = 0; i < sensors_deadline_rules_count; i++)
+		sensors_free_chip_name(&sensors_deadline_rules[i].match);
+	free(sensors_deadline_rules);
+	sensors_deadline_rules = NULL;
+	sensors_deadline_rules_count = sensors_deadline_rules_max = 0;
+}
+
+void sensors_set_read_deadline(const sensors_chip_name *match,
+			       double deadline)
+{
+	struct sensors_deadline_rule rule;
+	int i;
+
+	if (!(deadline > 0))
+		deadline = 0;
+
+	/* A rule for all chips overrides the previous ones */
+	if (!match)
+		sensors_free_deadline_rules();
+	if (match || deadline) {
+		memset(&rule, 0, sizeof(rule));
+		if (match) {
+			rule.match = *match;
+			rule.match.path = NULL;
+			if (match->prefix != SENSORS_CHIP_NAME_PREFIX_ANY &&
+			    !(rule.match.prefix = strdup(match->prefix)))
+				sensors_fatal_error(__func__, "Out of memory");
+		} else {
+			rule.match.prefix = SENSORS_CHIP_NAME_PREFIX_ANY;
+			rule.match.bus.type = SENSORS_BUS_TYPE_ANY;
+			rule.match.bus.nr = SENSORS_BUS_NR_ANY;
+			rule.match.addr = SENSORS_CHIP_NAME_ADDR_ANY;
+		}
+		rule.deadline = deadline;
+		sensors_add_deadline_rules(&rule);
+	}
+
+	for (i = 0; i < sensors_proc_chips_count; i++)
+		sensors_set_chip_deadline(&sensors_proc_chips[i],
+			find_deadline(&sensors_proc_chips[i].chip));
+}
+
+void sensors_bind_chip(sensors_chip_features *features)
+{
+	int nr, count;
+
+	free(features->config);
+	features->config = NULL;
+	features->config_count = 0;
+	sensors_free_chip_programs(features);
+	sensors_free_chip_labels(features);
+	sensors_alloc_chip_stats(features);
+	sensors_set_chip_deadline(features, find_deadline(&features->chip));
+
+	count = 0;
+	for (nr = 0; sensors_for_all_config_chips(&features->chip, NULL, &nr);)
+		count++;
+	if (count) {
+		features->config = malloc(count * sizeof(sensors_chip *));
+		if (!features->config)
+			sensors_fatal_error(__func__, "Out of memory");
+		for (nr = 0; features->config_count < count;)
+			features->config[features->config_count++] =
+				sensors_for_all_config_chips(&features->chip,
+							     NULL, &nr);
+
+		/* Bind the compute statements to the features once and for
+		   all, so that reading a value doesn't involve any search */
+		features->compute = calloc(features->feature_count,
+					   sizeof(sensors_compute *));
+		if (!features->compute)
+			sensors_fatal_error(__func__, "Out of memory");
+		for (nr = 0; nr < features->feature_count; nr++)
+			features->compute[nr] =
+				sensors_find_compute(features,
+						     &features->feature[nr]);
+
+		/* Then compile them, which requires all of them to be bound,
+		   as variables are inlined */
+		features->from_proc = calloc(features->feature_count,
+					     sizeof(sensors_program *));
+		features->to_proc = calloc(features->feature_count,
+					   sizeof(sensors_program *));
+		if (!features->from_proc || !features->to_proc)
+			sensors_fatal_error(__func__, "Out of memory");
+		for (nr = 0; nr < features->feature_count; nr++) {
+			if (!features->compute[nr])
+				continue;
+			features->from_proc[nr] = sensors_compile_expr(features,
+					features->compute[nr]->from_proc);
+			features->to_proc[nr] = sensors_compile_expr(features,
+					features->compute[nr]->to_proc);
+		}
+	}
+
+	/* Resolve all labels once, so that applications which print them
+	   over and over again don't hit the configuration and sysfs each
+	   time */
+	features->label = malloc(features->feature_count * sizeof(char *));
+	if (!features->label)
+		sensors_fatal_error(__func__, "Out of memory");
+	for (nr = 0; nr < features->feature_count; nr++)
+		features->label[nr] = sensors_find_label(&features->chip,
+							 features,
+							 &features->feature[nr]);
+}
+
+void sensors_index_chips(void)
+{
+	int i;
+
+	sensors_hash_chips();
+	sensors_hash_busses();
+	for (i = 0; i < sensors_proc_chips_count; i++)
+		sensors_bind_chip(&sensors_proc_chips[i]);
+	sensors_build_table();
+}
+
 /* Look up a chip in the intern chip list, and return a pointer to it.
    Do not modify the struct the return value points to! Returns NULL if
    not found.*/
 static const sensors_chip_features *
 sensors_lookup_chip(const sensors_chip_name *name)
 {
+	const sensors_chip_features *features;
+	unsigned int slot;
 	int i;
 
-	for (i = 0; i < sensors_proc_chips_count; i++)
-		if (sensors_match_chip(&sensors_proc_chips[i].chip, name))
-			return &sensors_proc_chips[i];
+	/* Most of the time, we are passed one of the chip names returned by
+	   sensors_get_detected_chips(), which point to our own array */
+	features = (const sensors_chip_features *)name;
+	if (features >= sensors_proc_chips &&
+	    features < sensors_proc_chips + sensors_proc_chips_count &&
+	    &sensors_proc_chips[features - sensors_proc_chips].chip == name)
+		return features;
+
+	if (!chip_index || sensors_chip_name_has_wildcards(name)) {
+		for (i = 0; i < sensors_proc_chips_count; i++)
+			if (sensors_match_chip(&sensors_proc_chips[i].chip,
+					       name))
+				return &sensors_proc_chips[i];
+		return NULL;
+	}
 
+	for (slot = sensors_hash_chip_name(name);
+	     (i = chip_index[slot & chip_index_mask]); slot++) {
+		features = &sensors_proc_chips[i - 1];
+		if (features->chip.bus.type == name->bus.type &&
+		    features->chip.bus.nr == name->bus.nr &&
+		    features->chip.addr == name->addr &&
+		    !strcmp(features->chip.prefix, name->prefix))
+			return features;
+	}
 	return NULL;
 }
 
@@ -118,22 +435,10 @@ sensors_lookup_subfeature_nr(const sensors_chip_features *chip,
 	return chip->subfeature + subfeat_nr;
 }
 
-/* Look up a feature of the given chip, and return a pointer to it.
-   Do not modify the struct the return value points to! Returns NULL if
-   not found.*/
-static const sensors_feature *
-sensors_lookup_feature_nr(const sensors_chip_features *chip, int feat_nr)
-{
-	if (feat_nr < 0 ||
-	    feat_nr >= chip->feature_count)
-		return NULL;
-	return chip->feature + feat_nr;
-}
-
 /* Look up a subfeature by name, and return a pointer to it.
    Do not modify the struct the return value points to! Returns NULL if 
    not found.*/
-static const sensors_subfeature *
+const sensors_subfeature *
 sensors_lookup_subfeature_name(const sensors_chip_features *chip,
 			       const char *name)
 {
@@ -159,23 +464,20 @@ int sensors_chip_name_has_wildcards(const sensors_chip_name *chip)
 		return 0;
 }
 
-/* Look up the label for a given feature. Note that chip should not
-   contain wildcard values! The returned string is newly allocated (free it
-   yourself). On failure, NULL is returned.
-   If no label exists for this feature, its name is returned itself. */
-char *sensors_get_label(const sensors_chip_name *name,
-			const sensors_feature *feature)
+/* Find the label of a given feature, in the configuration file first,
+   then in sysfs. chip_features may be NULL if name isn't a detected chip.
+   The returned string is newly allocated. */
+static char *sensors_find_label(const sensors_chip_name *name,
+				const sensors_chip_features *chip_features,
+				const sensors_feature *feature)
 {
 	char *label;
 	const sensors_chip *chip;
 	char buf[PATH_MAX];
-	FILE *f;
-	int i;
+	int i, nr;
 
-	if (sensors_chip_name_has_wildcards(name))
-		return NULL;
-
-	for (chip = NULL; (chip = sensors_for_all_config_chips(name, chip));)
+	for (nr = 0;
+	     (chip = sensors_for_all_config_chips(name, chip_features, &nr));)
 		for (i = 0; i < chip->labels_count; i++)
 			if (!strcmp(feature->name, chip->labels[i].name)) {
 				label = chip->labels[i].value;
@@ -183,17 +485,11 @@ char *sensors_get_label(const sensors_chip_name *name,
 			}
 
 	/* No user specified label, check for a _label sysfs file */
-	snprintf(buf, PATH_MAX, "%s/%s_label", name->path, feature->name);
-	
-	if ((f = fopen(buf, "r"))) {
-		i = fread(buf, 1, sizeof(buf), f);
-		fclose(f);
-		if (i > 0) {
-			/* i - 1 to strip the '\n' at the end */
-			buf[i - 1] = 0;
-			label = buf;
-			goto sensors_get_label_exit;
-		}
+	if (chip_features &&
+	    sensors_read_sysfs_label(chip_features, feature->name, buf,
+				     sizeof(buf))) {
+		label = buf;
+		goto sensors_get_label_exit;
 	}
 
 	/* No label, return the feature name instead */
@@ -206,35 +502,110 @@ sensors_get_label_exit:
 	return label;
 }
 
+/* Look up the label for a given feature. Note that chip should not
+   contain wildcard values! The returned string is newly allocated (free it
+   yourself). On failure, NULL is returned.
+   If no label exists for this feature, its name is returned itself. */
+char *sensors_get_label(const sensors_chip_name *name,
+			const sensors_feature *feature)
+{
+	const sensors_chip_features *chip_features;
+	char *label;
+
+	if (sensors_chip_name_has_wildcards(name))
+		return NULL;
+
+	chip_features = sensors_lookup_chip(name);
+	if (!chip_features || !chip_features->label ||
+	    feature->number >= chip_features->feature_count)
+		return sensors_find_label(name, chip_features, feature);
+
+	label = strdup(chip_features->label[feature->number]);
+	if (!label)
+		sensors_fatal_error(__func__, "Allocating label text");
+	return label;
+}
+
+const char *sensors_get_label_ref(const sensors_chip_name *name,
+				  const sensors_feature *feature)
+{
+	const sensors_chip_features *chip_features;
+
+	if (sensors_chip_name_has_wildcards(name) ||
+	    !(chip_features = sensors_lookup_chip(name)) ||
+	    !chip_features->label ||
+	    feature->number < 0 ||
+	    feature->number >= chip_features->feature_count)
+		return NULL;
+	return chip_features->label[feature->number];
+}
+
 /* Looks up whether a feature should be ignored. Returns
-   1 if it should be ignored, 0 if not. */
+   1 if it should be ignored, 0 if not. chip_features may be NULL if name
+   has wildcards. */
 static int sensors_get_ignored(const sensors_chip_name *name,
+			       const sensors_chip_features *chip_features,
 			       const sensors_feature *feature)
 {
 	const sensors_chip *chip;
-	int i;
+	int i, nr;
 
-	for (chip = NULL; (chip = sensors_for_all_config_chips(name, chip));)
+	for (nr = 0;
+	     (chip = sensors_for_all_config_chips(name, chip_features, &nr));)
 		for (i = 0; i < chip->ignores_count; i++)
 			if (!strcmp(feature->name, chip->ignores[i].name))
 				return 1;
 	return 0;
 }
 
+/* Return the compiled compute statement applying to a given feature, or
+   NULL if there is none. */
+static const sensors_program *
+sensors_lookup_program(const sensors_chip_features *chip_features,
+		       int feat_nr, int to_proc)
+{
+	if (!chip_features->compute)
+		return NULL;
+	return to_proc ? chip_features->to_proc[feat_nr] :
+			 chip_features->from_proc[feat_nr];
+}
+
+/* Read a subfeature value and apply the given compute program to it.
+   Returns 0 on success, and <0 on failure. */
+static int sensors_read_subfeature(const sensors_chip_features *chip_features,
+				   const sensors_subfeature *subfeature,
+				   const sensors_program *prog,
+				   double *result)
+{
+	double val;
+	int res;
+
+	if (!(subfeature->flags & SENSORS_MODE_R))
+		return -SENSORS_ERR_ACCESS_R;
+
+	res = sensors_read_sysfs_attr(chip_features, subfeature, &val);
+	if (res)
+		return res;
+	if (!prog)
+		*result = val;
+	else if (prog->linear)
+		*result = sensors_run_linear(prog, val);
+	else if ((res = sensors_run_program(chip_features, prog, val,
+					    result)))
+		return res;
+	return 0;
+}
+
 /* Read the value of a subfeature of a certain chip. Note that chip should not
    contain wildcard values! This function will return 0 on success, and <0
    on failure. */
-static int __sensors_get_value(const sensors_chip_name *name, int subfeat_nr,
-			       int depth, double *result)
+int sensors_get_value(const sensors_chip_name *name, int subfeat_nr,
+		      double *result)
 {
 	const sensors_chip_features *chip_features;
 	const sensors_subfeature *subfeature;
-	const sensors_expr *expr = NULL;
-	double val;
-	int res, i;
+	const sensors_program *prog = NULL;
 
-	if (depth >= DEPTH_MAX)
-		return -SENSORS_ERR_RECURSION;
 	if (sensors_chip_name_has_wildcards(name))
 		return -SENSORS_ERR_WILDCARDS;
 	if (!(chip_features = sensors_lookup_chip(name)))
@@ -242,44 +613,40 @@ static int __sensors_get_value(const sensors_chip_name *name, int subfeat_nr,
 	if (!(subfeature = sensors_lookup_subfeature_nr(chip_features,
 							subfeat_nr)))
 		return -SENSORS_ERR_NO_ENTRY;
-	if (!(subfeature->flags & SENSORS_MODE_R))
-		return -SENSORS_ERR_ACCESS_R;
 
 	/* Apply compute statement if it exists */
-	if (subfeature->flags & SENSORS_COMPUTE_MAPPING) {
-		const sensors_feature *feature;
-		const sensors_chip *chip;
-
-		feature = sensors_lookup_feature_nr(chip_features,
-					subfeature->mapping);
-
-		chip = NULL;
-		while (!expr &&
-		       (chip = sensors_for_all_config_chips(name, chip)))
-			for (i = 0; i < chip->computes_count; i++) {
-				if (!strcmp(feature->name,
-					    chip->computes[i].name)) {
-					expr = chip->computes[i].from_proc;
-					break;
-				}
-			}
-	}
+	if (subfeature->flags & SENSORS_COMPUTE_MAPPING)
+		prog = sensors_lookup_program(chip_features,
+					      subfeature->mapping, 0);
 
-	res = sensors_read_sysfs_attr(name, subfeature, &val);
-	if (res)
-		return res;
-	if (!expr)
-		*result = val;
-	else if ((res = sensors_eval_expr(chip_features, expr, val, depth,
-					  result)))
-		return res;
-	return 0;
+	return sensors_read_subfeature(chip_features, subfeature, prog,
+				       result);
 }
 
-int sensors_get_value(const sensors_chip_name *name, int subfeat_nr,
-		      double *result)
+/* Read the values of several subfeatures of a certain chip at once. Note
+   that chip should not contain wildcard values! If subfeat_nrs is NULL,
+   subfeatures 0 to count - 1 are read. This function will return 0 if all
+   values were read, <0 on failure. */
+int sensors_get_values(const sensors_chip_name *name, const int *subfeat_nrs,
+		       int count, double *values, int *errors)
 {
-	return __sensors_get_value(name, subfeat_nr, 0, result);
+	const sensors_chip_features *chip_features;
+	int i, err = 0;
+
+	if (sensors_chip_name_has_wildcards(name))
+		err = -SENSORS_ERR_WILDCARDS;
+	else if (!(chip_features = sensors_lookup_chip(name)))
+		err = -SENSORS_ERR_NO_ENTRY;
+	if (err) {
+		for (i = 0; errors && i < count; i++)
+			errors[i] = err;
+		return err;
+	}
+
+	return sensors_read_table(sensors_get_table()->chip_first[
+					chip_features - sensors_proc_chips],
+				  chip_features->subfeature_count, subfeat_nrs,
+				  count, values, errors);
 }
 
 /* Set the value of a subfeature of a certain chip. Note that chip should not
@@ -290,8 +657,8 @@ int sensors_set_value(const sensors_chip_name *name, int subfeat_nr,
 {
 	const sensors_chip_features *chip_features;
 	const sensors_subfeature *subfeature;
-	const sensors_expr *expr = NULL;
-	int i, res;
+	const sensors_program *prog = NULL;
+	int res;
 	double to_write;
 
 	if (sensors_chip_name_has_wildcards(name))
@@ -305,31 +672,32 @@ int sensors_set_value(const sensors_chip_name *name, int subfeat_nr,
 		return -SENSORS_ERR_ACCESS_W;
 
 	/* Apply compute statement if it exists */
-	if (subfeature->flags & SENSORS_COMPUTE_MAPPING) {
-		const sensors_feature *feature;
-		const sensors_chip *chip;
-
-		feature = sensors_lookup_feature_nr(chip_features,
-					subfeature->mapping);
-
-		chip = NULL;
-		while (!expr &&
-		       (chip = sensors_for_all_config_chips(name, chip)))
-			for (i = 0; i < chip->computes_count; i++) {
-				if (!strcmp(feature->name,
-					    chip->computes[i].name)) {
-					expr = chip->computes[i].to_proc;
-					break;
-				}
-			}
-	}
+	if (subfeature->flags & SENSORS_COMPUTE_MAPPING)
+		prog = sensors_lookup_program(chip_features,
+					      subfeature->mapping, 1);
 
 	to_write = value;
-	if (expr)
-		if ((res = sensors_eval_expr(chip_features, expr,
-					     value, 0, &to_write)))
+	if (prog)
+		if ((res = sensors_run_program(chip_features, prog,
+					       value, &to_write)))
 			return res;
-	return sensors_write_sysfs_attr(name, subfeature, to_write);
+	return sensors_write_sysfs_attr(chip_features, subfeature, to_write);
+}
+
+int sensors_get_stats(const sensors_chip_name *name, int subfeat_nr,
+		      sensors_stats *stats)
+{
+	const sensors_chip_features *chip_features;
+
+	if (sensors_chip_name_has_wildcards(name))
+		return -SENSORS_ERR_WILDCARDS;
+	if (!(chip_features = sensors_lookup_chip(name)) ||
+	    !chip_features->stats ||
+	    subfeat_nr < 0 || subfeat_nr >= chip_features->subfeature_count)
+		return -SENSORS_ERR_NO_ENTRY;
+
+	sensors_copy_stats(&chip_features->stats[subfeat_nr], stats);
+	return 0;
 }
 
 const sensors_chip_name *sensors_get_detected_chips(const sensors_chip_name
@@ -347,6 +715,7 @@ const sensors_chip_name *sensors_get_detected_chips(const sensors_chip_name
 
 const char *sensors_get_adapter_name(const sensors_bus_id *bus)
 {
+	unsigned int slot;
 	int i;
 
 	/* bus types with a single instance */
@@ -374,10 +743,13 @@ const char *sensors_get_adapter_name(const sensors_bus_id *bus)
 	}
 
 	/* bus types with several instances */
-	for (i = 0; i < sensors_proc_bus_count; i++)
-		if (sensors_proc_bus[i].bus.type == bus->type &&
-		    sensors_proc_bus[i].bus.nr == bus->nr)
-			return sensors_proc_bus[i].adapter;
+	if (!bus_index)
+		return NULL;
+	for (slot = sensors_hash_bus(bus);
+	     (i = bus_index[slot & bus_index_mask]); slot++)
+		if (sensors_proc_bus[i - 1].bus.type == bus->type &&
+		    sensors_proc_bus[i - 1].bus.nr == bus->nr)
+			return sensors_proc_bus[i - 1].adapter;
 	return NULL;
 }
 
@@ -390,7 +762,9 @@ sensors_get_features(const sensors_chip_name *name, int *nr)
 		return NULL;	/* No such chip */
 
 	while (*nr < chip->feature_count
-	    && sensors_get_ignored(name, &chip->feature[*nr]))
+	    && sensors_get_ignored(name,
+				   sensors_chip_name_has_wildcards(name) ?
+				   NULL : chip, &chip->feature[*nr]))
 		(*nr)++;
 	if (*nr >= chip->feature_count)
 		return NULL;
@@ -438,83 +812,104 @@ sensors_get_subfeature(const sensors_chip_name *name,
 	return NULL;	/* No such subfeature */
 }
 
-/* Evaluate an expression */
-static int sensors_eval_expr(const sensors_chip_features *chip_features,
-			     const sensors_expr *expr,
-			     double val, int depth, double *result)
+/* The values to write by the set statements of a chip. A subfeature is
+   only written once, with the value of its last set statement, in the
+   order of these statements. */
+struct chip_writes {
+	struct chip_write {
+		const sensors_subfeature *subfeature;	/* NULL if overridden */
+		const sensors_set *set;
+		double value;
+	} *write;
+	int count, max;
+	int *slot;	/* Index in write of each subfeature, -1 if none */
+};
+
+/* Whether a program reads a subfeature which is still to be written */
+static int reads_pending(const struct chip_writes *writes,
+			 const sensors_program *prog)
 {
-	double res1, res2;
-	int res;
-	const sensors_subfeature *subfeature;
+	int i;
 
-	if (expr->kind == sensors_kind_val) {
-		*result = expr->data.val;
-		return 0;
-	}
-	if (expr->kind == sensors_kind_source) {
-		*result = val;
+	if (!prog)
 		return 0;
-	}
-	if (expr->kind == sensors_kind_var) {
-		if (!(subfeature = sensors_lookup_subfeature_name(chip_features,
-							    expr->data.var)))
-			return -SENSORS_ERR_NO_ENTRY;
-		return __sensors_get_value(&chip_features->chip,
-					   subfeature->number, depth + 1,
-					   result);
-	}
-	if ((res = sensors_eval_expr(chip_features, expr->data.subexpr.sub1,
-				     val, depth, &res1)))
-		return res;
-	if (expr->data.subexpr.sub2 &&
-	    (res = sensors_eval_expr(chip_features, expr->data.subexpr.sub2,
-				     val, depth, &res2)))
-		return res;
-	switch (expr->data.subexpr.op) {
-	case sensors_add:
-		*result = res1 + res2;
-		return 0;
-	case sensors_sub:
-		*result = res1 - res2;
-		return 0;
-	case sensors_multiply:
-		*result = res1 * res2;
-		return 0;
-	case sensors_divide:
-		if (res2 == 0.0)
-			return -SENSORS_ERR_DIV_ZERO;
-		*result = res1 / res2;
-		return 0;
-	case sensors_negate:
-		*result = -res1;
-		return 0;
-	case sensors_exp:
-		*result = exp(res1);
-		return 0;
-	case sensors_log:
-		if (res1 < 0.0)
-			return -SENSORS_ERR_DIV_ZERO;
-		*result = log(res1);
-		return 0;
-	}
+	for (i = 0; i < prog->code_count; i++)
+		if (prog->code[i].op == SENSORS_OP_READ &&
+		    writes->slot[prog->code[i].arg.nr] >= 0)
+			return 1;
 	return 0;
 }
 
+static void add_write(struct chip_writes *writes,
+		      const sensors_subfeature *subfeature,
+		      const sensors_set *set, double value)
+{
+	struct chip_write write;
+	int *slot = &writes->slot[subfeature->number];
+
+	if (*slot >= 0)
+		writes->write[*slot].subfeature = NULL;
+	write.subfeature = subfeature;
+	write.set = set;
+	write.value = value;
+	*slot = writes->count;
+	sensors_add_array_el(&write, &writes->write, &writes->count,
+			     &writes->max, sizeof(write));
+}
+
+/* Write the values collected so far, the values already there are not
+   written again. *err is set on failure. */
+static void flush_writes(const sensors_chip_features *chip_features,
+			 struct chip_writes *writes, int *err)
+{
+	const struct chip_write *write;
+	int i, res;
+
+	for (i = 0; i < writes->count; i++) {
+		write = &writes->write[i];
+		if (!write->subfeature)
+			continue;
+		writes->slot[write->subfeature->number] = -1;
+		res = sensors_update_sysfs_attr(chip_features,
+						write->subfeature,
+						write->value);
+		if (res < 0) {
+			sensors_parse_error_wfn("Failed to set value",
+						write->set->line.filename,
+						write->set->line.lineno);
+			*err = res;
+		}
+	}
+	writes->count = 0;
+}
+
 /* Execute all set statements for this particular chip. The chip may not 
    contain wildcards!  This function will return 0 on success, and <0 on 
-   failure. */
+   failure. All values are computed before being written, unless a set
+   statement reads a subfeature which a previous one writes. */
 static int sensors_do_this_chip_sets(const sensors_chip_name *name)
 {
 	const sensors_chip_features *chip_features;
 	sensors_chip *chip;
+	sensors_program *prog;
+	const sensors_program *to_proc;
+	struct chip_writes writes;
 	double value;
-	int i;
+	int i, nr;
 	int err = 0, res;
 	const sensors_subfeature *subfeature;
 
 	chip_features = sensors_lookup_chip(name);	/* Can't fail */
 
-	for (chip = NULL; (chip = sensors_for_all_config_chips(name, chip));)
+	memset(&writes, 0, sizeof(writes));
+	writes.slot = malloc(chip_features->subfeature_count * sizeof(int));
+	if (!writes.slot)
+		sensors_fatal_error(__func__, "Out of memory");
+	for (i = 0; i < chip_features->subfeature_count; i++)
+		writes.slot[i] = -1;
+
+	for (nr = 0;
+	     (chip = sensors_for_all_config_chips(name, chip_features, &nr));)
 		for (i = 0; i < chip->sets_count; i++) {
 			subfeature = sensors_lookup_subfeature_name(chip_features,
 							chip->sets[i].name);
@@ -526,9 +921,13 @@ static int sensors_do_this_chip_sets(const sensors_chip_name *name)
 				continue;
 			}
 
-			res = sensors_eval_expr(chip_features,
-						chip->sets[i].value, 0,
-						0, &value);
+			prog = sensors_compile_expr(chip_features,
+						    chip->sets[i].value);
+			if (reads_pending(&writes, prog))
+				flush_writes(chip_features, &writes, &err);
+			res = sensors_run_program(chip_features, prog, 0,
+						  &value);
+			sensors_free_program(prog);
 			if (res) {
 				sensors_parse_error_wfn("Error parsing expression",
 						    chip->sets[i].line.filename,
@@ -536,15 +935,34 @@ static int sensors_do_this_chip_sets(const sensors_chip_name *name)
 				err = res;
 				continue;
 			}
-			if ((res = sensors_set_value(name, subfeature->number,
-						     value))) {
+
+			/* As done by sensors_set_value() */
+			res = 0;
+			to_proc = NULL;
+			if (!(subfeature->flags & SENSORS_MODE_W))
+				res = -SENSORS_ERR_ACCESS_W;
+			else if (subfeature->flags & SENSORS_COMPUTE_MAPPING)
+				to_proc = sensors_lookup_program(chip_features,
+							subfeature->mapping, 1);
+			if (reads_pending(&writes, to_proc))
+				flush_writes(chip_features, &writes, &err);
+			if (!res && to_proc)
+				res = sensors_run_program(chip_features,
+							  to_proc, value,
+							  &value);
+			if (res) {
 				sensors_parse_error_wfn("Failed to set value",
 						chip->sets[i].line.filename,
 						chip->sets[i].line.lineno);
 				err = res;
 				continue;
 			}
+			add_write(&writes, subfeature, &chip->sets[i], value);
 		}
+
+	flush_writes(chip_features, &writes, &err);
+	free(writes.write);
+	free(writes.slot);
 	return err;
 }
 
@@ -30,4 +30,38 @@
    if there are wildcards. */
 int sensors_chip_name_has_wildcards(const sensors_chip_name *chip);
 
+/* Build the detected chips lookup index, the list of matching
+   configuration chips of each detected chip, and the table of their
+   subfeatures. This must be called again whenever the detected chips or
+   the configuration change. */
+void sensors_index_chips(void);
+
+/* Rebuild the detected chips lookup index only, after chips were added
+   or removed */
+void sensors_hash_chips(void);
+
+/* Build the list of matching configuration chips of a single detected
+   chip, and bind its compute statements and labels */
+void sensors_bind_chip(sensors_chip_features *features);
+
+/* Forget the read deadlines set by sensors_set_read_deadline() */
+void sensors_free_deadline_rules(void);
+
+/* Free the memory allocated by sensors_index_chips() */
+void sensors_free_chip_index(void);
+void sensors_free_bus_index(void);
+
+/* Free the bound and compiled compute statements of a detected chip */
+void sensors_free_chip_programs(sensors_chip_features *features);
+
+/* Free the resolved labels of a detected chip */
+void sensors_free_chip_labels(sensors_chip_features *features);
+
+/* Look up a subfeature by name, and return a pointer to it.
+   Do not modify the struct the return value points to! Returns NULL if
+   not found.*/
+const sensors_subfeature *
+sensors_lookup_subfeature_name(const sensors_chip_features *chip,
+			       const char *name);
+
 #endif /* def LIB_SENSORS_ACCESS_H */
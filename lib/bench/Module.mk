@@ -0,0 +1,19 @@
+LIB_DIR		:= lib
+LIB_BENCH_DIR	:= lib/bench
+
+LIB_BENCH_TARGETS := $(LIB_BENCH_DIR)/bench-sensors
+LIB_BENCH_SOURCES := $(LIB_BENCH_DIR)/bench-sensors.c
+
+# Linked statically, so that it runs from the build tree. Not built by
+# default, use "make bench".
+$(LIB_BENCH_DIR)/bench-sensors: $(LIB_BENCH_DIR)/bench-sensors.ro $(LIBSTOBJECTS)
+	$(CC) $(EXLDFLAGS) -o $@ $(LIB_BENCH_DIR)/bench-sensors.ro $(LIBSTOBJECTS) -lm -lpthread -lrt
+
+bench: $(LIB_BENCH_TARGETS)
+
+$(LIB_BENCH_DIR)/bench-sensors.ro: $(LIB_DIR)/sensors.h $(LIB_DIR)/error.h
+
+clean-lib-bench:
+	$(RM) $(LIB_BENCH_DIR)/*.rd $(LIB_BENCH_DIR)/*.ro
+	$(RM) $(LIB_BENCH_TARGETS)
+clean :: clean-lib-bench
@@ -0,0 +1,613 @@
+/*
+    bench-sensors.c - Benchmark of the libsensors hot paths, run against a
+    synthetic sysfs tree.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+ * The tree holds a number of "bench" platform chips, each with a number of
+ * voltage, temperature and fan features, under a temporary directory. The
+ * library is pointed at it with sensors_set_sysfs_root(), or with -m, is
+ * given a capture of it to serve from memory. A configuration file with
+ * labels, compute and set statements for these chips is generated along
+ * with it.
+ *
+ * Each benchmark runs twice: once for the time, then once more in a child
+ * process traced with ptrace, to count its system calls. The child marks
+ * the measured sections with getppid() calls, which the library never
+ * makes; their first argument tells which benchmark starts, or 0 for the
+ * end of a section.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/ptrace.h>
+
+#include "../sensors.h"
+#include "../error.h"
+
+static int chipCount = 16;
+static int featureCount = 8;
+static int rounds = 100;
+static int blockCount = 1000;
+static int keepTree;
+static int inMemory;
+
+static char root[NAME_MAX];
+static char configPath[PATH_MAX];
+static FILE *config;
+
+/* Syscall markers, only made while counting */
+static int counting;
+
+static void mark(int bench)
+{
+	if (counting)
+		syscall(SYS_getppid, bench);
+}
+
+static long long nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/** Synthetic tree **/
+
+static void die(const char *what)
+{
+	fprintf(stderr, "bench-sensors: %s: %s\n", what, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+static void makeDir(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+static void makeDir(const char *fmt, ...)
+{
+	char path[PATH_MAX];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(path, sizeof(path), fmt, ap);
+	va_end(ap);
+	if (mkdir(path, 0755) && errno != EEXIST)
+		die(path);
+}
+
+static void writeAttr(const char *dir, const char *name, mode_t mode,
+		      const char *fmt, ...)
+	__attribute__((format(printf, 4, 5)));
+
+static void writeAttr(const char *dir, const char *name, mode_t mode,
+		      const char *fmt, ...)
+{
+	char path[PATH_MAX];
+	FILE *f;
+	va_list ap;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if (!(f = fopen(path, "w")))
+		die(path);
+	va_start(ap, fmt);
+	vfprintf(f, fmt, ap);
+	va_end(ap);
+	fputc('\n', f);
+	if (fclose(f) || chmod(path, mode))
+		die(path);
+}
+
+static void makeChip(int nr)
+{
+	char dir[NAME_MAX + 64], dev[NAME_MAX + 64], link[PATH_MAX], name[32];
+	int i;
+
+	snprintf(dev, sizeof(dev), "%s/devices/platform/bench.%d", root, nr);
+	makeDir("%s", dev);
+	snprintf(link, sizeof(link), "%s/subsystem", dev);
+	snprintf(dir, sizeof(dir), "%s/bus/platform", root);
+	if (symlink(dir, link))
+		die(link);
+
+	snprintf(dir, sizeof(dir), "%s/class/hwmon/hwmon%d", root, nr);
+	makeDir("%s", dir);
+	snprintf(link, sizeof(link), "%s/device", dir);
+	if (symlink(dev, link))
+		die(link);
+	writeAttr(dir, "name", 0444, "bench");
+
+	for (i = 1; i <= featureCount; i++) {
+		snprintf(name, sizeof(name), "in%d_input", i);
+		writeAttr(dir, name, 0444, "%d", 1000 + i);
+		snprintf(name, sizeof(name), "in%d_min", i);
+		writeAttr(dir, name, 0644, "%d", 800);
+		snprintf(name, sizeof(name), "in%d_max", i);
+		writeAttr(dir, name, 0644, "%d", 1400);
+		snprintf(name, sizeof(name), "in%d_alarm", i);
+		writeAttr(dir, name, 0444, "0");
+
+		snprintf(name, sizeof(name), "temp%d_input", i);
+		writeAttr(dir, name, 0444, "%d", 40000 + i * 500);
+		snprintf(name, sizeof(name), "temp%d_max", i);
+		writeAttr(dir, name, 0644, "%d", 80000);
+		snprintf(name, sizeof(name), "temp%d_max_hyst", i);
+		writeAttr(dir, name, 0644, "%d", 75000);
+		snprintf(name, sizeof(name), "temp%d_alarm", i);
+		writeAttr(dir, name, 0444, "0");
+		snprintf(name, sizeof(name), "temp%d_label", i);
+		writeAttr(dir, name, 0444, "Sensor %d", i);
+
+		snprintf(name, sizeof(name), "fan%d_input", i);
+		writeAttr(dir, name, 0444, "%d", 1200 + i * 10);
+		snprintf(name, sizeof(name), "fan%d_min", i);
+		writeAttr(dir, name, 0644, "%d", 600);
+		snprintf(name, sizeof(name), "fan%d_alarm", i);
+		writeAttr(dir, name, 0444, "0");
+	}
+}
+
+/* Each block configures one chip, blocks go round the chips */
+static void makeConfig(void)
+{
+	FILE *f;
+	int i, j;
+
+	snprintf(configPath, sizeof(configPath), "%s/sensors.conf", root);
+	if (!(f = fopen(configPath, "w")))
+		die(configPath);
+	for (j = 0; j < blockCount; j++) {
+		fprintf(f, "chip \"bench-isa-%04x\"\n", j % chipCount);
+		for (i = 1; i <= featureCount; i++) {
+			fprintf(f, "    label in%d \"Voltage %d.%d\"\n", i, j, i);
+			fprintf(f, "    compute in%d @*2, @/2\n", i);
+			if (j < chipCount)
+				fprintf(f, "    set in%d_min %d.%d * 0.9\n",
+					i, i, j % 10);
+		}
+		fprintf(f, "\n");
+	}
+	if (fclose(f))
+		die(configPath);
+}
+
+static void makeTree(void)
+{
+	int i;
+
+	makeDir("%s/class", root);
+	makeDir("%s/class/hwmon", root);
+	makeDir("%s/class/i2c-adapter", root);
+	makeDir("%s/bus", root);
+	makeDir("%s/bus/platform", root);
+	makeDir("%s/devices", root);
+	makeDir("%s/devices/platform", root);
+	for (i = 0; i < chipCount; i++)
+		makeChip(i);
+	makeConfig();
+}
+
+static void removeTree(void)
+{
+	char cmd[PATH_MAX + 16];
+
+	snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+	if (system(cmd))
+		fprintf(stderr, "bench-sensors: Can't remove %s\n", root);
+}
+
+static void initLib(void)
+{
+	int err;
+
+	rewind(config);
+	if ((err = sensors_init(config))) {
+		fprintf(stderr, "bench-sensors: sensors_init: %s\n",
+			sensors_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Scan the tree once, and serve its chips from memory from then on */
+static void useCapture(void)
+{
+	char path[NAME_MAX + 16];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/capture", root);
+	if (!(f = fopen(path, "w+")))
+		die(path);
+	initLib();
+	if (sensors_record_capture(f) || sensors_record_capture(NULL)) {
+		fprintf(stderr, "bench-sensors: Can't write %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	sensors_cleanup();
+
+	rewind(f);
+	if (sensors_load_capture(f)) {
+		fprintf(stderr, "bench-sensors: Can't load %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	fclose(f);
+}
+
+/** Benchmarks, each returning its number of operations **/
+
+static long benchInit(int nr, long long *ns)
+{
+	long long start;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		rewind(config);
+		mark(nr);
+		start = nowNs();
+		sensors_init(config);
+		*ns += nowNs() - start;
+		mark(0);
+		sensors_cleanup();
+	}
+	return rounds;
+}
+
+static long benchParse(int nr, long long *ns)
+{
+	long long start;
+	int i;
+
+	initLib();
+	for (i = 0; i < rounds; i++) {
+		rewind(config);
+		mark(nr);
+		start = nowNs();
+		sensors_reload_config(config);
+		*ns += nowNs() - start;
+		mark(0);
+	}
+	sensors_cleanup();
+	return rounds;
+}
+
+/* Read all readable subfeatures one at a time */
+static long readAll(void)
+{
+	const sensors_table *table = sensors_get_table();
+	const sensors_subfeature *sub;
+	long ops = 0;
+	double value;
+	int i;
+
+	for (i = 0; i < table->subfeature_count; i++) {
+		sub = table->subfeature[i];
+		if (!(sub->flags & SENSORS_MODE_R))
+			continue;
+		sensors_get_value(table->chip[table->chip_nr[i]], sub->number,
+				  &value);
+		ops++;
+	}
+	return ops;
+}
+
+static long benchGetValue(int nr, long long *ns, unsigned int flags)
+{
+	long long start;
+	long ops = 0;
+	int i;
+
+	initLib();
+	sensors_set_flags(flags);
+	readAll();		/* Open the files, if kept open */
+	mark(nr);
+	start = nowNs();
+	for (i = 0; i < rounds; i++)
+		ops += readAll();
+	*ns += nowNs() - start;
+	mark(0);
+	sensors_cleanup();
+	return ops;
+}
+
+static long benchGetValueOpen(int nr, long long *ns)
+{
+	return benchGetValue(nr, ns, 0);
+}
+
+static long benchGetValueKeep(int nr, long long *ns)
+{
+	return benchGetValue(nr, ns, SENSORS_FLAG_KEEP_FDS);
+}
+
+static long benchGetValues(int nr, long long *ns)
+{
+	const sensors_table *table;
+	long long start;
+	double *values;
+	long ops = 0;
+	int i, j, count;
+
+	initLib();
+	sensors_set_flags(SENSORS_FLAG_KEEP_FDS);
+	readAll();
+	table = sensors_get_table();
+	values = malloc((table->subfeature_count + 1) * sizeof(double));
+	if (!values)
+		die("malloc");
+	mark(nr);
+	start = nowNs();
+	for (i = 0; i < rounds; i++) {
+		for (j = 0; j < table->chip_count; j++) {
+			count = table->chip_first[j + 1] - table->chip_first[j];
+			sensors_get_values(table->chip[j], NULL, count,
+					   values, NULL);
+			ops += count;
+		}
+	}
+	*ns += nowNs() - start;
+	mark(0);
+	free(values);
+	sensors_cleanup();
+	return ops;
+}
+
+static long benchGetLabel(int nr, long long *ns)
+{
+	const sensors_chip_name *chip;
+	const sensors_feature *feature;
+	long long start;
+	long ops = 0;
+	int i, chipNr, featureNr;
+
+	initLib();
+	mark(nr);
+	start = nowNs();
+	for (i = 0; i < rounds; i++) {
+		chipNr = 0;
+		while ((chip = sensors_get_detected_chips(NULL, &chipNr))) {
+			featureNr = 0;
+			while ((feature = sensors_get_features(chip,
+							       &featureNr))) {
+				free(sensors_get_label(chip, feature));
+				ops++;
+			}
+		}
+	}
+	*ns += nowNs() - start;
+	mark(0);
+	sensors_cleanup();
+	return ops;
+}
+
+static long benchDoChipSets(int nr, long long *ns)
+{
+	const sensors_chip_name *chip;
+	long long start;
+	long ops = 0;
+	int i, chipNr;
+
+	initLib();
+	mark(nr);
+	start = nowNs();
+	for (i = 0; i < rounds; i++) {
+		chipNr = 0;
+		while ((chip = sensors_get_detected_chips(NULL, &chipNr))) {
+			sensors_do_chip_sets(chip);
+			ops++;
+		}
+	}
+	*ns += nowNs() - start;
+	mark(0);
+	sensors_cleanup();
+	return ops;
+}
+
+static const struct {
+	const char *name;
+	long (*run)(int nr, long long *ns);
+} benches[] = {
+	{ "sensors_init", benchInit },
+	{ "config parsing", benchParse },
+	{ "sensors_get_value", benchGetValueOpen },
+	{ "sensors_get_value fds", benchGetValueKeep },
+	{ "sensors_get_values fds", benchGetValues },
+	{ "sensors_get_label", benchGetLabel },
+	{ "sensors_do_chip_sets", benchDoChipSets },
+};
+
+#define BENCH_COUNT	(int)(sizeof(benches) / sizeof(benches[0]))
+
+/** System call counting **/
+
+/* Run all benchmarks in a traced child, and count the system calls made
+   within the marked sections. Returns 0 on success, -1 if the child
+   can't be traced. */
+static int countSyscalls(long *calls)
+{
+	struct ptrace_syscall_info info;
+	int i, status, current = -1;
+	pid_t pid;
+
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0)
+		return -1;
+	if (!pid) {
+		if (ptrace(PTRACE_TRACEME, 0, NULL, NULL))
+			_exit(EXIT_FAILURE);
+		raise(SIGSTOP);
+		counting = 1;
+		for (i = 0; i < BENCH_COUNT; i++) {
+			long long ns = 0;
+
+			benches[i].run(i + 1, &ns);
+		}
+		_exit(EXIT_SUCCESS);
+	}
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status) ||
+	    ptrace(PTRACE_SETOPTIONS, pid, NULL,
+		   PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL)) {
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, 0);
+		return -1;
+	}
+
+	for (;;) {
+		if (ptrace(PTRACE_SYSCALL, pid, NULL, NULL) ||
+		    waitpid(pid, &status, 0) < 0)
+			return -1;
+		if (WIFEXITED(status))
+			return WEXITSTATUS(status) ? -1 : 0;
+		if (WIFSIGNALED(status))
+			return -1;
+		if (WSTOPSIG(status) != (SIGTRAP | 0x80))
+			continue;
+
+		if (ptrace(PTRACE_GET_SYSCALL_INFO, pid,
+			   (void *)sizeof(info), &info) <= 0 ||
+		    info.op != PTRACE_SYSCALL_INFO_ENTRY)
+			continue;
+		if (info.entry.nr == SYS_getppid) {
+			i = info.entry.args[0];
+			current = i > 0 && i <= BENCH_COUNT ? i - 1 : -1;
+		} else if (current >= 0) {
+			calls[current]++;
+		}
+	}
+}
+
+static void usage(const char *prog)
+{
+	printf("Syntax: %s [-c chips] [-f features] [-n rounds] [-b blocks]"
+	       " [-m] [-k]\n"
+	       "  -c  number of chips (default 16)\n"
+	       "  -f  number of features of each type per chip (default 8)\n"
+	       "  -n  number of rounds of each benchmark (default 100)\n"
+	       "  -b  number of chip blocks in the configuration file"
+	       " (default 1000)\n"
+	       "  -m  serve the chips from memory, out of a capture of the"
+	       " tree\n"
+	       "  -k  keep the synthetic tree\n", prog);
+}
+
+static int parseCount(const char *arg, int *value)
+{
+	char *end;
+	long n = strtol(arg, &end, 10);
+
+	if (end == arg || *end || n < 1 || n > INT_MAX) {
+		fprintf(stderr, "bench-sensors: Invalid count `%s'\n", arg);
+		return -1;
+	}
+	*value = n;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	long long ns[BENCH_COUNT] = { 0 };
+	long ops[BENCH_COUNT], calls[BENCH_COUNT] = { 0 };
+	int c, i, traced;
+
+	while ((c = getopt(argc, argv, "c:f:n:b:mkh")) != -1) {
+		switch (c) {
+		case 'c':
+			if (parseCount(optarg, &chipCount))
+				return EXIT_FAILURE;
+			break;
+		case 'f':
+			if (parseCount(optarg, &featureCount))
+				return EXIT_FAILURE;
+			break;
+		case 'n':
+			if (parseCount(optarg, &rounds))
+				return EXIT_FAILURE;
+			break;
+		case 'b':
+			if (parseCount(optarg, &blockCount))
+				return EXIT_FAILURE;
+			break;
+		case 'm':
+			inMemory = 1;
+			break;
+		case 'k':
+			keepTree = 1;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	snprintf(root, sizeof(root), "%s/bench-sensors.XXXXXX",
+		 getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+	if (!mkdtemp(root))
+		die(root);
+	makeTree();
+	if (!(config = fopen(configPath, "r")))
+		die(configPath);
+	if (sensors_set_sysfs_root(root)) {
+		fprintf(stderr, "bench-sensors: Path %s too long\n", root);
+		return EXIT_FAILURE;
+	}
+	if (inMemory)
+		useCapture();
+
+	printf("%d chips, %d features of each type per chip, %d config"
+	       " blocks, %d rounds%s\n\n", chipCount, featureCount,
+	       blockCount, rounds, inMemory ? ", from memory" : "");
+	for (i = 0; i < BENCH_COUNT; i++)
+		ops[i] = benches[i].run(i + 1, &ns[i]);
+	traced = !countSyscalls(calls);
+
+	printf("%-24s %12s %12s %12s\n", "benchmark", "ops", "ns/op",
+	       "syscalls/op");
+	for (i = 0; i < BENCH_COUNT; i++) {
+		printf("%-24s %12ld %12.1f", benches[i].name, ops[i],
+		       (double)ns[i] / ops[i]);
+		if (traced)
+			printf(" %12.2f\n", (double)calls[i] / ops[i]);
+		else
+			printf(" %12s\n", "-");
+	}
+	if (!traced)
+		printf("\nSystem calls not counted, ptrace isn't available\n");
+
+	fclose(config);
+	if (keepTree)
+		printf("\nTree kept in %s\n", root);
+	else
+		removeTree();
+	return EXIT_SUCCESS;
+}
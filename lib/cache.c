@@ -0,0 +1,429 @@
+/*
+    cache.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/* The cache file holds the detected busses and chips, so that they don't
+   have to be discovered again by scanning sysfs. It is tied to the
+   identity of the system it was saved on: the inode numbers and
+   modification times of all hwmon and i2c-adapter class devices. If any
+   device is added or removed, the identity changes and the cache is
+   ignored. The file is mapped in memory and decoded in a single pass.
+
+   All values are stored in native byte order, as the cache is only
+   meant to be read back by the system which wrote it. Strings are stored
+   as their length followed by their characters, with no terminating
+   null character. A length of -1 denotes a NULL string. */
+
+/* this define needed for asprintf() */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "general.h"
+#include "sysfs.h"
+#include "init.h"
+#include "cache.h"
+
+#define CACHE_MAGIC	"LMSENSC"
+#define CACHE_VERSION	2
+
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t id_len;	/* Length of the system identity */
+	uint32_t data_len;	/* Length of the busses and chips data */
+	uint32_t data_sum;	/* FNV-1a hash of the busses and chips data */
+};
+
+struct cache_reader {
+	const char *p;
+	const char *end;
+	int err;
+};
+
+void sensors_set_cache_file(const char *filename)
+{
+	free(sensors_cache_file);
+	sensors_cache_file = NULL;
+	if (filename && !(sensors_cache_file = strdup(filename)))
+		sensors_fatal_error(__func__, "Out of memory");
+}
+
+static void put(sensors_cache_buf *buf, const void *data, size_t len)
+{
+	if (buf->len + len > buf->max) {
+		buf->max = buf->max ? buf->max * 2 : 4096;
+		if (buf->max < buf->len + len)
+			buf->max = buf->len + len;
+		buf->data = realloc(buf->data, buf->max);
+		if (!buf->data)
+			sensors_fatal_error(__func__, "Out of memory");
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+static void put_int(sensors_cache_buf *buf, int val)
+{
+	put(buf, &val, sizeof(val));
+}
+
+static void put_u64(sensors_cache_buf *buf, uint64_t val)
+{
+	put(buf, &val, sizeof(val));
+}
+
+static void put_str(sensors_cache_buf *buf, const char *str)
+{
+	int len = str ? (int)strlen(str) : -1;
+
+	put_int(buf, len);
+	if (str)
+		put(buf, str, len);
+}
+
+static void get(struct cache_reader *r, void *data, size_t len)
+{
+	if (r->err || (size_t)(r->end - r->p) < len) {
+		r->err = 1;
+		memset(data, 0, len);
+		return;
+	}
+	memcpy(data, r->p, len);
+	r->p += len;
+}
+
+static int get_int(struct cache_reader *r)
+{
+	int val;
+
+	get(r, &val, sizeof(val));
+	return val;
+}
+
+static char *get_str(struct cache_reader *r)
+{
+	char *str;
+	int len;
+
+	len = get_int(r);
+	if (len < 0 || r->err)
+		return NULL;
+	if (r->end - r->p < len) {
+		r->err = 1;
+		return NULL;
+	}
+	str = sensors_arena_strndup(&sensors_proc_arena, r->p, len);
+	r->p += len;
+	return str;
+}
+
+static uint32_t checksum(const char *data, size_t len)
+{
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static void put_stat(sensors_cache_buf *buf, const struct stat *st)
+{
+	put_u64(buf, st->st_ino);
+	put_u64(buf, st->st_mtim.tv_sec);
+	put_u64(buf, st->st_mtim.tv_nsec);
+}
+
+/* Record the identity of all devices of a class. Returns 0 on success,
+   -1 if the class doesn't exist. */
+static int put_class_identity(sensors_cache_buf *buf, const char *class)
+{
+	char path[NAME_MAX];
+	struct dirent *ent;
+	struct stat st;
+	DIR *dir;
+
+	snprintf(path, NAME_MAX, "%s/class/%s", sensors_sysfs_mount, class);
+	if (!(dir = opendir(path)) || fstat(dirfd(dir), &st)) {
+		if (dir)
+			closedir(dir);
+		put_int(buf, -1);
+		return -1;
+	}
+	put_int(buf, 0);
+	put_stat(buf, &st);
+
+	while ((ent = readdir(dir))) {
+		if (ent->d_name[0] == '.')
+			continue;
+		if (fstatat(dirfd(dir), ent->d_name, &st, 0))
+			memset(&st, 0, sizeof(st));
+		put_str(buf, ent->d_name);
+		put_stat(buf, &st);
+	}
+	put_str(buf, NULL);
+
+	closedir(dir);
+	return 0;
+}
+
+int sensors_cache_identity(sensors_cache_buf *buf)
+{
+	buf->len = 0;
+	put_int(buf, CACHE_VERSION);
+	put_str(buf, libsensors_version);
+	put_str(buf, sensors_sysfs_mount);
+
+	/* Old kernels without the hwmon class are not supported */
+	if (put_class_identity(buf, "hwmon"))
+		return -1;
+	put_class_identity(buf, "i2c-adapter");
+	return 0;
+}
+
+static void put_data(sensors_cache_buf *buf)
+{
+	const sensors_chip_features *chip;
+	const sensors_feature *feature;
+	const sensors_subfeature *sub;
+	int i, j;
+
+	put_int(buf, sensors_proc_bus_count);
+	for (i = 0; i < sensors_proc_bus_count; i++) {
+		put_str(buf, sensors_proc_bus[i].adapter);
+		put_int(buf, sensors_proc_bus[i].bus.type);
+		put_int(buf, sensors_proc_bus[i].bus.nr);
+	}
+
+	put_int(buf, sensors_proc_chips_count);
+	for (i = 0; i < sensors_proc_chips_count; i++) {
+		chip = &sensors_proc_chips[i];
+		put_str(buf, chip->chip.prefix);
+		put_int(buf, chip->chip.bus.type);
+		put_int(buf, chip->chip.bus.nr);
+		put_int(buf, chip->chip.addr);
+		put_str(buf, chip->chip.path);
+		put_str(buf, chip->class_path);
+
+		put_int(buf, chip->feature_count);
+		for (j = 0; j < chip->feature_count; j++) {
+			feature = &chip->feature[j];
+			put_str(buf, feature->name);
+			put_int(buf, feature->type);
+			put_int(buf, feature->first_subfeature);
+		}
+
+		put_int(buf, chip->subfeature_count);
+		for (j = 0; j < chip->subfeature_count; j++) {
+			sub = &chip->subfeature[j];
+			put_str(buf, sub->name);
+			put_int(buf, sub->type);
+			put_int(buf, sub->mapping);
+			put_int(buf, sub->flags);
+		}
+	}
+}
+
+void sensors_save_cache(const char *filename, const sensors_cache_buf *id)
+{
+	sensors_cache_buf data = { NULL, 0, 0 };
+	struct cache_header header;
+	char *tmp_name;
+	int fd, ok;
+
+	put_data(&data);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.version = CACHE_VERSION;
+	header.id_len = id->len;
+	header.data_len = data.len;
+	header.data_sum = checksum(data.data, data.len);
+
+	/* Write to a temporary file first, so that concurrent readers never
+	   see a partial cache */
+	if (asprintf(&tmp_name, "%s.XXXXXX", filename) < 0) {
+		free(data.data);
+		return;
+	}
+	fd = mkstemp(tmp_name);
+	if (fd >= 0) {
+		ok = fchmod(fd, 0644) == 0 &&
+		     write(fd, &header, sizeof(header)) == sizeof(header) &&
+		     write(fd, id->data, id->len) == (ssize_t)id->len &&
+		     write(fd, data.data, data.len) == (ssize_t)data.len;
+		if (close(fd))
+			ok = 0;
+		if (!ok || rename(tmp_name, filename))
+			unlink(tmp_name);
+	}
+	free(tmp_name);
+	free(data.data);
+}
+
+static int get_chip(struct cache_reader *r, sensors_chip_features *entry)
+{
+	sensors_feature *feature;
+	sensors_subfeature *sub;
+	int i, count;
+
+	/* Only the chips of sysfs are cached */
+	memset(entry, 0, sizeof(*entry));
+	entry->backend = &sensors_sysfs_backend;
+	entry->chip.prefix = get_str(r);
+	entry->chip.bus.type = get_int(r);
+	entry->chip.bus.nr = get_int(r);
+	entry->chip.addr = get_int(r);
+	entry->chip.path = get_str(r);
+	entry->class_path = get_str(r);
+	if (entry->chip.bus.type < SENSORS_BUS_TYPE_I2C ||
+	    entry->chip.bus.type > SENSORS_BUS_TYPE_SCSI)
+		r->err = 1;
+
+	count = get_int(r);
+	if (r->err || count <= 0 || count > r->end - r->p)
+		return -1;
+	entry->feature = sensors_arena_alloc(&sensors_proc_arena,
+					     count * sizeof(*entry->feature));
+	entry->feature_count = count;
+	for (i = 0; i < count; i++) {
+		feature = &entry->feature[i];
+		feature->name = get_str(r);
+		feature->number = i;
+		feature->type = get_int(r);
+		feature->first_subfeature = get_int(r);
+	}
+
+	count = get_int(r);
+	if (r->err || count <= 0 || count > r->end - r->p)
+		return -1;
+	entry->subfeature = sensors_arena_alloc(&sensors_proc_arena,
+					count * sizeof(*entry->subfeature));
+	entry->subfeature_fd = malloc(count * sizeof(*entry->subfeature_fd));
+	if (!entry->subfeature_fd)
+		sensors_fatal_error(__func__, "Out of memory");
+	entry->subfeature_count = count;
+	for (i = 0; i < count; i++) {
+		sub = &entry->subfeature[i];
+		entry->subfeature_fd[i] = -1;
+		sub->name = get_str(r);
+		sub->number = i;
+		sub->type = get_int(r);
+		sub->mapping = get_int(r);
+		sub->flags = get_int(r);
+		if (sub->mapping < 0 || sub->mapping >= entry->feature_count)
+			r->err = 1;
+	}
+
+	for (i = 0; i < entry->feature_count; i++)
+		if (entry->feature[i].first_subfeature < 0 ||
+		    entry->feature[i].first_subfeature >= count)
+			r->err = 1;
+
+	return r->err || !entry->chip.prefix ? -1 : 0;
+}
+
+static int get_data(struct cache_reader *r)
+{
+	sensors_chip_features entry;
+	sensors_bus bus;
+	int i, count;
+
+	count = get_int(r);
+	for (i = 0; i < count && !r->err; i++) {
+		memset(&bus, 0, sizeof(bus));
+		bus.adapter = get_str(r);
+		bus.bus.type = get_int(r);
+		bus.bus.nr = get_int(r);
+		if (!bus.adapter) {
+			r->err = 1;
+			break;
+		}
+		sensors_add_proc_bus(&bus);
+	}
+
+	count = get_int(r);
+	for (i = 0; i < count && !r->err; i++) {
+		if (get_chip(r, &entry)) {
+			sensors_free_chip_features(&entry);
+			r->err = 1;
+			break;
+		}
+		sensors_add_proc_chips(&entry);
+	}
+
+	return r->err || r->p != r->end ? -1 : 0;
+}
+
+int sensors_load_cache(const char *filename, const sensors_cache_buf *id)
+{
+	const struct cache_header *header;
+	struct cache_reader r;
+	struct stat st;
+	void *map;
+	int fd, res = -1;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*header)) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	header = map;
+	if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) ||
+	    header->version != CACHE_VERSION ||
+	    (uint64_t)sizeof(*header) + header->id_len + header->data_len !=
+	    (uint64_t)st.st_size ||
+	    header->id_len != id->len ||
+	    memcmp(header + 1, id->data, id->len))
+		goto exit_unmap;
+
+	r.p = (const char *)(header + 1) + header->id_len;
+	r.end = r.p + header->data_len;
+	r.err = 0;
+	if (checksum(r.p, header->data_len) != header->data_sum)
+		goto exit_unmap;
+	res = get_data(&r);
+	if (res)
+		sensors_cleanup();
+
+exit_unmap:
+	munmap(map, st.st_size);
+	return res;
+}
@@ -0,0 +1,45 @@
+/*
+    cache.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_CACHE_H
+#define LIB_SENSORS_CACHE_H
+
+typedef struct sensors_cache_buf {
+	char *data;
+	size_t len;
+	size_t max;
+} sensors_cache_buf;
+
+/* Record the identity of the running system, that is, the hwmon and
+   i2c-adapter class devices, in buf. This is done before scanning the
+   system, so that changes happening during the scan invalidate the cache.
+   Returns 0 on success, !0 if the system can't be cached. */
+int sensors_cache_identity(sensors_cache_buf *buf);
+
+/* Load the detected chips and busses from a cache file, if it was saved
+   with the same system identity. Returns 0 on success, !0 if the cache
+   couldn't be used, in which case nothing is loaded. */
+int sensors_load_cache(const char *filename, const sensors_cache_buf *id);
+
+/* Save the detected chips and busses to a cache file, along with the
+   system identity. Errors are silently ignored, as the cache is only
+   an optimization. */
+void sensors_save_cache(const char *filename, const sensors_cache_buf *id);
+
+#endif /* def LIB_SENSORS_CACHE_H */
@@ -0,0 +1,684 @@
+/*
+    capture.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/* A capture holds the chips of a system and the values of their
+   attributes, and possibly how these values changed over time. The memory
+   backend serves the chips of a loaded capture instead of those of sysfs.
+   Captures are text files, one statement per line:
+
+     root <sysfs mount point>
+     bus <type> <nr> <adapter name>
+     chip <path> <prefix> <bus type> <bus nr> <address>
+     attr <name> <r|w|rw|-> <raw value, or - if reading fails>
+     label <feature> <label>
+     sample <seconds> <chip path> <attribute> <raw value>
+
+   attr and label statements belong to the last chip statement. Samples
+   of each attribute must come in time order. Lines starting with # are
+   comments. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "general.h"
+#include "sysfs.h"
+#include "capture.h"
+
+struct capture_sample {
+	double time;
+	double value;
+};
+
+struct capture_attr {
+	char *name;
+	int chip;		/* Index of the chip */
+	int mode;
+	int failed;		/* Reading it fails */
+	double value;		/* Initial value, or last one written */
+	double write_time;	/* Capture time of the last write */
+	char *label;		/* For the labels of the features */
+	struct capture_sample *samples;
+	int sample_count, sample_max;
+};
+
+struct capture_chip {
+	sensors_chip_name name;
+	int first_attr, attr_count;
+};
+
+struct capture {
+	char root[NAME_MAX];
+	sensors_bus *buses;
+	int bus_count, bus_max;
+	struct capture_chip *chips;
+	int chip_count, chip_max;
+	struct capture_attr *attrs;
+	int attr_count, attr_max;
+	/* Attribute indexes by chip path and attribute name, -1 if empty */
+	int *hash;
+	unsigned int hash_mask;
+};
+
+/* The chips of a capture may still be read and written from other
+   contexts while another capture is loaded, so the capture and its time
+   are only accessed under the lock */
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct capture capture;
+static int capture_loaded;
+static double capture_time;
+
+/** Attribute lookup **/
+
+static unsigned int hash_attr(const char *path, const char *name)
+{
+	unsigned int h = 2166136261u;	/* FNV-1a */
+
+	while (*path)
+		h = (h ^ (unsigned char)*path++) * 16777619u;
+	h = (h ^ '/') * 16777619u;
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	return h;
+}
+
+static void hash_attrs(struct capture *c)
+{
+	unsigned int size = 16, h;
+	int i;
+
+	while (size < 2U * c->attr_count)
+		size <<= 1;
+	c->hash = malloc(size * sizeof(int));
+	if (!c->hash)
+		sensors_fatal_error(__func__, "Out of memory");
+	memset(c->hash, 0xff, size * sizeof(int));
+	c->hash_mask = size - 1;
+
+	for (i = 0; i < c->attr_count; i++) {
+		h = hash_attr(c->chips[c->attrs[i].chip].name.path,
+			      c->attrs[i].name) & c->hash_mask;
+		while (c->hash[h] >= 0)
+			h = (h + 1) & c->hash_mask;
+		c->hash[h] = i;
+	}
+}
+
+static struct capture_attr *find_attr(const char *path, const char *name)
+{
+	struct capture_attr *attr;
+	unsigned int h;
+
+	h = hash_attr(path, name) & capture.hash_mask;
+	while (capture.hash[h] >= 0) {
+		attr = &capture.attrs[capture.hash[h]];
+		if (!strcmp(attr->name, name) &&
+		    !strcmp(capture.chips[attr->chip].name.path, path))
+			return attr;
+		h = (h + 1) & capture.hash_mask;
+	}
+	return NULL;
+}
+
+/* The value at the capture time: that of the last sample until then,
+   unless the attribute was written since */
+static double attr_value(const struct capture_attr *attr)
+{
+	int lo = 0, hi = attr->sample_count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (attr->samples[mid].time <= capture_time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!lo || attr->write_time >= attr->samples[lo - 1].time)
+		return attr->value;
+	return attr->samples[lo - 1].value;
+}
+
+/** Loading **/
+
+static void free_capture(struct capture *c)
+{
+	int i;
+
+	for (i = 0; i < c->bus_count; i++)
+		free(c->buses[i].adapter);
+	free(c->buses);
+	for (i = 0; i < c->chip_count; i++) {
+		free(c->chips[i].name.prefix);
+		free(c->chips[i].name.path);
+	}
+	free(c->chips);
+	for (i = 0; i < c->attr_count; i++) {
+		free(c->attrs[i].name);
+		free(c->attrs[i].label);
+		free(c->attrs[i].samples);
+	}
+	free(c->attrs);
+	free(c->hash);
+	memset(c, 0, sizeof(*c));
+}
+
+void sensors_free_capture(void)
+{
+	pthread_mutex_lock(&capture_lock);
+	free_capture(&capture);
+	capture_loaded = 0;
+	pthread_mutex_unlock(&capture_lock);
+}
+
+static char *xstrdup(const char *s)
+{
+	char *p = strdup(s);
+
+	if (!p)
+		sensors_fatal_error(__func__, "Out of memory");
+	return p;
+}
+
+static char *next_word(char **p)
+{
+	char *word;
+
+	*p += strspn(*p, " \t");
+	if (!**p)
+		return NULL;
+	word = *p;
+	*p += strcspn(*p, " \t");
+	if (**p)
+		*(*p)++ = '\0';
+	return word;
+}
+
+/* The rest of the line, for names which may contain spaces */
+static char *rest_of_line(char **p)
+{
+	*p += strspn(*p, " \t");
+	return **p ? *p : NULL;
+}
+
+static int parse_double(const char *word, double *value)
+{
+	char *end;
+
+	if (!word)
+		return -1;
+	*value = strtod(word, &end);
+	return end == word || *end ? -1 : 0;
+}
+
+static int parse_int(const char *word, int *value)
+{
+	char *end;
+	long n;
+
+	if (!word)
+		return -1;
+	n = strtol(word, &end, 0);
+	if (end == word || *end || n < INT_MIN || n > INT_MAX)
+		return -1;
+	*value = n;
+	return 0;
+}
+
+static int parse_mode(const char *word, int *mode)
+{
+	if (!word)
+		return -1;
+	*mode = 0;
+	if (!strcmp(word, "-"))
+		return 0;
+	for (; *word; word++) {
+		if (*word == 'r')
+			*mode |= SENSORS_MODE_R;
+		else if (*word == 'w')
+			*mode |= SENSORS_MODE_W;
+		else
+			return -1;
+	}
+	return 0;
+}
+
+static void add_attr(struct capture *c, const char *name)
+{
+	struct capture_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.name = xstrdup(name);
+	attr.chip = c->chip_count - 1;
+	attr.write_time = -1;
+	sensors_add_array_el(&attr, &c->attrs, &c->attr_count, &c->attr_max,
+			     sizeof(attr));
+	c->chips[c->chip_count - 1].attr_count++;
+}
+
+static int parse_line(struct capture *c, char *line, int *last)
+{
+	char *p = line, *key, *word, *word2;
+	struct capture_sample sample;
+	struct capture_attr *attr;
+	struct capture_chip chip;
+	sensors_bus bus;
+	int type, nr, i;
+
+	key = next_word(&p);
+	if (!key || key[0] == '#')
+		return 0;
+
+	if (!strcmp(key, "root")) {
+		if (!(word = next_word(&p)) || strlen(word) >= NAME_MAX)
+			return -1;
+		strcpy(c->root, word);
+	} else if (!strcmp(key, "bus")) {
+		memset(&bus, 0, sizeof(bus));
+		if (parse_int(next_word(&p), &type) ||
+		    parse_int(next_word(&p), &nr) ||
+		    !(word = rest_of_line(&p)))
+			return -1;
+		bus.bus.type = type;
+		bus.bus.nr = nr;
+		bus.adapter = xstrdup(word);
+		sensors_add_array_el(&bus, &c->buses, &c->bus_count,
+				     &c->bus_max, sizeof(bus));
+	} else if (!strcmp(key, "chip")) {
+		memset(&chip, 0, sizeof(chip));
+		if (!(word = next_word(&p)) || !(word2 = next_word(&p)) ||
+		    parse_int(next_word(&p), &type) ||
+		    parse_int(next_word(&p), &nr) ||
+		    parse_int(next_word(&p), &chip.name.addr))
+			return -1;
+		chip.name.path = xstrdup(word);
+		chip.name.prefix = xstrdup(word2);
+		chip.name.bus.type = type;
+		chip.name.bus.nr = nr;
+		chip.first_attr = c->attr_count;
+		sensors_add_array_el(&chip, &c->chips, &c->chip_count,
+				     &c->chip_max, sizeof(chip));
+	} else if (!strcmp(key, "attr")) {
+		if (!c->chip_count || !(word = next_word(&p)) ||
+		    parse_mode(next_word(&p), &type) ||
+		    !(word2 = next_word(&p)))
+			return -1;
+		add_attr(c, word);
+		attr = &c->attrs[c->attr_count - 1];
+		attr->mode = type;
+		if (!strcmp(word2, "-"))
+			attr->failed = 1;
+		else if (parse_double(word2, &attr->value))
+			return -1;
+	} else if (!strcmp(key, "label")) {
+		char name[NAME_MAX];
+
+		if (!c->chip_count || !(word = next_word(&p)) ||
+		    !(word2 = rest_of_line(&p)) ||
+		    snprintf(name, NAME_MAX, "%s_label", word) >= NAME_MAX)
+			return -1;
+		add_attr(c, name);
+		c->attrs[c->attr_count - 1].label = xstrdup(word2);
+	} else if (!strcmp(key, "sample")) {
+		if (parse_double(next_word(&p), &sample.time) ||
+		    !(word = next_word(&p)) || !(word2 = next_word(&p)) ||
+		    parse_double(next_word(&p), &sample.value))
+			return -1;
+
+		/* Samples usually come in the same order round after round,
+		   so look right after the last attribute first */
+		attr = NULL;
+		for (i = *last + 1; i < c->attr_count && !attr; i++)
+			if (!strcmp(c->attrs[i].name, word2) &&
+			    !strcmp(c->chips[c->attrs[i].chip].name.path, word))
+				attr = &c->attrs[i];
+		for (i = 0; i < c->attr_count && !attr; i++)
+			if (!strcmp(c->attrs[i].name, word2) &&
+			    !strcmp(c->chips[c->attrs[i].chip].name.path, word))
+				attr = &c->attrs[i];
+		if (!attr || (attr->sample_count &&
+			      attr->samples[attr->sample_count - 1].time >
+			      sample.time))
+			return -1;
+		sensors_add_array_el(&sample, &attr->samples,
+				     &attr->sample_count, &attr->sample_max,
+				     sizeof(sample));
+		*last = attr - c->attrs;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+int sensors_load_capture(FILE *input)
+{
+	struct capture c;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int lineno = 0, last = -1;
+
+	if (!input) {
+		sensors_free_capture();
+		sensors_backend_ops = &sensors_sysfs_backend;
+		return 0;
+	}
+
+	memset(&c, 0, sizeof(c));
+	strcpy(c.root, "/sys");
+	while ((len = getline(&line, &size, input)) >= 0) {
+		lineno++;
+		if (len && line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		if (parse_line(&c, line, &last)) {
+			sensors_parse_error("Invalid capture line", lineno);
+			free(line);
+			free_capture(&c);
+			return -SENSORS_ERR_PARSE;
+		}
+	}
+	free(line);
+
+	hash_attrs(&c);
+	pthread_mutex_lock(&capture_lock);
+	free_capture(&capture);
+	capture = c;
+	capture_loaded = 1;
+	capture_time = 0;
+	pthread_mutex_unlock(&capture_lock);
+	sensors_backend_ops = &sensors_memory_backend;
+	return 0;
+}
+
+void sensors_set_capture_time(double t)
+{
+	pthread_mutex_lock(&capture_lock);
+	capture_time = t;
+	pthread_mutex_unlock(&capture_lock);
+}
+
+/** Memory backend **/
+
+static int memory_init(void)
+{
+	int loaded;
+
+	pthread_mutex_lock(&capture_lock);
+	loaded = capture_loaded;
+	if (loaded)
+		snprintf(sensors_sysfs_mount, NAME_MAX, "%s", capture.root);
+	pthread_mutex_unlock(&capture_lock);
+	return loaded;
+}
+
+static int memory_read_bus(void)
+{
+	sensors_bus entry;
+	int i;
+
+	pthread_mutex_lock(&capture_lock);
+	for (i = 0; i < capture.bus_count; i++) {
+		memset(&entry, 0, sizeof(entry));
+		entry.bus = capture.buses[i].bus;
+		entry.adapter = sensors_arena_strdup(&sensors_proc_arena,
+						     capture.buses[i].adapter);
+		sensors_add_proc_bus(&entry);
+	}
+	pthread_mutex_unlock(&capture_lock);
+	return 0;
+}
+
+struct attr_iter {
+	int next, end;
+};
+
+static const char *memory_next_attr(void *data)
+{
+	struct attr_iter *it = data;
+
+	return it->next < it->end ? capture.attrs[it->next++].name : NULL;
+}
+
+/* Always called for the attribute last returned */
+static int memory_get_attr_mode(void *data, const char *name)
+{
+	struct attr_iter *it = data;
+	(void)name; /* hide warning */
+
+	return capture.attrs[it->next - 1].mode;
+}
+
+static int memory_fill_chip(const struct capture_chip *chip,
+			    sensors_chip_features *entry,
+			    sensors_arena *arena)
+{
+	struct attr_iter it = { chip->first_attr,
+				chip->first_attr + chip->attr_count };
+
+	memset(entry, 0, sizeof(*entry));
+	entry->backend = &sensors_memory_backend;
+	sensors_read_dynamic_chip(entry, memory_next_attr,
+				  memory_get_attr_mode, &it, arena);
+	if (!entry->subfeature)
+		return 0;
+
+	entry->chip.prefix = sensors_arena_strdup(arena, chip->name.prefix);
+	entry->chip.path = sensors_arena_strdup(arena, chip->name.path);
+	entry->class_path = entry->chip.path;
+	entry->chip.bus = chip->name.bus;
+	entry->chip.addr = chip->name.addr;
+	return 1;
+}
+
+static int memory_read_chips(void)
+{
+	sensors_chip_features entry;
+	int i;
+
+	pthread_mutex_lock(&capture_lock);
+	for (i = 0; i < capture.chip_count; i++)
+		if (memory_fill_chip(&capture.chips[i], &entry,
+				     &sensors_proc_arena))
+			sensors_add_proc_chips(&entry);
+	pthread_mutex_unlock(&capture_lock);
+	return 0;
+}
+
+static int memory_scan_device(const char *path, sensors_chip_features *entry,
+			      sensors_arena *arena)
+{
+	int i, res = 0;
+
+	pthread_mutex_lock(&capture_lock);
+	for (i = 0; i < capture.chip_count; i++)
+		if (!strcmp(capture.chips[i].name.path, path)) {
+			res = memory_fill_chip(&capture.chips[i], entry,
+					       arena);
+			break;
+		}
+	pthread_mutex_unlock(&capture_lock);
+	return res;
+}
+
+static int memory_read_raw(const sensors_chip_features *chip,
+			   const sensors_subfeature *subfeature,
+			   double *value)
+{
+	const struct capture_attr *attr;
+	int err = 0;
+
+	pthread_mutex_lock(&capture_lock);
+	attr = find_attr(chip->chip.path, subfeature->name);
+	if (!attr || !(attr->mode & SENSORS_MODE_R))
+		err = -SENSORS_ERR_KERNEL;
+	else if (attr->failed)
+		err = -SENSORS_ERR_IO;
+	else
+		*value = attr_value(attr);
+	pthread_mutex_unlock(&capture_lock);
+	return err;
+}
+
+static int memory_write_raw(const sensors_chip_name *name,
+			    const sensors_subfeature *subfeature,
+			    double value)
+{
+	struct capture_attr *attr;
+	int err = 0;
+
+	pthread_mutex_lock(&capture_lock);
+	attr = find_attr(name->path, subfeature->name);
+	if (!attr || !(attr->mode & SENSORS_MODE_W)) {
+		err = -SENSORS_ERR_KERNEL;
+	} else {
+		/* As written by the sysfs backend */
+		attr->value = (int) value;
+		attr->write_time = capture_time;
+		attr->failed = 0;
+	}
+	pthread_mutex_unlock(&capture_lock);
+	return err;
+}
+
+static int memory_read_label(const sensors_chip_name *name,
+			     const char *feature, char *buf, int size)
+{
+	const struct capture_attr *attr;
+	char attr_name[NAME_MAX];
+	int res = 0;
+
+	snprintf(attr_name, NAME_MAX, "%s_label", feature);
+	pthread_mutex_lock(&capture_lock);
+	attr = find_attr(name->path, attr_name);
+	if (attr && attr->label) {
+		snprintf(buf, size, "%s", attr->label);
+		res = 1;
+	}
+	pthread_mutex_unlock(&capture_lock);
+	return res;
+}
+
+const sensors_backend sensors_memory_backend = {
+	.init		= memory_init,
+	.read_bus	= memory_read_bus,
+	.read_chips	= memory_read_chips,
+	.scan_device	= memory_scan_device,
+	.read_raw	= memory_read_raw,
+	.write_raw	= memory_write_raw,
+	.read_label	= memory_read_label,
+};
+
+/** Recording **/
+
+int sensors_capture_recording;
+static FILE *record_file;
+static struct timespec record_start;
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void write_mode(FILE *f, int mode)
+{
+	if (!(mode & (SENSORS_MODE_R | SENSORS_MODE_W)))
+		fputc('-', f);
+	if (mode & SENSORS_MODE_R)
+		fputc('r', f);
+	if (mode & SENSORS_MODE_W)
+		fputc('w', f);
+}
+
+static void write_chip(FILE *f, const sensors_chip_features *chip)
+{
+	const sensors_subfeature *sub;
+	char label[PATH_MAX];
+	double value;
+	int i;
+
+	fprintf(f, "chip %s %s %d %d %d\n", chip->chip.path,
+		chip->chip.prefix, chip->chip.bus.type, chip->chip.bus.nr,
+		chip->chip.addr);
+	for (i = 0; i < chip->subfeature_count; i++) {
+		sub = &chip->subfeature[i];
+		fprintf(f, "attr %s ", sub->name);
+		write_mode(f, sub->flags);
+		if ((sub->flags & SENSORS_MODE_R) &&
+		    !chip->backend->read_raw(chip, sub, &value))
+			fprintf(f, " %.15g\n", value);
+		else
+			fprintf(f, " -\n");
+	}
+	for (i = 0; i < chip->feature_count; i++)
+		if (chip->backend->read_label(&chip->chip,
+					      chip->feature[i].name,
+					      label, sizeof(label)))
+			fprintf(f, "label %s %s\n", chip->feature[i].name,
+				label);
+}
+
+int sensors_record_capture(FILE *output)
+{
+	int i, err = 0;
+
+	pthread_mutex_lock(&record_lock);
+	if (record_file && fflush(record_file))
+		err = -SENSORS_ERR_IO;
+	record_file = output;
+	__atomic_store_n(&sensors_capture_recording, output != NULL,
+			 __ATOMIC_RELEASE);
+	if (!output)
+		goto exit_unlock;
+
+	fprintf(output, "# libsensors capture\nroot %s\n",
+		sensors_sysfs_mount);
+	for (i = 0; i < sensors_proc_bus_count; i++)
+		fprintf(output, "bus %d %d %s\n",
+			sensors_proc_bus[i].bus.type,
+			sensors_proc_bus[i].bus.nr,
+			sensors_proc_bus[i].adapter);
+	for (i = 0; i < sensors_proc_chips_count; i++)
+		write_chip(output, &sensors_proc_chips[i]);
+	if (ferror(output))
+		err = -SENSORS_ERR_IO;
+	clock_gettime(CLOCK_MONOTONIC, &record_start);
+
+exit_unlock:
+	pthread_mutex_unlock(&record_lock);
+	return err;
+}
+
+void sensors_record_value(const sensors_chip_name *chip,
+			  const sensors_subfeature *subfeature, double value)
+{
+	struct timespec now;
+
+	pthread_mutex_lock(&record_lock);
+	if (record_file) {
+		/* Taken under the lock, so that samples stay in order */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		fprintf(record_file, "sample %.6f %s %s %.15g\n",
+			(now.tv_sec - record_start.tv_sec) +
+			(now.tv_nsec - record_start.tv_nsec) / 1e9,
+			chip->path, subfeature->name, value);
+	}
+	pthread_mutex_unlock(&record_lock);
+}
@@ -0,0 +1,37 @@
+/*
+    capture.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_CAPTURE_H
+#define LIB_SENSORS_CAPTURE_H
+
+/* Serves the chips of the capture loaded by sensors_load_capture() */
+extern const sensors_backend sensors_memory_backend;
+
+/* Set while sensors_record_capture() records the values read */
+extern int sensors_capture_recording;
+
+/* Record a raw value which was just read */
+void sensors_record_value(const sensors_chip_name *chip,
+			  const sensors_subfeature *subfeature, double value);
+
+/* Free the loaded capture, if any. The backend must be switched to sysfs
+   by the caller. */
+void sensors_free_capture(void);
+
+#endif /* def LIB_SENSORS_CAPTURE_H */
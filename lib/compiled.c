@@ -0,0 +1,824 @@
+/*
+    compiled.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/* A compiled configuration holds the configuration chips and busses as
+   they are once parsed, so that the configuration files don't have to be
+   parsed again. The busses are substituted when it is loaded, as they
+   depend on the detected busses, and the errors found while parsing are
+   reported again, so that it behaves exactly like the files. If it was
+   compiled from the default configuration files, it also holds their
+   identity, that is, their inode numbers, sizes and modification times,
+   as well as those of the configuration directory, so that it is only
+   used while they remain the same. The file is mapped in memory and
+   decoded in a single pass.
+
+   All values are stored in native byte order, like in the cache file.
+   The strings are stored once, null-terminated, in a table which is
+   copied as a whole to the configuration arena. They are referenced by
+   their offset in the table, -1 denoting a NULL string. */
+
+/* this define needed for asprintf() */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "general.h"
+#include "init.h"
+#include "cache.h"
+#include "compiled.h"
+
+#define COMPILED_MAGIC		"LMSCONF"
+#define COMPILED_VERSION	1
+
+/* As deep as the parser goes */
+#define MAX_EXPR_DEPTH		10000
+
+struct compiled_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t sources_len;	/* Length of the identity of the files */
+	uint32_t data_len;	/* Length of the configuration data */
+	uint32_t data_sum;	/* FNV-1a hash of the configuration data */
+};
+
+struct compiled_reader {
+	const char *p;
+	const char *end;
+	int err;
+	char *strings;		/* The string table, once copied */
+	int strings_len;
+};
+
+/* The configuration being compiled. The parse errors and the busses have
+   to be recorded as each file is parsed, the chips are recorded at the
+   end, as a file may add statements to the last chip of the previous
+   one. */
+struct compiled_file {
+	int name;		/* Reference to the name of the file */
+	int chips_count;	/* Number of chips declared in the file */
+	size_t record_start;	/* Offset of its errors and busses in records */
+};
+
+struct compiled_ref {
+	const char *str;
+	int offset;
+};
+
+static struct compiler {
+	struct compiled_file *files;
+	int files_count, files_max;
+	sensors_cache_buf records;
+	sensors_cache_buf errors;	/* Of the file being parsed */
+	int errors_count;
+	sensors_cache_buf strings;
+	/* Offsets of the strings in the table, by address, as the names are
+	   shared by all files */
+	struct compiled_ref *refs;
+	unsigned int refs_count, refs_mask;
+} compiler;
+
+/* The parse error handler, while the errors are recorded */
+static void (*parse_error_wfn)(const char *err, const char *filename,
+			       int lineno);
+
+static void put(sensors_cache_buf *buf, const void *data, size_t len)
+{
+	if (buf->len + len > buf->max) {
+		buf->max = buf->max ? buf->max * 2 : 4096;
+		if (buf->max < buf->len + len)
+			buf->max = buf->len + len;
+		buf->data = realloc(buf->data, buf->max);
+		if (!buf->data)
+			sensors_fatal_error(__func__, "Out of memory");
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+static void put_int(sensors_cache_buf *buf, int val)
+{
+	put(buf, &val, sizeof(val));
+}
+
+static void put_u64(sensors_cache_buf *buf, uint64_t val)
+{
+	put(buf, &val, sizeof(val));
+}
+
+static void put_str(sensors_cache_buf *buf, const char *str)
+{
+	int len = str ? (int)strlen(str) : -1;
+
+	put_int(buf, len);
+	if (str)
+		put(buf, str, len);
+}
+
+static unsigned int hash_ref(const char *str)
+{
+	return (unsigned int)((uintptr_t)str >> 3) * 2654435761U;
+}
+
+static void grow_refs(void)
+{
+	struct compiled_ref *old = compiler.refs;
+	unsigned int i, j, old_mask = compiler.refs_mask;
+
+	compiler.refs_mask = old ? old_mask * 2 + 1 : 255;
+	compiler.refs = calloc(compiler.refs_mask + 1, sizeof(*compiler.refs));
+	if (!compiler.refs)
+		sensors_fatal_error(__func__, "Out of memory");
+	if (!old)
+		return;
+
+	for (i = 0; i <= old_mask; i++) {
+		if (!old[i].str)
+			continue;
+		for (j = hash_ref(old[i].str) & compiler.refs_mask;
+		     compiler.refs[j].str; j = (j + 1) & compiler.refs_mask)
+			;
+		compiler.refs[j] = old[i];
+	}
+	free(old);
+}
+
+/* The offset of a string in the table, where it is added the first time */
+static int ref(const char *str)
+{
+	unsigned int i;
+
+	if (!str)
+		return -1;
+
+	if (!compiler.refs || 2 * (compiler.refs_count + 1) > compiler.refs_mask)
+		grow_refs();
+	for (i = hash_ref(str) & compiler.refs_mask; compiler.refs[i].str;
+	     i = (i + 1) & compiler.refs_mask) {
+		if (compiler.refs[i].str == str)
+			return compiler.refs[i].offset;
+	}
+
+	compiler.refs[i].str = str;
+	compiler.refs[i].offset = compiler.strings.len;
+	compiler.refs_count++;
+	put(&compiler.strings, str, strlen(str) + 1);
+	return compiler.refs[i].offset;
+}
+
+static void put_ref(sensors_cache_buf *buf, const char *str)
+{
+	put_int(buf, ref(str));
+}
+
+static void put_line(sensors_cache_buf *buf, const sensors_config_line *line)
+{
+	put_ref(buf, line->filename);
+	put_int(buf, line->lineno);
+}
+
+static void put_expr(sensors_cache_buf *buf, const sensors_expr *expr)
+{
+	if (!expr) {
+		put_int(buf, -1);
+		return;
+	}
+
+	put_int(buf, expr->kind);
+	switch (expr->kind) {
+	case sensors_kind_val:
+		put(buf, &expr->data.val, sizeof(expr->data.val));
+		break;
+	case sensors_kind_var:
+		put_ref(buf, expr->data.var);
+		break;
+	case sensors_kind_source:
+		break;
+	case sensors_kind_sub:
+		put_int(buf, expr->data.subexpr.op);
+		put_expr(buf, expr->data.subexpr.sub1);
+		put_expr(buf, expr->data.subexpr.sub2);
+		break;
+	}
+}
+
+static void put_chip(sensors_cache_buf *buf, const sensors_chip *chip)
+{
+	const sensors_chip_name *name;
+	int i;
+
+	put_line(buf, &chip->line);
+
+	put_int(buf, chip->chips.fits_count);
+	for (i = 0; i < chip->chips.fits_count; i++) {
+		name = &chip->chips.fits[i];
+		put_ref(buf, name->prefix);
+		put_int(buf, name->bus.type);
+		put_int(buf, name->bus.nr);
+		put_int(buf, name->addr);
+	}
+
+	put_int(buf, chip->labels_count);
+	for (i = 0; i < chip->labels_count; i++) {
+		put_ref(buf, chip->labels[i].name);
+		put_ref(buf, chip->labels[i].value);
+		put_line(buf, &chip->labels[i].line);
+	}
+
+	put_int(buf, chip->sets_count);
+	for (i = 0; i < chip->sets_count; i++) {
+		put_ref(buf, chip->sets[i].name);
+		put_expr(buf, chip->sets[i].value);
+		put_line(buf, &chip->sets[i].line);
+	}
+
+	put_int(buf, chip->computes_count);
+	for (i = 0; i < chip->computes_count; i++) {
+		put_ref(buf, chip->computes[i].name);
+		put_expr(buf, chip->computes[i].from_proc);
+		put_expr(buf, chip->computes[i].to_proc);
+		put_line(buf, &chip->computes[i].line);
+	}
+
+	put_int(buf, chip->ignores_count);
+	for (i = 0; i < chip->ignores_count; i++) {
+		put_ref(buf, chip->ignores[i].name);
+		put_line(buf, &chip->ignores[i].line);
+	}
+}
+
+/* The parse errors don't prevent the configuration from being loaded, they
+   are reported again whenever the compiled configuration is loaded */
+static void record_parse_error(const char *err, const char *filename,
+			       int lineno)
+{
+	put_str(&compiler.errors, err);
+	put_ref(&compiler.errors, filename);
+	put_int(&compiler.errors, lineno);
+	compiler.errors_count++;
+	parse_error_wfn(err, filename, lineno);
+}
+
+void sensors_compile_begin(void)
+{
+	sensors_compile_abort();
+	parse_error_wfn = sensors_parse_error_wfn;
+	sensors_parse_error_wfn = record_parse_error;
+}
+
+void sensors_compile_file(const char *name)
+{
+	struct compiled_file file;
+	const sensors_bus *bus;
+	int i;
+
+	file.name = ref(name);
+	file.chips_count = sensors_config_chips_count -
+			   sensors_config_chips_subst;
+	file.record_start = compiler.records.len;
+
+	put_int(&compiler.records, compiler.errors_count);
+	if (compiler.errors_count)
+		put(&compiler.records, compiler.errors.data,
+		    compiler.errors.len);
+	compiler.errors.len = 0;
+	compiler.errors_count = 0;
+
+	put_int(&compiler.records, sensors_config_busses_count);
+	for (i = 0; i < sensors_config_busses_count; i++) {
+		bus = &sensors_config_busses[i];
+		put_ref(&compiler.records, bus->adapter);
+		put_int(&compiler.records, bus->bus.type);
+		put_int(&compiler.records, bus->bus.nr);
+		put_line(&compiler.records, &bus->line);
+	}
+
+	sensors_add_array_el(&file, &compiler.files, &compiler.files_count,
+			     &compiler.files_max, sizeof(file));
+	sensors_config_chips_subst = sensors_config_chips_count;
+}
+
+void sensors_compile_abort(void)
+{
+	if (parse_error_wfn) {
+		sensors_parse_error_wfn = parse_error_wfn;
+		parse_error_wfn = NULL;
+	}
+	free(compiler.files);
+	free(compiler.records.data);
+	free(compiler.errors.data);
+	free(compiler.strings.data);
+	free(compiler.refs);
+	memset(&compiler, 0, sizeof(compiler));
+}
+
+static uint32_t checksum(const char *data, size_t len)
+{
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/* The identity of a file, or of its absence. The change time is recorded
+   too, as the modification time can be set back. */
+static void put_identity(sensors_cache_buf *buf, const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st)) {
+		put_int(buf, 0);
+		return;
+	}
+	put_int(buf, 1);
+	put_u64(buf, st.st_dev);
+	put_u64(buf, st.st_ino);
+	put_u64(buf, st.st_size);
+	put_u64(buf, st.st_mtim.tv_sec);
+	put_u64(buf, st.st_mtim.tv_nsec);
+	put_u64(buf, st.st_ctim.tv_sec);
+	put_u64(buf, st.st_ctim.tv_nsec);
+}
+
+/* The default files and directory come first, whether they exist or not,
+   then the files which were parsed */
+static const char *default_sources[] = {
+	DEFAULT_CONFIG_FILE, ALT_CONFIG_FILE, DEFAULT_CONFIG_DIR
+};
+
+#define DEFAULT_SOURCES_COUNT \
+	(int)(sizeof(default_sources) / sizeof(default_sources[0]))
+
+static void put_sources(sensors_cache_buf *buf)
+{
+	int i;
+
+	for (i = 0; i < DEFAULT_SOURCES_COUNT; i++) {
+		put_str(buf, default_sources[i]);
+		put_identity(buf, default_sources[i]);
+	}
+	for (i = 0; i < sensors_config_files_count; i++) {
+		put_str(buf, sensors_config_files[i]);
+		put_identity(buf, sensors_config_files[i]);
+	}
+}
+
+static void put_data(sensors_cache_buf *buf)
+{
+	sensors_cache_buf files = { NULL, 0, 0 };
+	const struct compiled_file *file;
+	size_t record_end;
+	int i, j, chip = 0;
+
+	/* The string table is only complete once everything else is put */
+	put_int(&files, compiler.files_count);
+	for (i = 0; i < compiler.files_count; i++) {
+		file = &compiler.files[i];
+		record_end = i + 1 < compiler.files_count ?
+			     compiler.files[i + 1].record_start :
+			     compiler.records.len;
+		put_int(&files, file->name);
+		put(&files, compiler.records.data + file->record_start,
+		    record_end - file->record_start);
+		put_int(&files, file->chips_count);
+		for (j = 0; j < file->chips_count; j++)
+			put_chip(&files, &sensors_config_chips[chip++]);
+	}
+
+	put_str(buf, libsensors_version);
+	put_int(buf, compiler.strings.len);
+	put(buf, compiler.strings.data, compiler.strings.len);
+	put(buf, files.data, files.len);
+	free(files.data);
+}
+
+int sensors_compile_end(const char *filename, int with_sources)
+{
+	sensors_cache_buf sources = { NULL, 0, 0 }, data = { NULL, 0, 0 };
+	struct compiled_header header;
+	char *tmp_name;
+	int fd, res = 0;
+
+	if (with_sources)
+		put_sources(&sources);
+	put_str(&sources, NULL);
+	put_data(&data);
+	sensors_compile_abort();
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, COMPILED_MAGIC, sizeof(header.magic));
+	header.version = COMPILED_VERSION;
+	header.sources_len = sources.len;
+	header.data_len = data.len;
+	header.data_sum = checksum(data.data, data.len);
+
+	/* Write to a temporary file first, so that concurrent readers never
+	   see a partial compiled configuration */
+	if (asprintf(&tmp_name, "%s.XXXXXX", filename) < 0) {
+		res = -SENSORS_ERR_ACCESS_W;
+		goto exit_free;
+	}
+	fd = mkstemp(tmp_name);
+	if (fd < 0) {
+		res = -SENSORS_ERR_ACCESS_W;
+	} else {
+		if (fchmod(fd, 0644) ||
+		    write(fd, &header, sizeof(header)) != sizeof(header) ||
+		    write(fd, sources.data, sources.len) !=
+		    (ssize_t)sources.len ||
+		    write(fd, data.data, data.len) != (ssize_t)data.len)
+			res = -SENSORS_ERR_IO;
+		if (close(fd) && !res)
+			res = -SENSORS_ERR_IO;
+		if (!res && rename(tmp_name, filename))
+			res = -SENSORS_ERR_ACCESS_W;
+		if (res)
+			unlink(tmp_name);
+	}
+	free(tmp_name);
+
+exit_free:
+	free(sources.data);
+	free(data.data);
+	return res;
+}
+
+static void get(struct compiled_reader *r, void *data, size_t len)
+{
+	if (r->err || (size_t)(r->end - r->p) < len) {
+		r->err = 1;
+		memset(data, 0, len);
+		return;
+	}
+	memcpy(data, r->p, len);
+	r->p += len;
+}
+
+static int get_int(struct compiled_reader *r)
+{
+	int val;
+
+	get(r, &val, sizeof(val));
+	return val;
+}
+
+/* Get the length of a string, and skip it */
+static const char *get_str(struct compiled_reader *r, int *len)
+{
+	const char *str;
+
+	*len = get_int(r);
+	if (*len < 0 || r->err)
+		return NULL;
+	if (r->end - r->p < *len) {
+		r->err = 1;
+		return NULL;
+	}
+	str = r->p;
+	r->p += *len;
+	return str;
+}
+
+static char *get_ref(struct compiled_reader *r)
+{
+	int offset;
+
+	offset = get_int(r);
+	if (offset == -1 || r->err)
+		return NULL;
+	if (offset < 0 || offset >= r->strings_len) {
+		r->err = 1;
+		return NULL;
+	}
+	return r->strings + offset;
+}
+
+/* Get a number of elements, each taking at least size bytes */
+static int get_count(struct compiled_reader *r, size_t size)
+{
+	int count;
+
+	count = get_int(r);
+	if (r->err || count < 0 || (size_t)count > (r->end - r->p) / size) {
+		r->err = 1;
+		return 0;
+	}
+	return count;
+}
+
+/* Get the elements of an array, allocated as the parser would */
+static void *get_array(struct compiled_reader *r, int *count, int *max,
+		       size_t el_size, size_t size)
+{
+	void *array;
+
+	*count = *max = get_count(r, size);
+	if (!*count)
+		return NULL;
+	array = malloc(*count * el_size);
+	if (!array)
+		sensors_fatal_error(__func__, "Out of memory");
+	return array;
+}
+
+static void get_line(struct compiled_reader *r, sensors_config_line *line)
+{
+	line->filename = get_ref(r);
+	line->lineno = get_int(r);
+}
+
+static sensors_expr *get_expr(struct compiled_reader *r, int depth)
+{
+	sensors_expr *expr;
+	int kind, op;
+
+	kind = get_int(r);
+	if (kind == -1 || r->err)
+		return NULL;
+	if (depth > MAX_EXPR_DEPTH) {
+		r->err = 1;
+		return NULL;
+	}
+
+	expr = sensors_arena_alloc(&sensors_config_arena, sizeof(*expr));
+	expr->kind = kind;
+	switch (kind) {
+	case sensors_kind_val:
+		get(r, &expr->data.val, sizeof(expr->data.val));
+		break;
+	case sensors_kind_var:
+		if (!(expr->data.var = get_ref(r)))
+			r->err = 1;
+		break;
+	case sensors_kind_source:
+		break;
+	case sensors_kind_sub:
+		op = get_int(r);
+		expr->data.subexpr.op = op;
+		expr->data.subexpr.sub1 = get_expr(r, depth + 1);
+		expr->data.subexpr.sub2 = get_expr(r, depth + 1);
+		if (op < sensors_add || op > sensors_log ||
+		    !expr->data.subexpr.sub1 ||
+		    (op < sensors_negate) != !!expr->data.subexpr.sub2)
+			r->err = 1;
+		break;
+	default:
+		r->err = 1;
+	}
+	return expr;
+}
+
+static void get_chip(struct compiled_reader *r, sensors_chip *chip)
+{
+	sensors_chip_name *name;
+	int i;
+
+	memset(chip, 0, sizeof(*chip));
+	get_line(r, &chip->line);
+
+	chip->chips.fits = get_array(r, &chip->chips.fits_count,
+				     &chip->chips.fits_max,
+				     sizeof(*chip->chips.fits),
+				     4 * sizeof(int));
+	for (i = 0; i < chip->chips.fits_count; i++) {
+		name = &chip->chips.fits[i];
+		name->prefix = get_ref(r);
+		name->bus.type = get_int(r);
+		name->bus.nr = get_int(r);
+		name->addr = get_int(r);
+		name->path = NULL;
+	}
+
+	chip->labels = get_array(r, &chip->labels_count, &chip->labels_max,
+				 sizeof(*chip->labels), 4 * sizeof(int));
+	for (i = 0; i < chip->labels_count; i++) {
+		chip->labels[i].name = get_ref(r);
+		chip->labels[i].value = get_ref(r);
+		get_line(r, &chip->labels[i].line);
+		if (!chip->labels[i].name || !chip->labels[i].value)
+			r->err = 1;
+	}
+
+	chip->sets = get_array(r, &chip->sets_count, &chip->sets_max,
+			       sizeof(*chip->sets), 4 * sizeof(int));
+	for (i = 0; i < chip->sets_count; i++) {
+		chip->sets[i].name = get_ref(r);
+		chip->sets[i].value = get_expr(r, 0);
+		get_line(r, &chip->sets[i].line);
+		if (!chip->sets[i].name || !chip->sets[i].value)
+			r->err = 1;
+	}
+
+	chip->computes = get_array(r, &chip->computes_count,
+				   &chip->computes_max,
+				   sizeof(*chip->computes), 5 * sizeof(int));
+	for (i = 0; i < chip->computes_count; i++) {
+		chip->computes[i].name = get_ref(r);
+		chip->computes[i].from_proc = get_expr(r, 0);
+		chip->computes[i].to_proc = get_expr(r, 0);
+		get_line(r, &chip->computes[i].line);
+		if (!chip->computes[i].name || !chip->computes[i].from_proc ||
+		    !chip->computes[i].to_proc)
+			r->err = 1;
+	}
+
+	chip->ignores = get_array(r, &chip->ignores_count, &chip->ignores_max,
+				  sizeof(*chip->ignores), 3 * sizeof(int));
+	for (i = 0; i < chip->ignores_count; i++) {
+		chip->ignores[i].name = get_ref(r);
+		get_line(r, &chip->ignores[i].line);
+		if (!chip->ignores[i].name)
+			r->err = 1;
+	}
+}
+
+/* Check that the configuration files are the same as when compiled */
+static int match_sources(struct compiled_reader *r)
+{
+	sensors_cache_buf now = { NULL, 0, 0 };
+	char path[PATH_MAX];
+	const char *str;
+	int i, len, res = 0;
+
+	for (i = 0; !res; i++) {
+		str = get_str(r, &len);
+		if (!str)
+			break;
+		if (len >= PATH_MAX) {
+			res = -1;
+			break;
+		}
+		memcpy(path, str, len);
+		path[len] = '\0';
+		if (i < DEFAULT_SOURCES_COUNT && strcmp(path, default_sources[i]))
+			res = -1;
+
+		now.len = 0;
+		put_identity(&now, path);
+		if ((size_t)(r->end - r->p) < now.len ||
+		    memcmp(r->p, now.data, now.len))
+			res = -1;
+		else
+			r->p += now.len;
+	}
+	free(now.data);
+
+	return res || r->err || i <= DEFAULT_SOURCES_COUNT ? -1 : 0;
+}
+
+static int get_data(struct compiled_reader *r, int *err)
+{
+	sensors_chip chip;
+	sensors_bus bus;
+	const char *version, *error;
+	char *name, *strings, *filename;
+	int i, j, len, count, error_len, lineno;
+
+	version = get_str(r, &len);
+	if (!version || len != (int)strlen(libsensors_version) ||
+	    memcmp(version, libsensors_version, len))
+		return -1;
+
+	r->strings_len = get_count(r, 1);
+	if (r->err || (r->strings_len && r->p[r->strings_len - 1] != '\0'))
+		return -1;
+	strings = sensors_arena_alloc(&sensors_config_arena,
+				      r->strings_len ? r->strings_len : 1);
+	memcpy(strings, r->p, r->strings_len);
+	r->strings = strings;
+	r->p += r->strings_len;
+
+	/* The busses are substituted after each file, as when parsing */
+	*err = 0;
+	count = get_count(r, 4 * sizeof(int));
+	for (i = 0; i < count && !r->err && !*err; i++) {
+		if ((name = get_ref(r)))
+			sensors_add_config_files(&name);
+
+		len = get_count(r, 3 * sizeof(int));
+		for (j = 0; j < len && !r->err; j++) {
+			error = get_str(r, &error_len);
+			filename = get_ref(r);
+			lineno = get_int(r);
+			if (!error) {
+				r->err = 1;
+				break;
+			}
+			sensors_parse_error_wfn(sensors_arena_strndup(
+					&sensors_config_arena, error,
+					error_len), filename, lineno);
+		}
+
+		len = get_count(r, 5 * sizeof(int));
+		for (j = 0; j < len && !r->err; j++) {
+			bus.adapter = get_ref(r);
+			bus.bus.type = get_int(r);
+			bus.bus.nr = get_int(r);
+			get_line(r, &bus.line);
+			if (!bus.adapter)
+				r->err = 1;
+			sensors_add_array_el(&bus, &sensors_config_busses,
+					     &sensors_config_busses_count,
+					     &sensors_config_busses_max,
+					     sizeof(bus));
+		}
+
+		len = get_count(r, 7 * sizeof(int));
+		for (j = 0; j < len && !r->err; j++) {
+			get_chip(r, &chip);
+			sensors_add_array_el(&chip, &sensors_config_chips,
+					     &sensors_config_chips_count,
+					     &sensors_config_chips_max,
+					     sizeof(chip));
+		}
+
+		if (!r->err)
+			*err = sensors_substitute_busses();
+		free(sensors_config_busses);
+		sensors_config_busses = NULL;
+		sensors_config_busses_count = sensors_config_busses_max = 0;
+	}
+
+	return r->err || (!*err && r->p != r->end) ? -1 : 0;
+}
+
+int sensors_is_compiled_config(FILE *input)
+{
+	char magic[sizeof(COMPILED_MAGIC)];
+	struct stat st;
+
+	/* Only regular files can be mapped */
+	if (ftello(input) != 0 || fstat(fileno(input), &st) ||
+	    !S_ISREG(st.st_mode))
+		return 0;
+	return pread(fileno(input), magic, sizeof(magic), 0) ==
+	       sizeof(magic) && !memcmp(magic, COMPILED_MAGIC, sizeof(magic));
+}
+
+int sensors_load_compiled_config(int fd, int check_sources, int *err)
+{
+	const struct compiled_header *header;
+	struct compiled_reader r;
+	struct stat st;
+	void *map;
+	int res = -1;
+
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*header))
+		return -1;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+
+	header = map;
+	if (memcmp(header->magic, COMPILED_MAGIC, sizeof(header->magic)) ||
+	    header->version != COMPILED_VERSION ||
+	    (uint64_t)sizeof(*header) + header->sources_len +
+	    header->data_len != (uint64_t)st.st_size)
+		goto exit_unmap;
+
+	memset(&r, 0, sizeof(r));
+	r.p = (const char *)(header + 1);
+	r.end = r.p + header->sources_len;
+	if (check_sources && match_sources(&r))
+		goto exit_unmap;
+
+	r.p = r.end;
+	r.end = r.p + header->data_len;
+	if (checksum(r.p, header->data_len) != header->data_sum)
+		goto exit_unmap;
+	res = get_data(&r, err);
+
+exit_unmap:
+	munmap(map, st.st_size);
+	return res;
+}
@@ -0,0 +1,54 @@
+/*
+    compiled.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_COMPILED_H
+#define LIB_SENSORS_COMPILED_H
+
+#include <stdio.h>
+
+/* Start compiling a configuration. The files are then parsed as usual,
+   except that their busses are not substituted, and the parse errors are
+   recorded. */
+void sensors_compile_begin(void);
+
+/* Record the configuration file just parsed, that is, the configuration
+   busses and the configuration chips not recorded yet. name is the name
+   of the file, NULL if unknown. */
+void sensors_compile_file(const char *name);
+
+/* Write the recorded configuration to a file, along with the identity of
+   the files it was parsed from if with_sources is set, and forget it.
+   Returns 0 on success, <0 on error. */
+int sensors_compile_end(const char *filename, int with_sources);
+
+/* Forget the recorded configuration */
+void sensors_compile_abort(void);
+
+/* Whether input starts with a compiled configuration */
+int sensors_is_compiled_config(FILE *input);
+
+/* Load a compiled configuration, if check_sources is not set or if it was
+   compiled from the configuration files as they are now. The busses of
+   each file are substituted as they would be after parsing it, *err is
+   set to the result. Returns 0 on success, !0 if the compiled
+   configuration couldn't be used, in which case part of it may have been
+   loaded already. */
+int sensors_load_compiled_config(int fd, int check_sources, int *err);
+
+#endif /* def LIB_SENSORS_COMPILED_H */
@@ -30,7 +30,6 @@
 #include "error.h"
 #include "conf.h"
 #include "access.h"
-#include "init.h"
 
 static void sensors_yyerror(const char *err);
 static sensors_expr *malloc_expr(void);
@@ -142,8 +141,6 @@ label_statement:	  LABEL function_name string
 			  { sensors_label new_el;
 			    if (!current_chip) {
 			      sensors_yyerror("Label statement before first chip statement");
-			      free($2);
-			      free($3);
 			      YYERROR;
 			    }
 			    new_el.line = $1;
@@ -157,8 +154,6 @@ set_statement:	  SET function_name expression
 		  { sensors_set new_el;
 		    if (!current_chip) {
 		      sensors_yyerror("Set statement before first chip statement");
-		      free($2);
-		      sensors_free_expr($3);
 		      YYERROR;
 		    }
 		    new_el.line = $1;
@@ -172,9 +167,6 @@ compute_statement:	  COMPUTE function_name expression ',' expression
 			  { sensors_compute new_el;
 			    if (!current_chip) {
 			      sensors_yyerror("Compute statement before first chip statement");
-			      free($2);
-			      sensors_free_expr($3);
-			      sensors_free_expr($5);
 			      YYERROR;
 			    }
 			    new_el.line = $1;
@@ -189,7 +181,6 @@ ignore_statement:	IGNORE function_name
 			{ sensors_ignore new_el;
 			  if (!current_chip) {
 			    sensors_yyerror("Ignore statement before first chip statement");
-			    free($2);
 			    YYERROR;
 			  }
 			  new_el.line = $1;
@@ -297,7 +288,6 @@ expression:	  FLOAT
 
 bus_id:		  NAME
 		  { int res = sensors_parse_bus_id($1,&$$);
-		    free($1);
 		    if (res) {
                       sensors_yyerror("Parse error in bus id");
 		      YYERROR;
@@ -319,11 +309,17 @@ string:	  NAME
 
 chip_name:	  NAME
 		  { int res = sensors_parse_chip_name($1,&$$); 
-		    free($1);
 		    if (res) {
 		      sensors_yyerror("Parse error in chip name");
 		      YYERROR;
 		    }
+		    /* Move the prefix to the configuration arena */
+		    if ($$.prefix) {
+		      char *prefix = $$.prefix;
+		      $$.prefix = sensors_arena_strdup(&sensors_config_arena,
+						       prefix);
+		      free(prefix);
+		    }
 		  }
 ;
 
@@ -340,8 +336,10 @@ void sensors_yyerror(const char *err)
 
 sensors_expr *malloc_expr(void)
 {
-  sensors_expr *res = malloc(sizeof(sensors_expr));
-  if (! res)
-    sensors_fatal_error(__func__, "Allocating a new expression");
-  return res;
+  return sensors_arena_alloc(&sensors_config_arena, sizeof(sensors_expr));
+}
+
+void sensors_yyreset(void)
+{
+  current_chip = NULL;
 }
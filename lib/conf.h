@@ -30,5 +30,8 @@ extern FILE *sensors_yyin;
 
 /* This is defined in conf-parse.y */
 int sensors_yyparse(void);
+/* Forget the chip block being parsed, which belongs to the previous
+   configuration */
+void sensors_yyreset(void);
 
 #endif /* def LIB_SENSORS_CONF_H */
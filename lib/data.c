@@ -33,26 +33,8 @@
 
 const char *libsensors_version = LM_VERSION;
 
-char **sensors_config_files = NULL;
-int sensors_config_files_count = 0;
-int sensors_config_files_max = 0;
-
-sensors_chip *sensors_config_chips = NULL;
-int sensors_config_chips_count = 0;
-int sensors_config_chips_subst = 0;
-int sensors_config_chips_max = 0;
-
-sensors_bus *sensors_config_busses = NULL;
-int sensors_config_busses_count = 0;
-int sensors_config_busses_max = 0;
-
-sensors_chip_features *sensors_proc_chips = NULL;
-int sensors_proc_chips_count = 0;
-int sensors_proc_chips_max = 0;
-
-sensors_bus *sensors_proc_bus = NULL;
-int sensors_proc_bus_count = 0;
-int sensors_proc_bus_max = 0;
+sensors_context sensors_default_context;
+__thread sensors_context *sensors_thread_context;
 
 void sensors_free_chip_name(sensors_chip_name *chip)
 {
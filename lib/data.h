@@ -130,48 +130,157 @@ typedef struct sensors_bus {
 	sensors_config_line line;
 } sensors_bus;
 
+struct sensors_backend;
+
 /* Internal data about all features and subfeatures of a chip */
 typedef struct sensors_chip_features {
 	struct sensors_chip_name chip;
+	/* The backend the chip was found through, which serves its reads
+	   and writes even if another one is selected later */
+	const struct sensors_backend *backend;
+	/* Path of the hwmon class device the chip was found through, NULL
+	   if none. The attributes may be those of its parent device. */
+	char *class_path;
 	struct sensors_feature *feature;
 	struct sensors_subfeature *subfeature;
 	int feature_count;
 	int subfeature_count;
+	int *subfeature_fd;	/* Open attribute files, -1 if closed, part
+				   of the table once it is built */
+	/* Matching configuration chips, latest first */
+	sensors_chip **config;
+	int config_count;
+	/* Compute statement of each feature, NULL if none, and its
+	   compiled form */
+	const sensors_compute **compute;
+	struct sensors_program **from_proc;
+	struct sensors_program **to_proc;
+	char **label;		/* Label of each feature */
+	/* Access statistics of each subfeature, NULL unless the chip was
+	   detected with SENSORS_FLAG_STATS */
+	struct sensors_stats_slot *stats;
+	/* Read deadline state, NULL unless sensors_set_read_deadline() gave
+	   the chip a deadline */
+	struct sensors_deadline *deadline;
+	/* The name, features and subfeatures of a chip added by
+	   sensors_add_chip(), freed with the chip. Empty for the chips
+	   found by sensors_init(), which live in the proc_arena. */
+	sensors_arena arena;
 } sensors_chip_features;
 
-extern char **sensors_config_files;
-extern int sensors_config_files_count;
-extern int sensors_config_files_max;
+/* All the state of the library. The default context is used by the
+   threads which didn't select another one with sensors_use_context(). */
+struct sensors_context {
+	char **config_files;
+	int config_files_count;
+	int config_files_max;
+
+	sensors_chip *config_chips;
+	int config_chips_count;
+	int config_chips_subst;
+	int config_chips_max;
+
+	sensors_bus *config_busses;
+	int config_busses_count;
+	int config_busses_max;
+
+	/* The configuration data, that is, the configuration file names,
+	   the names and expressions of the configuration chips, and the
+	   configuration busses, is allocated from this arena */
+	sensors_arena config_arena;
+
+	sensors_chip_features *proc_chips;
+	int proc_chips_count;
+	int proc_chips_max;
+
+	/* The names, features and subfeatures of the detected chips, and
+	   the names of the detected busses, are allocated from this arena */
+	sensors_arena proc_arena;
+
+	/* Library behavior flags, as set by sensors_set_flags() */
+	unsigned int flags;
+
+	sensors_bus *proc_bus;
+	int proc_bus_count;
+	int proc_bus_max;
+
+	/* Cache file set by sensors_set_cache_file(), NULL if none */
+	char *cache_file;
+
+	/* Read deadlines set by sensors_set_read_deadline(), the latest
+	   matching one applies */
+	struct sensors_deadline_rule *deadline_rules;
+	int deadline_rules_count;
+	int deadline_rules_max;
+
+	/* Hash tables of the detected chips and busses, see access.c */
+	int *chip_index;
+	unsigned int chip_index_mask;
+	int *bus_index;
+	unsigned int bus_index_mask;
+
+	/* Frozen view of the detected chips, see table.c */
+	struct sensors_table_data *table;
+};
+
+extern sensors_context sensors_default_context;
+extern __thread sensors_context *sensors_thread_context;
+
+/* The context of the calling thread */
+#define sensors_ctx	(sensors_thread_context ? sensors_thread_context : \
+			 &sensors_default_context)
+
+#define sensors_config_files		(sensors_ctx->config_files)
+#define sensors_config_files_count	(sensors_ctx->config_files_count)
+#define sensors_config_files_max	(sensors_ctx->config_files_max)
 
 #define sensors_add_config_files(el) sensors_add_array_el( \
 	(el), &sensors_config_files, &sensors_config_files_count, \
 	&sensors_config_files_max, sizeof(char *))
 
-extern sensors_chip *sensors_config_chips;
-extern int sensors_config_chips_count;
-extern int sensors_config_chips_subst;
-extern int sensors_config_chips_max;
+#define sensors_config_chips		(sensors_ctx->config_chips)
+#define sensors_config_chips_count	(sensors_ctx->config_chips_count)
+#define sensors_config_chips_subst	(sensors_ctx->config_chips_subst)
+#define sensors_config_chips_max	(sensors_ctx->config_chips_max)
+
+#define sensors_config_busses		(sensors_ctx->config_busses)
+#define sensors_config_busses_count	(sensors_ctx->config_busses_count)
+#define sensors_config_busses_max	(sensors_ctx->config_busses_max)
 
-extern sensors_bus *sensors_config_busses;
-extern int sensors_config_busses_count;
-extern int sensors_config_busses_max;
+#define sensors_config_arena		(sensors_ctx->config_arena)
 
-extern sensors_chip_features *sensors_proc_chips;
-extern int sensors_proc_chips_count;
-extern int sensors_proc_chips_max;
+#define sensors_proc_chips		(sensors_ctx->proc_chips)
+#define sensors_proc_chips_count	(sensors_ctx->proc_chips_count)
+#define sensors_proc_chips_max		(sensors_ctx->proc_chips_max)
 
 #define sensors_add_proc_chips(el) sensors_add_array_el( \
 	(el), &sensors_proc_chips, &sensors_proc_chips_count,\
 	&sensors_proc_chips_max, sizeof(struct sensors_chip_features))
 
-extern sensors_bus *sensors_proc_bus;
-extern int sensors_proc_bus_count;
-extern int sensors_proc_bus_max;
+#define sensors_proc_arena		(sensors_ctx->proc_arena)
+
+#define sensors_flags			(sensors_ctx->flags)
+
+#define sensors_proc_bus		(sensors_ctx->proc_bus)
+#define sensors_proc_bus_count		(sensors_ctx->proc_bus_count)
+#define sensors_proc_bus_max		(sensors_ctx->proc_bus_max)
 
 #define sensors_add_proc_bus(el) sensors_add_array_el( \
 	(el), &sensors_proc_bus, &sensors_proc_bus_count,\
 	&sensors_proc_bus_max, sizeof(struct sensors_bus))
 
+#define sensors_cache_file		(sensors_ctx->cache_file)
+
+#define sensors_deadline_rules		(sensors_ctx->deadline_rules)
+#define sensors_deadline_rules_count	(sensors_ctx->deadline_rules_count)
+#define sensors_deadline_rules_max	(sensors_ctx->deadline_rules_max)
+
+#define sensors_add_deadline_rules(el) sensors_add_array_el( \
+	(el), &sensors_deadline_rules, &sensors_deadline_rules_count,\
+	&sensors_deadline_rules_max, sizeof(struct sensors_deadline_rule))
+
+#define sensors_proc_table		(sensors_ctx->table)
+
 /* Substitute configuration bus numbers with real-world bus numbers
    in the chips lists */
 int sensors_substitute_busses(void);
@@ -0,0 +1,268 @@
+/*
+    deadline.c - Part of libsensors, a Linux library for reading sensor data.
+
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/* The attribute files of a chip with a read deadline are read by a helper
+   thread of the chip, while the caller waits for the value until the
+   deadline. A read which takes longer is left to the helper, and the
+   caller gets -SENSORS_ERR_IO; until the helper is done, the other reads
+   of the chip fail at once. After a few reads in a row miss the deadline,
+   the chip is quarantined: its reads fail at once, until a retry is let
+   through after a delay which doubles each time the chip misses the
+   deadline again. The helper only works on its own copy of the path of
+   the attribute file, so that the chip can be freed while the helper is
+   stuck. The result of a read goes to the request of the caller, and is
+   dropped if the caller gave up, so that a caller never gets the result
+   of the read of another thread. */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "sysfs.h"
+#include "deadline.h"
+
+/* Missed deadlines in a row before a chip is quarantined */
+#define DEADLINE_STRIKES	3
+/* First and longest quarantine, in seconds */
+#define QUARANTINE_MIN		1.0
+#define QUARANTINE_MAX		300.0
+
+/* A read waiting for its result */
+struct deadline_request {
+	double value;
+	int err;
+	int done;
+};
+
+struct sensors_deadline {
+	pthread_mutex_t lock;
+	pthread_cond_t work;	/* Signaled when there is a read to do */
+	pthread_cond_t done;	/* Signaled when a read is done */
+	int started;		/* The helper thread runs */
+	int quit;		/* The helper thread must free the state */
+	int pending;		/* A read is waiting for the helper */
+	int busy;		/* The helper is reading, or about to */
+	int stuck;		/* The read in progress missed its deadline */
+	struct deadline_request *req;	/* Of the read in progress, NULL if
+					   its caller gave up */
+	char path[NAME_MAX];
+
+	double deadline;
+	int strikes;		/* Missed deadlines in a row */
+	double quarantine;	/* Current quarantine, 0 if none */
+	struct timespec retry;	/* End of the quarantine */
+};
+
+static void add_time(struct timespec *ts, double seconds)
+{
+	long long ns = ts->tv_nsec + (long long)(seconds * 1e9);
+
+	ts->tv_sec += ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+}
+
+static int time_before(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec ||
+	       (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void free_deadline(struct sensors_deadline *d)
+{
+	pthread_cond_destroy(&d->done);
+	pthread_cond_destroy(&d->work);
+	pthread_mutex_destroy(&d->lock);
+	free(d);
+}
+
+static void *deadline_thread(void *data)
+{
+	struct sensors_deadline *d = data;
+	struct deadline_request *req;
+	char path[NAME_MAX];
+	double value;
+	int err;
+
+	pthread_mutex_lock(&d->lock);
+	for (;;) {
+		while (!d->pending && !d->quit)
+			pthread_cond_wait(&d->work, &d->lock);
+		if (d->quit)
+			break;
+		d->pending = 0;
+		req = d->req;
+		strcpy(path, d->path);
+		pthread_mutex_unlock(&d->lock);
+
+		value = 0.0;
+		err = sensors_read_sysfs_path(path, &value);
+
+		pthread_mutex_lock(&d->lock);
+		if (req && d->req == req) {
+			req->value = value;
+			req->err = err;
+			req->done = 1;
+			d->req = NULL;
+		}
+		d->busy = d->stuck = 0;
+		pthread_cond_broadcast(&d->done);
+	}
+	pthread_mutex_unlock(&d->lock);
+
+	free_deadline(d);
+	return NULL;
+}
+
+static int start_thread(struct sensors_deadline *d)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	int err;
+
+	if (pthread_attr_init(&attr))
+		return -1;
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	err = pthread_create(&thread, &attr, deadline_thread, d);
+	pthread_attr_destroy(&attr);
+	if (err)
+		return -1;
+	d->started = 1;
+	return 0;
+}
+
+void sensors_set_chip_deadline(sensors_chip_features *features,
+			       double deadline)
+{
+	struct sensors_deadline *d = features->deadline;
+	pthread_condattr_t attr;
+
+	if (!(deadline > 0)) {
+		sensors_free_chip_deadline(features);
+		return;
+	}
+	if (d) {
+		pthread_mutex_lock(&d->lock);
+		d->deadline = deadline;
+		pthread_mutex_unlock(&d->lock);
+		return;
+	}
+
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		sensors_fatal_error(__func__, "Out of memory");
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_cond_init(&d->work, NULL);
+	/* The deadlines are measured on the monotonic clock */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&d->done, &attr);
+	pthread_condattr_destroy(&attr);
+	d->deadline = deadline;
+	features->deadline = d;
+}
+
+void sensors_free_chip_deadline(sensors_chip_features *features)
+{
+	struct sensors_deadline *d = features->deadline;
+
+	if (!d)
+		return;
+	features->deadline = NULL;
+
+	pthread_mutex_lock(&d->lock);
+	if (!d->started) {
+		pthread_mutex_unlock(&d->lock);
+		free_deadline(d);
+		return;
+	}
+	d->quit = 1;
+	pthread_cond_signal(&d->work);
+	pthread_mutex_unlock(&d->lock);
+}
+
+int sensors_read_deadline(const sensors_chip_features *chip,
+			  const sensors_subfeature *subfeature,
+			  double *value)
+{
+	struct sensors_deadline *d = chip->deadline;
+	struct deadline_request req;
+	struct timespec now, end;
+	int err = -SENSORS_ERR_IO;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	end = now;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->stuck || (d->quarantine && time_before(&now, &d->retry)))
+		goto out;
+	if (!d->started && start_thread(d))
+		goto out;
+
+	/* Another thread may be reading from the chip, its read and ours
+	   have to fit in the deadline */
+	add_time(&end, d->deadline);
+	while (d->busy)
+		if (pthread_cond_timedwait(&d->done, &d->lock, &end) ==
+		    ETIMEDOUT)
+			goto out;
+
+	snprintf(d->path, NAME_MAX, "%s/%s", chip->chip.path,
+		 subfeature->name);
+	req.done = 0;
+	d->req = &req;
+	d->pending = d->busy = 1;
+	pthread_cond_signal(&d->work);
+
+	while (!req.done)
+		if (pthread_cond_timedwait(&d->done, &d->lock, &end) ==
+		    ETIMEDOUT)
+			break;
+
+	if (req.done) {
+		*value = req.value;
+		err = req.err;
+		d->strikes = 0;
+		d->quarantine = 0;
+		goto out;
+	}
+
+	/* Missed the deadline, the helper will finish on its own and drop
+	   the result */
+	d->req = NULL;
+	d->stuck = 1;
+	if (++d->strikes >= DEADLINE_STRIKES) {
+		d->quarantine = d->quarantine ? d->quarantine * 2 :
+				QUARANTINE_MIN;
+		if (d->quarantine > QUARANTINE_MAX)
+			d->quarantine = QUARANTINE_MAX;
+		clock_gettime(CLOCK_MONOTONIC, &d->retry);
+		add_time(&d->retry, d->quarantine);
+	}
+
+out:
+	pthread_mutex_unlock(&d->lock);
+	return err;
+}
@@ -0,0 +1,47 @@
+/*
+    deadline.h - Part of libsensors, a Linux library for reading sensor data.
+
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_DEADLINE_H
+#define LIB_SENSORS_DEADLINE_H
+
+#include "data.h"
+
+/* A read deadline set by sensors_set_read_deadline() */
+struct sensors_deadline_rule {
+	sensors_chip_name match;
+	double deadline;
+};
+
+/* Set the read deadline of a chip, in seconds, 0 for none */
+void sensors_set_chip_deadline(sensors_chip_features *features,
+			       double deadline);
+
+/* Free the read deadline state of a chip. A read still in progress is
+   left to complete on its own. */
+void sensors_free_chip_deadline(sensors_chip_features *features);
+
+/* Read a sysfs attribute of a chip which has a read deadline. Returns
+   -SENSORS_ERR_IO if the read takes longer than the deadline, or if the
+   chip is quarantined. */
+int sensors_read_deadline(const sensors_chip_features *chip,
+			  const sensors_subfeature *subfeature,
+			  double *value);
+
+#endif /* def LIB_SENSORS_DEADLINE_H */
@@ -0,0 +1,387 @@
+/*
+    expr.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <math.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "access.h"
+#include "general.h"
+#include "sysfs.h"
+#include "expr.h"
+
+/* We watch the recursion depth for variables only, as an easy way to
+   detect cycles. As variables are inlined at compile time, this also
+   bounds the size of the programs. */
+#define DEPTH_MAX	8
+
+static void emit(sensors_program *prog, sensors_opcode op, int *sp)
+{
+	sensors_instr instr;
+
+	instr.op = op;
+	instr.arg.val = 0;
+	sensors_add_array_el(&instr, &prog->code, &prog->code_count,
+			     &prog->code_max, sizeof(sensors_instr));
+
+	switch (op) {
+	case SENSORS_OP_VAL:
+	case SENSORS_OP_SOURCE:
+	case SENSORS_OP_READ:
+	case SENSORS_OP_ERROR:
+		(*sp)++;
+		break;
+	case SENSORS_OP_ENTER:
+	case SENSORS_OP_ADD:
+	case SENSORS_OP_SUB:
+	case SENSORS_OP_MULTIPLY:
+	case SENSORS_OP_DIVIDE:
+		(*sp)--;
+		break;
+	default:
+		break;
+	}
+	if (*sp > prog->stack_size)
+		prog->stack_size = *sp;
+}
+
+static void emit_val(sensors_program *prog, double val, int *sp)
+{
+	emit(prog, SENSORS_OP_VAL, sp);
+	prog->code[prog->code_count - 1].arg.val = val;
+}
+
+static void emit_error(sensors_program *prog, int err, int *sp)
+{
+	emit(prog, SENSORS_OP_ERROR, sp);
+	prog->code[prog->code_count - 1].arg.err = err;
+}
+
+/* Compute the result of an operation on constant operands at compile time.
+   Returns 0 if the operation can't be folded, because it would fail at
+   run time. */
+static int fold(sensors_operation op, double val1, double val2,
+		double *result)
+{
+	switch (op) {
+	case sensors_add:
+		*result = val1 + val2;
+		return 1;
+	case sensors_sub:
+		*result = val1 - val2;
+		return 1;
+	case sensors_multiply:
+		*result = val1 * val2;
+		return 1;
+	case sensors_divide:
+		if (val2 == 0.0)
+			return 0;
+		*result = val1 / val2;
+		return 1;
+	case sensors_negate:
+		*result = -val1;
+		return 1;
+	case sensors_exp:
+		*result = exp(val1);
+		return 1;
+	case sensors_log:
+		if (val1 < 0.0)
+			return 0;
+		*result = log(val1);
+		return 1;
+	}
+	return 0;
+}
+
+static void compile_var(const sensors_chip_features *chip,
+			sensors_program *prog, const char *name, int depth,
+			int *sp);
+
+static void compile(const sensors_chip_features *chip, sensors_program *prog,
+		    const sensors_expr *expr, int depth, int *sp)
+{
+	static const sensors_opcode opcodes[] = {
+		[sensors_add] = SENSORS_OP_ADD,
+		[sensors_sub] = SENSORS_OP_SUB,
+		[sensors_multiply] = SENSORS_OP_MULTIPLY,
+		[sensors_divide] = SENSORS_OP_DIVIDE,
+		[sensors_negate] = SENSORS_OP_NEGATE,
+		[sensors_exp] = SENSORS_OP_EXP,
+		[sensors_log] = SENSORS_OP_LOG,
+	};
+	const sensors_subexpr *sub;
+	double res;
+	int start;
+
+	switch (expr->kind) {
+	case sensors_kind_val:
+		emit_val(prog, expr->data.val, sp);
+		return;
+	case sensors_kind_source:
+		emit(prog, SENSORS_OP_SOURCE, sp);
+		return;
+	case sensors_kind_var:
+		compile_var(chip, prog, expr->data.var, depth, sp);
+		return;
+	case sensors_kind_sub:
+		break;
+	}
+
+	sub = &expr->data.subexpr;
+	start = prog->code_count;
+	compile(chip, prog, sub->sub1, depth, sp);
+	if (sub->sub2)
+		compile(chip, prog, sub->sub2, depth, sp);
+
+	/* Constant operands compile to a single instruction each */
+	if (prog->code_count == start + (sub->sub2 ? 2 : 1) &&
+	    prog->code[start].op == SENSORS_OP_VAL &&
+	    (!sub->sub2 || prog->code[start + 1].op == SENSORS_OP_VAL) &&
+	    fold(sub->op, prog->code[start].arg.val,
+		 sub->sub2 ? prog->code[start + 1].arg.val : 0, &res)) {
+		prog->code_count = start;
+		*sp -= sub->sub2 ? 2 : 1;
+		emit_val(prog, res, sp);
+		return;
+	}
+
+	emit(prog, opcodes[sub->op], sp);
+}
+
+/* A variable reads the value of another subfeature of the same chip, with
+   its own compute statement applied, if any. That compute statement is
+   inlined, with the raw value of the subfeature as its source value. */
+static void compile_var(const sensors_chip_features *chip,
+			sensors_program *prog, const char *name, int depth,
+			int *sp)
+{
+	const sensors_subfeature *subfeature;
+	const sensors_compute *compute = NULL;
+
+	if (!(subfeature = sensors_lookup_subfeature_name(chip, name))) {
+		emit_error(prog, -SENSORS_ERR_NO_ENTRY, sp);
+		return;
+	}
+	if (depth + 1 >= DEPTH_MAX) {
+		emit_error(prog, -SENSORS_ERR_RECURSION, sp);
+		return;
+	}
+	if (!(subfeature->flags & SENSORS_MODE_R)) {
+		emit_error(prog, -SENSORS_ERR_ACCESS_R, sp);
+		return;
+	}
+
+	emit(prog, SENSORS_OP_READ, sp);
+	prog->code[prog->code_count - 1].arg.nr = subfeature->number;
+
+	if ((subfeature->flags & SENSORS_COMPUTE_MAPPING) && chip->compute)
+		compute = chip->compute[subfeature->mapping];
+	if (!compute)
+		return;
+
+	emit(prog, SENSORS_OP_ENTER, sp);
+	compile(chip, prog, compute->from_proc, depth + 1, sp);
+	emit(prog, SENSORS_OP_LEAVE, sp);
+}
+
+/* Check whether a program has the form ((@ / div) * mul) + add, any step
+   being optional. Only the operations which the linear form performs the
+   same way are accepted: division by a non-zero constant, and commuted
+   multiplication and addition. Subtracting a constant is adding its
+   opposite. The identity values (1 and -0) keep the result unchanged, down
+   to the sign of zero. */
+static void match_linear(sensors_program *prog)
+{
+	const sensors_instr *instr, *end;
+	double div = 1.0, mul = 1.0, add = -0.0, k;
+	int source[2], sp = 0, stage = 0, seen = 0;
+	double val[2];
+
+	end = prog->code + prog->code_count;
+	for (instr = prog->code; instr < end; instr++) {
+		switch (instr->op) {
+		case SENSORS_OP_VAL:
+		case SENSORS_OP_SOURCE:
+			if (sp == 2)
+				return;
+			if (instr->op == SENSORS_OP_SOURCE) {
+				if (seen++)
+					return;
+				source[sp] = 1;
+			} else {
+				source[sp] = 0;
+				val[sp] = instr->arg.val;
+			}
+			sp++;
+			break;
+		case SENSORS_OP_ADD:
+		case SENSORS_OP_SUB:
+		case SENSORS_OP_MULTIPLY:
+		case SENSORS_OP_DIVIDE:
+			if (sp != 2 || source[0] == source[1])
+				return;
+			k = source[0] ? val[1] : val[0];
+			switch (instr->op) {
+			case SENSORS_OP_DIVIDE:
+				if (!source[0] || k == 0.0 || stage > 0)
+					return;
+				div = k;
+				stage = 1;
+				break;
+			case SENSORS_OP_MULTIPLY:
+				if (stage > 1)
+					return;
+				mul = k;
+				stage = 2;
+				break;
+			case SENSORS_OP_SUB:
+				if (!source[0])
+					return;
+				k = -k;
+				/* fall through */
+			default:
+				if (stage > 2)
+					return;
+				add = k;
+				stage = 3;
+				break;
+			}
+			sp = 1;
+			source[0] = 1;
+			break;
+		default:
+			return;
+		}
+	}
+	if (sp != 1 || !source[0])
+		return;
+
+	prog->linear = 1;
+	prog->div = div;
+	prog->mul = mul;
+	prog->add = add;
+}
+
+sensors_program *sensors_compile_expr(const sensors_chip_features *chip,
+				      const sensors_expr *expr)
+{
+	sensors_program *prog;
+	int sp = 0;
+
+	prog = calloc(1, sizeof(sensors_program));
+	if (!prog)
+		sensors_fatal_error(__func__, "Out of memory");
+	compile(chip, prog, expr, 0, &sp);
+	match_linear(prog);
+	return prog;
+}
+
+void sensors_free_program(sensors_program *prog)
+{
+	if (!prog)
+		return;
+	free(prog->code);
+	free(prog);
+}
+
+int sensors_run_program(const sensors_chip_features *chip,
+			const sensors_program *prog, double val,
+			double *result)
+{
+	double stack_buf[16], *stack = stack_buf;
+	double source[DEPTH_MAX];
+	const sensors_instr *instr, *end;
+	int sp = 0, depth = 0, res = 0;
+
+	if (prog->stack_size > ARRAY_SIZE(stack_buf)) {
+		stack = malloc(prog->stack_size * sizeof(double));
+		if (!stack)
+			sensors_fatal_error(__func__, "Out of memory");
+	}
+
+	end = prog->code + prog->code_count;
+	for (instr = prog->code; instr < end; instr++) {
+		switch (instr->op) {
+		case SENSORS_OP_VAL:
+			stack[sp++] = instr->arg.val;
+			break;
+		case SENSORS_OP_SOURCE:
+			stack[sp++] = val;
+			break;
+		case SENSORS_OP_READ:
+			res = sensors_read_sysfs_attr(chip,
+					&chip->subfeature[instr->arg.nr],
+					&stack[sp]);
+			if (res)
+				goto exit;
+			sp++;
+			break;
+		case SENSORS_OP_ENTER:
+			source[depth++] = val;
+			val = stack[--sp];
+			break;
+		case SENSORS_OP_LEAVE:
+			val = source[--depth];
+			break;
+		case SENSORS_OP_ADD:
+			sp--;
+			stack[sp - 1] += stack[sp];
+			break;
+		case SENSORS_OP_SUB:
+			sp--;
+			stack[sp - 1] -= stack[sp];
+			break;
+		case SENSORS_OP_MULTIPLY:
+			sp--;
+			stack[sp - 1] *= stack[sp];
+			break;
+		case SENSORS_OP_DIVIDE:
+			sp--;
+			if (stack[sp] == 0.0) {
+				res = -SENSORS_ERR_DIV_ZERO;
+				goto exit;
+			}
+			stack[sp - 1] /= stack[sp];
+			break;
+		case SENSORS_OP_NEGATE:
+			stack[sp - 1] = -stack[sp - 1];
+			break;
+		case SENSORS_OP_EXP:
+			stack[sp - 1] = exp(stack[sp - 1]);
+			break;
+		case SENSORS_OP_LOG:
+			if (stack[sp - 1] < 0.0) {
+				res = -SENSORS_ERR_DIV_ZERO;
+				goto exit;
+			}
+			stack[sp - 1] = log(stack[sp - 1]);
+			break;
+		case SENSORS_OP_ERROR:
+			res = instr->arg.err;
+			goto exit;
+		}
+	}
+	*result = stack[0];
+
+exit:
+	if (stack != stack_buf)
+		free(stack);
+	return res;
+}
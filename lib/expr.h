@@ -0,0 +1,88 @@
+/*
+    expr.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_EXPR_H
+#define LIB_SENSORS_EXPR_H
+
+#include "data.h"
+
+/* Expressions are compiled, for a given detected chip, to a flat program
+   for a small stack machine. Operands are pushed on the stack, operators
+   pop their operands and push their result. */
+typedef enum sensors_opcode {
+	SENSORS_OP_VAL,		/* Push a constant value */
+	SENSORS_OP_SOURCE,	/* Push the current source value (@) */
+	SENSORS_OP_READ,	/* Push the raw value of a subfeature */
+	SENSORS_OP_ENTER,	/* Pop the new source value, save the old one */
+	SENSORS_OP_LEAVE,	/* Restore the previous source value */
+	SENSORS_OP_ADD,
+	SENSORS_OP_SUB,
+	SENSORS_OP_MULTIPLY,
+	SENSORS_OP_DIVIDE,
+	SENSORS_OP_NEGATE,
+	SENSORS_OP_EXP,
+	SENSORS_OP_LOG,
+	SENSORS_OP_ERROR,	/* Fail with a given error code */
+} sensors_opcode;
+
+typedef struct sensors_instr {
+	sensors_opcode op;
+	union {
+		double val;	/* SENSORS_OP_VAL */
+		int nr;		/* SENSORS_OP_READ: subfeature number */
+		int err;	/* SENSORS_OP_ERROR: error code (<0) */
+	} arg;
+} sensors_instr;
+
+typedef struct sensors_program {
+	sensors_instr *code;
+	int code_count;
+	int code_max;
+	int stack_size;		/* Maximum stack depth at run time */
+	/* Most compute statements are linear, e.g. "@*2" or "@/1.5 + 10". They
+	   are also recorded as @ / div * mul + add, with the same rounding as
+	   the program itself, so that they can be applied to many values in a
+	   single loop. */
+	int linear;
+	double div, mul, add;
+} sensors_program;
+
+/* Compile an expression for a given detected chip. Variables are resolved
+   to subfeatures of this chip, and their own compute statements are
+   inlined, so the compute statements of the chip must have been bound
+   already. Constant subexpressions are folded. */
+sensors_program *sensors_compile_expr(const sensors_chip_features *chip,
+				      const sensors_expr *expr);
+
+void sensors_free_program(sensors_program *prog);
+
+/* Run a program, with val as the source value (@). Returns 0 on success,
+   <0 on failure. */
+int sensors_run_program(const sensors_chip_features *chip,
+			const sensors_program *prog, double val,
+			double *result);
+
+/* Apply a linear program, the result is that of sensors_run_program */
+static inline double sensors_run_linear(const sensors_program *prog,
+					double val)
+{
+	return val / prog->div * prog->mul + prog->add;
+}
+
+#endif /* def LIB_SENSORS_EXPR_H */
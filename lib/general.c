@@ -28,6 +28,16 @@
 
 #define A_BUNCH 16
 
+/* Arena blocks are this big, unless a larger object has to fit in */
+#define ARENA_BLOCK_SIZE	16384
+#define ARENA_ALIGN(size)	(((size) + 15) & ~(size_t)15)
+
+struct sensors_arena_block {
+	struct sensors_arena_block *next;
+	size_t used;
+	size_t size;
+};
+
 void sensors_malloc_array(void *list, int *num_el, int *max_el, int el_size)
 {
 	void **my_list = (void **)list;
@@ -55,7 +65,9 @@ void sensors_add_array_el(const void *el, void *list, int *num_el,
 	int new_max_el;
 	void **my_list = (void *)list;
 	if (*num_el + 1 > *max_el) {
-		new_max_el = *max_el + A_BUNCH;
+		/* Grow geometrically, so that long lists don't cost
+		   a quadratic number of copies */
+		new_max_el = *max_el ? *max_el * 2 : A_BUNCH;
 		*my_list = realloc(*my_list, new_max_el * el_size);
 		if (! *my_list)
 			sensors_fatal_error(__func__,
@@ -72,8 +84,11 @@ void sensors_add_array_els(const void *els, int nr_els, void *list,
 	int new_max_el;
 	void **my_list = (void *)list;
 	if (*num_el + nr_els > *max_el) {
-		new_max_el = (*max_el + nr_els + A_BUNCH);
-		new_max_el -= new_max_el % A_BUNCH;
+		new_max_el = *max_el ? *max_el * 2 : A_BUNCH;
+		if (new_max_el < *num_el + nr_els) {
+			new_max_el = *num_el + nr_els + A_BUNCH;
+			new_max_el -= new_max_el % A_BUNCH;
+		}
 		*my_list = realloc(*my_list, new_max_el * el_size);
 		if (! *my_list)
 			sensors_fatal_error(__func__,
@@ -83,3 +98,83 @@ void sensors_add_array_els(const void *els, int nr_els, void *list,
 	memcpy(((char *)*my_list) + *num_el * el_size, els, el_size * nr_els);
 	*num_el += nr_els;
 }
+
+void *sensors_arena_alloc(sensors_arena *arena, size_t size)
+{
+	struct sensors_arena_block *block = arena->block;
+	size_t header = ARENA_ALIGN(sizeof(struct sensors_arena_block));
+	char *p;
+
+	size = ARENA_ALIGN(size);
+	if (!block || block->size - block->used < size) {
+		size_t block_size = ARENA_BLOCK_SIZE;
+
+		if (header + size > block_size)
+			block_size = header + size;
+		/* calloc, so that we never have to clear anything */
+		block = calloc(1, block_size);
+		if (!block)
+			sensors_fatal_error(__func__, "Out of memory");
+		block->used = header;
+		block->size = block_size;
+
+		/* Keep allocating from the current block if it still has
+		   more room than the new one will have */
+		if (arena->block && block_size - header - size <
+		    arena->block->size - arena->block->used) {
+			block->next = arena->block->next;
+			arena->block->next = block;
+		} else {
+			block->next = arena->block;
+			arena->block = block;
+		}
+	}
+
+	p = (char *)block + block->used;
+	block->used += size;
+	return p;
+}
+
+char *sensors_arena_strndup(sensors_arena *arena, const char *str,
+			    size_t len)
+{
+	char *p;
+
+	p = sensors_arena_alloc(arena, len + 1);
+	memcpy(p, str, len);
+	return p;
+}
+
+char *sensors_arena_strdup(sensors_arena *arena, const char *str)
+{
+	return sensors_arena_strndup(arena, str, strlen(str));
+}
+
+void sensors_arena_merge(sensors_arena *dst, sensors_arena *src)
+{
+	struct sensors_arena_block *last;
+
+	if (!src->block)
+		return;
+	if (!dst->block) {
+		dst->block = src->block;
+	} else {
+		/* Keep the current block of dst first */
+		for (last = src->block; last->next; last = last->next)
+			;
+		last->next = dst->block->next;
+		dst->block->next = src->block;
+	}
+	src->block = NULL;
+}
+
+void sensors_arena_free(sensors_arena *arena)
+{
+	struct sensors_arena_block *block, *next;
+
+	for (block = arena->block; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+	arena->block = NULL;
+}
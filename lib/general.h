@@ -21,6 +21,8 @@
 #ifndef LIB_SENSORS_GENERAL_H
 #define LIB_SENSORS_GENERAL_H
 
+#include <stddef.h>
+
 /* These are general purpose functions. They allow you to use variable-
    length arrays, which are extended automatically. A distinction is
    made between the current number of elements and the maximum number.
@@ -34,6 +36,23 @@ void sensors_add_array_el(const void *el, void *list, int *num_el,
 void sensors_add_array_els(const void *els, int nr_els, void *list,
 			   int *num_el, int *max_el, int el_size);
 
+/* An arena allocates objects from large blocks, and frees them all at
+   once. Individual objects can't be freed or resized. Memory returned by
+   sensors_arena_alloc() is zeroed. */
+struct sensors_arena_block;
+
+typedef struct sensors_arena {
+	struct sensors_arena_block *block;	/* Current block, or NULL */
+} sensors_arena;
+
+void *sensors_arena_alloc(sensors_arena *arena, size_t size);
+char *sensors_arena_strdup(sensors_arena *arena, const char *str);
+char *sensors_arena_strndup(sensors_arena *arena, const char *str,
+			    size_t len);
+/* Move all objects of arena src to arena dst */
+void sensors_arena_merge(sensors_arena *dst, sensors_arena *src);
+void sensors_arena_free(sensors_arena *arena);
+
 #define ARRAY_SIZE(arr)	(int)(sizeof(arr) / sizeof((arr)[0]))
 
 #endif /* def LIB_SENSORS_GENERAL_H */
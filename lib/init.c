@@ -28,10 +28,13 @@
 #include <locale.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 #include <string.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "sensors.h"
 #include "data.h"
 #include "error.h"
@@ -40,10 +43,10 @@
 #include "sysfs.h"
 #include "scanner.h"
 #include "init.h"
-
-#define DEFAULT_CONFIG_FILE	ETCDIR "/sensors3.conf"
-#define ALT_CONFIG_FILE		ETCDIR "/sensors.conf"
-#define DEFAULT_CONFIG_DIR	ETCDIR "/sensors.d"
+#include "cache.h"
+#include "table.h"
+#include "compiled.h"
+#include "deadline.h"
 
 /* Wrapper around sensors_yyparse(), which clears the locale so that
    the decimal numbers are always parsed properly. */
@@ -73,17 +76,13 @@ static int sensors_parse(void)
 	return res;
 }
 
-static void free_bus(sensors_bus *bus)
-{
-	free(bus->adapter);
-}
+/* Set while sensors_compile_config() parses the configuration files */
+static int compiling;
+
+static void free_config(void);
 
 static void free_config_busses(void)
 {
-	int i;
-
-	for (i = 0; i < sensors_config_busses_count; i++)
-		free_bus(&sensors_config_busses[i]);
 	free(sensors_config_busses);
 	sensors_config_busses = NULL;
 	sensors_config_busses_count = sensors_config_busses_max = 0;
@@ -96,9 +95,7 @@ static int parse_config(FILE *input, const char *name)
 
 	if (name) {
 		/* Record configuration file name for error reporting */
-		name_copy = strdup(name);
-		if (!name_copy)
-			sensors_fatal_error(__func__, "Out of memory");
+		name_copy = sensors_arena_strdup(&sensors_config_arena, name);
 		sensors_add_config_files(&name_copy);
 	} else
 		name_copy = NULL;
@@ -114,7 +111,13 @@ static int parse_config(FILE *input, const char *name)
 		goto exit_cleanup;
 	}
 
-	err = sensors_substitute_busses();
+	/* The busses are substituted when a compiled configuration is
+	   loaded */
+	if (compiling) {
+		sensors_compile_file(name_copy);
+		err = 0;
+	} else
+		err = sensors_substitute_busses();
 
 exit_cleanup:
 	free_config_busses();
@@ -176,151 +179,228 @@ static int add_config_from_dir(const char *dir)
 	return res;
 }
 
-/* Ideally, initialization and configuraton file loading should be exposed
-   separately, to make it possible to load several configuration files. */
-int sensors_init(FILE *input)
+/* Discover the busses and chips, from the cache file if possible */
+static int read_system(void)
 {
-	int res;
+	sensors_cache_buf id = { NULL, 0, 0 };
+	int res, cacheable = 0;
+
+	/* Only the chips of sysfs are worth caching */
+	if (sensors_cache_file &&
+	    sensors_backend_ops == &sensors_sysfs_backend) {
+		cacheable = !sensors_cache_identity(&id);
+		if (cacheable && !sensors_load_cache(sensors_cache_file, &id)) {
+			free(id.data);
+			return 0;
+		}
+	}
 
-	if (!sensors_init_sysfs())
-		return -SENSORS_ERR_KERNEL;
 	if ((res = sensors_read_sysfs_bus()) ||
 	    (res = sensors_read_sysfs_chips()))
-		goto exit_cleanup;
+		goto exit_free;
+	if (cacheable)
+		sensors_save_cache(sensors_cache_file, &id);
+
+exit_free:
+	free(id.data);
+	return res;
+}
+
+/* Parse the given configuration file, or the default ones */
+static int read_config_files(FILE *input)
+{
+	const char *name;
+	int fd, res;
 
 	if (input) {
-		res = parse_config(input, NULL);
-		if (res)
-			goto exit_cleanup;
-	} else {
-		const char* name;
-
-		/* No configuration provided, use default */
-		input = fopen(name = DEFAULT_CONFIG_FILE, "r");
-		if (!input && errno == ENOENT)
-			input = fopen(name = ALT_CONFIG_FILE, "r");
-		if (input) {
-			res = parse_config(input, name);
-			fclose(input);
-			if (res)
-				goto exit_cleanup;
+		if (compiling || !sensors_is_compiled_config(input))
+			return parse_config(input, NULL);
+		if (sensors_load_compiled_config(fileno(input), 0, &res)) {
+			sensors_parse_error_wfn("Invalid compiled configuration",
+						NULL, 0);
+			return -SENSORS_ERR_PARSE;
+		}
+		return res;
+	}
 
-		} else if (errno != ENOENT) {
-			sensors_parse_error_wfn(strerror(errno), name, 0);
-			res = -SENSORS_ERR_PARSE;
-			goto exit_cleanup;
+	/* No configuration provided, use the compiled default if it is up
+	   to date */
+	if (!compiling &&
+	    (fd = open(DEFAULT_COMPILED_FILE, O_RDONLY | O_CLOEXEC)) >= 0) {
+		if (!sensors_load_compiled_config(fd, 1, &res)) {
+			close(fd);
+			return res;
 		}
+		close(fd);
+		free_config();
+	}
 
-		/* Also check for files in default directory */
-		res = add_config_from_dir(DEFAULT_CONFIG_DIR);
+	/* Otherwise parse the default files */
+	input = fopen(name = DEFAULT_CONFIG_FILE, "r");
+	if (!input && errno == ENOENT)
+		input = fopen(name = ALT_CONFIG_FILE, "r");
+	if (input) {
+		res = parse_config(input, name);
+		fclose(input);
 		if (res)
-			goto exit_cleanup;
-	}
+			return res;
 
-	return 0;
+	} else if (errno != ENOENT) {
+		sensors_parse_error_wfn(strerror(errno), name, 0);
+		return -SENSORS_ERR_PARSE;
+	}
 
-exit_cleanup:
-	sensors_cleanup();
-	return res;
+	/* Also check for files in default directory */
+	return add_config_from_dir(DEFAULT_CONFIG_DIR);
 }
 
-static void free_chip_name(sensors_chip_name *name)
+static int read_config(FILE *input)
 {
-	free(name->prefix);
-	free(name->path);
+	int res;
+
+	sensors_yyreset();
+	res = read_config_files(input);
+	sensors_scanner_forget_names();
+	return res;
 }
 
-static void free_chip_features(sensors_chip_features *features)
+/* The scanner and parser, and the backend and sysfs mount point, are shared
+   by all contexts, so only one of them can be loaded at a time */
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int sensors_init(FILE *input)
 {
-	int i;
+	int res;
 
-	for (i = 0; i < features->subfeature_count; i++)
-		free(features->subfeature[i].name);
-	free(features->subfeature);
-	for (i = 0; i < features->feature_count; i++)
-		free(features->feature[i].name);
-	free(features->feature);
+	pthread_mutex_lock(&load_lock);
+	if (!sensors_init_sysfs()) {
+		res = -SENSORS_ERR_KERNEL;
+		goto exit_unlock;
+	}
+	if ((res = read_system()) ||
+	    (res = read_config(input))) {
+		sensors_cleanup();
+		goto exit_unlock;
+	}
+
+	sensors_index_chips();
+
+exit_unlock:
+	pthread_mutex_unlock(&load_lock);
+	return res;
 }
 
-static void free_label(sensors_label *label)
+/* A chip belongs to a hwmon class device if it was found through it, even
+   if its attributes are those of the parent device */
+static int match_hwmon_device(const sensors_chip_features *features,
+			      const char *class_path)
 {
-	free(label->name);
-	free(label->value);
+	return features->class_path &&
+	       !strcmp(features->class_path, class_path);
 }
 
-void sensors_free_expr(sensors_expr *expr)
+int sensors_add_chip(const char *path)
 {
-	if (expr->kind == sensors_kind_var)
-		free(expr->data.var);
-	else if (expr->kind == sensors_kind_sub) {
-		if (expr->data.subexpr.sub1)
-			sensors_free_expr(expr->data.subexpr.sub1);
-		if (expr->data.subexpr.sub2)
-			sensors_free_expr(expr->data.subexpr.sub2);
+	sensors_chip_features entry;
+	sensors_arena arena = { NULL };
+	char class_path[PATH_MAX];
+	int i, res;
+
+	res = sensors_get_hwmon_path(path, class_path);
+	if (res)
+		return res;
+	for (i = 0; i < sensors_proc_chips_count; i++)
+		if (match_hwmon_device(&sensors_proc_chips[i], class_path))
+			return 0;
+
+	/* The chip gets an arena of its own, so that its memory can be
+	   freed when it is removed */
+	pthread_mutex_lock(&load_lock);
+	res = sensors_scan_hwmon_device(class_path, &entry, &arena);
+	pthread_mutex_unlock(&load_lock);
+	if (res <= 0) {
+		sensors_arena_free(&arena);
+		return res;
 	}
-	free(expr);
+	entry.arena = arena;
+
+	/* The other chips keep their bindings, only the index changes */
+	sensors_add_proc_chips(&entry);
+	sensors_bind_chip(&sensors_proc_chips[sensors_proc_chips_count - 1]);
+	sensors_hash_chips();
+	sensors_build_table();
+	return 1;
 }
 
-static void free_set(sensors_set *set)
+int sensors_remove_chip(const char *path)
 {
-	free(set->name);
-	sensors_free_expr(set->value);
-}
+	char class_path[PATH_MAX];
+	int i, res, removed = 0;
+
+	res = sensors_get_hwmon_path(path, class_path);
+	if (res)
+		return res;
+	for (i = 0; i < sensors_proc_chips_count;) {
+		if (!match_hwmon_device(&sensors_proc_chips[i], class_path)) {
+			i++;
+			continue;
+		}
+		sensors_free_chip_features(&sensors_proc_chips[i]);
+		memmove(&sensors_proc_chips[i], &sensors_proc_chips[i + 1],
+			(sensors_proc_chips_count - i - 1) *
+			sizeof(sensors_chip_features));
+		sensors_proc_chips_count--;
+		removed++;
+	}
 
-static void free_compute(sensors_compute *compute)
-{
-	free(compute->name);
-	sensors_free_expr(compute->from_proc);
-	sensors_free_expr(compute->to_proc);
+	if (removed) {
+		sensors_hash_chips();
+		sensors_build_table();
+	}
+	return removed;
 }
 
-static void free_ignore(sensors_ignore *ignore)
+/* The names, features and subfeatures live in sensors_proc_arena, or in
+   the arena of the chip if it was hotplugged, which is freed here along
+   with what is allocated later on */
+void sensors_free_chip_features(sensors_chip_features *features)
 {
-	free(ignore->name);
+	int i;
+
+	for (i = 0; i < features->subfeature_count; i++) {
+		if (features->subfeature_fd[i] >= 0)
+			close(features->subfeature_fd[i]);
+	}
+	if (!sensors_table_has_fds(features->subfeature_fd))
+		free(features->subfeature_fd);
+	free(features->config);
+	sensors_free_chip_programs(features);
+	sensors_free_chip_labels(features);
+	free(features->stats);
+	sensors_free_chip_deadline(features);
+	sensors_arena_free(&features->arena);
 }
 
+/* The names, labels, sets, computes and ignores themselves live in
+   sensors_config_arena, only the arrays have to be freed */
 static void free_chip(sensors_chip *chip)
 {
-	int i;
-
-	for (i = 0; i < chip->chips.fits_count; i++)
-		free_chip_name(&chip->chips.fits[i]);
 	free(chip->chips.fits);
 	chip->chips.fits_count = chip->chips.fits_max = 0;
-
-	for (i = 0; i < chip->labels_count; i++)
-		free_label(&chip->labels[i]);
 	free(chip->labels);
 	chip->labels_count = chip->labels_max = 0;
-
-	for (i = 0; i < chip->sets_count; i++)
-		free_set(&chip->sets[i]);
 	free(chip->sets);
 	chip->sets_count = chip->sets_max = 0;
-
-	for (i = 0; i < chip->computes_count; i++)
-		free_compute(&chip->computes[i]);
 	free(chip->computes);
 	chip->computes_count = chip->computes_max = 0;
-
-	for (i = 0; i < chip->ignores_count; i++)
-		free_ignore(&chip->ignores[i]);
 	free(chip->ignores);
 	chip->ignores_count = chip->ignores_max = 0;
 }
 
-void sensors_cleanup(void)
+static void free_config(void)
 {
 	int i;
 
-	for (i = 0; i < sensors_proc_chips_count; i++) {
-		free_chip_name(&sensors_proc_chips[i].chip);
-		free_chip_features(&sensors_proc_chips[i]);
-	}
-	free(sensors_proc_chips);
-	sensors_proc_chips = NULL;
-	sensors_proc_chips_count = sensors_proc_chips_max = 0;
-
 	for (i = 0; i < sensors_config_chips_count; i++)
 		free_chip(&sensors_config_chips[i]);
 	free(sensors_config_chips);
@@ -328,15 +408,163 @@ void sensors_cleanup(void)
 	sensors_config_chips_count = sensors_config_chips_max = 0;
 	sensors_config_chips_subst = 0;
 
-	for (i = 0; i < sensors_proc_bus_count; i++)
-		free_bus(&sensors_proc_bus[i]);
+	free(sensors_config_files);
+	sensors_config_files = NULL;
+	sensors_config_files_count = sensors_config_files_max = 0;
+
+	sensors_arena_free(&sensors_config_arena);
+}
+
+/* The whole configuration, so that it can be set aside while another one
+   is loaded */
+struct sensors_config {
+	char **files;
+	int files_count, files_max;
+	sensors_chip *chips;
+	int chips_count, chips_subst, chips_max;
+	sensors_arena arena;
+};
+
+static void take_config(struct sensors_config *config)
+{
+	config->files = sensors_config_files;
+	config->files_count = sensors_config_files_count;
+	config->files_max = sensors_config_files_max;
+	config->chips = sensors_config_chips;
+	config->chips_count = sensors_config_chips_count;
+	config->chips_subst = sensors_config_chips_subst;
+	config->chips_max = sensors_config_chips_max;
+	config->arena = sensors_config_arena;
+
+	sensors_config_files = NULL;
+	sensors_config_files_count = sensors_config_files_max = 0;
+	sensors_config_chips = NULL;
+	sensors_config_chips_count = sensors_config_chips_max = 0;
+	sensors_config_chips_subst = 0;
+	sensors_config_arena.block = NULL;
+}
+
+static void put_config(const struct sensors_config *config)
+{
+	sensors_config_files = config->files;
+	sensors_config_files_count = config->files_count;
+	sensors_config_files_max = config->files_max;
+	sensors_config_chips = config->chips;
+	sensors_config_chips_count = config->chips_count;
+	sensors_config_chips_subst = config->chips_subst;
+	sensors_config_chips_max = config->chips_max;
+	sensors_config_arena = config->arena;
+}
+
+int sensors_reload_config(FILE *input)
+{
+	struct sensors_config old, new;
+	int res;
+
+	take_config(&old);
+	pthread_mutex_lock(&load_lock);
+	res = read_config(input);
+	pthread_mutex_unlock(&load_lock);
+	if (res) {
+		free_config();
+		put_config(&old);
+		return res;
+	}
+
+	/* The detected chips must be bound to the new configuration before
+	   the old one goes away */
+	sensors_index_chips();
+	take_config(&new);
+	put_config(&old);
+	free_config();
+	put_config(&new);
+	return 0;
+}
+
+int sensors_compile_config(FILE *input, const char *filename)
+{
+	sensors_context *ctx, *old;
+	int res;
+
+	if (!filename)
+		filename = DEFAULT_COMPILED_FILE;
+
+	/* The configuration is parsed in a context of its own, with no
+	   detected busses to substitute */
+	ctx = sensors_context_new();
+	if (!ctx)
+		sensors_fatal_error(__func__, "Out of memory");
+	old = sensors_use_context(ctx);
+
+	pthread_mutex_lock(&load_lock);
+	compiling = 1;
+	sensors_compile_begin();
+	res = read_config(input);
+	if (!res)
+		res = sensors_compile_end(filename, !input);
+	else
+		sensors_compile_abort();
+	compiling = 0;
+	pthread_mutex_unlock(&load_lock);
+
+	sensors_use_context(old);
+	sensors_context_free(ctx);
+	return res;
+}
+
+sensors_context *sensors_context_new(void)
+{
+	return calloc(1, sizeof(sensors_context));
+}
+
+void sensors_context_free(sensors_context *ctx)
+{
+	sensors_context *old;
+
+	if (!ctx)
+		return;
+
+	old = sensors_use_context(ctx);
+	sensors_cleanup();
+	sensors_set_cache_file(NULL);
+	sensors_free_deadline_rules();
+	sensors_use_context(old == ctx ? NULL : old);
+	free(ctx);
+}
+
+sensors_context *sensors_use_context(sensors_context *ctx)
+{
+	sensors_context *old = sensors_thread_context;
+
+	sensors_thread_context = ctx;
+	return old;
+}
+
+unsigned int sensors_set_flags(unsigned int flags)
+{
+	unsigned int old_flags = sensors_flags;
+
+	sensors_flags = flags;
+	return old_flags;
+}
+
+void sensors_cleanup(void)
+{
+	int i;
+
+	for (i = 0; i < sensors_proc_chips_count; i++)
+		sensors_free_chip_features(&sensors_proc_chips[i]);
+	free(sensors_proc_chips);
+	sensors_proc_chips = NULL;
+	sensors_proc_chips_count = sensors_proc_chips_max = 0;
+	sensors_free_chip_index();
+	sensors_free_table();
+
+	free_config();
+
 	free(sensors_proc_bus);
 	sensors_proc_bus = NULL;
 	sensors_proc_bus_count = sensors_proc_bus_max = 0;
 
-	for (i = 0; i < sensors_config_files_count; i++)
-		free(sensors_config_files[i]);
-	free(sensors_config_files);
-	sensors_config_files = NULL;
-	sensors_config_files_count = sensors_config_files_max = 0;
+	sensors_arena_free(&sensors_proc_arena);
 }
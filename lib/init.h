@@ -23,6 +23,15 @@
 
 #include "data.h"
 
-void sensors_free_expr(sensors_expr *expr);
+#define DEFAULT_CONFIG_FILE	ETCDIR "/sensors3.conf"
+#define ALT_CONFIG_FILE		ETCDIR "/sensors.conf"
+#define DEFAULT_CONFIG_DIR	ETCDIR "/sensors.d"
+
+/* Used instead of the default configuration files when it was compiled
+   from them as they are */
+#define DEFAULT_COMPILED_FILE	ETCDIR "/sensors3.conf.bin"
+
+/* Free what was allocated for a detected chip after it was scanned */
+void sensors_free_chip_features(sensors_chip_features *features);
 
 #endif /* def LIB_SENSORS_INIT_H */
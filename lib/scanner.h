@@ -24,5 +24,9 @@
 int sensors_scanner_init(FILE *input, const char *filename);
 void sensors_scanner_exit(void);
 
+/* The names scanned are shared by all files of a configuration. Forget
+   them once it is loaded, as they belong to its arena. */
+void sensors_scanner_forget_names(void);
+
 #endif /* def LIB_SENSORS_SCANNER_H */
 
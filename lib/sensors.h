@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include <limits.h>
+#include <time.h>
 
 /* Publicly accessible library functions */
 
@@ -31,7 +32,7 @@
    when the API or ABI breaks), the third digit is incremented to track small
    API additions like new flags / enum values. The second digit is for tracking
    larger additions like new methods. */
-#define SENSORS_API_VERSION		0x500
+#define SENSORS_API_VERSION		0x510
 
 #define SENSORS_CHIP_NAME_PREFIX_ANY	NULL
 #define SENSORS_CHIP_NAME_ADDR_ANY	(-1)
@@ -68,6 +69,28 @@ typedef struct sensors_chip_name {
 	char *path;
 } sensors_chip_name;
 
+/* A library context holds the detected chips and the configuration. All
+   the other functions operate on the context of the calling thread, which
+   is the default one unless the thread selected another one with
+   sensors_use_context(). Within a context, the functions which only read
+   chips, features, labels and values can be called by several threads at
+   once, as long as no thread calls sensors_init(), sensors_cleanup(),
+   sensors_reload_config(), sensors_add_chip() or sensors_remove_chip()
+   in that context at the same time. */
+typedef struct sensors_context sensors_context;
+
+/* Allocate a new, empty context. Its chips and configuration are loaded
+   by calling sensors_init() after selecting it. Returns NULL on failure. */
+sensors_context *sensors_context_new(void);
+
+/* Clean up and free a context returned by sensors_context_new(). It must
+   not be in use by any thread. */
+void sensors_context_free(sensors_context *ctx);
+
+/* Select the context of the calling thread, NULL for the default one.
+   Returns the previously selected context, NULL for the default one. */
+sensors_context *sensors_use_context(sensors_context *ctx);
+
 /* Load the configuration file and the detected chips list. If this
    returns a value unequal to zero, you are in trouble; you can not
    assume anything will be initialized properly. If you want to
@@ -75,10 +98,103 @@ typedef struct sensors_chip_name {
    calling sensors_init() again. */
 int sensors_init(FILE *input);
 
+/* Load the configuration file again, without scanning the system for
+   chips. input is used the same way as by sensors_init(). The new
+   configuration only replaces the current one if it was loaded entirely;
+   otherwise the current one is kept and an error is returned. The labels
+   returned by sensors_get_label_ref() are invalidated, and the features
+   returned by sensors_get_features() may not be the same anymore. */
+int sensors_reload_config(FILE *input);
+
 /* Clean-up function: You can't access anything after
    this, until the next sensors_init() call! */
 void sensors_cleanup(void);
 
+/* These flags change the library behavior, see sensors_set_flags() */
+#define SENSORS_FLAG_KEEP_FDS		0x01
+#define SENSORS_FLAG_PARALLEL_SCAN	0x02
+#define SENSORS_FLAG_STATS		0x04
+
+/* Set the library behavior flags and return the previous ones. With
+   SENSORS_FLAG_KEEP_FDS, the attribute files read by sensors_get_value()
+   are kept open until sensors_cleanup(), which saves a lot of system calls
+   for applications polling the same values over and over again. With
+   SENSORS_FLAG_PARALLEL_SCAN, sensors_init() scans the hwmon devices using
+   several threads, which speeds up initialization on systems with many
+   devices. The resulting chip list is the same. With SENSORS_FLAG_STATS,
+   the accesses to the attribute files of the chips detected afterwards
+   are counted and timed, see sensors_get_stats(). */
+unsigned int sensors_set_flags(unsigned int flags);
+
+/* Set the file used by sensors_init() to cache the detected chips, or NULL
+   (the default) to always scan the system. The cache is only used while
+   the hwmon and i2c-adapter class devices remain the same, otherwise the
+   system is scanned again and the cache file is rewritten. */
+void sensors_set_cache_file(const char *filename);
+
+/* Give the chips matching match, or all chips if match is NULL, a read
+   deadline, in seconds, or no deadline if deadline is 0. Applies to the
+   chips already detected and to those detected later, the latest call
+   matching a chip taking precedence; a call with a NULL match overrides
+   all previous ones. The attribute files of a chip with a deadline are
+   read by a helper thread, and a read which takes longer than the
+   deadline fails with -SENSORS_ERR_IO. A chip which misses several
+   deadlines in a row is quarantined: its reads fail at once, and are
+   retried after a delay which doubles each time the chip misses the
+   deadline again. sensors_set_read_deadline() must not run concurrently
+   with reads. */
+void sensors_set_read_deadline(const sensors_chip_name *match,
+			       double deadline);
+
+/* Parse a configuration like sensors_init() would, from input or from the
+   default configuration files if input is NULL, and write it in compiled
+   form to filename, or to the default compiled configuration file if
+   filename is NULL. sensors_init() and sensors_reload_config() accept a
+   compiled configuration in place of a configuration file, and use the
+   default one instead of parsing the default configuration files as long
+   as these remain the same. Returns 0 on success, <0 on error. */
+int sensors_compile_config(FILE *input, const char *filename);
+
+/* Make sensors_init() find the chips in a directory laid out like sysfs,
+   e.g. a copy of the hwmon tree of another system, instead of in /sys.
+   NULL goes back to /sys. This applies to all contexts, and unloads any
+   capture. Returns 0 on success, <0 on error. */
+int sensors_set_sysfs_root(const char *path);
+
+/* Make sensors_init() serve the chips of a capture, read from input and
+   kept in memory, instead of those of sysfs. Values read are those of the
+   capture at the time set by sensors_set_capture_time(), 0 initially, and
+   values written are kept in memory. NULL unloads the capture. This
+   applies to all contexts, but only to the chips detected afterwards, the
+   chips already detected keep being read the way they were found.
+   Returns 0 on success, <0 on error. */
+int sensors_load_capture(FILE *input);
+
+/* Set the time, in seconds since the start of the recording, at which the
+   values of the loaded capture are read */
+void sensors_set_capture_time(double t);
+
+/* Write a capture of the detected chips to output, then record every
+   value read from then on, with the time it was read, until called again
+   with NULL. Returns 0 on success, <0 on error. */
+int sensors_record_capture(FILE *output);
+
+/* Add the chip behind a hwmon class device which appeared after
+   sensors_init(), without scanning the rest of the system. The device is
+   given by its sysfs path, e.g. "/sys/class/hwmon/hwmon3", or by the
+   DEVPATH of its uevent. Returns 1 if a chip was added, 0 if the device
+   has no sensors or its chip is already known, <0 on error. */
+int sensors_add_chip(const char *path);
+
+/* Remove the chip behind a hwmon class device which went away, given the
+   same way as to sensors_add_chip(). Returns the number of chips removed,
+   <0 on error. Both functions invalidate the chip names returned so far by
+   sensors_get_detected_chips(), the features and subfeatures of the other
+   chips remain valid. The memory of a chip added by sensors_add_chip() is
+   freed when it is removed, that of a chip found by sensors_init() only
+   by sensors_cleanup(). */
+int sensors_remove_chip(const char *path);
+
 /* Parse a chip name to the internal representation. Return 0 on success, <0
    on error. */
 int sensors_parse_chip_name(const char *orig_name, sensors_chip_name *res);
@@ -106,12 +222,29 @@ typedef struct sensors_feature sensors_feature;
 char *sensors_get_label(const sensors_chip_name *name,
 			const sensors_feature *feature);
 
+/* Same as sensors_get_label(), but the returned string belongs to the
+   library and must not be freed; it remains valid until sensors_cleanup()
+   is called. Labels are resolved once at initialization time, so this is
+   cheap enough to call each time a label is needed. */
+const char *sensors_get_label_ref(const sensors_chip_name *name,
+				  const sensors_feature *feature);
+
 /* Read the value of a subfeature of a certain chip. Note that chip should not
    contain wildcard values! This function will return 0 on success, and <0
    on failure.  */
 int sensors_get_value(const sensors_chip_name *name, int subfeat_nr,
 		      double *value);
 
+/* Read the values of count subfeatures of a certain chip at once, which is
+   cheaper than calling sensors_get_value() for each of them. subfeat_nrs
+   lists the subfeature numbers to read; if it is NULL, subfeatures 0 to
+   count - 1 are read. The values are stored in values, and if errors isn't
+   NULL, the status of each read (0 or <0) is stored in errors. Note that
+   chip should not contain wildcard values! This function will return 0 if
+   all values could be read, and <0 otherwise (the last error code). */
+int sensors_get_values(const sensors_chip_name *name, const int *subfeat_nrs,
+		       int count, double *values, int *errors);
+
 /* Set the value of a subfeature of a certain chip. Note that chip should not
    contain wildcard values! This function will return 0 on success, and <0
    on failure. */
@@ -119,9 +252,36 @@ int sensors_set_value(const sensors_chip_name *name, int subfeat_nr,
 		      double value);
 
 /* Execute all set statements for this particular chip. The chip may contain
-   wildcards!  This function will return 0 on success, and <0 on failure. */
+   wildcards!  This function will return 0 on success, and <0 on failure.
+   Each subfeature is written once, with the value of its last set
+   statement, and not at all if it already holds that value. */
 int sensors_do_chip_sets(const sensors_chip_name *name);
 
+/* Access statistics of a subfeature, see SENSORS_FLAG_STATS. errors[n]
+   counts the accesses which failed with error -n, errors[0] counts all
+   failed accesses. Latencies are in seconds; histogram[n] counts the
+   accesses which took less than 10^(n-5) seconds, except for the last
+   bucket which counts all slower accesses. */
+#define SENSORS_STATS_ERRORS		12
+#define SENSORS_STATS_BUCKETS		7
+
+typedef struct sensors_stats {
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long errors[SENSORS_STATS_ERRORS];
+	double last_latency;
+	double max_latency;
+	double total_latency;
+	unsigned long histogram[SENSORS_STATS_BUCKETS];
+} sensors_stats;
+
+/* Get the access statistics of a subfeature of a certain chip. The chip
+   should not contain wildcard values. Returns 0 on success, <0 on error;
+   -SENSORS_ERR_NO_ENTRY if the statistics of the chip are not kept, which
+   is the case of the chips detected without SENSORS_FLAG_STATS. */
+int sensors_get_stats(const sensors_chip_name *name, int subfeat_nr,
+		      sensors_stats *stats);
+
 /* This function returns all detected chips that match a given chip name,
    one by one. If no chip name is provided, all detected chips are returned.
    To start at the beginning of the list, use 0 for nr; NULL is returned if
@@ -309,6 +469,75 @@ sensors_get_subfeature(const sensors_chip_name *name,
 		       const sensors_feature *feature,
 		       sensors_subfeature_type type);
 
+/* Read-only view of the subfeatures of all detected chips, as contiguous
+   arrays indexed by a global subfeature number. The subfeatures of chip i
+   have global numbers chip_first[i] to chip_first[i + 1] - 1, in the order
+   of their own subfeature numbers. The view is built by sensors_init(),
+   and built again by sensors_add_chip(), sensors_remove_chip() and
+   sensors_reload_config(), which invalidates the previous one.
+   chip_count is the number of chips, chip_first has one more entry than
+   that; the other arrays have subfeature_count entries:
+   chip is the name of each chip
+   chip_nr is the chip of each subfeature
+   subfeature is the subfeature itself, also giving its name and number
+   type, flags and mapping are those of the subfeature
+   scaling is the factor between the raw values and the values in standard
+     units
+   program identifies the compute statement applying to the subfeature,
+     subfeatures sharing one have the same number; -1 if there is none */
+typedef struct sensors_table {
+	int chip_count;
+	int subfeature_count;
+	const sensors_chip_name * const *chip;
+	const int *chip_first;
+	const int *chip_nr;
+	const sensors_subfeature * const *subfeature;
+	const sensors_subfeature_type *type;
+	const unsigned int *flags;
+	const int *mapping;
+	const int *scaling;
+	const int *program;
+} sensors_table;
+
+/* Return the view of the subfeatures of the detected chips. It remains
+   valid until the detected chips or the configuration change. */
+const sensors_table *sensors_get_table(void);
+
+/* Same as sensors_get_values(), but for the subfeatures of global numbers
+   first to first + count - 1 of the view, possibly of several chips. */
+int sensors_get_table_values(int first, int count, double *values,
+			     int *errors);
+
+/* Shared memory snapshot of the values of all chips, as published by
+   sensord. Reading from a snapshot doesn't access the hardware, and
+   usually takes no system call at all. */
+typedef struct sensors_snapshot sensors_snapshot;
+
+/* Open the snapshot of the given name, e.g. "/sensord". Returns NULL on
+   error, with errno set. The library doesn't need to be initialized. */
+sensors_snapshot *sensors_open_snapshot(const char *name);
+
+/* Close a snapshot returned by sensors_open_snapshot(). */
+void sensors_close_snapshot(sensors_snapshot *snapshot);
+
+/* Same as sensors_get_values(), but from a snapshot. Subfeature numbers
+   are those used by the library on the same system. If the snapshot was
+   replaced, it is opened again; if that fails, or if the values of the
+   chip were left half-updated by a writer which died, or were replaced
+   while being read, -SENSORS_ERR_ACCESS_R is returned. Subfeatures which
+   were never published read as
+   -SENSORS_ERR_NO_ENTRY. A snapshot may only be used by one thread at a
+   time. */
+int sensors_get_snapshot_values(sensors_snapshot *snapshot,
+				const sensors_chip_name *name,
+				const int *subfeat_nrs, int count,
+				double *values, int *errors);
+
+/* Return the time of the last update of the values of a chip in a
+   snapshot, or 0 if they were never published or can't be read. */
+time_t sensors_get_snapshot_time(sensors_snapshot *snapshot,
+				 const sensors_chip_name *name);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
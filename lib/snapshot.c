@@ -0,0 +1,267 @@
+/*
+    snapshot.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/* Reading of the shared memory snapshots published by sensord. Reads are
+   served from the mapped segment, without any system call, unless the
+   segment was replaced, in which case it is mapped again. Each chip has
+   its own sequence counter, which the writer makes odd while it updates
+   the values of the chip; readers retry until they get a stable copy. A
+   writer which died in the middle of an update leaves the counter odd, so
+   readers give up after a while. */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sensors.h"
+#include "error.h"
+#include "access.h"
+#include "snapshot.h"
+
+struct sensors_snapshot {
+	char *name;
+	void *map;
+	size_t size;
+	const struct sensors_snapshot_header *header;
+	const struct sensors_snapshot_chip *chips;
+	const struct sensors_snapshot_value *values;
+	int hint;		/* Chip found by the last lookup */
+};
+
+/* Map the segment and check its layout once, so that reads can trust it */
+static int map_snapshot(sensors_snapshot *snapshot)
+{
+	const struct sensors_snapshot_header *header;
+	const struct sensors_snapshot_chip *chips;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd, i, err;
+
+	fd = shm_open(snapshot->name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(*header)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	size = st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+	if (map == MAP_FAILED) {
+		errno = err;
+		return -1;
+	}
+
+	header = map;
+	chips = (const struct sensors_snapshot_chip *)(header + 1);
+	if (__atomic_load_n(&header->version, __ATOMIC_ACQUIRE) !=
+	    SENSORS_SNAPSHOT_VERSION ||
+	    memcmp(header->magic, SENSORS_SNAPSHOT_MAGIC, 8) ||
+	    header->size != size ||
+	    header->chip_count > (size - sizeof(*header)) / sizeof(*chips) ||
+	    header->value_count >
+	    (size - sizeof(*header) - header->chip_count * sizeof(*chips)) /
+	    sizeof(struct sensors_snapshot_value))
+		goto invalid;
+	for (i = 0; i < (int)header->chip_count; i++)
+		if (chips[i].first_value > header->value_count ||
+		    chips[i].value_count >
+		    header->value_count - chips[i].first_value ||
+		    !memchr(chips[i].prefix, '\0', sizeof(chips[i].prefix)))
+			goto invalid;
+
+	if (snapshot->map)
+		munmap(snapshot->map, snapshot->size);
+	snapshot->map = map;
+	snapshot->size = size;
+	snapshot->header = header;
+	snapshot->chips = chips;
+	snapshot->values = (const struct sensors_snapshot_value *)
+			   (chips + header->chip_count);
+	snapshot->hint = 0;
+	return 0;
+
+invalid:
+	munmap(map, size);
+	errno = EINVAL;
+	return -1;
+}
+
+sensors_snapshot *sensors_open_snapshot(const char *name)
+{
+	sensors_snapshot *snapshot;
+	int err;
+
+	snapshot = calloc(1, sizeof(sensors_snapshot));
+	if (!snapshot)
+		return NULL;
+	snapshot->name = strdup(name);
+	if (!snapshot->name || map_snapshot(snapshot)) {
+		err = errno;
+		free(snapshot->name);
+		free(snapshot);
+		errno = err;
+		return NULL;
+	}
+	return snapshot;
+}
+
+void sensors_close_snapshot(sensors_snapshot *snapshot)
+{
+	if (!snapshot)
+		return;
+	munmap(snapshot->map, snapshot->size);
+	free(snapshot->name);
+	free(snapshot);
+}
+
+static int match_chip(const struct sensors_snapshot_chip *chip,
+		      const sensors_chip_name *name)
+{
+	return chip->bus_type == name->bus.type &&
+	       chip->bus_nr == name->bus.nr &&
+	       chip->addr == name->addr &&
+	       !strcmp(chip->prefix, name->prefix);
+}
+
+static const struct sensors_snapshot_chip *
+find_chip(sensors_snapshot *snapshot, const sensors_chip_name *name)
+{
+	int i, count = snapshot->header->chip_count;
+
+	/* Applications usually read a chip several times in a row */
+	if (snapshot->hint < count &&
+	    match_chip(&snapshot->chips[snapshot->hint], name))
+		return &snapshot->chips[snapshot->hint];
+
+	for (i = 0; i < count; i++) {
+		if (match_chip(&snapshot->chips[i], name)) {
+			snapshot->hint = i;
+			return &snapshot->chips[i];
+		}
+	}
+	return NULL;
+}
+
+/* Updates take microseconds, a chip still being updated after this many
+   tries was left half-updated */
+#define SNAPSHOT_RETRIES	1000
+
+/* Wait for the values of a chip to be stable, returns !0 if they never
+   become so or if the snapshot was replaced meanwhile */
+static int begin_read(const sensors_snapshot *snapshot,
+		      const struct sensors_snapshot_chip *chip,
+		      unsigned int *seq, int *tries)
+{
+	for (;;) {
+		if (__atomic_load_n(&snapshot->header->stale,
+				    __ATOMIC_ACQUIRE) ||
+		    ++*tries > SNAPSHOT_RETRIES)
+			return -1;
+		*seq = __atomic_load_n(&chip->seq, __ATOMIC_ACQUIRE);
+		if (!(*seq & 1))
+			return 0;
+		sched_yield();
+	}
+}
+
+int sensors_get_snapshot_values(sensors_snapshot *snapshot,
+				const sensors_chip_name *name,
+				const int *subfeat_nrs, int count,
+				double *values, int *errors)
+{
+	const struct sensors_snapshot_chip *chip = NULL;
+	const struct sensors_snapshot_value *value;
+	unsigned int seq;
+	int i, nr, res, err = 0, tries = 0;
+
+	if (sensors_chip_name_has_wildcards(name))
+		err = -SENSORS_ERR_WILDCARDS;
+	else if (__atomic_load_n(&snapshot->header->stale,
+				 __ATOMIC_ACQUIRE) && map_snapshot(snapshot))
+		err = -SENSORS_ERR_ACCESS_R;
+	else if (!(chip = find_chip(snapshot, name)))
+		err = -SENSORS_ERR_NO_ENTRY;
+	if (err) {
+		for (i = 0; errors && i < count; i++)
+			errors[i] = err;
+		return err;
+	}
+
+	do {
+		if (begin_read(snapshot, chip, &seq, &tries)) {
+			for (i = 0; errors && i < count; i++)
+				errors[i] = -SENSORS_ERR_ACCESS_R;
+			return -SENSORS_ERR_ACCESS_R;
+		}
+		err = 0;
+		for (i = 0; i < count; i++) {
+			nr = subfeat_nrs ? subfeat_nrs[i] : i;
+			if (nr < 0 || nr >= (int)chip->value_count) {
+				res = -SENSORS_ERR_NO_ENTRY;
+			} else {
+				value = &snapshot->values[chip->first_value +
+							  nr];
+				__atomic_load(&value->value, &values[i],
+					      __ATOMIC_RELAXED);
+				res = __atomic_load_n(&value->error,
+						      __ATOMIC_RELAXED);
+			}
+			if (errors)
+				errors[i] = res;
+			if (res)
+				err = res;
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&chip->seq, __ATOMIC_RELAXED) != seq);
+
+	return err;
+}
+
+time_t sensors_get_snapshot_time(sensors_snapshot *snapshot,
+				 const sensors_chip_name *name)
+{
+	const struct sensors_snapshot_chip *chip;
+	unsigned int seq;
+	int tries = 0;
+	time_t t;
+
+	if (sensors_chip_name_has_wildcards(name) ||
+	    (__atomic_load_n(&snapshot->header->stale, __ATOMIC_ACQUIRE) &&
+	     map_snapshot(snapshot)) ||
+	    !(chip = find_chip(snapshot, name)))
+		return 0;
+
+	do {
+		if (begin_read(snapshot, chip, &seq, &tries))
+			return 0;
+		t = __atomic_load_n(&chip->time, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&chip->seq, __ATOMIC_RELAXED) != seq);
+
+	return t;
+}
@@ -0,0 +1,62 @@
+/*
+    snapshot.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_SNAPSHOT_H
+#define LIB_SENSORS_SNAPSHOT_H
+
+#include <stdint.h>
+
+/* Layout of the shared memory snapshots written by sensord and read with
+   sensors_open_snapshot(). The segment starts with a header, followed by
+   the chip table, then the value table. Only the values, the sequence
+   counters, the update times and the stale flag change once the version
+   is set, which the writer does last. */
+
+#define SENSORS_SNAPSHOT_MAGIC		"LMSENSS"
+#define SENSORS_SNAPSHOT_VERSION	1
+#define SENSORS_SNAPSHOT_PREFIX_MAX	64
+
+struct sensors_snapshot_header {
+	char magic[8];
+	uint32_t version;	/* 0 while the segment is being set up */
+	uint32_t stale;		/* The segment was replaced or removed */
+	uint32_t size;		/* Of the whole segment */
+	uint32_t chip_count;
+	uint32_t value_count;
+	uint32_t reserved;
+};
+
+struct sensors_snapshot_chip {
+	char prefix[SENSORS_SNAPSHOT_PREFIX_MAX];
+	int32_t bus_type;
+	int32_t bus_nr;
+	int32_t addr;
+	uint32_t seq;		/* Odd while the values are being updated */
+	int64_t time;		/* Of the last update, 0 if none */
+	uint32_t first_value;	/* In the value table */
+	uint32_t value_count;	/* Indexed by subfeature number */
+};
+
+struct sensors_snapshot_value {
+	double value;
+	int32_t error;		/* 0 or <0, as returned by libsensors */
+	int32_t reserved;
+};
+
+#endif /* def LIB_SENSORS_SNAPSHOT_H */
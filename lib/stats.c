@@ -0,0 +1,105 @@
+/*
+    stats.c - Part of libsensors, a Linux library for reading sensor data.
+
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/* The statistics are kept in one preallocated slot per subfeature, so
+   that recording an access takes no lock and no allocation, only a few
+   relaxed atomic operations. */
+
+#include <stdlib.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "stats.h"
+
+void sensors_alloc_chip_stats(sensors_chip_features *features)
+{
+	if (!(sensors_flags & SENSORS_FLAG_STATS) || features->stats ||
+	    !features->subfeature_count)
+		return;
+
+	features->stats = calloc(features->subfeature_count,
+				 sizeof(struct sensors_stats_slot));
+	if (!features->stats)
+		sensors_fatal_error(__func__, "Out of memory");
+}
+
+void sensors_record_access(const sensors_chip_features *chip,
+			   const sensors_subfeature *subfeature,
+			   const struct timespec *start, int write, int err)
+{
+	struct sensors_stats_slot *slot;
+	struct timespec end;
+	unsigned long long latency, max, limit;
+	int bucket;
+
+	if (subfeature->number < 0 ||
+	    subfeature->number >= chip->subfeature_count)
+		return;
+	slot = &chip->stats[subfeature->number];
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	latency = (end.tv_sec - start->tv_sec) * 1000000000ULL +
+		  end.tv_nsec - start->tv_nsec;
+
+	__atomic_fetch_add(write ? &slot->writes : &slot->reads, 1,
+			   __ATOMIC_RELAXED);
+	if (err < 0) {
+		__atomic_fetch_add(&slot->errors[0], 1, __ATOMIC_RELAXED);
+		if (-err < SENSORS_STATS_ERRORS)
+			__atomic_fetch_add(&slot->errors[-err], 1,
+					   __ATOMIC_RELAXED);
+	}
+
+	/* Buckets are decades, starting below 10 us */
+	for (bucket = 0, limit = 10000; bucket < SENSORS_STATS_BUCKETS - 1 &&
+	     latency >= limit; bucket++, limit *= 10)
+		;
+	__atomic_fetch_add(&slot->histogram[bucket], 1, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&slot->last_latency, latency, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&slot->total_latency, latency, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&slot->max_latency, __ATOMIC_RELAXED);
+	while (latency > max &&
+	       !__atomic_compare_exchange_n(&slot->max_latency, &max, latency,
+					    1, __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		;
+}
+
+void sensors_copy_stats(const struct sensors_stats_slot *slot,
+			sensors_stats *stats)
+{
+	int i;
+
+	stats->reads = __atomic_load_n(&slot->reads, __ATOMIC_RELAXED);
+	stats->writes = __atomic_load_n(&slot->writes, __ATOMIC_RELAXED);
+	for (i = 0; i < SENSORS_STATS_ERRORS; i++)
+		stats->errors[i] = __atomic_load_n(&slot->errors[i],
+						   __ATOMIC_RELAXED);
+	for (i = 0; i < SENSORS_STATS_BUCKETS; i++)
+		stats->histogram[i] = __atomic_load_n(&slot->histogram[i],
+						      __ATOMIC_RELAXED);
+	stats->last_latency = __atomic_load_n(&slot->last_latency,
+					      __ATOMIC_RELAXED) / 1e9;
+	stats->max_latency = __atomic_load_n(&slot->max_latency,
+					     __ATOMIC_RELAXED) / 1e9;
+	stats->total_latency = __atomic_load_n(&slot->total_latency,
+					       __ATOMIC_RELAXED) / 1e9;
+}
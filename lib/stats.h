@@ -0,0 +1,61 @@
+/*
+    stats.h - Part of libsensors, a Linux library for reading sensor data.
+
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_STATS_H
+#define LIB_SENSORS_STATS_H
+
+#include <time.h>
+#include "sensors.h"
+#include "data.h"
+
+/* Access statistics of a subfeature. The counters are updated atomically,
+   as values may be read from several threads at once. Latencies are in
+   nanoseconds. */
+struct sensors_stats_slot {
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long errors[SENSORS_STATS_ERRORS];
+	unsigned long histogram[SENSORS_STATS_BUCKETS];
+	unsigned long long last_latency;
+	unsigned long long max_latency;
+	unsigned long long total_latency;
+};
+
+/* Allocate the statistics of a chip if SENSORS_FLAG_STATS is set and they
+   are not allocated yet */
+void sensors_alloc_chip_stats(sensors_chip_features *features);
+
+/* Get the time an access to an attribute file starts at */
+static inline void sensors_stats_start(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+/* Record an access to the attribute file of a subfeature of a chip, which
+   started at start and returned err */
+void sensors_record_access(const sensors_chip_features *chip,
+			   const sensors_subfeature *subfeature,
+			   const struct timespec *start, int write, int err);
+
+/* Copy the statistics of a subfeature */
+void sensors_copy_stats(const struct sensors_stats_slot *slot,
+			sensors_stats *stats);
+
+#endif /* def LIB_SENSORS_STATS_H */
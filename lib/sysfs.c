@@ -26,16 +26,22 @@
 #include <sys/stat.h>
 #include <sys/vfs.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <errno.h>
 #include <dirent.h>
+#include <pthread.h>
 #include "data.h"
 #include "error.h"
 #include "access.h"
 #include "general.h"
 #include "sysfs.h"
+#include "init.h"
+#include "capture.h"
+#include "stats.h"
+#include "deadline.h"
 
 
 /****************************************************************************/
@@ -138,8 +144,7 @@ static int sysfs_foreach_busdev(const char *bus_type,
 
 char sensors_sysfs_mount[NAME_MAX];
 
-static
-int get_type_scaling(sensors_subfeature_type type)
+int sensors_get_type_scaling(sensors_subfeature_type type)
 {
 	/* Multipliers for subfeatures */
 	switch (type & 0xFF80) {
@@ -168,7 +173,8 @@ int get_type_scaling(sensors_subfeature_type type)
 }
 
 static
-char *get_feature_name(sensors_feature_type ftype, char *sfname)
+char *get_feature_name(sensors_arena *arena, sensors_feature_type ftype,
+		       char *sfname)
 {
 	char *name, *underscore;
 
@@ -182,15 +188,11 @@ char *get_feature_name(sensors_feature_type ftype, char *sfname)
 	case SENSORS_FEATURE_HUMIDITY:
 	case SENSORS_FEATURE_INTRUSION:
 		underscore = strchr(sfname, '_');
-		name = strndup(sfname, underscore - sfname);
-		if (!name)
-			sensors_fatal_error(__func__, "Out of memory");
-
+		name = sensors_arena_strndup(arena, sfname,
+					     underscore - sfname);
 		break;
 	default:
-		name = strdup(sfname);
-		if (!name)
-			sensors_fatal_error(__func__, "Out of memory");
+		name = sensors_arena_strdup(arena, sfname);
 	}
 
 	return name;
@@ -330,25 +332,71 @@ static const struct subfeature_type_match intrusion_matches[] = {
 	{ NULL, 0 }
 };
 static struct feature_type_match matches[] = {
-	{ "temp%d%c", temp_matches },
-	{ "in%d%c", in_matches },
-	{ "fan%d%c", fan_matches },
-	{ "cpu%d%c", cpu_matches },
-	{ "power%d%c", power_matches },
-	{ "curr%d%c", curr_matches },
-	{ "energy%d%c", energy_matches },
-	{ "intrusion%d%c", intrusion_matches },
-	{ "humidity%d%c", humidity_matches },
+	{ "temp", temp_matches },
+	{ "in", in_matches },
+	{ "fan", fan_matches },
+	{ "cpu", cpu_matches },
+	{ "power", power_matches },
+	{ "curr", curr_matches },
+	{ "energy", energy_matches },
+	{ "intrusion", intrusion_matches },
+	{ "humidity", humidity_matches },
 };
 
+/* Find the main feature type matching the beginning of a subfeature name,
+   and return the position right after it. This is called for every
+   attribute file, so we dispatch on the first character instead of
+   trying every prefix in turn. */
+static const struct feature_type_match *
+sensors_feature_match_prefix(const char *name, const char **end)
+{
+	const struct feature_type_match *match;
+	size_t len;
+
+	switch (name[0]) {
+	case 't':
+		match = &matches[0];
+		break;
+	case 'i':
+		/* "in" is a prefix of "intrusion" */
+		match = name[1] == 'n' && name[2] == 't' ?
+			&matches[7] : &matches[1];
+		break;
+	case 'f':
+		match = &matches[2];
+		break;
+	case 'c':
+		match = name[1] == 'p' ? &matches[3] : &matches[5];
+		break;
+	case 'p':
+		match = &matches[4];
+		break;
+	case 'e':
+		match = &matches[6];
+		break;
+	case 'h':
+		match = &matches[8];
+		break;
+	default:
+		return NULL;
+	}
+
+	len = strlen(match->name);
+	if (strncmp(name, match->name, len))
+		return NULL;
+	*end = name + len;
+	return match;
+}
+
 /* Return the subfeature type and channel number based on the subfeature
    name */
 static
 sensors_subfeature_type sensors_subfeature_get_type(const char *name, int *nr)
 {
-	char c;
-	int i, count;
+	const struct feature_type_match *match;
 	const struct subfeature_type_match *submatches;
+	const char *p;
+	int i, neg = 0;
 
 	/* Special case */
 	if (!strcmp(name, "beep_enable")) {
@@ -356,17 +404,28 @@ sensors_subfeature_type sensors_subfeature_get_type(const char *name, int *nr)
 		return SENSORS_SUBFEATURE_BEEP_ENABLE;
 	}
 
-	for (i = 0; i < ARRAY_SIZE(matches); i++)
-		if ((count = sscanf(name, matches[i].name, nr, &c)))
-			break;
-
-	if (i == ARRAY_SIZE(matches) || count != 2 || c != '_')
+	if (!(match = sensors_feature_match_prefix(name, &p)))
 		return SENSORS_SUBFEATURE_UNKNOWN;  /* no match */
 
-	submatches = matches[i].submatches;
-	name = strchr(name + 3, '_') + 1;
+	/* Channel number, followed by an underscore */
+	if (*p == '-' || *p == '+')
+		neg = *p++ == '-';
+	if (*p < '0' || *p > '9')
+		return SENSORS_SUBFEATURE_UNKNOWN;
+	for (*nr = 0; *p >= '0' && *p <= '9'; p++) {
+		if (*nr >= 100000)	/* Rejected by our caller anyway */
+			return SENSORS_SUBFEATURE_UNKNOWN;
+		*nr = *nr * 10 + *p - '0';
+	}
+	if (neg)
+		*nr = -*nr;
+	if (*p++ != '_')
+		return SENSORS_SUBFEATURE_UNKNOWN;
+
+	submatches = match->submatches;
 	for (i = 0; submatches[i].name != NULL; i++)
-		if (!strcmp(name, submatches[i].name))
+		if (submatches[i].name[0] == p[0] &&
+		    !strcmp(p, submatches[i].name))
 			return submatches[i].type;
 
 	return SENSORS_SUBFEATURE_UNKNOWN;
@@ -399,14 +458,35 @@ static int sensors_compute_max_sf(void)
 	return max;
 }
 
-static int sensors_get_attr_mode(const char *device, const char *attr)
+static int max_subfeatures, feature_size;
+
+/* Dynamically figure out the max number of subfeatures */
+static void sensors_init_max_sf(void)
+{
+	if (!max_subfeatures) {
+		max_subfeatures = sensors_compute_max_sf();
+		feature_size = max_subfeatures * 2;
+	}
+}
+
+/* The regular files of a class device directory are its attributes */
+static const char *sysfs_next_attr(void *data)
+{
+	struct dirent *ent;
+
+	while ((ent = readdir(data)))
+		if (ent->d_type == DT_REG)	/* Skip directories and symlinks */
+			return ent->d_name;
+	return NULL;
+}
+
+/* Get the access mode of an attribute, relative to its directory */
+static int sysfs_get_attr_mode(void *data, const char *attr)
 {
-	char path[NAME_MAX];
 	struct stat st;
 	int mode = 0;
 
-	snprintf(path, NAME_MAX, "%s/%s", device, attr);
-	if (!stat(path, &st)) {
+	if (!fstatat(dirfd(data), attr, &st, 0)) {
 		if (st.st_mode & S_IRUSR)
 			mode |= SENSORS_MODE_R;
 		if (st.st_mode & S_IWUSR)
@@ -415,46 +495,33 @@ static int sensors_get_attr_mode(const char *device, const char *attr)
 	return mode;
 }
 
-static int sensors_read_dynamic_chip(sensors_chip_features *chip,
-				     const char *dev_path)
+int sensors_read_dynamic_chip(sensors_chip_features *chip,
+			      const char *(*next)(void *data),
+			      int (*get_mode)(void *data, const char *name),
+			      void *data, sensors_arena *arena)
 {
 	int i, fnum = 0, sfnum = 0, prev_slot;
-	static int max_subfeatures, feature_size;
-	DIR *dir;
-	struct dirent *ent;
+	const char *name;
 	struct {
 		int count;
 		sensors_subfeature *sf;
 	} all_types[SENSORS_FEATURE_MAX];
 	sensors_subfeature *dyn_subfeatures;
 	sensors_feature *dyn_features;
+	int *dyn_fds;
 	sensors_feature_type ftype;
 	sensors_subfeature_type sftype;
 
-	if (!(dir = opendir(dev_path)))
-		return -errno;
-
-	/* Dynamically figure out the max number of subfeatures */
-	if (!max_subfeatures) {
-		max_subfeatures = sensors_compute_max_sf();
-		feature_size = max_subfeatures * 2;
-	}
+	sensors_init_max_sf();
 
 	/* We use a set of large sparse tables at first (one per main
 	   feature type present) to store all found subfeatures, so that we
 	   can store them sorted and then later create a dense sorted table. */
 	memset(&all_types, 0, sizeof(all_types));
 
-	while ((ent = readdir(dir))) {
-		char *name;
+	while ((name = next(data))) {
 		int nr;
 
-		/* Skip directories and symlinks */
-		if (ent->d_type != DT_REG)
-			continue;
-
-		name = ent->d_name;
-
 		sftype = sensors_subfeature_get_type(name, &nr);
 		if (sftype == SENSORS_SUBFEATURE_UNKNOWN)
 			continue;
@@ -522,19 +589,15 @@ static int sensors_read_dynamic_chip(sensors_chip_features *chip,
 
 		/* fill in the subfeature members */
 		all_types[ftype].sf[i].type = sftype;
-		all_types[ftype].sf[i].name = strdup(name);
-		if (!all_types[ftype].sf[i].name)
-			sensors_fatal_error(__func__, "Out of memory");
+		all_types[ftype].sf[i].name = sensors_arena_strdup(arena, name);
 
 		/* Other and misc subfeatures are never scaled */
 		if (sftype < SENSORS_SUBFEATURE_VID && !(sftype & 0x80))
 			all_types[ftype].sf[i].flags |= SENSORS_COMPUTE_MAPPING;
-		all_types[ftype].sf[i].flags |=
-					sensors_get_attr_mode(dev_path, name);
+		all_types[ftype].sf[i].flags |= get_mode(data, name);
 
 		sfnum++;
 	}
-	closedir(dir);
 
 	if (!sfnum) { /* No subfeature */
 		chip->subfeature = NULL;
@@ -555,10 +618,15 @@ static int sensors_read_dynamic_chip(sensors_chip_features *chip,
 		}
 	}
 
-	dyn_subfeatures = calloc(sfnum, sizeof(sensors_subfeature));
-	dyn_features = calloc(fnum, sizeof(sensors_feature));
-	if (!dyn_subfeatures || !dyn_features)
+	dyn_subfeatures = sensors_arena_alloc(arena, sfnum *
+					      sizeof(sensors_subfeature));
+	dyn_features = sensors_arena_alloc(arena, fnum *
+					   sizeof(sensors_feature));
+	dyn_fds = malloc(sfnum * sizeof(int));
+	if (!dyn_fds)
 		sensors_fatal_error(__func__, "Out of memory");
+	for (i = 0; i < sfnum; i++)
+		dyn_fds[i] = -1;
 
 	/* Copy from the sparse array to the compact array */
 	sfnum = 0;
@@ -575,7 +643,7 @@ static int sensors_read_dynamic_chip(sensors_chip_features *chip,
 				prev_slot = i / feature_size;
 
 				dyn_features[fnum].name =
-					get_feature_name(ftype,
+					get_feature_name(arena, ftype,
 						all_types[ftype].sf[i].name);
 				dyn_features[fnum].number = fnum;
 				dyn_features[fnum].first_subfeature = sfnum;
@@ -593,6 +661,7 @@ static int sensors_read_dynamic_chip(sensors_chip_features *chip,
 
 	chip->subfeature = dyn_subfeatures;
 	chip->subfeature_count = sfnum;
+	chip->subfeature_fd = dyn_fds;
 	chip->feature = dyn_features;
 	chip->feature_count = ++fnum;
 
@@ -602,11 +671,35 @@ exit_free:
 	return 0;
 }
 
+static int sysfs_read_dynamic_chip(sensors_chip_features *chip,
+				   const char *dev_path,
+				   sensors_arena *arena)
+{
+	DIR *dir;
+	int ret;
+
+	if (!(dir = opendir(dev_path)))
+		return -errno;
+	ret = sensors_read_dynamic_chip(chip, sysfs_next_attr,
+					sysfs_get_attr_mode, dir, arena);
+	closedir(dir);
+	return ret;
+}
+
+/* Set by sensors_set_sysfs_root(), empty for the real sysfs */
+static char sysfs_root[NAME_MAX];
+
 /* returns !0 if sysfs filesystem was found, 0 otherwise */
-int sensors_init_sysfs(void)
+static int sysfs_init(void)
 {
 	struct statfs statfsbuf;
 
+	/* Another tree isn't checked, it may well be a plain directory */
+	if (sysfs_root[0]) {
+		snprintf(sensors_sysfs_mount, NAME_MAX, "%s", sysfs_root);
+		return 1;
+	}
+
 	snprintf(sensors_sysfs_mount, NAME_MAX, "%s", "/sys");
 	if (statfs(sensors_sysfs_mount, &statfsbuf) < 0
 	 || statfsbuf.f_type != SYSFS_MAGIC)
@@ -700,6 +793,184 @@ static int classify_device(const char *dev_name,
 	return ret;
 }
 
+/*
+ * Bus types found during a discovery pass. Many hwmon devices share their
+ * parent devices, so the result of find_bus_type() is recorded for each
+ * device it went through, and the next device climbing the same chain
+ * stops there. The memo is shared by the scanning threads, and only
+ * lives as long as the pass: devices may come and go afterwards. The
+ * entries are indexed by hash, with open addressing.
+ */
+struct bus_memo_entry {
+	unsigned int hash;
+	char *path;
+	char *name;
+	int ret;		/* 0 if virtual, 1 if classified */
+	sensors_bus_id bus;
+	int addr;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	int users;
+	struct bus_memo_entry *entry;
+	int count;
+	int max;
+	int *index;		/* 1-based indices in entry, 0 if free */
+	unsigned int mask;
+} bus_memo = { PTHREAD_MUTEX_INITIALIZER, 0, NULL, 0, 0, NULL, 0 };
+
+static unsigned int bus_memo_hash(const char *path, const char *name)
+{
+	unsigned int hash = 2166136261u;
+
+	/* FNV-1a */
+	while (*path)
+		hash = (hash ^ (unsigned char)*path++) * 16777619u;
+	hash = (hash ^ '/') * 16777619u;
+	while (*name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	return hash;
+}
+
+static void bus_memo_begin(void)
+{
+	pthread_mutex_lock(&bus_memo.lock);
+	bus_memo.users++;
+	pthread_mutex_unlock(&bus_memo.lock);
+}
+
+static void bus_memo_end(void)
+{
+	int i;
+
+	pthread_mutex_lock(&bus_memo.lock);
+	if (!--bus_memo.users) {
+		for (i = 0; i < bus_memo.count; i++) {
+			free(bus_memo.entry[i].path);
+			free(bus_memo.entry[i].name);
+		}
+		free(bus_memo.entry);
+		bus_memo.entry = NULL;
+		bus_memo.count = bus_memo.max = 0;
+		free(bus_memo.index);
+		bus_memo.index = NULL;
+		bus_memo.mask = 0;
+	}
+	pthread_mutex_unlock(&bus_memo.lock);
+}
+
+/* Returns the memoized result of find_bus_type(), or -1 if unknown */
+static int bus_memo_lookup(const char *path, const char *name,
+			   sensors_chip_features *entry)
+{
+	const struct bus_memo_entry *memo;
+	unsigned int hash = bus_memo_hash(path, name), slot;
+	int i, ret = -1;
+
+	pthread_mutex_lock(&bus_memo.lock);
+	if (!bus_memo.index)
+		goto exit_unlock;
+
+	for (slot = hash; (i = bus_memo.index[slot & bus_memo.mask]); slot++) {
+		memo = &bus_memo.entry[i - 1];
+		if (memo->hash != hash ||
+		    strcmp(memo->path, path) || strcmp(memo->name, name))
+			continue;
+		ret = memo->ret;
+		if (ret) {
+			entry->chip.bus = memo->bus;
+			entry->chip.addr = memo->addr;
+		}
+		break;
+	}
+
+exit_unlock:
+	pthread_mutex_unlock(&bus_memo.lock);
+	return ret;
+}
+
+/* Index the last entry, growing the index to keep its load factor at or
+   below 50% */
+static void bus_memo_index_last(void)
+{
+	unsigned int size, slot;
+	int i, first;
+
+	size = bus_memo.mask + 1;
+	if (!bus_memo.index || 2 * (unsigned int)bus_memo.count > size) {
+		size = bus_memo.index ? 2 * size : 16;
+		free(bus_memo.index);
+		bus_memo.index = calloc(size, sizeof(int));
+		if (!bus_memo.index)
+			sensors_fatal_error(__func__, "Out of memory");
+		bus_memo.mask = size - 1;
+		first = 0;
+	} else {
+		first = bus_memo.count - 1;
+	}
+
+	for (i = first; i < bus_memo.count; i++) {
+		slot = bus_memo.entry[i].hash;
+		while (bus_memo.index[slot & bus_memo.mask])
+			slot++;
+		bus_memo.index[slot & bus_memo.mask] = i + 1;
+	}
+}
+
+static void bus_memo_insert(const char *path, const char *name, int ret,
+			    const sensors_chip_features *entry)
+{
+	struct bus_memo_entry new;
+
+	pthread_mutex_lock(&bus_memo.lock);
+	if (!bus_memo.users)
+		goto exit_unlock;
+
+	new.hash = bus_memo_hash(path, name);
+	new.path = strdup(path);
+	new.name = strdup(name);
+	if (!new.path || !new.name)
+		sensors_fatal_error(__func__, "Out of memory");
+	new.ret = ret;
+	new.bus = entry->chip.bus;
+	new.addr = entry->chip.addr;
+	sensors_add_array_el(&new, &bus_memo.entry, &bus_memo.count,
+			     &bus_memo.max, sizeof(struct bus_memo_entry));
+	bus_memo_index_last();
+
+exit_unlock:
+	pthread_mutex_unlock(&bus_memo.lock);
+}
+
+/* Record the outcome for each device visited, and forget them */
+static void bus_memo_record(char **visited, int count, int ret,
+			    const sensors_chip_features *entry)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		bus_memo_insert(visited[i], visited[i] + strlen(visited[i]) + 1,
+				ret, entry);
+		free(visited[i]);
+	}
+}
+
+/* Keep track of a device visited, the name being stored after the path */
+static void bus_memo_visit(char ***visited, int *count, int *max,
+			   const char *path, const char *name)
+{
+	size_t path_len = strlen(path), name_len = strlen(name);
+	char *el;
+
+	el = malloc(path_len + name_len + 2);
+	if (!el)
+		sensors_fatal_error(__func__, "Out of memory");
+	memcpy(el, path, path_len + 1);
+	memcpy(el + path_len + 1, name, name_len + 1);
+	sensors_add_array_el(&el, visited, count, max, sizeof(char *));
+}
+
 static int find_bus_type(const char *dev_path,
                          const char *dev_name,
                          sensors_chip_features *entry)
@@ -708,6 +979,9 @@ static int find_bus_type(const char *dev_path,
 	char subsys_path[NAME_MAX], *subsys;
 	int sub_len;
 	char *my_dev_path = NULL;
+	char **visited = NULL;
+	int visited_count = 0, visited_max = 0;
+	int memo = __atomic_load_n(&bus_memo.users, __ATOMIC_RELAXED);
 	int ret = 0;
 
 	my_dev_path = strdup(dev_path);
@@ -716,6 +990,18 @@ static int find_bus_type(const char *dev_path,
 
 	/* Find bus type */
 	while (!ret && my_dev_path != NULL) {
+		if (memo) {
+			ret = bus_memo_lookup(my_dev_path, dev_name, entry);
+			if (ret >= 0) {
+				bus_memo_record(visited, visited_count, ret,
+						entry);
+				goto exit_free;
+			}
+			ret = 0;
+			bus_memo_visit(&visited, &visited_count, &visited_max,
+				       my_dev_path, dev_name);
+		}
+
 		snprintf(linkpath, NAME_MAX, "%s/subsystem", my_dev_path);
 		sub_len = readlink(linkpath, subsys_path, NAME_MAX - 1);
 		if (sub_len < 0 && errno == ENOENT) {
@@ -748,32 +1034,41 @@ static int find_bus_type(const char *dev_path,
 		}
 	}
 
+	if (ret >= 0)
+		bus_memo_record(visited, visited_count, ret, entry);
+	else
+		while (visited_count)
+			free(visited[--visited_count]);
+exit_free:
+	free(visited);
 	if (my_dev_path != NULL)
 		free(my_dev_path);
 	return ret;
 }
 
-/* returns: number of devices added (0 or 1) if successful, <0 otherwise */
-static int sensors_read_one_sysfs_chip(const char *dev_path,
+/* Fill entry with the chip found at the given paths.
+   returns: number of devices found (0 or 1) if successful, <0 otherwise */
+static int sensors_scan_one_sysfs_chip(const char *dev_path,
 				       const char *dev_name,
-				       const char *hwmon_path)
+				       const char *hwmon_path,
+				       sensors_chip_features *entry,
+				       sensors_arena *arena)
 {
 	int ret = 1;
 	int virtual = 0;
-	sensors_chip_features entry;
+	char *prefix;
+
+	memset(entry, 0, sizeof(*entry));
+	entry->backend = &sensors_sysfs_backend;
 
 	/* ignore any device without name attribute */
-	if (!(entry.chip.prefix = sysfs_read_attr(hwmon_path, "name")))
+	if (!(prefix = sysfs_read_attr(hwmon_path, "name")))
 		return 0;
 
-	entry.chip.path = strdup(hwmon_path);
-	if (!entry.chip.path)
-		sensors_fatal_error(__func__, "Out of memory");
-
 	if (dev_path == NULL) {
 		virtual = 1;
 	} else {
-		ret = find_bus_type(dev_path, dev_name, &entry);
+		ret = find_bus_type(dev_path, dev_name, entry);
 		if (ret == 0) {
 			virtual = 1;
 			ret = 1;
@@ -783,27 +1078,41 @@ static int sensors_read_one_sysfs_chip(const char *dev_path,
 	}
 	if (virtual) {
 		/* Virtual device */
-		entry.chip.bus.type = SENSORS_BUS_TYPE_VIRTUAL;
-		entry.chip.bus.nr = 0;
+		entry->chip.bus.type = SENSORS_BUS_TYPE_VIRTUAL;
+		entry->chip.bus.nr = 0;
 		/* For now we assume that virtual devices are unique */
-		entry.chip.addr = 0;
+		entry->chip.addr = 0;
 	}
 
-	if (sensors_read_dynamic_chip(&entry, hwmon_path) < 0) {
+	if (sysfs_read_dynamic_chip(entry, hwmon_path, arena) < 0) {
 		ret = -SENSORS_ERR_KERNEL;
 		goto exit_free;
 	}
-	if (!entry.subfeature) { /* No subfeature, discard chip */
+	if (!entry->subfeature) { /* No subfeature, discard chip */
 		ret = 0;
 		goto exit_free;
 	}
-	sensors_add_proc_chips(&entry);
 
-	return ret;
+	entry->chip.prefix = sensors_arena_strdup(arena, prefix);
+	entry->chip.path = sensors_arena_strdup(arena, hwmon_path);
 
 exit_free:
-	free(entry.chip.prefix);
-	free(entry.chip.path);
+	free(prefix);
+	return ret;
+}
+
+/* returns: number of devices added (0 or 1) if successful, <0 otherwise */
+static int sensors_read_one_sysfs_chip(const char *dev_path,
+				       const char *dev_name,
+				       const char *hwmon_path)
+{
+	sensors_chip_features entry;
+	int ret;
+
+	ret = sensors_scan_one_sysfs_chip(dev_path, dev_name, hwmon_path,
+					  &entry, &sensors_proc_arena);
+	if (ret > 0)
+		sensors_add_proc_chips(&entry);
 	return ret;
 }
 
@@ -830,12 +1139,15 @@ static int sensors_read_sysfs_chips_compat(void)
 	return 0;
 }
 
-static int sensors_add_hwmon_device(const char *path, const char *classdev)
+/* Fill entry with the chip behind a given hwmon class device.
+   returns: number of devices found (0 or 1) if successful, <0 otherwise */
+static int sysfs_scan_hwmon_device(const char *path,
+				   sensors_chip_features *entry,
+				   sensors_arena *arena)
 {
 	char linkpath[NAME_MAX];
 	char *dev_path, *dev_name;
 	int err = 0;
-	(void)classdev; /* hide warning */
 
 	snprintf(linkpath, NAME_MAX, "%s/device", path);
 	dev_path = realpath(linkpath, NULL);
@@ -844,30 +1156,207 @@ static int sensors_add_hwmon_device(const char *path, const char *classdev)
 			sensors_fatal_error(__func__, "Out of memory");
 		} else {
 			/* No device link? Treat as virtual */
-			err = sensors_read_one_sysfs_chip(NULL, NULL, path);
+			err = sensors_scan_one_sysfs_chip(NULL, NULL, path,
+							  entry, arena);
 		}
 	} else {
 		dev_name = strrchr(dev_path, '/') + 1;
 
 		/* The attributes we want might be those of the hwmon class
 		   device, or those of the device itself. */
-		err = sensors_read_one_sysfs_chip(dev_path, dev_name, path);
+		err = sensors_scan_one_sysfs_chip(dev_path, dev_name, path,
+						  entry, arena);
 		if (err == 0)
-			err = sensors_read_one_sysfs_chip(dev_path, dev_name,
-							  dev_path);
+			err = sensors_scan_one_sysfs_chip(dev_path, dev_name,
+							  dev_path, entry,
+							  arena);
 		free(dev_path);
 	}
+	if (err > 0)
+		entry->class_path = sensors_arena_strdup(arena, path);
+	return err;
+}
+
+int sensors_get_hwmon_path(const char *path, char *class_path)
+{
+	size_t len = strlen(sensors_sysfs_mount);
+	const char *name;
+
+	/* Uevents give paths relative to the sysfs mount point */
+	if (!strncmp(path, sensors_sysfs_mount, len) && path[len] == '/')
+		path += len;
+	name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	if (name[0] == '\0' || name[0] == '.')
+		return -SENSORS_ERR_NO_ENTRY;
+	if (snprintf(class_path, PATH_MAX, "%s/class/hwmon/%s",
+		     sensors_sysfs_mount, name) >= PATH_MAX)
+		return -SENSORS_ERR_NO_ENTRY;
+	return 0;
+}
+
+static int sensors_add_hwmon_device(const char *path, const char *classdev)
+{
+	sensors_chip_features entry;
+	int err;
+	(void)classdev; /* hide warning */
+
+	err = sysfs_scan_hwmon_device(path, &entry, &sensors_proc_arena);
 	if (err < 0)
 		return err;
+	if (err > 0)
+		sensors_add_proc_chips(&entry);
 	return 0;
 }
 
+/* Parallel discovery: the hwmon class devices are listed first, then
+   scanned by a few threads, each one storing its results in the slot of
+   the class device. The results are finally merged in directory order,
+   so that the chip list is the same as with a sequential scan. */
+#define SCAN_THREADS_MAX	8
+
+struct sysfs_scan_slot {
+	char path[PATH_MAX];
+	int ret;
+	sensors_chip_features entry;
+};
+
+struct sysfs_scan {
+	struct sysfs_scan_slot *slots;
+	int count;
+	int max;
+	int next;
+	pthread_mutex_t lock;
+	sensors_context *ctx;	/* Of the thread calling sensors_init() */
+};
+
+/* Each thread allocates from its own arena */
+struct sysfs_scan_worker {
+	struct sysfs_scan *scan;
+	pthread_t thread;
+	sensors_arena arena;
+};
+
+/* List the hwmon class devices, in directory order. Returns 0 on success,
+   a positive errno otherwise. */
+static int sensors_list_hwmon_devices(struct sysfs_scan *scan)
+{
+	struct sysfs_scan_slot slot;
+	char path[PATH_MAX];
+	DIR *dir;
+	struct dirent *ent;
+	int ret = 0;
+
+	if (snprintf(path, PATH_MAX, "%s/class/hwmon",
+		     sensors_sysfs_mount) >= PATH_MAX)
+		return ENAMETOOLONG;
+	if (!(dir = opendir(path)))
+		return errno;
+
+	while ((ent = readdir(dir))) {
+		if (ent->d_name[0] == '.')	/* skip hidden entries */
+			continue;
+
+		if (snprintf(slot.path, PATH_MAX, "%s/%s", path,
+			     ent->d_name) >= PATH_MAX) {
+			ret = ENAMETOOLONG;
+			break;
+		}
+		sensors_add_array_el(&slot, &scan->slots, &scan->count,
+				     &scan->max, sizeof(struct sysfs_scan_slot));
+	}
+
+	closedir(dir);
+	return ret;
+}
+
+static void *sensors_scan_thread(void *data)
+{
+	struct sysfs_scan_worker *worker = data;
+	struct sysfs_scan *scan = worker->scan;
+	struct sysfs_scan_slot *slot;
+	int i;
+
+	sensors_thread_context = scan->ctx;
+	for (;;) {
+		pthread_mutex_lock(&scan->lock);
+		i = scan->next++;
+		pthread_mutex_unlock(&scan->lock);
+		if (i >= scan->count)
+			break;
+
+		slot = &scan->slots[i];
+		slot->ret = sysfs_scan_hwmon_device(slot->path, &slot->entry,
+						    &worker->arena);
+	}
+	return NULL;
+}
+
+static int sensors_read_sysfs_chips_parallel(void)
+{
+	struct sysfs_scan scan;
+	struct sysfs_scan_worker workers[SCAN_THREADS_MAX];
+	int i, nthreads, ret;
+
+	memset(&scan, 0, sizeof(scan));
+	memset(workers, 0, sizeof(workers));
+	ret = sensors_list_hwmon_devices(&scan);
+	if (ret) {
+		free(scan.slots);
+		return ret;
+	}
+
+	/* Make sure no lazy initialization happens in the threads */
+	sensors_init_max_sf();
+	pthread_mutex_init(&scan.lock, NULL);
+	scan.ctx = sensors_thread_context;
+
+	/* The calling thread does its share of the work too, as the
+	   last worker */
+	nthreads = scan.count < SCAN_THREADS_MAX ? scan.count :
+						   SCAN_THREADS_MAX;
+	for (i = 0; i < SCAN_THREADS_MAX; i++)
+		workers[i].scan = &scan;
+	for (i = 0; i < nthreads - 1; i++)
+		if (pthread_create(&workers[i].thread, NULL,
+				   sensors_scan_thread, &workers[i]))
+			break;
+	nthreads = i;
+	sensors_scan_thread(&workers[SCAN_THREADS_MAX - 1]);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].thread, NULL);
+	pthread_mutex_destroy(&scan.lock);
+	for (i = 0; i < SCAN_THREADS_MAX; i++)
+		sensors_arena_merge(&sensors_proc_arena, &workers[i].arena);
+
+	/* Merge the results, stopping at the first error like the
+	   sequential scan does */
+	for (i = 0; i < scan.count; i++) {
+		if (ret >= 0 && scan.slots[i].ret < 0)
+			ret = scan.slots[i].ret;
+		if (scan.slots[i].ret <= 0)
+			continue;
+		if (ret >= 0)
+			sensors_add_proc_chips(&scan.slots[i].entry);
+		else
+			sensors_free_chip_features(&scan.slots[i].entry);
+	}
+	free(scan.slots);
+	return ret;
+}
+
 /* returns 0 if successful, !0 otherwise */
-int sensors_read_sysfs_chips(void)
+static int sysfs_read_chips(void)
 {
 	int ret;
 
-	ret = sysfs_foreach_classdev("hwmon", sensors_add_hwmon_device);
+	bus_memo_begin();
+	if (sensors_flags & SENSORS_FLAG_PARALLEL_SCAN)
+		ret = sensors_read_sysfs_chips_parallel();
+	else
+		ret = sysfs_foreach_classdev("hwmon",
+					     sensors_add_hwmon_device);
+	bus_memo_end();
 	if (ret == ENOENT) {
 		/* compatibility function for kernel 2.6.n where n <= 13 */
 		return sensors_read_sysfs_chips_compat();
@@ -882,6 +1371,7 @@ int sensors_read_sysfs_chips(void)
 static int sensors_add_i2c_bus(const char *path, const char *classdev)
 {
 	sensors_bus entry;
+	char *adapter;
 
 	if (sscanf(classdev, "i2c-%hd", &entry.bus.nr) != 1 ||
 	    entry.bus.nr == 9191) /* legacy ISA */
@@ -891,17 +1381,21 @@ static int sensors_add_i2c_bus(const char *path, const char *classdev)
 	/* Get the adapter name from the classdev "name" attribute
 	 * (Linux 2.6.20 and later). If it fails, fall back to
 	 * the device "name" attribute (for older kernels). */
-	entry.adapter = sysfs_read_attr(path, "name");
-	if (!entry.adapter)
-		entry.adapter = sysfs_read_attr(path, "device/name");
-	if (entry.adapter)
+	adapter = sysfs_read_attr(path, "name");
+	if (!adapter)
+		adapter = sysfs_read_attr(path, "device/name");
+	if (adapter) {
+		entry.adapter = sensors_arena_strdup(&sensors_proc_arena,
+						     adapter);
 		sensors_add_proc_bus(&entry);
+		free(adapter);
+	}
 
 	return 0;
 }
 
 /* returns 0 if successful, !0 otherwise */
-int sensors_read_sysfs_bus(void)
+static int sysfs_read_bus(void)
 {
 	int ret;
 
@@ -914,14 +1408,104 @@ int sensors_read_sysfs_bus(void)
 	return 0;
 }
 
-int sensors_read_sysfs_attr(const sensors_chip_name *name,
-			    const sensors_subfeature *subfeature,
-			    double *value)
+/* Parse a sysfs attribute value. hwmon attributes are integers by
+   definition, so we avoid the cost of strtod() unless we have to. */
+static int sysfs_parse_value(const char *buf, double *value)
+{
+	const char *p = buf;
+	long long v = 0;
+	int neg = 0;
+	char *end;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (*p == '-' || *p == '+')
+		neg = *p++ == '-';
+	if (*p < '0' || *p > '9')
+		return -SENSORS_ERR_ACCESS_R;
+	while (*p >= '0' && *p <= '9' && v < LLONG_MAX / 10 - 1)
+		v = v * 10 + *p++ - '0';
+
+	if (*p == '\n' || *p == '\0') {
+		*value = neg ? -v : v;
+		return 0;
+	}
+
+	/* Not a plain integer, let the C library deal with it */
+	*value = strtod(buf, &end);
+	if (end == buf)
+		return -SENSORS_ERR_ACCESS_R;
+	return 0;
+}
+
+int sensors_read_sysfs_path(const char *path, double *value)
+{
+	char buf[32];
+	ssize_t len;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return -SENSORS_ERR_KERNEL;
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (len < 0) {
+		len = errno;
+		close(fd);
+		return len == EIO ? -SENSORS_ERR_IO : -SENSORS_ERR_ACCESS_R;
+	}
+	close(fd);
+	buf[len] = '\0';
+
+	return sysfs_parse_value(buf, value);
+}
+
+/* Read an attribute through a file descriptor we keep open, so that each
+   read costs a single system call */
+static int sysfs_read_attr_fd(const sensors_chip_features *chip,
+			      const sensors_subfeature *subfeature,
+			      double *value)
+{
+	int *slot = &chip->subfeature_fd[subfeature->number];
+	int fd, old = -1;
+	char buf[32];
+	ssize_t len;
+
+	fd = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	if (fd < 0) {
+		char n[NAME_MAX];
+
+		snprintf(n, NAME_MAX, "%s/%s", chip->chip.path,
+			 subfeature->name);
+		if ((fd = open(n, O_RDONLY | O_CLOEXEC)) < 0)
+			return -SENSORS_ERR_KERNEL;
+
+		/* Another thread may have opened it in the meantime */
+		if (!__atomic_compare_exchange_n(slot, &old, fd, 0,
+						 __ATOMIC_ACQ_REL,
+						 __ATOMIC_ACQUIRE)) {
+			close(fd);
+			fd = old;
+		}
+	}
+
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (len < 0)
+		return errno == EIO ? -SENSORS_ERR_IO : -SENSORS_ERR_ACCESS_R;
+	buf[len] = '\0';
+
+	return sysfs_parse_value(buf, value);
+}
+
+static int sysfs_read_raw(const sensors_chip_features *chip,
+			  const sensors_subfeature *subfeature,
+			  double *value)
 {
 	char n[NAME_MAX];
 	FILE *f;
 
-	snprintf(n, NAME_MAX, "%s/%s", name->path, subfeature->name);
+	if (sensors_flags & SENSORS_FLAG_KEEP_FDS)
+		return sysfs_read_attr_fd(chip, subfeature, value);
+
+	snprintf(n, NAME_MAX, "%s/%s", chip->chip.path, subfeature->name);
 	if ((f = fopen(n, "r"))) {
 		int res, err = 0;
 
@@ -941,16 +1525,15 @@ int sensors_read_sysfs_attr(const sensors_chip_name *name,
 			else 
 				return -SENSORS_ERR_ACCESS_R;
 		}
-		*value /= get_type_scaling(subfeature->type);
 	} else
 		return -SENSORS_ERR_KERNEL;
 
 	return 0;
 }
 
-int sensors_write_sysfs_attr(const sensors_chip_name *name,
-			     const sensors_subfeature *subfeature,
-			     double value)
+static int sysfs_write_raw(const sensors_chip_name *name,
+			   const sensors_subfeature *subfeature,
+			   double value)
 {
 	char n[NAME_MAX];
 	FILE *f;
@@ -959,7 +1542,6 @@ int sensors_write_sysfs_attr(const sensors_chip_name *name,
 	if ((f = fopen(n, "w"))) {
 		int res, err = 0;
 
-		value *= get_type_scaling(subfeature->type);
 		res = fprintf(f, "%d", (int) value);
 		if (res == -EIO)
 			err = -SENSORS_ERR_IO;
@@ -980,3 +1562,197 @@ int sensors_write_sysfs_attr(const sensors_chip_name *name,
 
 	return 0;
 }
+
+/* The attribute file is opened once, to read the current value and to
+   write the new one. Writes are slow on some buses, and may have side
+   effects, so the current value is checked first. */
+static int sysfs_update_raw(const sensors_chip_features *chip,
+			    const sensors_subfeature *subfeature,
+			    double value)
+{
+	char n[NAME_MAX], buf[32];
+	double current;
+	int fd, len, res;
+
+	snprintf(n, NAME_MAX, "%s/%s", chip->chip.path, subfeature->name);
+	fd = open(n, (subfeature->flags & SENSORS_MODE_R ? O_RDWR : O_WRONLY) |
+		  O_CLOEXEC);
+	if (fd < 0)
+		return -SENSORS_ERR_KERNEL;
+
+	if (subfeature->flags & SENSORS_MODE_R) {
+		len = pread(fd, buf, sizeof(buf) - 1, 0);
+		if (len > 0) {
+			buf[len] = '\0';
+			if (!sysfs_parse_value(buf, &current) &&
+			    current == (int) value) {
+				close(fd);
+				return 0;
+			}
+		}
+	}
+
+	len = snprintf(buf, sizeof(buf), "%d", (int) value);
+	if (pwrite(fd, buf, len, 0) == len)
+		res = 1;
+	else
+		res = errno == EIO ? -SENSORS_ERR_IO : -SENSORS_ERR_ACCESS_W;
+	if (close(fd) && res > 0)
+		res = errno == EIO ? -SENSORS_ERR_IO : -SENSORS_ERR_ACCESS_W;
+	return res;
+}
+
+static int sysfs_read_label(const sensors_chip_name *name,
+			    const char *feature, char *buf, int size)
+{
+	FILE *f;
+	int len;
+
+	snprintf(buf, size, "%s/%s_label", name->path, feature);
+	if (!(f = fopen(buf, "r")))
+		return 0;
+	len = fread(buf, 1, size, f);
+	fclose(f);
+	if (len <= 0)
+		return 0;
+
+	/* len - 1 to strip the '\n' at the end */
+	buf[len - 1] = '\0';
+	return 1;
+}
+
+const sensors_backend sensors_sysfs_backend = {
+	.init		= sysfs_init,
+	.read_bus	= sysfs_read_bus,
+	.read_chips	= sysfs_read_chips,
+	.scan_device	= sysfs_scan_hwmon_device,
+	.read_raw	= sysfs_read_raw,
+	.write_raw	= sysfs_write_raw,
+	.update_raw	= sysfs_update_raw,
+	.read_label	= sysfs_read_label,
+};
+
+const sensors_backend *sensors_backend_ops = &sensors_sysfs_backend;
+
+int sensors_set_sysfs_root(const char *path)
+{
+	if (path && strlen(path) >= NAME_MAX)
+		return -SENSORS_ERR_NO_ENTRY;
+
+	snprintf(sysfs_root, NAME_MAX, "%s", path ? path : "");
+	sensors_free_capture();
+	sensors_backend_ops = &sensors_sysfs_backend;
+	return 0;
+}
+
+/* The rest of the library goes through the backend */
+
+int sensors_init_sysfs(void)
+{
+	return sensors_backend_ops->init();
+}
+
+int sensors_read_sysfs_chips(void)
+{
+	return sensors_backend_ops->read_chips();
+}
+
+int sensors_read_sysfs_bus(void)
+{
+	return sensors_backend_ops->read_bus();
+}
+
+int sensors_scan_hwmon_device(const char *path, sensors_chip_features *entry,
+			      sensors_arena *arena)
+{
+	return sensors_backend_ops->scan_device(path, entry, arena);
+}
+
+int sensors_read_sysfs_raw(const sensors_chip_features *chip,
+			   const sensors_subfeature *subfeature,
+			   double *value)
+{
+	struct timespec start;
+	int err;
+
+	if (chip->stats)
+		sensors_stats_start(&start);
+	if (chip->deadline && chip->backend == &sensors_sysfs_backend)
+		err = sensors_read_deadline(chip, subfeature, value);
+	else
+		err = chip->backend->read_raw(chip, subfeature, value);
+	if (chip->stats)
+		sensors_record_access(chip, subfeature, &start, 0, err);
+	if (sensors_capture_recording && !err)
+		sensors_record_value(&chip->chip, subfeature, *value);
+	return err;
+}
+
+int sensors_read_sysfs_attr(const sensors_chip_features *chip,
+			    const sensors_subfeature *subfeature,
+			    double *value)
+{
+	int err;
+
+	err = sensors_read_sysfs_raw(chip, subfeature, value);
+	if (err)
+		return err;
+	*value /= sensors_get_type_scaling(subfeature->type);
+	return 0;
+}
+
+int sensors_write_sysfs_attr(const sensors_chip_features *chip,
+			     const sensors_subfeature *subfeature,
+			     double value)
+{
+	struct timespec start;
+	int err;
+
+	value *= sensors_get_type_scaling(subfeature->type);
+	if (chip->stats)
+		sensors_stats_start(&start);
+	err = chip->backend->write_raw(&chip->chip, subfeature, value);
+	if (chip->stats)
+		sensors_record_access(chip, subfeature, &start, 1, err);
+	return err;
+}
+
+static int update_raw(const sensors_chip_features *chip,
+		      const sensors_subfeature *subfeature, double value)
+{
+	double current;
+	int err;
+
+	if (chip->backend->update_raw)
+		return chip->backend->update_raw(chip, subfeature, value);
+
+	if ((subfeature->flags & SENSORS_MODE_R) &&
+	    !chip->backend->read_raw(chip, subfeature, &current) &&
+	    current == (int) value)
+		return 0;
+	err = chip->backend->write_raw(&chip->chip, subfeature, value);
+	return err ? err : 1;
+}
+
+int sensors_update_sysfs_attr(const sensors_chip_features *chip,
+			      const sensors_subfeature *subfeature,
+			      double value)
+{
+	struct timespec start;
+	int res;
+
+	value *= sensors_get_type_scaling(subfeature->type);
+	if (chip->stats)
+		sensors_stats_start(&start);
+	res = update_raw(chip, subfeature, value);
+	if (chip->stats)
+		sensors_record_access(chip, subfeature, &start, res != 0,
+				      res < 0 ? res : 0);
+	return res;
+}
+
+int sensors_read_sysfs_label(const sensors_chip_features *chip,
+			     const char *feature, char *buf, int size)
+{
+	return chip->backend->read_label(&chip->chip, feature, buf, size);
+}
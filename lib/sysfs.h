@@ -22,22 +22,99 @@
 #ifndef LIB_SENSORS_SYSFS_H
 #define LIB_SENSORS_SYSFS_H
 
+/* Where sysfs is mounted, set by sensors_init_sysfs(). It is the
+   directory given to sensors_set_sysfs_root(), if any, or the root of the
+   tree of a capture. */
 extern char sensors_sysfs_mount[];
 
+/* How the library gets to the chips and their attributes. The discovery
+   functions below go through the backend in use, which is sysfs unless a
+   capture was loaded, the access functions through the backend of the
+   chip. Raw values are those found in the attribute files. */
+typedef struct sensors_backend {
+	/* Returns !0 if the backend can be used, 0 otherwise */
+	int (*init)(void);
+	int (*read_bus)(void);
+	int (*read_chips)(void);
+	/* Same as sensors_scan_hwmon_device() */
+	int (*scan_device)(const char *path, sensors_chip_features *entry,
+			   sensors_arena *arena);
+	int (*read_raw)(const sensors_chip_features *chip,
+			const sensors_subfeature *subfeature, double *value);
+	int (*write_raw)(const sensors_chip_name *name,
+			 const sensors_subfeature *subfeature, double value);
+	/* Same as sensors_update_sysfs_attr(), with a raw value. NULL if
+	   read_raw and write_raw do as well. */
+	int (*update_raw)(const sensors_chip_features *chip,
+			  const sensors_subfeature *subfeature, double value);
+	/* Same as sensors_read_sysfs_label() */
+	int (*read_label)(const sensors_chip_name *name, const char *feature,
+			  char *buf, int size);
+} sensors_backend;
+
+extern const sensors_backend sensors_sysfs_backend;
+extern const sensors_backend *sensors_backend_ops;
+
 int sensors_init_sysfs(void);
 
 int sensors_read_sysfs_chips(void);
 
 int sensors_read_sysfs_bus(void);
 
+/* Fill entry with the chip behind a hwmon class device, allocating
+   from arena. Returns the number of chips found (0 or 1), <0 on error. */
+int sensors_scan_hwmon_device(const char *path, sensors_chip_features *entry,
+			      sensors_arena *arena);
+
+/* Fill chip with the features of the attributes of a device, allocating
+   from arena. next() returns the name of the next attribute, or NULL when
+   there are no more, and get_mode() the SENSORS_MODE_* flags of the one
+   it last returned. Attributes which aren't subfeatures are ignored.
+   Returns 0. */
+int sensors_read_dynamic_chip(sensors_chip_features *chip,
+			      const char *(*next)(void *data),
+			      int (*get_mode)(void *data, const char *name),
+			      void *data, sensors_arena *arena);
+
+/* Get the path of a hwmon class device, as found when scanning, from its
+   sysfs path or from its path relative to the sysfs mount point. The
+   buffer must hold PATH_MAX bytes. Returns 0 on success, <0 if the path
+   can't be that of a class device or if it would be too long. */
+int sensors_get_hwmon_path(const char *path, char *class_path);
+
+/* Get the factor between the values of sysfs attribute files of a given
+   type and their values in standard units */
+int sensors_get_type_scaling(sensors_subfeature_type type);
+
+/* Read the value of a sysfs attribute file, as found in the file */
+int sensors_read_sysfs_raw(const sensors_chip_features *chip,
+			   const sensors_subfeature *subfeature,
+			   double *value);
+
+/* Read the value of the sysfs attribute file at path, with no other
+   access to the library data */
+int sensors_read_sysfs_path(const char *path, double *value);
+
 /* Read a value out of a sysfs attribute file */
-int sensors_read_sysfs_attr(const sensors_chip_name *name,
+int sensors_read_sysfs_attr(const sensors_chip_features *chip,
 			    const sensors_subfeature *subfeature,
 			    double *value);
 
 /* Write a value to a sysfs attribute file */
-int sensors_write_sysfs_attr(const sensors_chip_name *name,
+int sensors_write_sysfs_attr(const sensors_chip_features *chip,
 			     const sensors_subfeature *subfeature,
 			     double value);
 
+/* Write a value to a sysfs attribute file, unless the file can be read and
+   already holds it. Returns 1 if the value was written, 0 if it was
+   already there, <0 on error. */
+int sensors_update_sysfs_attr(const sensors_chip_features *chip,
+			      const sensors_subfeature *subfeature,
+			      double value);
+
+/* Read the label of a feature from its _label attribute into buf, which
+   holds size bytes. Returns 1 if the feature has a label, 0 otherwise. */
+int sensors_read_sysfs_label(const sensors_chip_features *chip,
+			     const char *feature, char *buf, int size);
+
 #endif /* def LIB_SENSORS_SYSFS_H */
@@ -0,0 +1,271 @@
+/*
+    table.c - Part of libsensors, a Linux library for reading sensor data.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/* The table is a frozen copy of the data about the subfeatures of all
+   detected chips, laid out as one array per field, so that reading many
+   values walks a few contiguous arrays instead of the chips, features and
+   subfeatures. All arrays live in a single block. The open attribute files
+   are kept in the table itself, the chips pointing to their part of it. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "sensors.h"
+#include "data.h"
+#include "error.h"
+#include "sysfs.h"
+#include "expr.h"
+#include "table.h"
+
+/* Values are converted in batches of this size */
+#define VALUES_BATCH	64
+
+struct sensors_table_data {
+	sensors_table pub;
+	void *block;
+	int *fd;
+	/* Linear form of the compute statement of each subfeature, the
+	   identity if it has none or it isn't linear */
+	double *div, *mul, *add;
+	/* Compiled compute statements, by program number */
+	const sensors_program **programs;
+};
+
+static const int no_chip_first;
+static const sensors_table empty_table = { .chip_first = &no_chip_first };
+
+static void *carve(char **p, size_t size)
+{
+	void *res = *p;
+
+	*p += size;
+	return res;
+}
+
+int sensors_table_has_fds(const int *fds)
+{
+	const struct sensors_table_data *t = sensors_proc_table;
+
+	return t && fds >= t->fd && fds <= t->fd + t->pub.subfeature_count;
+}
+
+void sensors_build_table(void)
+{
+	struct sensors_table_data *t;
+	sensors_chip_features *features;
+	const sensors_subfeature *sub;
+	const sensors_program *prog;
+	const sensors_chip_name **chip;
+	const sensors_subfeature **subfeature;
+	sensors_subfeature_type *type;
+	unsigned int *flags;
+	int *chip_first, *chip_nr, *mapping, *scaling, *program;
+	int chips = sensors_proc_chips_count, count = 0, feature_count = 0;
+	int i, j, k, base;
+	size_t size;
+	char *p;
+
+	for (i = 0; i < chips; i++) {
+		count += sensors_proc_chips[i].subfeature_count;
+		feature_count += sensors_proc_chips[i].feature_count;
+	}
+
+	/* Largest alignment first */
+	size = 3 * count * sizeof(double) +
+	       chips * sizeof(sensors_chip_name *) +
+	       count * sizeof(sensors_subfeature *) +
+	       feature_count * sizeof(sensors_program *) +
+	       count * sizeof(sensors_subfeature_type) +
+	       count * sizeof(unsigned int) +
+	       ((chips + 1) + 6 * count) * sizeof(int);
+	t = calloc(1, sizeof(struct sensors_table_data));
+	if (!t || !(t->block = malloc(size)))
+		sensors_fatal_error(__func__, "Out of memory");
+
+	p = t->block;
+	t->div = carve(&p, count * sizeof(double));
+	t->mul = carve(&p, count * sizeof(double));
+	t->add = carve(&p, count * sizeof(double));
+	chip = carve(&p, chips * sizeof(sensors_chip_name *));
+	subfeature = carve(&p, count * sizeof(sensors_subfeature *));
+	t->programs = carve(&p, feature_count * sizeof(sensors_program *));
+	type = carve(&p, count * sizeof(sensors_subfeature_type));
+	flags = carve(&p, count * sizeof(unsigned int));
+	chip_first = carve(&p, (chips + 1) * sizeof(int));
+	chip_nr = carve(&p, count * sizeof(int));
+	mapping = carve(&p, count * sizeof(int));
+	scaling = carve(&p, count * sizeof(int));
+	program = carve(&p, count * sizeof(int));
+	t->fd = carve(&p, count * sizeof(int));
+
+	/* Programs are numbered after the features, across all chips */
+	k = 0;
+	base = 0;
+	for (i = 0; i < chips; i++) {
+		features = &sensors_proc_chips[i];
+		chip[i] = &features->chip;
+		chip_first[i] = k;
+
+		for (j = 0; j < features->feature_count; j++)
+			t->programs[base + j] = features->compute ?
+						features->from_proc[j] : NULL;
+
+		for (j = 0; j < features->subfeature_count; j++, k++) {
+			sub = &features->subfeature[j];
+			chip_nr[k] = i;
+			subfeature[k] = sub;
+			type[k] = sub->type;
+			flags[k] = sub->flags;
+			mapping[k] = sub->mapping;
+			scaling[k] = sensors_get_type_scaling(sub->type);
+			t->fd[k] = features->subfeature_fd[j];
+
+			t->div[k] = t->mul[k] = 1.0;
+			t->add[k] = -0.0;
+			program[k] = -1;
+			if (!(sub->flags & SENSORS_COMPUTE_MAPPING) ||
+			    !(prog = t->programs[base + sub->mapping]))
+				continue;
+			program[k] = base + sub->mapping;
+			if (prog->linear) {
+				t->div[k] = prog->div;
+				t->mul[k] = prog->mul;
+				t->add[k] = prog->add;
+			}
+		}
+
+		if (!sensors_table_has_fds(features->subfeature_fd))
+			free(features->subfeature_fd);
+		features->subfeature_fd = &t->fd[chip_first[i]];
+		base += features->feature_count;
+	}
+	chip_first[chips] = k;
+
+	t->pub.chip_count = chips;
+	t->pub.subfeature_count = count;
+	t->pub.chip = chip;
+	t->pub.chip_first = chip_first;
+	t->pub.chip_nr = chip_nr;
+	t->pub.subfeature = subfeature;
+	t->pub.type = type;
+	t->pub.flags = flags;
+	t->pub.mapping = mapping;
+	t->pub.scaling = scaling;
+	t->pub.program = program;
+
+	sensors_free_table();
+	sensors_proc_table = t;
+}
+
+void sensors_free_table(void)
+{
+	if (!sensors_proc_table)
+		return;
+	free(sensors_proc_table->block);
+	free(sensors_proc_table);
+	sensors_proc_table = NULL;
+}
+
+const sensors_table *sensors_get_table(void)
+{
+	return sensors_proc_table ? &sensors_proc_table->pub : &empty_table;
+}
+
+int sensors_read_table(int first, int limit, const int *subfeat_nrs,
+		       int count, double *values, int *errors)
+{
+	const struct sensors_table_data *t = sensors_proc_table;
+	const sensors_program *prog;
+	double raw[VALUES_BATCH];
+	int idx[VALUES_BATCH], res[VALUES_BATCH];
+	int i, j, k, n, nr, start, err = 0;
+
+	for (start = 0; start < count; start += n) {
+		n = count - start < VALUES_BATCH ? count - start : VALUES_BATCH;
+
+		for (j = 0; j < n; j++) {
+			nr = subfeat_nrs ? subfeat_nrs[start + j] : start + j;
+			raw[j] = 0.0;
+			if (nr < 0 || nr >= limit) {
+				idx[j] = -1;
+				res[j] = -SENSORS_ERR_NO_ENTRY;
+				continue;
+			}
+			k = idx[j] = first + nr;
+			if (!(t->pub.flags[k] & SENSORS_MODE_R))
+				res[j] = -SENSORS_ERR_ACCESS_R;
+			else
+				res[j] = sensors_read_sysfs_raw(
+					&sensors_proc_chips[t->pub.chip_nr[k]],
+					t->pub.subfeature[k], &raw[j]);
+		}
+
+		/* Scaling and linear compute statements, for the whole batch.
+		   The operations are those of sensors_read_sysfs_attr() and
+		   sensors_run_linear(), so the results are the same. */
+		if (!subfeat_nrs && start + n <= limit) {
+			k = first + start;
+			for (j = 0; j < n; j++)
+				raw[j] = raw[j] / t->pub.scaling[k + j] /
+					 t->div[k + j] * t->mul[k + j] +
+					 t->add[k + j];
+		} else {
+			for (j = 0; j < n; j++) {
+				if (res[j])
+					continue;
+				k = idx[j];
+				raw[j] = raw[j] / t->pub.scaling[k] /
+					 t->div[k] * t->mul[k] + t->add[k];
+			}
+		}
+
+		/* Other compute statements go through the evaluator */
+		for (j = 0; j < n; j++) {
+			i = start + j;
+			if (!res[j]) {
+				k = idx[j];
+				prog = t->pub.program[k] < 0 ? NULL :
+				       t->programs[t->pub.program[k]];
+				if (prog && !prog->linear)
+					res[j] = sensors_run_program(
+						&sensors_proc_chips[t->pub.chip_nr[k]],
+						prog, raw[j], &values[i]);
+				else
+					values[i] = raw[j];
+			}
+			if (errors)
+				errors[i] = res[j];
+			if (res[j])
+				err = res[j];
+		}
+	}
+	return err;
+}
+
+int sensors_get_table_values(int first, int count, double *values,
+			     int *errors)
+{
+	int i, total = sensors_get_table()->subfeature_count;
+
+	if (first < 0 || count < 0 || first > total || count > total - first) {
+		for (i = 0; errors && i < count; i++)
+			errors[i] = -SENSORS_ERR_NO_ENTRY;
+		return -SENSORS_ERR_NO_ENTRY;
+	}
+	return sensors_read_table(first, count, NULL, count, values, errors);
+}
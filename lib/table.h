@@ -0,0 +1,43 @@
+/*
+    table.h - Part of libsensors, a Linux library for reading sensor data.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef LIB_SENSORS_TABLE_H
+#define LIB_SENSORS_TABLE_H
+
+/* Build the table of the subfeatures of the detected chips again. This
+   must be done whenever chips were added or removed, or bound again. The
+   open attribute files of the chips are moved to the new table. */
+void sensors_build_table(void);
+
+/* Free the table. The attribute files must have been closed already. */
+void sensors_free_table(void);
+
+/* Check whether an array of open attribute files is part of the table,
+   otherwise it belongs to its chip */
+int sensors_table_has_fds(const int *fds);
+
+/* Read the values of count subfeatures, with the conversions done in
+   batches. The subfeatures are given by their numbers relative to the
+   global number first, which are valid below limit. If subfeat_nrs is
+   NULL, they are numbered 0 to count - 1. Returns 0 if all values were
+   read, <0 on failure. */
+int sensors_read_table(int first, int limit, const int *subfeat_nrs,
+		       int count, double *values, int *errors);
+
+#endif /* def LIB_SENSORS_TABLE_H */
@@ -1,8 +1,8 @@
 LIB_DIR		:= lib
 LIB_TEST_DIR	:= lib/test
 
-LIB_TEST_TARGETS := $(LIB_TEST_DIR)/test-scanner
-LIB_TEST_SOURCES := $(LIB_TEST_DIR)/test-scanner.c
+LIB_TEST_TARGETS := $(LIB_TEST_DIR)/test-scanner $(LIB_TEST_DIR)/test-compiled
+LIB_TEST_SOURCES := $(LIB_TEST_DIR)/test-scanner.c $(LIB_TEST_DIR)/test-compiled.c
 
 LIB_TEST_SCANNER_OBJS := \
 	$(LIB_TEST_DIR)/test-scanner.ro \
@@ -13,10 +13,15 @@ LIB_TEST_SCANNER_OBJS := \
 $(LIB_TEST_DIR)/test-scanner: $(LIB_TEST_SCANNER_OBJS)
 	$(CC) $(EXLDFLAGS) -o $@ $(LIB_TEST_SCANNER_OBJS) -Llib
 
+# Linked statically, as it uses the internals of the library
+$(LIB_TEST_DIR)/test-compiled: $(LIB_TEST_DIR)/test-compiled.ro $(LIBSTOBJECTS)
+	$(CC) $(EXLDFLAGS) -o $@ $(LIB_TEST_DIR)/test-compiled.ro $(LIBSTOBJECTS) -lm -lpthread -lrt
+
 all-lib-test: $(LIB_TEST_TARGETS)
 user :: all-lib-test
 
 $(LIB_TEST_DIR)/test-scanner.ro: $(LIB_DIR)/data.h $(LIB_DIR)/conf.h $(LIB_DIR)/conf-parse.h $(LIB_DIR)/scanner.h
+$(LIB_TEST_DIR)/test-compiled.ro: $(LIB_DIR)/data.h $(LIB_DIR)/compiled.h $(LIB_DIR)/sensors.h $(LIB_DIR)/error.h
 
 clean-lib-test:
 	$(RM) $(LIB_TEST_DIR)/*.rd $(LIB_TEST_DIR)/*.ro 
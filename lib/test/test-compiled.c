@@ -0,0 +1,351 @@
+/*
+    test-compiled.c - Regression test driver for the libsensors compiled
+    configurations.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/* Each configuration file given on the command line is loaded as is, then
+   compiled and loaded again, and both must give the same configuration:
+   the same chips with the same label, set, compute and ignore statements,
+   the same chip names once the bus statements are substituted, and the
+   same parse errors. The busses are those of a small sysfs tree created
+   for the test. Compiled configurations which are corrupt or stale must
+   be refused. Run from lib/test as "./test-compiled *.conf", the results
+   are printed in TAP format. */
+
+/* this define needed for open_memstream() and mkdtemp() */
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../sensors.h"
+#include "../error.h"
+#include "../data.h"
+#include "../compiled.h"
+
+/* Where the parse errors are reported */
+static FILE *dump_out;
+static int tests, failures;
+
+static void ok(int cond, const char *desc, const char *name)
+{
+	printf("%sok %d - %s: %s\n", cond ? "" : "not ", ++tests, desc, name);
+	if (!cond)
+		failures++;
+}
+
+static void dump_error(const char *err, const char *filename, int lineno)
+{
+	fprintf(dump_out, "error %s:%d: %s\n", filename ? filename : "-",
+		lineno, err);
+}
+
+static void dump_line(FILE *out, const sensors_config_line *line)
+{
+	fprintf(out, " at %s:%d\n", line->filename ? line->filename : "-",
+		line->lineno);
+}
+
+static void dump_expr(FILE *out, const sensors_expr *expr)
+{
+	if (!expr) {
+		fputs("-", out);
+		return;
+	}
+
+	switch (expr->kind) {
+	case sensors_kind_val:
+		fprintf(out, "%.17g", expr->data.val);
+		break;
+	case sensors_kind_source:
+		fputs("@", out);
+		break;
+	case sensors_kind_var:
+		fputs(expr->data.var, out);
+		break;
+	case sensors_kind_sub:
+		fprintf(out, "(%d ", expr->data.subexpr.op);
+		dump_expr(out, expr->data.subexpr.sub1);
+		fputs(" ", out);
+		dump_expr(out, expr->data.subexpr.sub2);
+		fputs(")", out);
+		break;
+	}
+}
+
+static void dump_config(FILE *out)
+{
+	const sensors_chip *chip;
+	const sensors_chip_name *name;
+	int i, j;
+
+	for (i = 0; i < sensors_config_files_count; i++)
+		fprintf(out, "file %s\n", sensors_config_files[i]);
+
+	for (i = 0; i < sensors_config_chips_count; i++) {
+		chip = &sensors_config_chips[i];
+		fputs("chip", out);
+		dump_line(out, &chip->line);
+		for (j = 0; j < chip->chips.fits_count; j++) {
+			name = &chip->chips.fits[j];
+			fprintf(out, "  name %s %d %d %d\n", name->prefix ?
+				name->prefix : "-", name->bus.type,
+				name->bus.nr, name->addr);
+		}
+		for (j = 0; j < chip->labels_count; j++) {
+			fprintf(out, "  label %s \"%s\"", chip->labels[j].name,
+				chip->labels[j].value);
+			dump_line(out, &chip->labels[j].line);
+		}
+		for (j = 0; j < chip->sets_count; j++) {
+			fprintf(out, "  set %s ", chip->sets[j].name);
+			dump_expr(out, chip->sets[j].value);
+			dump_line(out, &chip->sets[j].line);
+		}
+		for (j = 0; j < chip->computes_count; j++) {
+			fprintf(out, "  compute %s ", chip->computes[j].name);
+			dump_expr(out, chip->computes[j].from_proc);
+			fputs(", ", out);
+			dump_expr(out, chip->computes[j].to_proc);
+			dump_line(out, &chip->computes[j].line);
+		}
+		for (j = 0; j < chip->ignores_count; j++) {
+			fprintf(out, "  ignore %s", chip->ignores[j].name);
+			dump_line(out, &chip->ignores[j].line);
+		}
+	}
+}
+
+/* Load a configuration, return a dump of it and of the parse errors */
+static char *load(const char *filename, int *res)
+{
+	FILE *input;
+	char *dump;
+	size_t len;
+
+	input = fopen(filename, "r");
+	if (!input) {
+		perror(filename);
+		exit(1);
+	}
+	dump_out = open_memstream(&dump, &len);
+	*res = sensors_init(input);
+	fclose(input);
+	fprintf(dump_out, "result %d\n", *res);
+	if (!*res) {
+		dump_config(dump_out);
+		sensors_cleanup();
+	}
+	fclose(dump_out);
+	return dump;
+}
+
+/* Compile a configuration, return a dump of the parse errors */
+static char *compile(const char *filename, const char *compiled, int *res)
+{
+	FILE *input;
+	char *dump;
+	size_t len;
+
+	input = fopen(filename, "r");
+	if (!input) {
+		perror(filename);
+		exit(1);
+	}
+	dump_out = open_memstream(&dump, &len);
+	*res = sensors_compile_config(input, compiled);
+	fclose(input);
+	fprintf(dump_out, "result %d\n", *res);
+	fclose(dump_out);
+	return dump;
+}
+
+/* Copy a compiled configuration, truncating it to len bytes if len is
+   not 0, and flipping the bits of the byte at offset flip if it is not
+   negative */
+static void copy_damaged(const char *from, const char *to, off_t len,
+			 off_t flip)
+{
+	FILE *input, *output;
+	off_t i;
+	int c;
+
+	if (!(input = fopen(from, "r")) || !(output = fopen(to, "w"))) {
+		perror(to);
+		exit(1);
+	}
+	for (i = 0; (c = getc(input)) != EOF && (!len || i < len); i++)
+		putc(i == flip ? c ^ 0xff : c, output);
+	fclose(input);
+	fclose(output);
+}
+
+static void check_refused(const char *compiled, const char *desc,
+			  const char *name)
+{
+	char *dump;
+	int res;
+
+	dump = load(compiled, &res);
+	ok(res == -SENSORS_ERR_PARSE &&
+	   strstr(dump, "Invalid compiled configuration"), desc, name);
+	free(dump);
+}
+
+/* The default compiled configuration is only used if it was compiled from
+   the default configuration files as they are now, which a configuration
+   compiled from another file never was */
+static void check_stale(const char *compiled, const char *name)
+{
+	sensors_context *ctx, *old;
+	int fd, res, err;
+
+	fd = open(compiled, O_RDONLY);
+	if (fd < 0) {
+		perror(compiled);
+		exit(1);
+	}
+	ctx = sensors_context_new();
+	old = sensors_use_context(ctx);
+	res = sensors_load_compiled_config(fd, 1, &err);
+	sensors_use_context(old);
+	sensors_context_free(ctx);
+	close(fd);
+	ok(res != 0, "stale sources refused", name);
+}
+
+static void check_file(const char *name, const char *compiled,
+		       const char *damaged)
+{
+	char *text, *comp, *loaded;
+	struct stat st;
+	int text_res, comp_res, res;
+
+	text = load(name, &text_res);
+	comp = compile(name, compiled, &comp_res);
+
+	/* A file which can't be parsed can't be compiled either */
+	if (comp_res) {
+		ok(text_res && !strcmp(comp, text), "compile errors", name);
+		free(text);
+		free(comp);
+		return;
+	}
+	free(comp);
+
+	loaded = load(compiled, &res);
+	ok(!strcmp(loaded, text), "same configuration", name);
+	if (strcmp(loaded, text))
+		printf("# text:\n%s# compiled:\n%s", text, loaded);
+	free(loaded);
+	free(text);
+
+	if (stat(compiled, &st)) {
+		perror(compiled);
+		exit(1);
+	}
+	copy_damaged(compiled, damaged, 0, st.st_size - 1);
+	check_refused(damaged, "corrupt data refused", name);
+	copy_damaged(compiled, damaged, st.st_size - 1, -1);
+	check_refused(damaged, "truncated file refused", name);
+	/* The version of the format follows the magic */
+	copy_damaged(compiled, damaged, 0, 8);
+	check_refused(damaged, "other format version refused", name);
+	check_stale(compiled, name);
+
+	unlink(damaged);
+	unlink(compiled);
+}
+
+/* Make a sysfs tree with a few i2c adapters, for the bus statements */
+static void make_sysfs(char *root)
+{
+	static const char *adapters[][2] = {
+		{ "i2c-1", "SMBus I801 adapter at f000" },
+		{ "i2c-3", "SMBus PIIX4 adapter at 0b00" },
+	};
+	char path[PATH_MAX];
+	FILE *f;
+	int i;
+
+	if (!mkdtemp(root)) {
+		perror(root);
+		exit(1);
+	}
+	snprintf(path, sizeof(path), "%s/class", root);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/class/hwmon", root);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/class/i2c-adapter", root);
+	mkdir(path, 0755);
+	for (i = 0; i < (int)(sizeof(adapters) / sizeof(adapters[0])); i++) {
+		snprintf(path, sizeof(path), "%s/class/i2c-adapter/%s", root,
+			 adapters[i][0]);
+		mkdir(path, 0755);
+		snprintf(path, sizeof(path), "%s/class/i2c-adapter/%s/name",
+			 root, adapters[i][0]);
+		if (!(f = fopen(path, "w"))) {
+			perror(path);
+			exit(1);
+		}
+		fprintf(f, "%s\n", adapters[i][1]);
+		fclose(f);
+	}
+}
+
+static void remove_sysfs(const char *root)
+{
+	char cmd[PATH_MAX + 16];
+
+	snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+	if (system(cmd))
+		fprintf(stderr, "Couldn't remove %s\n", root);
+}
+
+int main(int argc, char *argv[])
+{
+	char root[] = "/tmp/test-compiled.XXXXXX";
+	char compiled[PATH_MAX], damaged[PATH_MAX];
+	int i;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s FILE...\n", argv[0]);
+		return 1;
+	}
+
+	make_sysfs(root);
+	if (sensors_set_sysfs_root(root)) {
+		fprintf(stderr, "Couldn't use %s\n", root);
+		remove_sysfs(root);
+		return 1;
+	}
+	snprintf(compiled, sizeof(compiled), "%s/sensors.conf.bin", root);
+	snprintf(damaged, sizeof(damaged), "%s/damaged.conf.bin", root);
+	sensors_parse_error_wfn = dump_error;
+
+	for (i = 1; i < argc; i++)
+		check_file(argv[i], compiled, damaged);
+	printf("1..%d\n", tests);
+
+	remove_sysfs(root);
+	return failures ? 1 : 0;
+}
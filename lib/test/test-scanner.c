@@ -26,6 +26,8 @@
 #include "../scanner.h"
 
 YYSTYPE sensors_yylval;
+sensors_context sensors_default_context;
+__thread sensors_context *sensors_thread_context;
 
 int main(void)
 {
@@ -84,7 +86,6 @@ int main(void)
 	
 			case NAME:
 				printf("NAME: %s\n", sensors_yylval.name);
-				free(sensors_yylval.name);
 				break;
 	
 			case ERROR:
@@ -100,6 +101,8 @@ int main(void)
 
 	/* clean up the scanner */
 	sensors_scanner_exit();
+	sensors_scanner_forget_names();
+	sensors_arena_free(&sensors_config_arena);
 
 	return 0;
 }
@@ -27,6 +27,8 @@
 	isadump 0x2e 0x2f 0x09		Super-I/O, logical device 9
 	isadump -f 0x5000		Flat address space dump like for Via 686a
 	isadump -f 0xecf0 0x10 1	PC87366, temperature channel 2
+	isadump -r 0x295 0x296 0-7	Winbond dump, banks 0 to 7, one
+					register per line
 */
 
 #include <sys/io.h>
@@ -45,15 +47,17 @@ static void help(void)
 {
 	fprintf(stderr,
 	        "Syntax for I2C-like access:\n"
-	        "  isadump [OPTIONS] [-k V1,V2...] ADDRREG DATAREG [BANK [BANKREG]]\n"
+	        "  isadump [OPTIONS] [-k V1,V2...] ADDRREG DATAREG [BANK[-LAST] [BANKREG]]\n"
 	        "Syntax for flat address space:\n"
-	        "  isadump -f [OPTIONS] ADDRESS [RANGE [BANK [BANKREG]]]\n"
+	        "  isadump -f [OPTIONS] ADDRESS [RANGE [BANK[-LAST] [BANKREG]]]\n"
 		"Options:\n"
 		"  -k	Super-I/O configuration access key\n"
 		"  -f	Enable flat address space mode\n"
 		"  -y	Assume affirmative answer to all questions\n"
 		"  -W	Read and display word (16-bit) values\n"
-		"  -L	Read and display long (32-bit) values\n");
+		"  -L	Read and display long (32-bit) values\n"
+		"  -b	Read all registers before displaying them\n"
+		"  -r	Display one register per line (implies -b)\n");
 }
 
 static int default_bankreg(int flat, int addrreg, int datareg)
@@ -87,19 +91,101 @@ static int set_bank(int flat, int addrreg, int datareg, int bank, int bankreg)
 	return oldbank;
 }
 
+/* Registers read in batch mode, by bank */
+static unsigned long regs[32][256];
+
+/* Format the column headers into buf, return the length */
+static int format_header(char *buf, int flat, int width)
+{
+	char *p = buf;
+	int j;
+
+	p += sprintf(p, "%*s", flat ? 5 : 3, "");
+	for (j = 0; j < 16; j += width)
+		p += sprintf(p, " %*x", width * 2, j);
+	*p++ = '\n';
+	return p - buf;
+}
+
+/* Format the row of registers starting at i into buf, return the length */
+static int format_row(char *buf, int flat, int addrreg, int i, int width,
+		      const unsigned long *row)
+{
+	char *p = buf;
+	int j;
+
+	if (flat)
+		p += sprintf(p, "%04x: ", addrreg + i);
+	else
+		p += sprintf(p, "%02x: ", i);
+	for (j = 0; j < 16; j += width)
+		p += sprintf(p, "%0*lx ", width * 2, row[j]);
+	*p++ = '\n';
+	return p - buf;
+}
+
+/* Format all the registers read at once, and write them in one go */
+static void print_batch(int flat, int addrreg, int range, int width,
+			int bank, int banks, int raw)
+{
+	char *out, *p;
+	int b, i, j;
+
+	/* A line holds at most 16 values of 3 characters and an address,
+	   or a bank, register and value */
+	out = malloc(raw ? banks * range * 24 + 1 :
+			   banks * (range / 16 + 3) * 80);
+	if (!out) {
+		fprintf(stderr, "Error: Out of memory!\n");
+		exit(1);
+	}
+	p = out;
+
+	if (!raw && banks == 1)
+		p += format_header(p, flat, width);
+	for (b = 0; b < banks; b++) {
+		if (!raw && banks > 1) {
+			p += sprintf(p, "%sBank %d:\n", b ? "\n" : "",
+				     bank + b);
+			p += format_header(p, flat, width);
+		}
+		for (i = 0; i < range; i += 16) {
+			if (!raw) {
+				p += format_row(p, flat, addrreg, i, width,
+						regs[b] + i);
+				continue;
+			}
+			for (j = 0; j < 16; j += width) {
+				if (bank >= 0)
+					p += sprintf(p, "%02x ", bank + b);
+				else
+					p += sprintf(p, "- ");
+				p += sprintf(p, flat ? "%04x %0*lx\n" :
+					     "%02x %0*lx\n",
+					     flat ? addrreg + i + j : i + j,
+					     width * 2, regs[b][i + j]);
+			}
+		}
+	}
+
+	fwrite(out, 1, p - out, stdout);
+	free(out);
+}
+
 int main(int argc, char *argv[])
 {
 	int addrreg;        /* address in flat mode */
 	int datareg = 0;    /* unused in flat mode */
 	int range = 256;    /* can be changed only in flat mode */
 	int bank = -1;      /* -1 means no bank operation */
+	int banks = 1;      /* number of banks to dump, from bank on */
 	int bankreg;
 	int oldbank = 0;
-	int i, j;
+	int b, i, j;
 	unsigned long res;
 	int flags = 0;
-	int flat = 0, yes = 0, width = 1;
-	char *end;
+	int flat = 0, yes = 0, width = 1, batch = 0, raw = 0;
+	char *end, line[80];
 	unsigned char enter_key[SUPERIO_MAX_KEY+1];
 
 	enter_key[0] = 0;
@@ -120,6 +206,8 @@ int main(int argc, char *argv[])
 			break;
 		case 'W': width = 2; break;
 		case 'L': width = 4; break;
+		case 'b': batch = 1; break;
+		case 'r': batch = raw = 1; break;
 		default:
 			fprintf(stderr, "Warning: Unsupported flag "
 				"\"-%c\"!\n", argv[1+flags][1]);
@@ -188,12 +276,18 @@ int main(int argc, char *argv[])
 
 	if (1+flags+2 < argc) {
 		bank = strtol(argv[1+flags+2], &end, 0);
+		if (*end == '-') {
+			/* A range of banks, read in batch mode */
+			banks = strtol(end + 1, &end, 0) - bank + 1;
+			batch = 1;
+		}
 		if (*end) {
 			fprintf(stderr, "Error: Invalid bank number!\n");
 			help();
 			exit(1);
 		}
-		if ((bank < 0) || (bank > 31)) {
+		if ((bank < 0) || (bank > 31) || (banks < 1)
+		 || (bank + banks - 1 > 31)) {
 			fprintf(stderr, "Error: bank out of range (0-31)!\n");
 			help();
 			exit(1);
@@ -233,7 +327,11 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "I will probe address register 0x%x "
 			        "and data register 0x%x.\n", addrreg, datareg);
 
-		if (bank>=0) 	
+		if (bank>=0 && banks>1)
+			fprintf(stderr, "Probing banks %d to %d using bank "
+			        "register 0x%02x.\n", bank, bank + banks - 1,
+			        bankreg);
+		else if (bank>=0)
 			fprintf(stderr, "Probing bank %d using bank register "
 			        "0x%02x.\n", bank, bankreg);
 
@@ -257,6 +355,12 @@ int main(int argc, char *argv[])
 			        "register!\n");
 			exit(1);
 		}
+	} else if (flat && addrreg + range <= 0x400) {
+		if (ioperm(addrreg, range, 1)) {
+			fprintf(stderr, "Error: Could not ioperm() address "
+			        "range!\n");
+			exit(1);
+		}
 	} else {
 		if (iopl(3)) {
 			fprintf(stderr, "Error: Could not do iopl(3)!\n");
@@ -269,45 +373,57 @@ int main(int argc, char *argv[])
 	if (enter_key[0])
 		superio_write_key(addrreg, enter_key);
 
-	if (bank >= 0)
-		oldbank = set_bank(flat, addrreg, datareg, bank, bankreg);
-
 	/* print column headers */
-	printf("%*s", flat ? 5 : 3, "");
-	for (j = 0; j < 16; j += width)
-		printf(" %*x", width * 2, j);
-	printf("\n");
+	if (!batch)
+		fwrite(line, 1, format_header(line, flat, width), stdout);
+
+	for (b = 0; b < banks; b++) {
+		if (bank >= 0) {
+			i = set_bank(flat, addrreg, datareg, bank + b,
+				     bankreg);
+			if (!b)
+				oldbank = i;
+		}
 
-	for (i = 0; i < range; i += 16) {
-		if (flat)
-			printf("%04x: ", addrreg + i);
-		else
-			printf("%02x: ", i);
-
-		/* It was noticed that Winbond Super-I/O chips
-		   would leave the configuration mode after
-		   an arbitrary number of register reads,
-		   causing any subsequent read attempt to
-		   silently fail. Repeating the key every 16 reads
-		   prevents that. */
-		if (enter_key[0])
-			superio_write_key(addrreg, enter_key);
-
-		for (j = 0; j < 16; j += width) {
-			fflush(stdout);
-			if (flat) {
-				res = inx(addrreg + i + j, width);
-			} else {	
-				outb(i+j, addrreg);
-				if (i+j == 0 && inb(addrreg) == 0x80) {
-					/* Bit 7 appears to be a busy flag */
-					range = 128;
+		for (i = 0; i < range; i += 16) {
+			/* Unless in batch mode, each value is printed as
+			   soon as it is read, so that the last value
+			   read before a hang is shown */
+			if (!batch && flat)
+				printf("%04x: ", addrreg + i);
+			else if (!batch)
+				printf("%02x: ", i);
+
+			/* It was noticed that Winbond Super-I/O chips
+			   would leave the configuration mode after
+			   an arbitrary number of register reads,
+			   causing any subsequent read attempt to
+			   silently fail. Repeating the key every 16 reads
+			   prevents that. */
+			if (enter_key[0])
+				superio_write_key(addrreg, enter_key);
+
+			for (j = 0; j < 16; j += width) {
+				if (!batch)
+					fflush(stdout);
+				if (flat) {
+					res = inx(addrreg + i + j, width);
+				} else {
+					outb(i+j, addrreg);
+					if (i+j == 0 && inb(addrreg) == 0x80) {
+						/* Bit 7 appears to be a busy
+						   flag */
+						range = 128;
+					}
+					res = inx(datareg, width);
 				}
-				res = inx(datareg, width);
+				regs[b][i + j] = res;
+				if (!batch)
+					printf("%0*lx ", width * 2, res);
 			}
-			printf("%0*lx ", width * 2, res);
+			if (!batch)
+				printf("\n");
 		}
-		printf("\n");
 	}
 
 	/* Restore the original bank value */
@@ -318,5 +434,8 @@ int main(int argc, char *argv[])
 	if (enter_key[0])
 		superio_reset(addrreg, datareg);
 
+	if (batch)
+		print_batch(flat, addrreg, range, width, bank, banks, raw);
+
 	exit(0);
 }
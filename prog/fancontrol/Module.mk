@@ -0,0 +1,55 @@
+#  Module.mk - Makefile for a Linux module for reading sensor data.
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#  MA 02110-1301 USA.
+
+# The compiled fancontrol is installed instead of the fancontrol script,
+# and shares its manual page (see prog/pwm/Module.mk).
+
+# Note that MODULE_DIR (the directory in which this file resides) is a
+# 'simply expanded variable'. That means that its value is substituted
+# verbatim in the rules, until it is redefined. 
+MODULE_DIR := prog/fancontrol
+PROGFANCONTROLDIR := $(MODULE_DIR)
+
+# Regrettably, even 'simply expanded variables' will not put their currently
+# defined value verbatim into the command-list of rules...
+PROGFANCONTROLTARGETS := $(MODULE_DIR)/fancontrol
+PROGFANCONTROLSOURCES := $(MODULE_DIR)/fancontrol.c
+
+# Include all dependency files. We use '.rd' to indicate this will create
+# executables.
+INCLUDEFILES += $(PROGFANCONTROLSOURCES:.c=.rd)
+
+REMOVEFANCONTROLBIN := $(patsubst $(MODULE_DIR)/%,$(DESTDIR)$(SBINDIR)/%,$(PROGFANCONTROLTARGETS))
+
+$(PROGFANCONTROLTARGETS): $(PROGFANCONTROLSOURCES:.c=.ro)
+	$(CC) $(EXLDFLAGS) -o $@ $(PROGFANCONTROLSOURCES:.c=.ro) -lm -lrt
+
+all-prog-fancontrol: $(PROGFANCONTROLTARGETS)
+user :: all-prog-fancontrol
+
+install-prog-fancontrol: all-prog-fancontrol
+	$(MKDIR) $(DESTDIR)$(SBINDIR)
+	$(INSTALL) -m 755 $(PROGFANCONTROLTARGETS) $(DESTDIR)$(SBINDIR)
+user_install :: install-prog-fancontrol
+
+user_uninstall::
+	$(RM) $(REMOVEFANCONTROLBIN)
+
+clean-prog-fancontrol:
+	$(RM) $(PROGFANCONTROLDIR)/*.rd $(PROGFANCONTROLDIR)/*.ro 
+	$(RM) $(PROGFANCONTROLTARGETS)
+clean :: clean-prog-fancontrol
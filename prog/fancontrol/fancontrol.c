@@ -0,0 +1,1012 @@
+/*
+ * fancontrol
+ *
+ * Temperature dependent fan speed control. This is a compiled version of
+ * the fancontrol script, which reads the same configuration file. The
+ * attribute files are opened once and read and written in place on every
+ * cycle, and cycles are run on a fixed schedule, so that the control loop
+ * keeps up even when the system is loaded.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "version.h"
+
+#define PROGRAM		"fancontrol"
+#define VERSION		LM_VERSION
+#define CONFIGFILE	"/etc/fancontrol"
+#define PIDFILE		"/var/run/fancontrol.pid"
+#define MAX		255
+#define MAX_FANS	8
+
+/* Configuration variables, in the order of the configuration file */
+enum {
+	INTERVAL, DEVPATH, DEVNAME, FCTEMPS, MINTEMP, MAXTEMP, MINSTART,
+	MINSTOP, FCFANS, MINPWM, MAXPWM, AVERAGE, HYSTERESIS, PIDTARGET,
+	PIDKP, PIDKI, PIDKD, SETTING_COUNT
+};
+
+static const char *const settingNames[SETTING_COUNT] = {
+	"INTERVAL", "DEVPATH", "DEVNAME", "FCTEMPS", "MINTEMP", "MAXTEMP",
+	"MINSTART", "MINSTOP", "FCFANS", "MINPWM", "MAXPWM", "AVERAGE",
+	"HYSTERESIS", "PIDTARGET", "PIDKP", "PIDKI", "PIDKD"
+};
+
+/* A device=value pair of a configuration variable */
+typedef struct {
+	char *key;
+	char *value;
+} Entry;
+
+typedef struct {
+	Entry *entries;
+	int count;
+} Setting;
+
+typedef struct {
+	char *pwm;		/* Attribute paths, relative to dir */
+	char *temp;
+	char *fans[MAX_FANS];
+	int fanCount;
+
+	long minTemp, maxTemp;	/* In millidegrees */
+	int minStart, minStop, minPwm, maxPwm;
+	int average;
+	long hysteresis;	/* In millidegrees, 0 if disabled */
+	int pid;		/* PID control between MINTEMP and MAXTEMP */
+	double target, kp, ki, kd;
+
+	int pwmFd, tempFd, fanFds[MAX_FANS];
+	long *history;		/* The last temperature readings */
+	int historyCount, historyPos;
+
+	int hasLast;		/* The last value set, for hysteresis */
+	long lastTemp;
+	int lastPwm;
+
+	int hasError;		/* PID state */
+	double integral, lastError;
+
+	int saved;		/* Values before we started */
+	int origEnable, origPwm;
+} Channel;
+
+static Setting settings[SETTING_COUNT];
+static Channel *channels;
+static int channelCount;
+static double interval;
+static const char *dir;
+static int debug;
+static int pidFileCreated;
+
+static volatile sig_atomic_t stopping;
+static volatile sig_atomic_t stopStatus;
+
+static void *xmalloc(size_t size)
+{
+	void *p = calloc(1, size);
+
+	if (!p) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+static char *xstrdup(const char *s)
+{
+	char *p = strdup(s);
+
+	if (!p) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+static void configError(const char *pwm, const char *fmt, const char *arg)
+{
+	if (pwm)
+		fprintf(stderr, "Error in configuration file (%s):\n", pwm);
+	else
+		fprintf(stderr, "Error in configuration file:\n");
+	fprintf(stderr, fmt, arg);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+/*
+ * Configuration file
+ */
+
+/* Split a value into its whitespace separated device=value pairs */
+static void addEntries(Setting *setting, char *value)
+{
+	char *token, *save, *eq;
+
+	for (token = strtok_r(value, " \t\n", &save); token;
+	     token = strtok_r(NULL, " \t\n", &save)) {
+		setting->entries = realloc(setting->entries,
+					   (setting->count + 1) *
+					   sizeof(Entry));
+		if (!setting->entries) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		eq = strchr(token, '=');
+		if (eq)
+			*eq = '\0';
+		setting->entries[setting->count].key = token;
+		setting->entries[setting->count].value = eq ? eq + 1 : NULL;
+		setting->count++;
+	}
+}
+
+static void loadConfig(const char *path)
+{
+	char line[4096];
+	size_t len;
+	FILE *f;
+	int i;
+
+	printf("Loading configuration from %s ...\n", path);
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Error: Can't read configuration file\n");
+		exit(1);
+	}
+
+	/* Several lines setting the same variable add up */
+	while (fgets(line, sizeof(line), f)) {
+		for (i = 0; i < SETTING_COUNT; i++) {
+			len = strlen(settingNames[i]);
+			if (!strncmp(line, settingNames[i], len) &&
+			    line[len] == '=') {
+				addEntries(&settings[i],
+					   xstrdup(line + len + 1));
+				break;
+			}
+		}
+	}
+	fclose(f);
+}
+
+/* Value of a single-valued variable */
+static const char *getGlobal(int setting)
+{
+	if (!settings[setting].count)
+		return NULL;
+	return settings[setting].entries[0].key;
+}
+
+/* Value of a variable for a given PWM output */
+static const char *getValue(int setting, const char *pwm)
+{
+	int i;
+
+	for (i = 0; i < settings[setting].count; i++)
+		if (settings[setting].entries[i].value &&
+		    !strcmp(settings[setting].entries[i].key, pwm))
+			return settings[setting].entries[i].value;
+	return NULL;
+}
+
+static int getInt(int setting, const char *pwm, int def, int *val)
+{
+	const char *s = getValue(setting, pwm);
+	char *end;
+	long l;
+
+	if (!s) {
+		if (def < 0)
+			configError(pwm, "%s is not set", settingNames[setting]);
+		*val = def;
+		return 0;
+	}
+	errno = 0;
+	l = strtol(s, &end, 10);
+	if (errno || *end || end == s || l < INT_MIN || l > INT_MAX)
+		configError(pwm, "%s must be an integer",
+			    settingNames[setting]);
+	*val = l;
+	return 1;
+}
+
+static int getDouble(int setting, const char *pwm, double *val)
+{
+	const char *s = getValue(setting, pwm);
+	char *end;
+
+	*val = 0;
+	if (!s)
+		return 0;
+	*val = strtod(s, &end);
+	if (*end || end == s || !isfinite(*val))
+		configError(pwm, "%s must be a number", settingNames[setting]);
+	return 1;
+}
+
+static void setupChannel(Channel *ch, const Entry *entry)
+{
+	const char *fans;
+	char *p, *save;
+	int val;
+
+	if (!entry->value)
+		configError(NULL, "FCTEMPS value is improperly formatted",
+			    NULL);
+	ch->pwm = xstrdup(entry->key);
+	ch->temp = xstrdup(entry->value);
+	fans = getValue(FCFANS, ch->pwm);
+	if (fans && *fans) {
+		/* A given PWM output can control several fans */
+		p = xstrdup(fans);
+		for (p = strtok_r(p, "+", &save); p;
+		     p = strtok_r(NULL, "+", &save)) {
+			if (ch->fanCount == MAX_FANS)
+				configError(ch->pwm, "Too many fans", NULL);
+			ch->fans[ch->fanCount++] = p;
+		}
+	}
+
+	getInt(MINTEMP, ch->pwm, -1, &val);
+	ch->minTemp = val * 1000L;
+	getInt(MAXTEMP, ch->pwm, -1, &val);
+	ch->maxTemp = val * 1000L;
+	getInt(MINSTART, ch->pwm, -1, &ch->minStart);
+	getInt(MINSTOP, ch->pwm, -1, &ch->minStop);
+	getInt(MINPWM, ch->pwm, 0, &ch->minPwm);
+	getInt(MAXPWM, ch->pwm, MAX, &ch->maxPwm);
+	getInt(AVERAGE, ch->pwm, 1, &ch->average);
+	getInt(HYSTERESIS, ch->pwm, 0, &val);
+	ch->hysteresis = val * 1000L;
+
+	ch->pid = getDouble(PIDTARGET, ch->pwm, &ch->target);
+	if (!ch->pid && (getValue(PIDKP, ch->pwm) || getValue(PIDKI, ch->pwm) ||
+			 getValue(PIDKD, ch->pwm)))
+		configError(ch->pwm, "PID gains require a PIDTARGET", NULL);
+	getDouble(PIDKP, ch->pwm, &ch->kp);
+	getDouble(PIDKI, ch->pwm, &ch->ki);
+	getDouble(PIDKD, ch->pwm, &ch->kd);
+
+	/* Verify the validity of the settings */
+	if (ch->minTemp >= ch->maxTemp)
+		configError(ch->pwm, "MINTEMP must be less than MAXTEMP", NULL);
+	if (ch->maxPwm > MAX)
+		configError(ch->pwm, "MAXPWM must be at most 255", NULL);
+	if (ch->minStop >= ch->maxPwm)
+		configError(ch->pwm, "MINSTOP must be less than MAXPWM", NULL);
+	if (ch->minStop < ch->minPwm)
+		configError(ch->pwm, "MINSTOP must be greater than or equal "
+			    "to MINPWM", NULL);
+	if (ch->minPwm < 0)
+		configError(ch->pwm, "MINPWM must be at least 0", NULL);
+	if (ch->average < 1)
+		configError(ch->pwm, "AVERAGE must be at least 1", NULL);
+	if (ch->hysteresis < 0)
+		configError(ch->pwm, "HYSTERESIS must be at least 0", NULL);
+
+	ch->history = xmalloc(ch->average * sizeof(long));
+	ch->pwmFd = ch->tempFd = -1;
+
+	printf("\nSettings for %s:\n", ch->pwm);
+	printf("  Depends on %s\n", ch->temp);
+	printf("  Controls %s\n", fans ? fans : "");
+	printf("  MINTEMP=%ld\n", ch->minTemp / 1000);
+	printf("  MAXTEMP=%ld\n", ch->maxTemp / 1000);
+	printf("  MINSTART=%d\n", ch->minStart);
+	printf("  MINSTOP=%d\n", ch->minStop);
+	printf("  MINPWM=%d\n", ch->minPwm);
+	printf("  MAXPWM=%d\n", ch->maxPwm);
+	printf("  AVERAGE=%d\n", ch->average);
+	if (ch->hysteresis)
+		printf("  HYSTERESIS=%ld\n", ch->hysteresis / 1000);
+	if (ch->pid)
+		printf("  PIDTARGET=%g PIDKP=%g PIDKI=%g PIDKD=%g\n",
+		       ch->target, ch->kp, ch->ki, ch->kd);
+}
+
+static void parseConfig(void)
+{
+	const char *s;
+	char *end;
+	int i;
+
+	/* Check whether all mandatory settings are set */
+	if (!getGlobal(INTERVAL) || !settings[FCTEMPS].count ||
+	    !settings[MINTEMP].count || !settings[MAXTEMP].count ||
+	    !settings[MINSTART].count || !settings[MINSTOP].count) {
+		fprintf(stderr, "Some mandatory settings missing, please "
+			"check your config file!\n");
+		exit(1);
+	}
+	s = getGlobal(INTERVAL);
+	interval = strtod(s, &end);
+	if (*end || end == s || !(interval > 0) || interval > 86400)
+		configError(NULL, "INTERVAL must be a positive number of "
+			    "seconds", NULL);
+
+	printf("\nCommon settings:\n");
+	printf("  INTERVAL=%s\n", s);
+
+	channelCount = settings[FCTEMPS].count;
+	channels = xmalloc(channelCount * sizeof(Channel));
+	for (i = 0; i < channelCount; i++)
+		setupChannel(&channels[i], &settings[FCTEMPS].entries[i]);
+	printf("\n");
+}
+
+/*
+ * Devices
+ */
+
+static int readFileString(const char *path, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+	buf[len] = '\0';
+	return 0;
+}
+
+static int parseLong(const char *buf, long *val)
+{
+	char *end;
+
+	errno = 0;
+	*val = strtol(buf, &end, 10);
+	if (errno || end == buf || (*end && !isspace((unsigned char)*end)))
+		return -1;
+	return 0;
+}
+
+static int readFileInt(const char *path, int *val)
+{
+	char buf[32];
+	long l;
+
+	if (readFileString(path, buf, sizeof(buf)) || parseLong(buf, &l))
+		return -1;
+	*val = l;
+	return 0;
+}
+
+static int writeFileInt(const char *path, int val)
+{
+	char buf[16];
+	int fd, len, ret;
+
+	fd = open(path, O_WRONLY | O_TRUNC);
+	if (fd < 0)
+		return -1;
+	len = snprintf(buf, sizeof(buf), "%d\n", val);
+	ret = write(fd, buf, len) == len ? 0 : -1;
+	if (close(fd))
+		ret = -1;
+	return ret;
+}
+
+/* Attributes are read and written at offset 0 of their open file */
+static int readFd(int fd, long *val)
+{
+	char buf[32];
+	ssize_t len;
+
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (len < 0)
+		return -1;
+	buf[len] = '\0';
+	return parseLong(buf, val);
+}
+
+static int writeFd(int fd, int val)
+{
+	char buf[16];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%d\n", val);
+	return pwrite(fd, buf, len, 0) == len ? 0 : -1;
+}
+
+static int devicePath(const char *device, char *buf, size_t size)
+{
+	char path[PATH_MAX], real[PATH_MAX];
+
+	buf[0] = '\0';
+	snprintf(path, sizeof(path), "%s/device", device);
+	if (!realpath(path, real))
+		return 0;
+	snprintf(buf, size, "%s",
+		 strncmp(real, "/sys/", 5) ? real : real + 5);
+	return 0;
+}
+
+static void deviceName(const char *device, char *buf, size_t size)
+{
+	char path[PATH_MAX];
+	size_t len;
+	char *p;
+
+	snprintf(path, sizeof(path), "%s/name", device);
+	if (readFileString(path, buf, size)) {
+		snprintf(path, sizeof(path), "%s/device/name", device);
+		if (readFileString(path, buf, size))
+			buf[0] = '\0';
+	}
+	len = strlen(buf);
+	while (len && buf[len - 1] == '\n')
+		buf[--len] = '\0';
+	for (p = buf; *p; p++)
+		if (isspace((unsigned char)*p) || *p == '=')
+			*p = '_';
+}
+
+static int validateDevices(void)
+{
+	char buf[PATH_MAX];
+	const Entry *e;
+	int i, outdated = 0;
+
+	for (i = 0; i < settings[DEVPATH].count; i++) {
+		e = &settings[DEVPATH].entries[i];
+		devicePath(e->key, buf, sizeof(buf));
+		if (strcmp(buf, e->value ? e->value : "")) {
+			fprintf(stderr, "Device path of %s has changed\n",
+				e->key);
+			outdated = 1;
+		}
+	}
+
+	for (i = 0; i < settings[DEVNAME].count; i++) {
+		e = &settings[DEVNAME].entries[i];
+		deviceName(e->key, buf, sizeof(buf));
+		if (strcmp(buf, e->value ? e->value : "")) {
+			fprintf(stderr, "Device name of %s has changed\n",
+				e->key);
+			outdated = 1;
+		}
+	}
+
+	return outdated;
+}
+
+/* Replace all occurrences of from with to in *s */
+static void replace(char **s, const char *from, const char *to)
+{
+	size_t flen = strlen(from), tlen = strlen(to);
+	char *p, *r;
+
+	while ((p = strstr(*s, from))) {
+		r = xmalloc(strlen(*s) - flen + tlen + 1);
+		memcpy(r, *s, p - *s);
+		strcpy(r + (p - *s), to);
+		strcat(r, p + flen);
+		printf("Adjusting %s -> %s\n", *s, r);
+		free(*s);
+		*s = r;
+	}
+}
+
+/* Some drivers moved their attributes from hard device to class device */
+static void fixupFiles(void)
+{
+	char path[PATH_MAX], from[PATH_MAX];
+	const char *device;
+	int i, j, k;
+
+	for (i = 0; i < settings[DEVPATH].count; i++) {
+		device = settings[DEVPATH].entries[i].key;
+		snprintf(path, sizeof(path), "%s/name", device);
+		if (access(path, F_OK))
+			continue;
+
+		snprintf(from, sizeof(from), "%s/device", device);
+		for (j = 0; j < channelCount; j++) {
+			replace(&channels[j].pwm, from, device);
+			replace(&channels[j].temp, from, device);
+			for (k = 0; k < channels[j].fanCount; k++)
+				replace(&channels[j].fans[k], from, device);
+		}
+	}
+}
+
+/* Check that all referenced sysfs files exist */
+static int checkFiles(void)
+{
+	int i, j, outdated = 0;
+
+	for (i = 0; i < channelCount; i++) {
+		if (access(channels[i].pwm, W_OK)) {
+			fprintf(stderr, "Error: file %s doesn't exist\n",
+				channels[i].pwm);
+			outdated = 1;
+		}
+	}
+	for (i = 0; i < channelCount; i++) {
+		if (access(channels[i].temp, R_OK)) {
+			fprintf(stderr, "Error: file %s doesn't exist\n",
+				channels[i].temp);
+			outdated = 1;
+		}
+	}
+	for (i = 0; i < channelCount; i++) {
+		for (j = 0; j < channels[i].fanCount; j++) {
+			if (access(channels[i].fans[j], R_OK)) {
+				fprintf(stderr, "Error: file %s doesn't "
+					"exist\n", channels[i].fans[j]);
+				outdated = 1;
+			}
+		}
+	}
+
+	if (outdated)
+		fprintf(stderr, "\nAt least one referenced file is missing. "
+			"Either some required kernel\nmodules haven't been "
+			"loaded, or your configuration file is outdated.\n"
+			"In the latter case, you should run pwmconfig "
+			"again.\n");
+
+	return outdated;
+}
+
+static void findDir(void)
+{
+	const char *pwm = channels[0].pwm;
+	const char *p;
+
+	/* Detect path to sensors */
+	if (pwm[0] == '/') {
+		dir = "/";
+	} else if (!strncmp(pwm, "hwmon", 5) && isdigit((unsigned char)pwm[5])) {
+		dir = "/sys/class/hwmon";
+	} else {
+		/* Bus number, dash, address */
+		for (p = pwm; isdigit((unsigned char)*p); p++)
+			;
+		if (p == pwm || *p != '-' || !isxdigit((unsigned char)p[1]) ||
+		    !isxdigit((unsigned char)p[2]) ||
+		    !isxdigit((unsigned char)p[3]) ||
+		    !isxdigit((unsigned char)p[4])) {
+			fprintf(stderr, "%s: Invalid path to sensors\n",
+				PROGRAM);
+			exit(1);
+		}
+		dir = "/sys/bus/i2c/devices";
+	}
+
+	if (chdir(dir)) {
+		fprintf(stderr, "%s: No sensors found! (did you load the "
+			"necessary modules?)\n", PROGRAM);
+		exit(1);
+	}
+}
+
+/*
+ * PWM outputs
+ */
+
+static void enableFile(const Channel *ch, char *buf, size_t size)
+{
+	snprintf(buf, size, "%s_enable", ch->pwm);
+}
+
+static int pwmEnable(Channel *ch)
+{
+	char enable[PATH_MAX];
+	int origEnable, origPwm;
+
+	enableFile(ch, enable, sizeof(enable));
+	if (!access(enable, F_OK)) {
+		/* Save the original state, to restore it when we quit */
+		if (!readFileInt(enable, &origEnable) &&
+		    !readFileInt(ch->pwm, &origPwm)) {
+			if (debug) {
+				printf("Saving %s original value as %d\n",
+				       enable, origEnable);
+				printf("Saving %s original value as %d\n",
+				       ch->pwm, origPwm);
+			}
+			ch->origEnable = origEnable;
+			ch->origPwm = origPwm;
+			ch->saved = 1;
+		}
+		/* Enable manual control by fancontrol */
+		if (writeFileInt(enable, 1))
+			return -1;
+	}
+	return writeFileInt(ch->pwm, MAX);
+}
+
+static int pwmDisable(const Channel *ch)
+{
+	char enable[PATH_MAX];
+	int val;
+
+	enableFile(ch, enable, sizeof(enable));
+
+	/* No enable file? Just set to max */
+	if (access(enable, F_OK))
+		return writeFileInt(ch->pwm, MAX) ? 1 : 0;
+
+	/*
+	 * Try to restore the pwmN and pwmN_enable values as they were before
+	 * we started, pwmN first, as some chips need this to properly restore
+	 * fan operation when switching to automatic mode.
+	 */
+	if (ch->saved) {
+		if (debug)
+			printf("Restoring %s original value of %d\n",
+			       ch->pwm, ch->origPwm);
+		writeFileInt(ch->pwm, ch->origPwm);
+		/* Setting 1 again might reset the pwmN value */
+		if (ch->origEnable != 1) {
+			if (debug)
+				printf("Restoring %s original value of %d\n",
+				       enable, ch->origEnable);
+			writeFileInt(enable, ch->origEnable);
+			if (!readFileInt(enable, &val) &&
+			    val == ch->origEnable)
+				return 0;
+		} else if (!readFileInt(ch->pwm, &val) && val == ch->origPwm) {
+			return 0;
+		}
+	}
+
+	/* Try pwmN_enable=0 */
+	writeFileInt(enable, 0);
+	if (!readFileInt(enable, &val) && val == 0)
+		return 0;
+
+	/* It didn't work, try pwmN_enable=1 pwmN=255 */
+	writeFileInt(enable, 1);
+	writeFileInt(ch->pwm, MAX);
+	if (!readFileInt(enable, &val) && val == 1 &&
+	    !readFileInt(ch->pwm, &val) && val >= 190)
+		return 0;
+
+	/* Nothing worked */
+	if (readFileInt(enable, &val))
+		fprintf(stderr, "%s stuck\n", enable);
+	else
+		fprintf(stderr, "%s stuck to %d\n", enable, val);
+	return 1;
+}
+
+static void restoreFans(int status)
+{
+	int i;
+
+	printf("Aborting, restoring fans...\n");
+	for (i = 0; i < channelCount; i++)
+		pwmDisable(&channels[i]);
+	printf("Verify fans have returned to full speed\n");
+	if (pidFileCreated)
+		unlink(PIDFILE);
+	exit(status);
+}
+
+static void openFiles(Channel *ch)
+{
+	int i;
+
+	ch->pwmFd = open(ch->pwm, O_RDWR | O_CLOEXEC);
+	ch->tempFd = open(ch->temp, O_RDONLY | O_CLOEXEC);
+	for (i = 0; i < ch->fanCount; i++)
+		ch->fanFds[i] = open(ch->fans[i], O_RDONLY | O_CLOEXEC);
+	if (ch->pwmFd < 0 || ch->tempFd < 0) {
+		fprintf(stderr, "Error opening %s/%s: %s\n", dir,
+			ch->pwmFd < 0 ? ch->pwm : ch->temp, strerror(errno));
+		restoreFans(1);
+	}
+	for (i = 0; i < ch->fanCount; i++) {
+		if (ch->fanFds[i] < 0) {
+			fprintf(stderr, "Error opening %s/%s: %s\n", dir,
+				ch->fans[i], strerror(errno));
+			restoreFans(1);
+		}
+	}
+}
+
+/*
+ * Control loop
+ */
+
+static void signalHandler(int sig)
+{
+	stopStatus = sig == SIGHUP || sig == SIGINT;
+	stopping = 1;
+}
+
+static void initSignals(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = signalHandler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGQUIT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+}
+
+static void addTime(struct timespec *ts, double seconds)
+{
+	ts->tv_sec += (time_t)seconds;
+	ts->tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+/* Sleep until the given time, unless a signal asks us to stop */
+static void sleepUntil(const struct timespec *ts)
+{
+	while (!stopping &&
+	       clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, ts, NULL) ==
+	       EINTR)
+		;
+}
+
+static void sleepFor(double seconds)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	addTime(&ts, seconds);
+	sleepUntil(&ts);
+}
+
+/* Average of the last AVERAGE readings */
+static long averageTemp(Channel *ch, long temp)
+{
+	long sum = 0;
+	int i;
+
+	ch->history[ch->historyPos] = temp;
+	ch->historyPos = (ch->historyPos + 1) % ch->average;
+	if (ch->historyCount < ch->average)
+		ch->historyCount++;
+	for (i = 0; i < ch->historyCount; i++)
+		sum += ch->history[i];
+	return sum / ch->historyCount;
+}
+
+/*
+ * PID output above MINSTOP, from the error in degrees. The integral term
+ * is kept within the output range, so that it doesn't wind up while the
+ * fan is at either end.
+ */
+static int pidPwm(Channel *ch, long temp)
+{
+	double error = (temp - ch->target * 1000) / 1000, out;
+	double range = ch->maxPwm - ch->minStop;
+
+	ch->integral += ch->ki * error * interval;
+	if (ch->integral < 0)
+		ch->integral = 0;
+	else if (ch->integral > range)
+		ch->integral = range;
+	out = ch->kp * error + ch->integral;
+	if (ch->hasError)
+		out += ch->kd * (error - ch->lastError) / interval;
+	ch->lastError = error;
+	ch->hasError = 1;
+
+	if (out <= 0)
+		return ch->minPwm;
+	if (out >= range)
+		return ch->maxPwm;
+	return ch->minStop + (int)(out + 0.5);
+}
+
+static void updateChannel(Channel *ch)
+{
+	long tempLast, temp, pwmPrev, fan, minFan;
+	int i, pwm, inRange = 0, pidOut = 0;
+
+	if (readFd(ch->tempFd, &tempLast)) {
+		printf("Error reading temperature from %s/%s\n", dir, ch->temp);
+		restoreFans(1);
+	}
+	if (readFd(ch->pwmFd, &pwmPrev)) {
+		printf("Error reading PWM value from %s/%s\n", dir, ch->pwm);
+		restoreFans(1);
+	}
+	temp = averageTemp(ch, tempLast);
+
+	/* If fan speed inputs are configured, we can tell a stopped fan */
+	minFan = ch->fanCount ? 100000 : 1;
+	for (i = 0; i < ch->fanCount; i++) {
+		if (readFd(ch->fanFds[i], &fan)) {
+			fprintf(stderr, "Error reading Fan value from %s/%s\n",
+				dir, ch->fans[i]);
+			restoreFans(1);
+		}
+		if (fan < minFan)
+			minFan = fan;
+	}
+
+	/* The PID state is updated on every cycle */
+	if (ch->pid)
+		pidOut = pidPwm(ch, temp);
+
+	if (temp <= ch->minTemp) {
+		pwm = ch->minPwm;	/* below min temp, use defined min pwm */
+	} else if (temp >= ch->maxTemp) {
+		pwm = ch->maxPwm;	/* over max temp, use defined max pwm */
+	} else {
+		inRange = 1;
+		if (ch->pid)
+			pwm = pidOut;
+		else
+			pwm = (temp - ch->minTemp) *
+			      (ch->maxPwm - ch->minStop) /
+			      (ch->maxTemp - ch->minTemp) + ch->minStop;
+	}
+
+	/* Don't slow down until the temperature dropped by HYSTERESIS */
+	if (ch->hysteresis && ch->hasLast && pwm < ch->lastPwm &&
+	    ch->lastTemp - temp < ch->hysteresis) {
+		pwm = ch->lastPwm;
+	} else {
+		ch->lastTemp = temp;
+		ch->lastPwm = pwm;
+		ch->hasLast = 1;
+	}
+
+	if (debug) {
+		printf("pwmo=%s\n", ch->pwm);
+		printf("tsens=%s\n", ch->temp);
+		printf("tlastval=%ld\n", tempLast);
+		printf("tval=%ld\n", temp);
+		printf("pwmpval=%ld\n", pwmPrev);
+		printf("min_fanval=%ld\n", minFan);
+	}
+
+	/* If the fan was stopped, start it using a safe value */
+	if (inRange && (pwmPrev == 0 || minFan == 0)) {
+		writeFd(ch->pwmFd, ch->minStart);
+		sleepFor(1);
+	}
+	if (writeFd(ch->pwmFd, pwm)) {
+		fprintf(stderr, "Error writing PWM value to %s/%s\n", dir,
+			ch->pwm);
+		restoreFans(1);
+	}
+	if (debug)
+		printf("new pwmval=%d\n", pwm);
+}
+
+static void createPidFile(void)
+{
+	char buf[16];
+	int fd, len;
+
+	fd = open(PIDFILE, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) {
+		if (errno == EEXIST)
+			fprintf(stderr, "File %s exists, is fancontrol "
+				"already running?\n", PIDFILE);
+		else
+			fprintf(stderr, "Error creating %s: %s\n", PIDFILE,
+				strerror(errno));
+		exit(1);
+	}
+	len = snprintf(buf, sizeof(buf), "%d\n", (int)getpid());
+	if (write(fd, buf, len) != len || close(fd)) {
+		fprintf(stderr, "Error writing %s\n", PIDFILE);
+		unlink(PIDFILE);
+		exit(1);
+	}
+	pidFileCreated = 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec next, now;
+	const char *env;
+	int i;
+
+	if (argc > 1 && (!strcmp(argv[1], "-v") ||
+			 !strcmp(argv[1], "--version"))) {
+		printf("%s version %s\n", PROGRAM, VERSION);
+		return 0;
+	}
+
+	/* Messages are usually logged, don't hold them back */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	env = getenv("DEBUG");
+	debug = env && *env;
+
+	loadConfig(argc > 1 && !access(argv[1], F_OK) ? argv[1] : CONFIGFILE);
+	parseConfig();
+	findDir();
+
+	/* Check for configuration change */
+	if (strcmp(dir, "/") &&
+	    (!settings[DEVPATH].count || !settings[DEVNAME].count)) {
+		fprintf(stderr, "Configuration is too old, please run "
+			"pwmconfig again\n");
+		exit(1);
+	}
+	if (!strcmp(dir, "/") && settings[DEVPATH].count) {
+		fprintf(stderr, "Unneeded DEVPATH with absolute device paths\n");
+		exit(1);
+	}
+	if (validateDevices()) {
+		fprintf(stderr, "Configuration appears to be outdated, please "
+			"run pwmconfig again\n");
+		exit(1);
+	}
+	if (!strcmp(dir, "/sys/class/hwmon"))
+		fixupFiles();
+	if (checkFiles())
+		exit(1);
+
+	createPidFile();
+	initSignals();
+
+	printf("Enabling PWM on fans...\n");
+	for (i = 0; i < channelCount; i++) {
+		if (pwmEnable(&channels[i])) {
+			fprintf(stderr, "Error enabling PWM on %s/%s\n", dir,
+				channels[i].pwm);
+			restoreFans(1);
+		}
+	}
+	for (i = 0; i < channelCount; i++)
+		openFiles(&channels[i]);
+
+	printf("Starting automatic fan control...\n");
+
+	/* Cycles are kept on a fixed schedule, unless we fell behind */
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!stopping) {
+		for (i = 0; i < channelCount && !stopping; i++)
+			updateChannel(&channels[i]);
+
+		addTime(&next, interval);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > next.tv_sec ||
+		    (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec))
+			next = now;
+		sleepUntil(&next);
+	}
+
+	restoreFans(stopStatus);
+	return 0;
+}
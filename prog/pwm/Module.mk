@@ -22,8 +22,13 @@ PROGPWMDIR := $(MODULE_DIR)
 PROGPWMMAN8DIR := $(MANDIR)/man8
 PROGPWMMAN8FILES := $(MODULE_DIR)/fancontrol.8 $(MODULE_DIR)/pwmconfig.8
 
-PROGPWMTARGETS := $(MODULE_DIR)/fancontrol \
-                  $(MODULE_DIR)/pwmconfig
+PROGPWMTARGETS := $(MODULE_DIR)/pwmconfig
+
+# The fancontrol script is replaced by the compiled version when
+# PROG_EXTRA includes fancontrol
+ifeq (,$(filter fancontrol,$(PROG_EXTRA)))
+PROGPWMTARGETS += $(MODULE_DIR)/fancontrol
+endif
 
 # The vt1211_pwm script is not installed by default, pass VT1211_PWM=1
 # to get it 
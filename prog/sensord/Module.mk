@@ -32,7 +32,7 @@ PROGSENSORDMAN8FILES := $(MODULE_DIR)/sensord.8
 # Regrettably, even 'simply expanded variables' will not put their currently
 # defined value verbatim into the command-list of rules...
 PROGSENSORDTARGETS := $(MODULE_DIR)/sensord
-PROGSENSORDSOURCES := $(MODULE_DIR)/args.c $(MODULE_DIR)/chips.c $(MODULE_DIR)/lib.c $(MODULE_DIR)/rrd.c $(MODULE_DIR)/sense.c $(MODULE_DIR)/sensord.c
+PROGSENSORDSOURCES := $(MODULE_DIR)/args.c $(MODULE_DIR)/chips.c $(MODULE_DIR)/history.c $(MODULE_DIR)/hotplug.c $(MODULE_DIR)/lib.c $(MODULE_DIR)/metrics.c $(MODULE_DIR)/rrd.c $(MODULE_DIR)/sampler.c $(MODULE_DIR)/sense.c $(MODULE_DIR)/sensord.c $(MODULE_DIR)/shm.c
 
 # Include all dependency files. We use '.rd' to indicate this will create
 # executables.
@@ -42,7 +42,7 @@ REMOVESENSORDBIN := $(patsubst $(MODULE_DIR)/%,$(DESTDIR)$(SBINDIR)/%,$(PROGSENS
 REMOVESENSORDMAN := $(patsubst $(MODULE_DIR)/%,$(DESTDIR)$(PROGSENSORDMAN8DIR)/%,$(PROGSENSORDMAN8FILES))
 
 $(PROGSENSORDTARGETS): $(PROGSENSORDSOURCES:.c=.ro) lib/$(LIBSHBASENAME)
-	$(CC) $(EXLDFLAGS) -o $@ $(PROGSENSORDSOURCES:.c=.ro) -Llib -lsensors -lrrd
+	$(CC) $(EXLDFLAGS) -o $@ $(PROGSENSORDSOURCES:.c=.ro) -Llib -lsensors -lrrd -lpthread -lrt -lm
 
 all-prog-sensord: $(PROGSENSORDTARGETS)
 user :: all-prog-sensord
@@ -37,6 +37,12 @@ struct sensord_arguments sensord_args = {
  	.scanTime = 60,
  	.logTime = 30 * 60,
  	.rrdTime = 5 * 60,
+	.rrdBatch = 1,
+	.metricsTime = 10,
+	.historyTime = 1,
+	.historyLength = 60 * 60,
+	.sampleThreads = 4,
+	.deadbands = { 0.02, 50, 0.5 },
  	.syslogFacility = LOG_DAEMON,
 };
 
@@ -89,13 +95,122 @@ static int parseFacility(char *arg)
 	return facilities[i].id;
 }
 
+/* Parse <chip>=<time> */
+static int parseChipInterval(char *arg)
+{
+	char *sep = strrchr(arg, '=');
+	int n = sensord_args.numIntervalChips, time, err;
+
+	if (!sep) {
+		fprintf(stderr, "Error parsing chip interval `%s'.\n", arg);
+		return -1;
+	}
+	if (n == MAX_CHIP_NAMES) {
+		fprintf(stderr, "Too many chip intervals.\n");
+		return -1;
+	}
+	if ((time = parseTime(sep + 1)) < 0)
+		return -1;
+
+	*sep = '\0';
+	err = sensors_parse_chip_name(arg, &sensord_args.intervalChips[n]);
+	*sep = '=';
+	if (err) {
+		fprintf(stderr, "Invalid chip name `%s': %s\n", arg,
+			sensors_strerror(err));
+		return -1;
+	}
+	sensord_args.intervalTimes[n] = time;
+	sensord_args.numIntervalChips++;
+
+	return 0;
+}
+
+/* Parse <chip>=<seconds> */
+static int parseReadDeadline(char *arg)
+{
+	char *sep = strrchr(arg, '='), *end;
+	int n = sensord_args.numDeadlineChips, err;
+	double time;
+
+	if (!sep) {
+		fprintf(stderr, "Error parsing read deadline `%s'.\n", arg);
+		return -1;
+	}
+	if (n == MAX_CHIP_NAMES) {
+		fprintf(stderr, "Too many read deadlines.\n");
+		return -1;
+	}
+	time = strtod(sep + 1, &end);
+	if (end == sep + 1 || *end || !(time > 0)) {
+		fprintf(stderr, "Error parsing time value `%s'.\n", sep + 1);
+		return -1;
+	}
+
+	*sep = '\0';
+	err = sensors_parse_chip_name(arg, &sensord_args.deadlineChips[n]);
+	*sep = '=';
+	if (err) {
+		fprintf(stderr, "Invalid chip name `%s': %s\n", arg,
+			sensors_strerror(err));
+		return -1;
+	}
+	sensord_args.deadlineTimes[n] = time;
+	sensord_args.numDeadlineChips++;
+
+	return 0;
+}
+
+/* Parse <type>=<value> */
+static int parseDeadband(char *arg)
+{
+	static const char *types[] = { "voltage", "rpm", "temperature" };
+	char *sep = strchr(arg, '='), *end;
+	double value;
+	int i;
+
+	for (i = 0; sep && i < ARRAY_SIZE(types); i++)
+		if (!strncmp(arg, types[i], sep - arg) &&
+		    !types[i][sep - arg])
+			break;
+	if (!sep || i == ARRAY_SIZE(types)) {
+		fprintf(stderr, "Error parsing deadband `%s'.\n", arg);
+		return -1;
+	}
+	value = strtod(sep + 1, &end);
+	if (end == sep + 1 || *end || value < 0) {
+		fprintf(stderr, "Error parsing deadband value `%s'.\n",
+			sep + 1);
+		return -1;
+	}
+	sensord_args.deadbands[i] = value;
+
+	return 0;
+}
+
 static const char *daemonSyntax =
 	"  -i, --interval <time>     -- interval between scanning alarms (default 60s)\n"
+	"  -e, --alarm-events        -- also wait for alarm notifications\n"
+	"  -u, --hotplug             -- follow the addition and removal of chips\n"
 	"  -l, --log-interval <time> -- interval between logging sensors (default 30m)\n"
+	"  -s, --sample-interval <time> -- sample chips in the background (default 0)\n"
+	"  -S, --chip-interval <chip>=<time> -- sampling interval of some chips\n"
+	"  -w, --sample-threads <n>  -- number of sampling threads (default 4)\n"
+	"  -x, --max-sample-interval <time> -- back off sampling of stable sensors\n"
+	"  -D, --deadband <type>=<value> -- changes ignored when backing off\n"
+	"  -R, --read-deadline <chip>=<seconds> -- fail slower reads of some chips\n"
+	"  -n, --snapshot <name>     -- publish samples in shared memory\n"
 	"  -t, --rrd-interval <time> -- interval between updating RRD file (default 5m)\n"
 	"  -1, --oneline             -- log chip, adapter, and sensor data on one line\n"
 	"  -T, --rrd-no-average      -- switch RRD in non-average mode\n"
+	"  -b, --rrd-batch <n>       -- number of RRD updates to write at once (default 1)\n"
 	"  -r, --rrd-file <file>     -- RRD file (default <none>)\n"
+	"  -k, --rrd-shard <chip|n>  -- split the RRD file by chip or every n sensors\n"
+	"  -m, --metrics <[addr:]port> -- serve Prometheus metrics over HTTP\n"
+	"  -M, --metrics-interval <time> -- interval between sampling metrics (default 10s)\n"
+	"  -H, --history <socket>    -- keep recent readings, queried on a unix socket\n"
+	"  -I, --history-interval <time> -- interval between history samples (default 1s)\n"
+	"  -L, --history-length <time> -- how long history is kept (default 1h)\n"
 	"  -c, --config-file <file>  -- configuration file\n"
 	"  -p, --pid-file <file>     -- PID file (default /var/run/sensord.pid)\n"
 	"  -f, --syslog-facility <f> -- syslog facility to use (default local4)\n"
@@ -117,16 +232,32 @@ static const char *daemonSyntax =
 	"the RRD file configuration must EXACTLY match the sensors that are used. If\n"
 	"your configuration changes, delete the old RRD file and restart sensord.\n";
 
-static const char *shortOptions = "i:l:t:1Tf:r:c:p:advhg:";
+static const char *shortOptions = "i:eul:s:S:w:x:D:R:n:t:1Tb:f:r:k:m:M:H:I:L:c:p:advhg:";
 
 static const struct option longOptions[] = {
 	{ "interval", required_argument, NULL, 'i' },
+	{ "alarm-events", no_argument, NULL, 'e' },
+	{ "hotplug", no_argument, NULL, 'u' },
 	{ "log-interval", required_argument, NULL, 'l' },
+	{ "sample-interval", required_argument, NULL, 's' },
+	{ "chip-interval", required_argument, NULL, 'S' },
+	{ "sample-threads", required_argument, NULL, 'w' },
+	{ "max-sample-interval", required_argument, NULL, 'x' },
+	{ "deadband", required_argument, NULL, 'D' },
+	{ "read-deadline", required_argument, NULL, 'R' },
+	{ "snapshot", required_argument, NULL, 'n' },
 	{ "rrd-interval", required_argument, NULL, 't' },
 	{ "oneline", no_argument, NULL, '1' },
 	{ "rrd-no-average", no_argument, NULL, 'T' },
+	{ "rrd-batch", required_argument, NULL, 'b' },
 	{ "syslog-facility", required_argument, NULL, 'f' },
 	{ "rrd-file", required_argument, NULL, 'r' },
+	{ "rrd-shard", required_argument, NULL, 'k' },
+	{ "metrics", required_argument, NULL, 'm' },
+	{ "metrics-interval", required_argument, NULL, 'M' },
+	{ "history", required_argument, NULL, 'H' },
+	{ "history-interval", required_argument, NULL, 'I' },
+	{ "history-length", required_argument, NULL, 'L' },
 	{ "config-file", required_argument, NULL, 'c' },
 	{ "pid-file", required_argument, NULL, 'p' },
 	{ "rrd-cgi", required_argument, NULL, 'g' },
@@ -155,10 +286,47 @@ int parseArgs(int argc, char **argv)
 			if ((sensord_args.scanTime = parseTime(optarg)) < 0)
 				return -1;
 			break;
+		case 'e':
+			sensord_args.alarmEvents = 1;
+			break;
+		case 'u':
+			sensord_args.hotplug = 1;
+			break;
 		case 'l':
 			if ((sensord_args.logTime = parseTime(optarg)) < 0)
 				return -1;
 			break;
+		case 's':
+			if ((sensord_args.sampleTime = parseTime(optarg)) < 0)
+				return -1;
+			break;
+		case 'S':
+			if (parseChipInterval(optarg))
+				return -1;
+			break;
+		case 'w':
+			sensord_args.sampleThreads = atoi(optarg);
+			if (sensord_args.sampleThreads < 1) {
+				fprintf(stderr, "Error parsing thread count"
+					" `%s'.\n", optarg);
+				return -1;
+			}
+			break;
+		case 'x':
+			if ((sensord_args.maxSampleTime = parseTime(optarg)) < 0)
+				return -1;
+			break;
+		case 'D':
+			if (parseDeadband(optarg))
+				return -1;
+			break;
+		case 'R':
+			if (parseReadDeadline(optarg))
+				return -1;
+			break;
+		case 'n':
+			sensord_args.snapshotName = optarg;
+			break;
 		case 't':
 			if ((sensord_args.rrdTime = parseTime(optarg)) < 0)
 				return -1;
@@ -169,6 +337,14 @@ int parseArgs(int argc, char **argv)
 		case 'T':
 			sensord_args.rrdNoAverage = 1;
 			break;
+		case 'b':
+			sensord_args.rrdBatch = atoi(optarg);
+			if (sensord_args.rrdBatch < 1) {
+				fprintf(stderr, "Error parsing batch size"
+					" `%s'.\n", optarg);
+				return -1;
+			}
+			break;
 		case 'f':
 			sensord_args.syslogFacility = parseFacility(optarg);
 			if (sensord_args.syslogFacility < 0)
@@ -186,6 +362,36 @@ int parseArgs(int argc, char **argv)
 		case 'r':
 			sensord_args.rrdFile = optarg;
 			break;
+		case 'k':
+			if (!strcmp(optarg, "chip")) {
+				sensord_args.rrdShard = -1;
+				break;
+			}
+			sensord_args.rrdShard = atoi(optarg);
+			if (sensord_args.rrdShard < 1) {
+				fprintf(stderr, "Error parsing shard size"
+					" `%s'.\n", optarg);
+				return -1;
+			}
+			break;
+		case 'm':
+			sensord_args.metricsAddr = optarg;
+			break;
+		case 'M':
+			if ((sensord_args.metricsTime = parseTime(optarg)) < 0)
+				return -1;
+			break;
+		case 'H':
+			sensord_args.historySocket = optarg;
+			break;
+		case 'I':
+			if ((sensord_args.historyTime = parseTime(optarg)) < 0)
+				return -1;
+			break;
+		case 'L':
+			if ((sensord_args.historyLength = parseTime(optarg)) < 0)
+				return -1;
+			break;
 		case 'd':
 			sensord_args.debug = 1;
 			break;
@@ -218,14 +424,57 @@ int parseArgs(int argc, char **argv)
 		return -1;
 	}
 
+	if (sensord_args.rrdShard && !sensord_args.rrdFile) {
+		fprintf(stderr,
+			"Error: Incompatible --rrd-shard without --rrd-file.\n");
+		return -1;
+	}
+
 	if (sensord_args.rrdFile && !sensord_args.rrdTime) {
 		fprintf(stderr,
 			"Error: Incompatible --rrd-file without --rrd-interval.\n");
 		return -1;
 	}
 
+	if (sensord_args.alarmEvents && sensord_args.sampleTime) {
+		fprintf(stderr,
+			"Error: Incompatible --alarm-events with --sample-interval.\n");
+		return -1;
+	}
+
+	if (sensord_args.numIntervalChips && !sensord_args.sampleTime) {
+		fprintf(stderr,
+			"Error: Incompatible --chip-interval without --sample-interval.\n");
+		return -1;
+	}
+
+	if (sensord_args.maxSampleTime && !sensord_args.sampleTime) {
+		fprintf(stderr,
+			"Error: Incompatible --max-sample-interval without --sample-interval.\n");
+		return -1;
+	}
+
+	if (sensord_args.snapshotName && !sensord_args.sampleTime) {
+		fprintf(stderr,
+			"Error: Incompatible --snapshot without --sample-interval.\n");
+		return -1;
+	}
+
+	if (sensord_args.metricsAddr && !sensord_args.metricsTime) {
+		fprintf(stderr,
+			"Error: Incompatible --metrics without --metrics-interval.\n");
+		return -1;
+	}
+
+	if (sensord_args.historySocket && !sensord_args.historyTime) {
+		fprintf(stderr,
+			"Error: Incompatible --history without --history-interval.\n");
+		return -1;
+	}
+
 	if (!sensord_args.logTime && !sensord_args.scanTime &&
-	    !sensord_args.rrdFile) {
+	    !sensord_args.alarmEvents && !sensord_args.rrdFile &&
+	    !sensord_args.metricsAddr && !sensord_args.historySocket) {
 		fprintf(stderr,
 			"Error: No logging, alarm or RRD scanning.\n");
 		return -1;
@@ -276,4 +525,8 @@ void freeChips()
 
 	for (i = 0; i < sensord_args.numChipNames; i++)
 		sensors_free_chip_name(sensord_args.chipNames + i);
+	for (i = 0; i < sensord_args.numIntervalChips; i++)
+		sensors_free_chip_name(sensord_args.intervalChips + i);
+	for (i = 0; i < sensord_args.numDeadlineChips; i++)
+		sensors_free_chip_name(sensord_args.deadlineChips + i);
 }
@@ -12,10 +12,30 @@ struct sensord_arguments {
 	const char *rrdFile;
 	const char *cgiDir;
 	int scanTime;
+	int alarmEvents;
+	int hotplug;
 	int logTime;
 	int logOneline;
 	int rrdTime;
 	int rrdNoAverage;
+	int rrdBatch;
+	int rrdShard;		/* Data sources per file, -1 for per chip */
+	const char *metricsAddr;
+	int metricsTime;
+	const char *historySocket;
+	int historyTime;
+	int historyLength;
+	int sampleTime;
+	int sampleThreads;
+	sensors_chip_name intervalChips[MAX_CHIP_NAMES];
+	int intervalTimes[MAX_CHIP_NAMES];
+	int numIntervalChips;
+	int maxSampleTime;
+	sensors_chip_name deadlineChips[MAX_CHIP_NAMES];
+	double deadlineTimes[MAX_CHIP_NAMES];
+	int numDeadlineChips;
+	double deadbands[3];	/* Indexed by DataType */
+	const char *snapshotName;
 	int syslogFacility;
 	int doScan;
 	int doSet;
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "args.h"
 #include "sensord.h"
 
 /* TODO: Temp in C/F */
@@ -367,6 +368,9 @@ static FeatureDescriptor * generateChipFeatures(const sensors_chip_name *chip)
 		}
 
 		features[count].feature = sensor;
+		if (features[count].type != DataType_other)
+			features[count].deadband =
+				sensord_args.deadbands[features[count].type];
 		count++;
 	}
 
@@ -406,7 +410,10 @@ void freeKnownChips(void)
 {
 	int index0;
 
+	if (!knownChips)
+		return;
 	for (index0 = 0; knownChips[index0].features; index0++)
 		free(knownChips[index0].features);
 	free(knownChips);
+	knownChips = NULL;
 }
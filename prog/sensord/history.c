@@ -0,0 +1,796 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * In-memory history of the recent readings, queried over a unix socket.
+ * The features recorded in the RRD file are sampled together by the main
+ * loop, and the samples are appended to a ring of blocks. Blocks are
+ * compressed the way Gorilla does it: the sample times are stored as
+ * deltas of deltas, and each value as its XOR with the previous value of
+ * the same series, leading and trailing zero bits dropped. Readings
+ * seldom change between samples, so most of them take a single bit. Once
+ * the ring is full, the oldest block is reused. A separate thread answers
+ * the queries, so they never touch the hardware or the disk.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "args.h"
+#include "sensord.h"
+
+#define BLOCK_SAMPLES	120
+#define REQUEST_MAX	4096
+
+typedef struct {
+	unsigned char *data;
+	size_t bits;		/* Written so far */
+	size_t max;		/* Allocated bytes */
+} BitStream;
+
+typedef struct {
+	const BitStream *stream;
+	size_t pos;
+} BitReader;
+
+/* Compression state of a series, when writing or reading */
+typedef struct {
+	uint64_t prev;
+	int leading;		/* Zero bits around the last meaningful ones, */
+	int trailing;		/* leading is -1 if there were none */
+} XorState;
+
+/* Compression state of the sample times */
+typedef struct {
+	time_t prev;
+	int64_t delta;
+} TimeState;
+
+typedef struct {
+	int count;		/* Samples in the block */
+	time_t first, last;
+	BitStream times;
+	BitStream *values;	/* One per series */
+} HistoryBlock;
+
+typedef struct {
+	const ChipDescriptor *chip;
+	int *numbers;		/* Subfeatures to read, one per series */
+	double *values;
+	int *errors;
+	int count;
+} HistoryChip;
+
+/* Owned by the main thread */
+static HistoryChip *chips;
+static int chipCount, chipMax;
+static int *fed;		/* Series of each value read, in order */
+static int fedCount, fedMax;
+static int newBlock;		/* The series fed changed */
+static XorState *writers;	/* One per series */
+static TimeState timeWriter;
+
+/* Shared with the server thread, under historyLock */
+static pthread_mutex_t historyLock = PTHREAD_MUTEX_INITIALIZER;
+static char **labels;
+static int seriesCount, seriesMax;
+static HistoryBlock *blocks;
+static int blockCount;
+static int head;		/* Block being filled */
+static int used;		/* Blocks holding samples */
+
+static int listenFd = -1;
+static pthread_t serverThread;
+static int serverStarted;
+
+static void *grow(void *array, int *max, int count, size_t size)
+{
+	if (count < *max)
+		return array;
+	*max = *max ? *max * 2 : 16;
+	array = realloc(array, *max * size);
+	if (!array) {
+		sensorLog(LOG_ERR, "Out of memory");
+		exit(EXIT_FAILURE);
+	}
+	return array;
+}
+
+/* Append the n low bits of value, most significant first */
+static void putBits(BitStream *s, uint64_t value, int n)
+{
+	while (n--) {
+		if (!(s->bits & 7)) {
+			if ((s->bits >> 3) == s->max) {
+				s->max = s->max ? s->max * 2 : 64;
+				s->data = realloc(s->data, s->max);
+				if (!s->data) {
+					sensorLog(LOG_ERR, "Out of memory");
+					exit(EXIT_FAILURE);
+				}
+			}
+			s->data[s->bits >> 3] = 0;
+		}
+		if ((value >> n) & 1)
+			s->data[s->bits >> 3] |= 0x80 >> (s->bits & 7);
+		s->bits++;
+	}
+}
+
+static uint64_t getBits(BitReader *r, int n)
+{
+	uint64_t value = 0;
+
+	while (n--) {
+		value <<= 1;
+		if (r->pos < r->stream->bits &&
+		    (r->stream->data[r->pos >> 3] & (0x80 >> (r->pos & 7))))
+			value |= 1;
+		r->pos++;
+	}
+	return value;
+}
+
+/* Sign-extend the n low bits of value, n is at most 32 */
+static int64_t getSigned(BitReader *r, int n)
+{
+	uint64_t value = getBits(r, n);
+
+	if (value & (1ULL << (n - 1)))
+		return (int64_t)value - (int64_t)(1ULL << n);
+	return value;
+}
+
+static void putTime(BitStream *s, TimeState *state, int first, time_t t)
+{
+	int64_t delta = t - state->prev, dod = delta - state->delta;
+
+	state->prev = t;
+	if (first) {
+		state->delta = 0;
+		return;		/* Stored in the block */
+	}
+	state->delta = delta;
+
+	if (!dod) {
+		putBits(s, 0, 1);
+	} else if (dod >= -64 && dod < 64) {
+		putBits(s, 2, 2);
+		putBits(s, dod, 7);
+	} else if (dod >= -256 && dod < 256) {
+		putBits(s, 6, 3);
+		putBits(s, dod, 9);
+	} else if (dod >= -2048 && dod < 2048) {
+		putBits(s, 14, 4);
+		putBits(s, dod, 12);
+	} else {
+		putBits(s, 15, 4);
+		putBits(s, dod, 32);
+	}
+}
+
+static time_t getTime(BitReader *r, TimeState *state, int first,
+		      time_t firstTime)
+{
+	int prefix;
+
+	if (first) {
+		state->prev = firstTime;
+		state->delta = 0;
+		return firstTime;
+	}
+
+	for (prefix = 0; prefix < 4 && getBits(r, 1); prefix++)
+		;
+	switch (prefix) {
+	case 1:
+		state->delta += getSigned(r, 7);
+		break;
+	case 2:
+		state->delta += getSigned(r, 9);
+		break;
+	case 3:
+		state->delta += getSigned(r, 12);
+		break;
+	case 4:
+		state->delta += getSigned(r, 32);
+		break;
+	}
+	state->prev += state->delta;
+	return state->prev;
+}
+
+static void putValue(BitStream *s, XorState *state, int first, double value)
+{
+	uint64_t bits, x;
+	int leading, trailing, significant;
+
+	memcpy(&bits, &value, sizeof(bits));
+	if (first) {
+		putBits(s, bits, 64);
+		state->prev = bits;
+		state->leading = -1;
+		return;
+	}
+
+	x = bits ^ state->prev;
+	state->prev = bits;
+	if (!x) {
+		putBits(s, 0, 1);
+		return;
+	}
+
+	leading = __builtin_clzll(x);
+	trailing = __builtin_ctzll(x);
+	if (leading > 31)
+		leading = 31;	/* Has to fit in 5 bits */
+
+	/* Reuse the previous window if the meaningful bits fit in it */
+	if (state->leading >= 0 && leading >= state->leading &&
+	    trailing >= state->trailing) {
+		putBits(s, 2, 2);
+		putBits(s, x >> state->trailing,
+			64 - state->leading - state->trailing);
+		return;
+	}
+
+	significant = 64 - leading - trailing;
+	putBits(s, 3, 2);
+	putBits(s, leading, 5);
+	putBits(s, significant - 1, 6);
+	putBits(s, x >> trailing, significant);
+	state->leading = leading;
+	state->trailing = trailing;
+}
+
+static double getValue(BitReader *r, XorState *state, int first)
+{
+	int significant;
+	double value;
+
+	if (first) {
+		state->prev = getBits(r, 64);
+		state->leading = -1;
+	} else if (getBits(r, 1)) {
+		if (getBits(r, 1)) {
+			state->leading = getBits(r, 5);
+			significant = getBits(r, 6) + 1;
+			state->trailing = 64 - state->leading - significant;
+		}
+		state->prev ^= getBits(r, 64 - state->leading -
+				       state->trailing) << state->trailing;
+	}
+
+	memcpy(&value, &state->prev, sizeof(value));
+	return value;
+}
+
+static void *growZero(void *array, int max, int count, size_t size)
+{
+	array = realloc(array, max * size);
+	if (!array) {
+		sensorLog(LOG_ERR, "Out of memory");
+		exit(EXIT_FAILURE);
+	}
+	memset((char *)array + count * size, 0, (max - count) * size);
+	return array;
+}
+
+/* Find the series of a label, or start a new one. Must be called with
+   historyLock held. */
+static int findSeries(const char *rawLabel)
+{
+	int i, oldMax = seriesMax;
+
+	for (i = 0; i < seriesCount; i++)
+		if (!strcmp(labels[i], rawLabel))
+			return i;
+
+	labels = grow(labels, &seriesMax, seriesCount, sizeof(char *));
+	if (seriesMax != oldMax) {
+		for (i = 0; i < blockCount; i++)
+			blocks[i].values = growZero(blocks[i].values,
+						    seriesMax, oldMax,
+						    sizeof(BitStream));
+		writers = growZero(writers, seriesMax, oldMax,
+				   sizeof(XorState));
+	}
+	labels[seriesCount] = strdup(rawLabel);
+	if (!labels[seriesCount]) {
+		sensorLog(LOG_ERR, "Out of memory");
+		exit(EXIT_FAILURE);
+	}
+	return seriesCount++;
+}
+
+/* Drop the series which are no longer fed once the blocks holding their
+   samples have all been reused. Must be called with historyLock held. */
+static void dropStaleSeries(void)
+{
+	int s, i, b, kept;
+
+	for (s = 0; s < seriesCount; s++) {
+		for (i = 0; i < fedCount; i++)
+			if (fed[i] == s)
+				break;
+		kept = i < fedCount;
+		for (b = 0; !kept && b < used; b++)
+			kept = blocks[(head - b + blockCount) % blockCount]
+			       .values[s].bits != 0;
+		if (kept)
+			continue;
+
+		free(labels[s]);
+		memmove(&labels[s], &labels[s + 1],
+			(seriesCount - s - 1) * sizeof(char *));
+		for (b = 0; b < blockCount; b++) {
+			free(blocks[b].values[s].data);
+			memmove(&blocks[b].values[s], &blocks[b].values[s + 1],
+				(seriesCount - s - 1) * sizeof(BitStream));
+			memset(&blocks[b].values[seriesCount - 1], 0,
+			       sizeof(BitStream));
+		}
+		memmove(&writers[s], &writers[s + 1],
+			(seriesCount - s - 1) * sizeof(XorState));
+		for (i = 0; i < fedCount; i++)
+			if (fed[i] > s)
+				fed[i]--;
+		seriesCount--;
+		s--;
+	}
+}
+
+/* The series are the features recorded in the RRD file, named after their
+   label there */
+static void addSeries(void *data, const ChipDescriptor *chip,
+		      const char *rawLabel, const char *label,
+		      const FeatureDescriptor *feature)
+{
+	HistoryChip *hchip;
+	int n, s;
+
+	(void) label; /* no warning */
+	if (!feature || !feature->rrd)
+		return;
+
+	if (!chipCount || chips[chipCount - 1].chip != chip) {
+		chips = grow(chips, &chipMax, chipCount, sizeof(HistoryChip));
+		hchip = &chips[chipCount++];
+		for (n = 0; chip->features[n].format; n++)
+			;
+		hchip->chip = chip;
+		hchip->numbers = malloc(n * sizeof(int));
+		hchip->values = malloc(n * sizeof(double));
+		hchip->errors = malloc(n * sizeof(int));
+		hchip->count = 0;
+		if (!hchip->numbers || !hchip->values || !hchip->errors) {
+			sensorLog(LOG_ERR, "Out of memory");
+			exit(EXIT_FAILURE);
+		}
+	}
+	hchip = &chips[chipCount - 1];
+	hchip->numbers[hchip->count++] = feature->dataNumbers[0];
+
+	s = findSeries(rawLabel);
+	/* The current block can only go on if the same series are fed in
+	   the same order */
+	if (fedCount >= *(int *)data || fed[fedCount] != s)
+		newBlock = 1;
+	fed = grow(fed, &fedMax, fedCount, sizeof(int));
+	fed[fedCount++] = s;
+}
+
+/* The series are carried over from the previous chips, so a rescan or
+   hotplug event only starts the series of the new features */
+void initHistory(void)
+{
+	int oldFed = fedCount;
+
+	if (!sensord_args.historySocket)
+		return;
+
+	pthread_mutex_lock(&historyLock);
+	if (!blocks) {
+		/* One more block than needed, as the oldest one is reused */
+		blockCount = (sensord_args.historyLength /
+			      sensord_args.historyTime + BLOCK_SAMPLES - 1) /
+			     BLOCK_SAMPLES + 1;
+		blocks = calloc(blockCount, sizeof(HistoryBlock));
+		if (!blocks) {
+			sensorLog(LOG_ERR, "Out of memory");
+			exit(EXIT_FAILURE);
+		}
+		head = used = 0;
+	}
+
+	fedCount = 0;
+	if (applyToFeatures(addSeries, &oldFed))
+		sensorLog(LOG_ERR, "Error listing the history series");
+	if (fedCount != oldFed)
+		newBlock = 1;
+	dropStaleSeries();
+	pthread_mutex_unlock(&historyLock);
+}
+
+/* Only the references to the chips are dropped, the samples are kept for
+   initHistory() */
+void freeHistoryChips(void)
+{
+	int i;
+
+	for (i = 0; i < chipCount; i++) {
+		free(chips[i].numbers);
+		free(chips[i].values);
+		free(chips[i].errors);
+	}
+	free(chips);
+	chips = NULL;
+	chipCount = chipMax = 0;
+}
+
+void freeHistory(void)
+{
+	int i, j;
+
+	freeHistoryChips();
+	free(fed);
+	fed = NULL;
+	fedCount = fedMax = 0;
+
+	pthread_mutex_lock(&historyLock);
+	for (i = 0; i < blockCount; i++) {
+		free(blocks[i].times.data);
+		for (j = 0; j < seriesCount; j++)
+			free(blocks[i].values[j].data);
+		free(blocks[i].values);
+	}
+	free(blocks);
+	blocks = NULL;
+	blockCount = head = used = 0;
+	for (i = 0; i < seriesCount; i++)
+		free(labels[i]);
+	free(labels);
+	labels = NULL;
+	seriesCount = seriesMax = 0;
+	pthread_mutex_unlock(&historyLock);
+
+	free(writers);
+	writers = NULL;
+}
+
+int sampleHistory(void)
+{
+	HistoryBlock *block;
+	time_t now = time(NULL);
+	int i, j, s, ret = 0;
+
+	if (!sensord_args.historySocket || !chipCount)
+		return 0;
+
+	for (i = 0; i < chipCount; i++)
+		if (readValues(chips[i].chip, chips[i].numbers,
+			       chips[i].count, chips[i].values,
+			       chips[i].errors))
+			ret = 1;
+
+	pthread_mutex_lock(&historyLock);
+	block = &blocks[head];
+	/* A block holds the same series from its first sample to its last,
+	   the others are left empty */
+	if (!used || block->count == BLOCK_SAMPLES || newBlock) {
+		if (used)
+			head = (head + 1) % blockCount;
+		if (used < blockCount)
+			used++;
+		block = &blocks[head];
+		block->count = 0;
+		block->first = now;
+		block->times.bits = 0;
+		for (s = 0; s < seriesCount; s++)
+			block->values[s].bits = 0;
+		newBlock = 0;
+		dropStaleSeries();
+	}
+
+	putTime(&block->times, &timeWriter, !block->count, now);
+	for (i = 0, s = 0; i < chipCount; i++)
+		for (j = 0; j < chips[i].count; j++, s++)
+			putValue(&block->values[fed[s]], &writers[fed[s]],
+				 !block->count, chips[i].errors[j] ? NAN :
+				 chips[i].values[j]);
+	block->last = now;
+	block->count++;
+	pthread_mutex_unlock(&historyLock);
+
+	return ret;
+}
+
+/* Parse a time, relative to now if not positive */
+static int parseQueryTime(const char *arg, time_t now, time_t *t)
+{
+	char *end;
+	long value;
+
+	value = strtol(arg, &end, 10);
+	if (end == arg || *end)
+		return -1;
+	*t = value > 0 ? value : now + value;
+	return 0;
+}
+
+/* Answer a query of the form [<start> <end> [<series>...]] with a header
+   line naming the series, then a line per sample in the range. Must be
+   called with historyLock held. */
+static void answerQuery(FILE *out, char *request)
+{
+	HistoryBlock *block;
+	BitReader timeReader, *readers = NULL;
+	TimeState timeState;
+	XorState *states = NULL;
+	time_t now = time(NULL), start = 0, end = now, t;
+	char *arg, *save;
+	int *selected, count = 0, i, k, b;
+	double value;
+
+	selected = malloc((seriesCount + 1) * sizeof(int));
+	if (!selected) {
+		fprintf(out, "error: Out of memory\n");
+		return;
+	}
+
+	arg = strtok_r(request, " \t\r\n", &save);
+	if (arg && (parseQueryTime(arg, now, &start) ||
+		    !(arg = strtok_r(NULL, " \t\r\n", &save)) ||
+		    parseQueryTime(arg, now, &end))) {
+		fprintf(out, "error: Invalid time range\n");
+		goto exit_free;
+	}
+	while ((arg = strtok_r(NULL, " \t\r\n", &save))) {
+		for (i = 0; i < seriesCount; i++)
+			if (!strcmp(labels[i], arg))
+				break;
+		if (i == seriesCount) {
+			fprintf(out, "error: Unknown series `%s'\n", arg);
+			goto exit_free;
+		}
+		if (count < seriesCount)
+			selected[count++] = i;
+	}
+	if (!count)
+		for (count = 0; count < seriesCount; count++)
+			selected[count] = count;
+
+	readers = malloc((count + 1) * sizeof(BitReader));
+	states = malloc((count + 1) * sizeof(XorState));
+	if (!readers || !states) {
+		fprintf(out, "error: Out of memory\n");
+		goto exit_free;
+	}
+
+	fprintf(out, "time");
+	for (k = 0; k < count; k++)
+		fprintf(out, " %s", labels[selected[k]]);
+	fprintf(out, "\n");
+
+	/* From the oldest block to the newest */
+	for (b = 0; b < used; b++) {
+		block = &blocks[(head - used + 1 + b + blockCount) %
+				blockCount];
+		if (block->last < start)
+			continue;
+		if (block->first > end)
+			break;
+
+		timeReader.stream = &block->times;
+		timeReader.pos = 0;
+		for (k = 0; k < count; k++) {
+			readers[k].stream = &block->values[selected[k]];
+			readers[k].pos = 0;
+		}
+
+		for (i = 0; i < block->count; i++) {
+			t = getTime(&timeReader, &timeState, !i, block->first);
+			if (t > end)
+				break;
+			if (t >= start)
+				fprintf(out, "%ld", (long)t);
+			for (k = 0; k < count; k++) {
+				/* Not fed while the block was filled */
+				if (!readers[k].stream->bits)
+					value = NAN;
+				else
+					value = getValue(&readers[k],
+							 &states[k], !i);
+				if (t < start)
+					continue;
+				if (isnan(value))
+					fprintf(out, " NaN");
+				else
+					fprintf(out, " %g", value);
+			}
+			if (t >= start)
+				fprintf(out, "\n");
+		}
+	}
+
+exit_free:
+	free(selected);
+	free(readers);
+	free(states);
+}
+
+static int sendAll(int fd, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, data, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void serveClient(int fd)
+{
+	struct timeval timeout = { 5, 0 };
+	char request[REQUEST_MAX], *data = NULL;
+	size_t size = 0;
+	int len = 0;
+	ssize_t n;
+	FILE *out;
+
+	/* Don't let a slow client block the others for long */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	/* A query is a single line */
+	request[0] = '\0';
+	while (len < (int)sizeof(request) - 1) {
+		n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+		if (n < 0)
+			return;
+		if (!n)
+			break;
+		len += n;
+		request[len] = '\0';
+		if (strchr(request, '\n'))
+			break;
+	}
+
+	out = open_memstream(&data, &size);
+	if (!out)
+		return;
+	pthread_mutex_lock(&historyLock);
+	answerQuery(out, request);
+	pthread_mutex_unlock(&historyLock);
+	if (!fclose(out))
+		sendAll(fd, data, size);
+	free(data);
+}
+
+static void *serveHistory(void *data)
+{
+	int fd;
+
+	(void)data;
+	for (;;) {
+		fd = accept(listenFd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;	/* Socket shut down */
+		}
+		serveClient(fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+int openHistory(void)
+{
+	const char *path = sensord_args.historySocket;
+	struct sockaddr_un addr;
+	struct stat sb;
+
+	if (!path)
+		return 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "History socket path too long `%s'.\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	/* Left behind by a previous instance */
+	if (!stat(path, &sb) && S_ISSOCK(sb.st_mode))
+		unlink(path);
+
+	listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listenFd < 0 ||
+	    bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(listenFd, 16)) {
+		fprintf(stderr, "Error listening on `%s': %s\n", path,
+			strerror(errno));
+		if (listenFd >= 0)
+			close(listenFd);
+		listenFd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Threads don't survive fork(), so this must be called after daemonizing */
+void startHistory(void)
+{
+	sigset_t all, old;
+	int err;
+
+	if (listenFd < 0)
+		return;
+
+	/* Signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&serverThread, NULL, serveHistory, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		sensorLog(LOG_ERR, "Error starting history server: %s",
+			  strerror(err));
+		return;
+	}
+	serverStarted = 1;
+}
+
+void closeHistory(void)
+{
+	if (listenFd < 0)
+		return;
+
+	shutdown(listenFd, SHUT_RDWR);
+	if (serverStarted)
+		pthread_join(serverThread, NULL);
+	close(listenFd);
+	listenFd = -1;
+	serverStarted = 0;
+	unlink(sensord_args.historySocket);
+}
@@ -0,0 +1,221 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * Hotplug: the kernel announces the addition and removal of hwmon class
+ * devices with uevents. They are queued as they come, and applied to the
+ * library one device at a time, instead of reloading everything.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "args.h"
+#include "sensord.h"
+#include "lib/error.h"
+
+#define UEVENT_BUFFER	8192
+
+typedef struct {
+	int add;
+	char *path;
+} HotplugEvent;
+
+static int hotplugSocket = -1;
+static HotplugEvent *events;
+static int eventCount, eventMax;
+
+void initHotplug(void)
+{
+	struct sockaddr_nl addr;
+	int size = 1 << 20;
+
+	if (!sensord_args.hotplug)
+		return;
+
+	hotplugSocket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK |
+			       SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (hotplugSocket < 0) {
+		sensorLog(LOG_ERR, "Error opening uevent socket: %s",
+			  strerror(errno));
+		return;
+	}
+
+	/* Devices come in bursts, e.g. when a driver is loaded */
+	setsockopt(hotplugSocket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;	/* Those of the kernel, not of udev */
+	if (bind(hotplugSocket, (struct sockaddr *)&addr, sizeof(addr))) {
+		sensorLog(LOG_ERR, "Error binding uevent socket: %s",
+			  strerror(errno));
+		close(hotplugSocket);
+		hotplugSocket = -1;
+	}
+}
+
+static void clearEvents(void)
+{
+	int i;
+
+	for (i = 0; i < eventCount; i++)
+		free(events[i].path);
+	eventCount = 0;
+}
+
+void freeHotplug(void)
+{
+	if (hotplugSocket >= 0)
+		close(hotplugSocket);
+	hotplugSocket = -1;
+	clearEvents();
+	free(events);
+	events = NULL;
+	eventMax = 0;
+}
+
+int getHotplugFd(void)
+{
+	return hotplugSocket;
+}
+
+/* A uevent is a header followed by KEY=value strings */
+static void parseUevent(const char *buf, int len)
+{
+	const char *action = NULL, *devpath = NULL, *subsystem = NULL;
+	const char *p;
+	int add;
+
+	for (p = buf; p < buf + len; p += strlen(p) + 1) {
+		if (!strncmp(p, "ACTION=", 7))
+			action = p + 7;
+		else if (!strncmp(p, "DEVPATH=", 8))
+			devpath = p + 8;
+		else if (!strncmp(p, "SUBSYSTEM=", 10))
+			subsystem = p + 10;
+	}
+	if (!action || !devpath || !subsystem || strcmp(subsystem, "hwmon"))
+		return;
+	if (!strcmp(action, "add"))
+		add = 1;
+	else if (!strcmp(action, "remove"))
+		add = 0;
+	else
+		return;
+
+	if (eventCount == eventMax) {
+		eventMax = eventMax ? eventMax * 2 : 8;
+		events = realloc(events, eventMax * sizeof(HotplugEvent));
+		if (!events) {
+			sensorLog(LOG_ERR, "Out of memory");
+			exit(EXIT_FAILURE);
+		}
+	}
+	events[eventCount].add = add;
+	events[eventCount].path = strdup(devpath);
+	if (!events[eventCount].path) {
+		sensorLog(LOG_ERR, "Out of memory");
+		exit(EXIT_FAILURE);
+	}
+	eventCount++;
+}
+
+/*
+ * Read the pending uevents. Returns the number of hwmon devices waiting to
+ * be added or removed, or -1 if uevents were lost, in which case all
+ * devices must be scanned again.
+ */
+int readHotplug(void)
+{
+	char buf[UEVENT_BUFFER + 1];
+	struct sockaddr_nl addr;
+	struct iovec iov;
+	struct msghdr msg;
+	ssize_t len;
+	int lost = 0;
+
+	if (hotplugSocket < 0)
+		return 0;
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf;
+		iov.iov_len = UEVENT_BUFFER;
+		msg.msg_name = &addr;
+		msg.msg_namelen = sizeof(addr);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		len = recvmsg(hotplugSocket, &msg, 0);
+		if (len < 0) {
+			if (errno == ENOBUFS)
+				lost = 1;
+			else if (errno != EINTR)
+				break;
+			continue;
+		}
+
+		/* Only the kernel is trusted */
+		if (addr.nl_pid || (msg.msg_flags & MSG_TRUNC))
+			continue;
+		buf[len] = '\0';
+		parseUevent(buf, len);
+	}
+
+	if (lost) {
+		sensorLog(LOG_NOTICE, "Lost uevents, rescanning all devices");
+		clearEvents();
+		return -1;
+	}
+	return eventCount;
+}
+
+/* Apply the pending uevents, knownChips are built again afterwards */
+int applyHotplug(void)
+{
+	HotplugEvent *event;
+	int i, ret;
+
+	freeKnownChips();
+	for (i = 0; i < eventCount; i++) {
+		event = &events[i];
+		if (event->add)
+			ret = sensors_add_chip(event->path);
+		else
+			ret = sensors_remove_chip(event->path);
+		if (ret < 0)
+			sensorLog(LOG_ERR, "Error %s chip of %s: %s",
+				  event->add ? "adding" : "removing",
+				  event->path, sensors_strerror(ret));
+		else if (ret > 0)
+			sensorLog(LOG_INFO, "Chip of %s %s", event->path,
+				  event->add ? "added" : "removed");
+	}
+	clearEvents();
+
+	return initKnownChips();
+}
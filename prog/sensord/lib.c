@@ -30,73 +30,98 @@
 #include <unistd.h>
 #include <sys/stat.h>
 
+#include "args.h"
 #include "sensord.h"
 #include "lib/error.h"
 
-static int loadConfig(const char *cfgPath, int reload)
+#define LOAD_INIT	0
+#define LOAD_CONFIG	1	/* Only the configuration */
+#define LOAD_ALL	2	/* The configuration and the chips */
+
+/*
+ * When only the configuration is loaded again, the previous one is still in
+ * effect if this fails.
+ */
+static int loadConfig(const char *cfgPath, int load)
 {
 	int ret;
- 	FILE *fp;
+	FILE *fp = NULL;
 
- 	/* Load default configuration. */
- 	if (!cfgPath) {
- 		if (reload) {
-			sensorLog(LOG_INFO, "configuration reloading");
-			sensors_cleanup();
+	if (cfgPath) {
+		fp = fopen(cfgPath, "r");
+		if (!fp) {
+			sensorLog(LOG_ERR, "Error opening config file %s: %s",
+				  cfgPath, strerror(errno));
+			return -1;
 		}
+	}
 
- 		ret = sensors_init(NULL);
- 		if (ret) {
- 			sensorLog(LOG_ERR, "Error loading default"
- 				  " configuration file: %s",
- 				  sensors_strerror(ret));
- 			return -1;
-  		}
- 		return 0;
- 	}
-
- 	fp = fopen(cfgPath, "r");
- 	if (!fp) {
- 		sensorLog(LOG_ERR, "Error opening config file %s: %s",
- 			  strerror(errno));
- 		return -1;
- 	}
-
-	if (reload) {
+	if (load == LOAD_CONFIG) {
 		sensorLog(LOG_INFO, "configuration reloading");
-		sensors_cleanup();
+		ret = sensors_reload_config(fp);
+	} else {
+		if (load == LOAD_ALL) {
+			sensorLog(LOG_INFO, "configuration reloading");
+			sensors_cleanup();
+		}
+		ret = sensors_init(fp);
+	}
+	if (ret) {
+		if (cfgPath)
+			sensorLog(LOG_ERR, "Error loading sensors configuration"
+				  " file %s: %s", cfgPath,
+				  sensors_strerror(ret));
+		else
+			sensorLog(LOG_ERR, "Error loading default"
+				  " configuration file: %s",
+				  sensors_strerror(ret));
 	}
- 	ret = sensors_init(fp);
- 	if (ret) {
- 		sensorLog(LOG_ERR, "Error loading sensors configuration file"
-			  " %s: %s", cfgPath, sensors_strerror(ret));
- 		fclose(fp);
- 		return -1;
- 	}
- 	fclose(fp);
+	if (fp)
+		fclose(fp);
 
- 	return 0;
+	return ret ? -1 : 0;
 }
 
 int loadLib(const char *cfgPath)
 {
-	int ret;
-	ret = loadConfig(cfgPath, 0);
+	int i, ret;
+
+	/* We read the same attributes over and over again, and the access
+	   statistics are exported along with the metrics */
+	sensors_set_flags(SENSORS_FLAG_KEEP_FDS |
+			  (sensord_args.metricsAddr ? SENSORS_FLAG_STATS : 0));
+	/* Kept by the library for the chips detected later on as well */
+	for (i = 0; i < sensord_args.numDeadlineChips; i++)
+		sensors_set_read_deadline(&sensord_args.deadlineChips[i],
+					  sensord_args.deadlineTimes[i]);
+	ret = loadConfig(cfgPath, LOAD_INIT);
 	if (!ret)
 		ret = initKnownChips();
 	return ret;
 }
 
-int reloadLib(const char *cfgPath)
+/* Chips are built again in any case, whatever the library could load */
+static int doReload(const char *cfgPath, int load)
 {
 	int ret;
+
 	freeKnownChips();
-	ret = loadConfig(cfgPath, 1);
-	if (!ret)
-		ret = initKnownChips();
+	ret = loadConfig(cfgPath, load);
+	if (initKnownChips())
+		ret = -1;
 	return ret;
 }
 
+int reloadLib(const char *cfgPath)
+{
+	return doReload(cfgPath, LOAD_CONFIG);
+}
+
+int rescanLib(const char *cfgPath)
+{
+	return doReload(cfgPath, LOAD_ALL);
+}
+
 int unloadLib(void)
 {
 	freeKnownChips();
@@ -0,0 +1,688 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * Prometheus metrics endpoint. The metric names and labels are rendered
+ * once, when the chips are loaded, into a template holding all the text
+ * of the page except the values. Sampling, done by the main loop, only
+ * formats the values into a copy of the template. A separate thread
+ * serves the last sampled page over HTTP, so scrapes never touch the
+ * hardware and never wait for it. The access statistics kept by the
+ * library for the sampled subfeatures follow the readings.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "args.h"
+#include "sensord.h"
+#include "lib/error.h"
+
+#define VALUE_MAX	32	/* Room for a formatted value and newline */
+
+typedef struct {
+	const ChipDescriptor *chip;
+	const sensors_chip_name *name;
+	int *numbers;		/* Subfeatures to read */
+	double *values;
+	int *errors;
+	int *statsLabels;	/* Start of the labels of each subfeature in
+				   statsText, and end of the last ones */
+	int count;
+} MetricsChip;
+
+typedef struct {
+	int textEnd;		/* End of the template text before the value */
+	const double *value;
+	const int *error;
+} MetricsSlot;
+
+typedef struct {
+	char *data;
+	int len;
+	int max;
+} Buffer;
+
+static const struct {
+	DataType type;		/* DataType_other for alarms */
+	const char *name;
+	const char *help;
+} families[] = {
+	{ DataType_temperature, "sensors_temperature_celsius",
+	  "Temperature in degrees Celsius." },
+	{ DataType_voltage, "sensors_voltage_volts", "Voltage in volts." },
+	{ DataType_rpm, "sensors_fan_rpm",
+	  "Fan speed in revolutions per minute." },
+	{ DataType_other, "sensors_alarm", "Alarm state, 1 if raised." },
+};
+
+/* Owned by the main thread */
+static MetricsChip *chips;
+static int chipCount;
+static MetricsSlot *slots;
+static int slotCount;
+static Buffer template;
+static Buffer statsText;
+static Buffer statsPage;
+
+static const struct {
+	const char *name;
+	const char *type;
+	const char *help;
+} statsFamilies[] = {
+	{ "sensors_accesses_total", "counter",
+	  "Accesses to the attribute file." },
+	{ "sensors_access_errors_total", "counter",
+	  "Failed accesses to the attribute file, by error." },
+	{ "sensors_access_latency_seconds", "histogram",
+	  "Latency of the accesses to the attribute file." },
+	{ "sensors_access_last_latency_seconds", "gauge",
+	  "Latency of the last access to the attribute file." },
+};
+
+/* Upper bounds of the buckets of the access latency histogram */
+static const char *latencyBounds[SENSORS_STATS_BUCKETS] = {
+	"1e-05", "0.0001", "0.001", "0.01", "0.1", "1", "+Inf"
+};
+
+/* Shared with the server thread, under pageLock */
+static pthread_mutex_t pageLock = PTHREAD_MUTEX_INITIALIZER;
+static Buffer pages[2];
+static int pageCur;
+
+static int listenFd = -1;
+static pthread_t serverThread;
+static int serverStarted;
+
+static void reserve(Buffer *buf, int len)
+{
+	if (buf->len + len <= buf->max)
+		return;
+	buf->max = buf->max ? buf->max * 2 : 4096;
+	if (buf->max < buf->len + len)
+		buf->max = buf->len + len;
+	buf->data = realloc(buf->data, buf->max);
+	if (!buf->data) {
+		sensorLog(LOG_ERR, "Out of memory");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void append(Buffer *buf, const char *str, int len)
+{
+	if (!len)
+		return;
+	reserve(buf, len);
+	memcpy(buf->data + buf->len, str, len);
+	buf->len += len;
+}
+
+static void appendString(Buffer *buf, const char *str)
+{
+	append(buf, str, strlen(str));
+}
+
+/* Label values need backslash, double-quote and line feed escaped */
+static void appendLabel(Buffer *buf, const char *name, const char *value)
+{
+	const char *p;
+
+	appendString(buf, name);
+	appendString(buf, "=\"");
+	for (p = value; *p; p++) {
+		if (*p == '\\')
+			appendString(buf, "\\\\");
+		else if (*p == '"')
+			appendString(buf, "\\\"");
+		else if (*p == '\n')
+			appendString(buf, "\\n");
+		else
+			append(buf, p, 1);
+	}
+	appendString(buf, "\"");
+}
+
+static void freeMetricsChips(void)
+{
+	int i;
+
+	for (i = 0; i < chipCount; i++) {
+		free(chips[i].numbers);
+		free(chips[i].values);
+		free(chips[i].errors);
+		free(chips[i].statsLabels);
+	}
+	free(chips);
+	chips = NULL;
+	chipCount = 0;
+	free(slots);
+	slots = NULL;
+	slotCount = 0;
+	template.len = 0;
+	statsText.len = 0;
+}
+
+/* Returns the index of a subfeature in the sampling list of a chip */
+static int addNumber(MetricsChip *chip, const char *chipName,
+		     const sensors_feature *feature, int number)
+{
+	const sensors_subfeature *sub;
+	int nr = 0;
+
+	while ((sub = sensors_get_all_subfeatures(chip->name, feature, &nr)))
+		if (sub->number == number)
+			break;
+
+	chip->statsLabels[chip->count] = statsText.len;
+	appendLabel(&statsText, "chip", chipName);
+	appendString(&statsText, ",");
+	appendLabel(&statsText, "subfeature", sub ? sub->name : "");
+	chip->statsLabels[chip->count + 1] = statsText.len;
+
+	chip->numbers[chip->count] = number;
+	return chip->count++;
+}
+
+static void addSlot(MetricsChip *chip, int index)
+{
+	slots[slotCount].textEnd = template.len;
+	slots[slotCount].value = &chip->values[index];
+	slots[slotCount].error = &chip->errors[index];
+	slotCount++;
+}
+
+void initMetrics(void)
+{
+	const FeatureDescriptor *feature;
+	MetricsChip *chip;
+	char chipName[256];
+	const char *label;
+	int i, j, f, n, first, *valueIndex, *alarmIndex;
+
+	if (!sensord_args.metricsAddr)
+		return;
+
+	for (n = 0; knownChips[n].features; n++)
+		;
+	chips = calloc(n, sizeof(MetricsChip));
+	if (n && !chips)
+		goto oom;
+	chipCount = n;
+
+	/* Build the sampling list of each chip. Each feature has at most a
+	   value and an alarm. */
+	for (i = 0, n = 0; i < chipCount; i++) {
+		chips[i].chip = &knownChips[i];
+		chips[i].name = knownChips[i].name;
+		for (j = 0; knownChips[i].features[j].format; j++)
+			;
+		chips[i].numbers = malloc(2 * j * sizeof(int) + 1);
+		chips[i].values = malloc(2 * j * sizeof(double) + 1);
+		chips[i].errors = malloc(2 * j * sizeof(int) + 1);
+		chips[i].statsLabels = malloc((2 * j + 1) * sizeof(int));
+		if (!chips[i].numbers || !chips[i].values ||
+		    !chips[i].errors || !chips[i].statsLabels)
+			goto oom;
+		n += 2 * j;
+	}
+	slots = malloc(n * sizeof(MetricsSlot) + 1);
+	valueIndex = malloc(n * sizeof(int) + 1);
+	alarmIndex = malloc(n * sizeof(int) + 1);
+	if (!slots || !valueIndex || !alarmIndex)
+		goto oom;
+
+	for (i = 0, n = 0; i < chipCount; i++) {
+		if (sensors_snprintf_chip_name(chipName, sizeof(chipName),
+					       chips[i].name) < 0)
+			chipName[0] = '\0';
+		for (feature = knownChips[i].features; feature->format;
+		     feature++, n++) {
+			valueIndex[n] = feature->type == DataType_other ? -1 :
+				addNumber(&chips[i], chipName,
+					  feature->feature,
+					  feature->dataNumbers[0]);
+			alarmIndex[n] = feature->alarmNumber < 0 ? -1 :
+				addNumber(&chips[i], chipName,
+					  feature->feature,
+					  feature->alarmNumber);
+		}
+	}
+
+	/* Samples of a family must be grouped together */
+	for (f = 0; f < ARRAY_SIZE(families); f++) {
+		first = 1;
+		for (i = 0, n = 0; i < chipCount; i++) {
+			chip = &chips[i];
+			if (sensors_snprintf_chip_name(chipName,
+						       sizeof(chipName),
+						       chip->name) < 0)
+				chipName[0] = '\0';
+
+			for (feature = knownChips[i].features;
+			     feature->format; feature++, n++) {
+				j = families[f].type == DataType_other ?
+				    alarmIndex[n] : valueIndex[n];
+				if (j < 0 || (families[f].type !=
+					      DataType_other &&
+					      feature->type != families[f].type))
+					continue;
+
+				if (first) {
+					appendString(&template, "# HELP ");
+					appendString(&template,
+						     families[f].name);
+					appendString(&template, " ");
+					appendString(&template,
+						     families[f].help);
+					appendString(&template, "\n# TYPE ");
+					appendString(&template,
+						     families[f].name);
+					appendString(&template, " gauge\n");
+					first = 0;
+				}
+
+				label = sensors_get_label_ref(chip->name,
+							      feature->feature);
+				appendString(&template, families[f].name);
+				appendString(&template, "{");
+				appendLabel(&template, "chip", chipName);
+				appendString(&template, ",");
+				appendLabel(&template, "feature",
+					    feature->feature->name);
+				appendString(&template, ",");
+				appendLabel(&template, "label",
+					    label ? label : "");
+				appendString(&template, "} ");
+				addSlot(chip, j);
+			}
+		}
+	}
+
+	free(valueIndex);
+	free(alarmIndex);
+	sampleMetrics();
+	return;
+
+oom:
+	sensorLog(LOG_ERR, "Out of memory");
+	exit(EXIT_FAILURE);
+}
+
+static void appendHeader(Buffer *buf, const char *name, const char *type,
+			 const char *help)
+{
+	appendString(buf, "# HELP ");
+	appendString(buf, name);
+	appendString(buf, " ");
+	appendString(buf, help);
+	appendString(buf, "\n# TYPE ");
+	appendString(buf, name);
+	appendString(buf, " ");
+	appendString(buf, type);
+	appendString(buf, "\n");
+}
+
+/* Append a sample labelled with a sampled subfeature, and possibly with
+   another label */
+static void appendStat(Buffer *buf, const char *name,
+		       const MetricsChip *chip, int index,
+		       const char *label, const char *labelValue,
+		       double value)
+{
+	appendString(buf, name);
+	appendString(buf, "{");
+	append(buf, statsText.data + chip->statsLabels[index],
+	       chip->statsLabels[index + 1] - chip->statsLabels[index]);
+	if (label) {
+		appendString(buf, ",");
+		appendLabel(buf, label, labelValue);
+	}
+	appendString(buf, "} ");
+	reserve(buf, VALUE_MAX);
+	buf->len += snprintf(buf->data + buf->len, VALUE_MAX, "%.9g\n",
+			     value);
+}
+
+/* Append the samples of a family of statistics for a subfeature */
+static void appendStats(Buffer *buf, int family, const MetricsChip *chip,
+			int index, const sensors_stats *stats)
+{
+	const char *name = statsFamilies[family].name;
+	unsigned long count;
+	char metric[64];
+	int i;
+
+	switch (family) {
+	case 0:
+		appendStat(buf, name, chip, index, NULL, NULL,
+			   stats->reads + stats->writes);
+		break;
+	case 1:
+		for (i = 1; i < SENSORS_STATS_ERRORS; i++)
+			if (stats->errors[i])
+				appendStat(buf, name, chip, index, "error",
+					   sensors_strerror(-i),
+					   stats->errors[i]);
+		break;
+	case 2:
+		snprintf(metric, sizeof(metric), "%s_bucket", name);
+		for (i = 0, count = 0; i < SENSORS_STATS_BUCKETS; i++) {
+			count += stats->histogram[i];
+			appendStat(buf, metric, chip, index, "le",
+				   latencyBounds[i], count);
+		}
+		snprintf(metric, sizeof(metric), "%s_sum", name);
+		appendStat(buf, metric, chip, index, NULL, NULL,
+			   stats->total_latency);
+		snprintf(metric, sizeof(metric), "%s_count", name);
+		appendStat(buf, metric, chip, index, NULL, NULL, count);
+		break;
+	case 3:
+		appendStat(buf, name, chip, index, NULL, NULL,
+			   stats->last_latency);
+		break;
+	}
+}
+
+/* Render the statistics of the sampled subfeatures, if the library keeps
+   them. A family is only announced if it has samples. */
+static void renderStats(Buffer *buf)
+{
+	sensors_stats stats;
+	int f, i, j, start, len;
+
+	buf->len = 0;
+	for (f = 0; f < ARRAY_SIZE(statsFamilies); f++) {
+		start = buf->len;
+		appendHeader(buf, statsFamilies[f].name,
+			     statsFamilies[f].type, statsFamilies[f].help);
+		len = buf->len;
+		for (i = 0; i < chipCount; i++)
+			for (j = 0; j < chips[i].count; j++)
+				if (!sensors_get_stats(chips[i].name,
+						       chips[i].numbers[j],
+						       &stats))
+					appendStats(buf, f, &chips[i], j,
+						    &stats);
+		if (buf->len == len)
+			buf->len = start;
+	}
+}
+
+int sampleMetrics(void)
+{
+	const MetricsSlot *slot;
+	Buffer *page;
+	int i, start, ret = 0;
+
+	if (!sensord_args.metricsAddr)
+		return 0;
+
+	for (i = 0; i < chipCount; i++) {
+		if (!chips[i].count)
+			continue;
+		if (readValues(chips[i].chip, chips[i].numbers,
+			       chips[i].count, chips[i].values,
+			       chips[i].errors))
+			ret = 1;
+	}
+	renderStats(&statsPage);
+
+	/* Fill the page which isn't being served. The server thread only
+	   accesses the current page, with the lock held. */
+	pthread_mutex_lock(&pageLock);
+	page = &pages[!pageCur];
+	page->len = 0;
+	reserve(page, template.len + slotCount * VALUE_MAX + statsPage.len);
+	pthread_mutex_unlock(&pageLock);
+
+	for (i = 0, start = 0; i < slotCount; i++) {
+		slot = &slots[i];
+		append(page, template.data + start, slot->textEnd - start);
+		start = slot->textEnd;
+		if (*slot->error)
+			page->len += sprintf(page->data + page->len, "NaN\n");
+		else
+			page->len += snprintf(page->data + page->len,
+					      VALUE_MAX, "%g\n", *slot->value);
+	}
+	append(page, statsPage.data, statsPage.len);
+
+	pthread_mutex_lock(&pageLock);
+	pageCur = !pageCur;
+	pthread_mutex_unlock(&pageLock);
+
+	return ret;
+}
+
+static int sendAll(int fd, const char *data, int len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, data, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void serveClient(int fd, Buffer *body)
+{
+	static const char notFound[] =
+		"HTTP/1.0 404 Not Found\r\n"
+		"Content-Type: text/plain\r\n"
+		"Connection: close\r\n\r\n"
+		"Not found\n";
+	struct timeval timeout = { 5, 0 };
+	char request[1024], header[256];
+	int len = 0, headerLen;
+	ssize_t n;
+
+	/* Don't let a slow client block the others for long */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	/* We only need the request line */
+	while (len < (int)sizeof(request) - 1) {
+		n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+		if (n <= 0)
+			return;
+		len += n;
+		request[len] = '\0';
+		if (strchr(request, '\n'))
+			break;
+	}
+
+	if (strncmp(request, "GET /metrics", 12) ||
+	    (request[12] != ' ' && request[12] != '?')) {
+		sendAll(fd, notFound, sizeof(notFound) - 1);
+		return;
+	}
+
+	pthread_mutex_lock(&pageLock);
+	body->len = 0;
+	append(body, pages[pageCur].data, pages[pageCur].len);
+	pthread_mutex_unlock(&pageLock);
+
+	headerLen = snprintf(header, sizeof(header),
+			     "HTTP/1.0 200 OK\r\n"
+			     "Content-Type: text/plain; version=0.0.4;"
+			     " charset=utf-8\r\n"
+			     "Content-Length: %d\r\n"
+			     "Connection: close\r\n\r\n", body->len);
+	if (!sendAll(fd, header, headerLen))
+		sendAll(fd, body->data, body->len);
+}
+
+static void *serveMetrics(void *data)
+{
+	Buffer body = { NULL, 0, 0 };
+	int fd;
+
+	(void)data;
+	for (;;) {
+		fd = accept(listenFd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;	/* Socket shut down */
+		}
+		serveClient(fd, &body);
+		close(fd);
+	}
+	free(body.data);
+	return NULL;
+}
+
+/* Parse [address:]port, address being optionally enclosed in brackets */
+static int openListenSocket(const char *arg)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256], *port;
+	int fd = -1, one = 1, err;
+
+	snprintf(host, sizeof(host), "%s", arg);
+	port = strrchr(host, ':');
+	if (port) {
+		*port++ = '\0';
+		if (host[0] == '[' && host[strlen(host) - 1] == ']') {
+			host[strlen(host) - 1] = '\0';
+			memmove(host, host + 1, strlen(host));
+		}
+	} else {
+		port = host;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	err = getaddrinfo(port == host || !host[0] ? NULL : host, port,
+			  &hints, &res);
+	if (err) {
+		fprintf(stderr, "Error parsing metrics address `%s': %s\n",
+			arg, gai_strerror(err));
+		return -1;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+			    ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, 16))
+			break;
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+		fprintf(stderr, "Error listening on `%s': %s\n", arg,
+			strerror(errno));
+
+	freeaddrinfo(res);
+	return fd;
+}
+
+int openMetrics(void)
+{
+	if (!sensord_args.metricsAddr)
+		return 0;
+
+	listenFd = openListenSocket(sensord_args.metricsAddr);
+	return listenFd < 0 ? -1 : 0;
+}
+
+/* Threads don't survive fork(), so this must be called after daemonizing */
+void startMetrics(void)
+{
+	sigset_t all, old;
+	int err;
+
+	if (listenFd < 0)
+		return;
+
+	/* Signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&serverThread, NULL, serveMetrics, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		sensorLog(LOG_ERR, "Error starting metrics server: %s",
+			  strerror(err));
+		return;
+	}
+	serverStarted = 1;
+}
+
+void closeMetrics(void)
+{
+	int i;
+
+	if (listenFd < 0)
+		return;
+
+	shutdown(listenFd, SHUT_RDWR);
+	if (serverStarted)
+		pthread_join(serverThread, NULL);
+	close(listenFd);
+	listenFd = -1;
+	serverStarted = 0;
+
+	free(template.data);
+	template.data = NULL;
+	template.max = 0;
+	free(statsText.data);
+	free(statsPage.data);
+	statsText.data = statsPage.data = NULL;
+	statsText.max = statsPage.max = 0;
+	statsPage.len = 0;
+	for (i = 0; i < 2; i++) {
+		free(pages[i].data);
+		pages[i].data = NULL;
+		pages[i].len = pages[i].max = 0;
+	}
+}
+
+/* The page refers to the chips, so it is emptied along with them */
+void freeMetrics(void)
+{
+	freeMetricsChips();
+
+	pthread_mutex_lock(&pageLock);
+	pages[0].len = pages[1].len = 0;
+	pthread_mutex_unlock(&pageLock);
+}
@@ -33,10 +33,13 @@
  */
 
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -45,31 +48,85 @@
 
 #include "args.h"
 #include "sensord.h"
-
-#define DO_READ 0
-#define DO_SCAN 1
-#define DO_SET 2
-#define DO_RRD 3
+#include "lib/error.h"
 
 /* one integer */
 #define STEP_BUFF 64
 /* RRA:AVERAGE:0.5:1:12345 */
 #define RRA_BUFF 256
-/* weak: max sensors for RRD .. TODO: fix */
-#define MAX_RRD_SENSORS 256
 /* weak: max raw label length .. TODO: fix */
 #define RAW_LABEL_LENGTH 32
-/* DS:label:GAUGE:900:U:U | :3000 .. TODO: fix */
+/* DS:label:GAUGE:900:U:U | :3000 */
 #define RRD_BUFF 64
 
-char rrdBuff[MAX_RRD_SENSORS * RRD_BUFF + 1];
-static char rrdLabels[MAX_RRD_SENSORS][RAW_LABEL_LENGTH + 1];
+typedef char RRDLabel[RAW_LABEL_LENGTH + 1];
+
+/* A data source of the RRD file, NULL chip and feature for loadavg */
+typedef struct {
+	const ChipDescriptor *chip;
+	const FeatureDescriptor *feature;
+	RRDLabel rawLabel;
+} RRDSource;
+
+static RRDLabel *rrdLabels;
+static int rrdLabelMax;
+
+/* Computed once by rrdInit(), in the order of the RRD file */
+static RRDSource *rrdSources;
+static int rrdSourceCount, rrdSourceMax;
+
+/* Pending updates of a file, each terminated by a null character */
+typedef struct {
+	char *buff;
+	int len, max;
+	int *updates;		/* Offset of each update in buff */
+} RRDBatch;
+
+/* A file holding some of the data sources, all of them if not sharded */
+typedef struct {
+	char *file;
+	int first, count;	/* Data sources in rrdSources */
+	RRDBatch batch;
+} RRDShard;
+
+static RRDShard *rrdShards;
+static int rrdShardCount, rrdShardMax;
+static int rrdPending;		/* Updates in each batch */
+
+/* Batches handed over to the writer thread, so that the main loop never
+   waits for the disk */
+typedef struct RRDJob {
+	struct RRDJob *next;
+	char *file;
+	RRDBatch batch;
+	int pending;
+} RRDJob;
+
+#define MAX_RRD_JOBS 1024
+
+static pthread_mutex_t writerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writerCond = PTHREAD_COND_INITIALIZER;
+static RRDJob *jobHead, **jobTail = &jobHead;
+static int jobCount;
+static int writerQuit;
+static pthread_t writerThread;
+static int writerStarted;
 
 #define LOADAVG "loadavg"
 #define LOAD_AVERAGE "Load Average"
 
-typedef void (*FeatureFN) (void *data, const char *rawLabel, const char *label,
-			   const FeatureDescriptor *feature);
+static void *rrdGrow(void *array, int *max, int count, size_t size)
+{
+	if (count < *max)
+		return array;
+	*max = *max ? *max * 2 : 64;
+	array = realloc(array, *max * size);
+	if (!array) {
+		sensorLog(LOG_ERR, "Out of memory");
+		exit(EXIT_FAILURE);
+	}
+	return array;
+}
 
 static char rrdNextChar(char c)
 {
@@ -147,22 +204,23 @@ static int _applyToFeatures(FeatureFN fn, void *data,
 	const FeatureDescriptor *features = desc->features;
 	const FeatureDescriptor *feature;
 	const char *rawLabel;
-	char *label;
+	const char *label;
 
-	for (i = 0; labelOffset + i < MAX_RRD_SENSORS && features[i].format; ++i) {
+	for (i = 0; features[i].format; ++i) {
 		feature = features + i;
 		rawLabel = feature->feature->name;
 
-		label = sensors_get_label(chip, feature->feature);
+		label = sensors_get_label_ref(chip, feature->feature);
 		if (!label) {
 			sensorLog(LOG_ERR, "Error getting sensor label: %s/%s",
 				  chip->prefix, rawLabel);
 			return -1;
 		}
 
+		rrdLabels = rrdGrow(rrdLabels, &rrdLabelMax, labelOffset + i,
+				    sizeof(RRDLabel));
 		rrdCheckLabel(rawLabel, labelOffset + i);
-		fn(data, rrdLabels[labelOffset + i], label, feature);
-		free(label);
+		fn(data, desc, rrdLabels[labelOffset + i], label, feature);
 	}
 	return i;
 }
@@ -184,7 +242,7 @@ static ChipDescriptor *lookup_known_chips(const sensors_chip_name *chip)
 	return NULL;
 }
 
-static int applyToFeatures(FeatureFN fn, void *data)
+int applyToFeatures(FeatureFN fn, void *data)
 {
 	int i, i_detected, ret, labelOffset = 0;
 	const sensors_chip_name *chip, *chip_arg;
@@ -208,88 +266,208 @@ static int applyToFeatures(FeatureFN fn, void *data)
 	return 0;
 }
 
-struct ds {
-	int num;
-	const char **argv;
-};
+static void rrdAddSource(void *data, const ChipDescriptor *chip,
+			 const char *rawLabel, const char *label,
+			 const FeatureDescriptor *feature)
+{
+	RRDSource *source;
+
+	(void) data; /* no warning */
+	(void) label;
+	if (feature && !feature->rrd)
+		return;
+
+	rrdSources = rrdGrow(rrdSources, &rrdSourceMax, rrdSourceCount,
+			     sizeof(RRDSource));
+	source = &rrdSources[rrdSourceCount++];
+	source->chip = chip;
+	source->feature = feature;
+	strcpy(source->rawLabel, rawLabel);
+}
 
-static void rrdGetSensors_DS(void *_data, const char *rawLabel,
-			     const char *label,
-			     const FeatureDescriptor *feature)
+/* The largest batch, in the worst case, is preallocated */
+static void rrdNewBatch(RRDShard *shard)
 {
-	(void) label; /* no warning */
-	if (!feature || feature->rrd) {
-		struct ds *data = _data;
-		char *ptr = rrdBuff + data->num * RRD_BUFF;
-		const char *min, *max;
-		data->argv[data->num ++] = ptr;
-
-		/* arbitrary sanity limits */
-		switch (feature ? feature->type : DataType_other) {
-		case DataType_voltage:
-			min="-25";
-			max="25";
-			break;
-		case DataType_rpm:
-			min = "0";
-			max = "12000";
-			break;
-		case DataType_temperature:
-			min = "-100";
-			max = "250";
-			break;
-		default:
-			min = max = "U";
-			break;
-		}
+	RRDBatch *batch = &shard->batch;
+
+	batch->len = 0;
+	batch->max = sensord_args.rrdBatch * (shard->count + 1) * RRD_BUFF;
+	batch->buff = malloc(batch->max);
+	batch->updates = malloc(sensord_args.rrdBatch * sizeof(int));
+	if (!batch->buff || !batch->updates) {
+		sensorLog(LOG_ERR, "Out of memory");
+		exit(EXIT_FAILURE);
+	}
+}
 
-		/*
-		 * number of seconds downtime during which average be used
-		 * instead of unknown
-		 */
-		sprintf(ptr, "DS:%s:GAUGE:%d:%s:%s", rawLabel, 5 *
-			sensord_args.rrdTime, min, max);
+static void rrdFreeShards(void)
+{
+	int i;
+
+	for (i = 0; i < rrdShardCount; i++) {
+		free(rrdShards[i].file);
+		free(rrdShards[i].batch.buff);
+		free(rrdShards[i].batch.updates);
 	}
+	free(rrdShards);
+	rrdShards = NULL;
+	rrdShardCount = rrdShardMax = 0;
+	rrdPending = 0;
 }
 
-static int rrdGetSensors(const char **argv)
+/* The file of a shard is named after the RRD file, with a suffix inserted
+   before the .rrd extension if there is one */
+static void rrdAddShard(const char *suffix, int first)
 {
-	int ret = 0;
-	struct ds data = { 0, argv};
-	ret = applyToFeatures(rrdGetSensors_DS, &data);
-	if (!ret && sensord_args.doLoad)
-		rrdGetSensors_DS(&data, LOADAVG, LOAD_AVERAGE, NULL);
-	return ret ? -1 : data.num;
+	const char *base = sensord_args.rrdFile;
+	RRDShard *shard;
+	int len = strlen(base), ext = 0;
+
+	rrdShards = rrdGrow(rrdShards, &rrdShardMax, rrdShardCount,
+			    sizeof(RRDShard));
+	shard = &rrdShards[rrdShardCount++];
+	shard->first = first;
+	shard->count = 0;
+
+	if (!suffix) {
+		shard->file = strdup(base);
+	} else {
+		if (len > 4 && !strcmp(base + len - 4, ".rrd"))
+			ext = 4;
+		shard->file = malloc(len + strlen(suffix) + 2);
+		if (shard->file)
+			sprintf(shard->file, "%.*s-%s%s", len - ext, base,
+				suffix, base + len - ext);
+	}
+	if (!shard->file) {
+		sensorLog(LOG_ERR, "Out of memory");
+		exit(EXIT_FAILURE);
+	}
 }
 
-int rrdInit(void)
+/* Split the data sources into files, one per chip or by count, as asked.
+   The load average has a file of its own when split by chip. */
+static void rrdGetShards(void)
+{
+	char suffix[256];
+	const ChipDescriptor *chip = NULL;
+	int i, size = sensord_args.rrdShard;
+
+	rrdFreeShards();
+	if (!size) {
+		rrdAddShard(NULL, 0);
+		rrdShards[0].count = rrdSourceCount;
+	} else {
+		for (i = 0; i < rrdSourceCount; i++) {
+			if (size < 0 ? !i || rrdSources[i].chip != chip :
+				       !(i % size)) {
+				chip = rrdSources[i].chip;
+				if (size > 0)
+					snprintf(suffix, sizeof(suffix), "%d",
+						 i / size);
+				else if (!chip)
+					snprintf(suffix, sizeof(suffix), "%s",
+						 LOADAVG);
+				else if (sensors_snprintf_chip_name(suffix,
+						sizeof(suffix), chip->name) < 0)
+					snprintf(suffix, sizeof(suffix), "%d",
+						 rrdShardCount);
+				rrdAddShard(suffix, i);
+			}
+			rrdShards[rrdShardCount - 1].count++;
+		}
+	}
+
+	for (i = 0; i < rrdShardCount; i++)
+		rrdNewBatch(&rrdShards[i]);
+}
+
+static int rrdGetSources(void)
 {
 	int ret;
+
+	rrdSourceCount = 0;
+	ret = applyToFeatures(rrdAddSource, NULL);
+	if (!ret && sensord_args.doLoad)
+		rrdAddSource(NULL, NULL, LOADAVG, LOAD_AVERAGE, NULL);
+
+	if (!ret)
+		rrdGetShards();
+
+	return ret ? -1 : rrdSourceCount;
+}
+
+static void rrdGetSensors_DS(char *ptr, const RRDSource *source)
+{
+	const char *min, *max;
+
+	/* arbitrary sanity limits */
+	switch (source->feature ? source->feature->type : DataType_other) {
+	case DataType_voltage:
+		min="-25";
+		max="25";
+		break;
+	case DataType_rpm:
+		min = "0";
+		max = "12000";
+		break;
+	case DataType_temperature:
+		min = "-100";
+		max = "250";
+		break;
+	default:
+		min = max = "U";
+		break;
+	}
+
+	/*
+	 * number of seconds downtime during which average be used
+	 * instead of unknown
+	 */
+	snprintf(ptr, RRD_BUFF, "DS:%s:GAUGE:%d:%s:%s", source->rawLabel,
+		 5 * sensord_args.rrdTime, min, max);
+}
+
+/* Create an RRD file if it does not exist */
+static int rrdCreate(const RRDShard *shard)
+{
+	int ret, i;
 	struct stat sb;
 	char stepBuff[STEP_BUFF], rraBuff[RRA_BUFF];
-	int argc = 4, num;
-	const char *argv[6 + MAX_RRD_SENSORS] = {
-		"sensord", sensord_args.rrdFile, "-s", stepBuff
-	};
-
-	sensorLog(LOG_DEBUG, "sensor RRD init");
+	int argc = 4, num = shard->count;
+	const char **argv;
+	char *dsBuff;
 
-	/* Create RRD if it does not exist. */
-	if (stat(sensord_args.rrdFile, &sb)) {
+	if (stat(shard->file, &sb)) {
 		if (errno != ENOENT) {
 			sensorLog(LOG_ERR, "Could not stat rrd file: %s\n",
-				  sensord_args.rrdFile);
+				  shard->file);
 			return -1;
 		}
 		sensorLog(LOG_INFO, "Creating round robin database");
 
-		num = rrdGetSensors(argv + argc);
 		if (num < 1) {
 			sensorLog(LOG_ERR, "Error creating RRD: %s: %s",
-				  sensord_args.rrdFile, "No sensors detected");
+				  shard->file, "No sensors detected");
 			return -1;
 		}
 
+		argv = malloc((argc + num + 2) * sizeof(char *));
+		dsBuff = malloc(num * RRD_BUFF);
+		if (!argv || !dsBuff) {
+			sensorLog(LOG_ERR, "Out of memory");
+			exit(EXIT_FAILURE);
+		}
+		argv[0] = "sensord";
+		argv[1] = shard->file;
+		argv[2] = "-s";
+		argv[3] = stepBuff;
+		for (i = 0; i < num; i++) {
+			rrdGetSensors_DS(dsBuff + i * RRD_BUFF,
+					 &rrdSources[shard->first + i]);
+			argv[argc + i] = dsBuff + i * RRD_BUFF;
+		}
+
 		sprintf(stepBuff, "%d", sensord_args.rrdTime);
 		sprintf(rraBuff, "RRA:%s:%f:%d:%d",
 			sensord_args.rrdNoAverage ? "LAST" :"AVERAGE",
@@ -300,13 +478,37 @@ int rrdInit(void)
 		argv[argc] = NULL;
 
 		ret = rrd_create(argc, (char**) argv);
+		free(argv);
+		free(dsBuff);
 		if (ret == -1) {
 			sensorLog(LOG_ERR, "Error creating RRD file: %s: %s",
-				  sensord_args.rrdFile, rrd_get_error());
+				  shard->file, rrd_get_error());
 			return -1;
 		}
 	}
 
+	return 0;
+}
+
+int rrdInit(void)
+{
+	int i;
+
+	sensorLog(LOG_DEBUG, "sensor RRD init");
+
+	/* Also done on reload, as the chips may have changed */
+	if (rrdGetSources() < 0)
+		return -1;
+
+	if (!rrdShardCount) {
+		sensorLog(LOG_ERR, "Error creating RRD: %s: %s",
+			  sensord_args.rrdFile, "No sensors detected");
+		return -1;
+	}
+	for (i = 0; i < rrdShardCount; i++)
+		if (rrdCreate(&rrdShards[i]))
+			return -1;
+
 	sensorLog(LOG_DEBUG, "sensor RRD initialized");
 	return 0;
 }
@@ -325,14 +527,29 @@ struct gr {
 	int loadAvg;
 };
 
-static void rrdCGI_DEF(void *_data, const char *rawLabel, const char *label,
+/* The file holding a data source */
+static const char *rrdSourceFile(const char *rawLabel)
+{
+	int i, j;
+
+	for (i = 0; i < rrdShardCount; i++)
+		for (j = 0; j < rrdShards[i].count; j++)
+			if (!strcmp(rrdSources[rrdShards[i].first + j].rawLabel,
+				    rawLabel))
+				return rrdShards[i].file;
+	return sensord_args.rrdFile;
+}
+
+static void rrdCGI_DEF(void *_data, const ChipDescriptor *chip,
+		       const char *rawLabel, const char *label,
 		       const FeatureDescriptor *feature)
 {
 	struct gr *data = _data;
-	(void) label; /* no warning */
+	(void) chip; /* no warning */
+	(void) label;
 	if (!feature || (feature->rrd && (feature->type == data->type)))
 		printf("\n\tDEF:%s=%s:%s:AVERAGE", rawLabel,
-		       sensord_args.rrdFile, rawLabel);
+		       rrdSourceFile(rawLabel), rawLabel);
 }
 
 /*
@@ -360,10 +577,12 @@ static int rrdCGI_color(const char *label)
 	return color;
 }
 
-static void rrdCGI_LINE(void *_data, const char *rawLabel, const char *label,
+static void rrdCGI_LINE(void *_data, const ChipDescriptor *chip,
+			const char *rawLabel, const char *label,
 			const FeatureDescriptor *feature)
 {
 	struct gr *data = _data;
+	(void) chip; /* no warning */
 	if (!feature || (feature->rrd && (feature->type == data->type)))
 		printf("\n\tLINE2:%s#%.6x:\"%s\"", rawLabel,
 		       rrdCGI_color(label), label);
@@ -427,44 +646,277 @@ static struct gr graphs[] = {
 	}
 };
 
-int rrdUpdate(void)
+static void rrdAppend(RRDBatch *batch, const char *str)
 {
-	int ret = rrdChips ();
-
-	if (!ret && sensord_args.doLoad) {
-		FILE *loadavg;
-		if (!(loadavg = fopen("/proc/loadavg", "r"))) {
-			sensorLog(LOG_ERR,
-				  "Error opening `/proc/loadavg': %s",
-				  strerror(errno));
-			ret = 1;
-		} else {
-			float value;
-			if (fscanf(loadavg, "%f", &value) != 1) {
-				sensorLog(LOG_ERR,
-					  "Error reading load average");
-				ret = 2;
-			} else {
-				sprintf(rrdBuff + strlen(rrdBuff), ":%f",
-					value);
-			}
-			fclose(loadavg);
+	int len = strlen(str);
+
+	while (batch->len + len >= batch->max)
+		batch->buff = rrdGrow(batch->buff, &batch->max, batch->max, 1);
+	memcpy(batch->buff + batch->len, str, len + 1);
+	batch->len += len;
+}
+
+static int rrdAppendSource(RRDBatch *batch, const RRDSource *source)
+{
+	const FeatureDescriptor *feature = source->feature;
+	const char *rrded;
+	double val[MAX_DATA];
+	int err[MAX_DATA];
+	int i, n, ret;
+
+	for (n = 0; feature->dataNumbers[n] >= 0; n++)
+		;
+	ret = readValues(source->chip, feature->dataNumbers, n, val, err);
+	if (ret) {
+		for (i = n - 1; !err[i]; i--)
+			;
+		sensorLog(LOG_ERR, "Error getting sensor data: %s/#%d: %s",
+			  source->chip->name->prefix, feature->dataNumbers[i],
+			  sensors_strerror(ret));
+		return -1;
+	}
+
+	rrded = feature->rrd(val);
+	rrdAppend(batch, ":");
+	rrdAppend(batch, rrded ? rrded : "U");
+	return 0;
+}
+
+static int rrdAppendLoad(RRDBatch *batch)
+{
+	FILE *loadavg;
+	char buff[RRD_BUFF];
+	float value;
+	int ret = 0;
+
+	if (!(loadavg = fopen("/proc/loadavg", "r"))) {
+		sensorLog(LOG_ERR, "Error opening `/proc/loadavg': %s",
+			  strerror(errno));
+		return 1;
+	}
+	if (fscanf(loadavg, "%f", &value) != 1) {
+		sensorLog(LOG_ERR, "Error reading load average");
+		ret = 2;
+	} else {
+		snprintf(buff, sizeof(buff), ":%f", value);
+		rrdAppend(batch, buff);
+	}
+	fclose(loadavg);
+	return ret;
+}
+
+/* Write the updates of a file in a single call */
+static int rrdWrite(RRDJob *job)
+{
+	const char **argv;
+	int i, ret;
+
+	argv = malloc((job->pending + 3) * sizeof(char *));
+	if (!argv) {
+		sensorLog(LOG_ERR, "Out of memory");
+		exit(EXIT_FAILURE);
+	}
+	argv[0] = "sensord";
+	argv[1] = job->file;
+	for (i = 0; i < job->pending; i++)
+		argv[2 + i] = job->batch.buff + job->batch.updates[i];
+	argv[2 + i] = NULL;
+
+	if ((ret = rrd_update(2 + job->pending, (char **) /* WEAK */ argv))) {
+		sensorLog(LOG_ERR, "Error updating RRD file: %s: %s",
+			  job->file, rrd_get_error());
+	}
+	free(argv);
+	sensorLog(LOG_DEBUG, "sensor rrd updated");
+
+	free(job->file);
+	free(job->batch.buff);
+	free(job->batch.updates);
+	free(job);
+	return ret;
+}
+
+/* The only thread calling librrd while it runs, rrdInit() is only called
+   again after it was stopped */
+static void *rrdWriter(void *data)
+{
+	RRDJob *job;
+
+	(void)data;
+	pthread_mutex_lock(&writerLock);
+	for (;;) {
+		while (!jobHead && !writerQuit)
+			pthread_cond_wait(&writerCond, &writerLock);
+		if (!jobHead)
+			break;	/* Done with the pending jobs */
+
+		job = jobHead;
+		jobHead = job->next;
+		if (!jobHead)
+			jobTail = &jobHead;
+		jobCount--;
+		pthread_mutex_unlock(&writerLock);
+		rrdWrite(job);
+		pthread_mutex_lock(&writerLock);
+	}
+	pthread_mutex_unlock(&writerLock);
+	return NULL;
+}
+
+/* Threads don't survive fork(), so the writer is started on the first
+   flush, which happens after daemonizing */
+static int rrdStartWriter(void)
+{
+	sigset_t all, old;
+	int err;
+
+	if (writerStarted)
+		return 0;
+
+	/* Signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&writerThread, NULL, rrdWriter, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		sensorLog(LOG_ERR, "Error starting RRD writer: %s",
+			  strerror(err));
+		return -1;
+	}
+	writerStarted = 1;
+	return 0;
+}
+
+/* Wait for the pending jobs to be written */
+static void rrdStopWriter(void)
+{
+	if (!writerStarted)
+		return;
+
+	pthread_mutex_lock(&writerLock);
+	writerQuit = 1;
+	pthread_cond_signal(&writerCond);
+	pthread_mutex_unlock(&writerLock);
+	pthread_join(writerThread, NULL);
+	writerQuit = 0;
+	writerStarted = 0;
+}
+
+/* Hand the pending updates of each file over to the writer thread, or
+   write them if it isn't running */
+static int rrdFlush(void)
+{
+	RRDJob *job, *dropped;
+	int i, ret = 0;
+
+	if (!rrdPending)
+		return 0;
+
+	rrdStartWriter();
+	for (i = 0; i < rrdShardCount; i++) {
+		job = malloc(sizeof(RRDJob));
+		if (job)
+			job->file = strdup(rrdShards[i].file);
+		if (!job || !job->file) {
+			sensorLog(LOG_ERR, "Out of memory");
+			exit(EXIT_FAILURE);
+		}
+		job->next = NULL;
+		job->batch = rrdShards[i].batch;
+		job->pending = rrdPending;
+		rrdNewBatch(&rrdShards[i]);
+
+		if (!writerStarted) {
+			if (rrdWrite(job))
+				ret = -1;
+			continue;
+		}
+
+		dropped = NULL;
+		pthread_mutex_lock(&writerLock);
+		if (jobCount == MAX_RRD_JOBS) {
+			dropped = jobHead;
+			jobHead = dropped->next;
+			jobCount--;
+		}
+		*jobTail = job;
+		jobTail = &job->next;
+		jobCount++;
+		pthread_cond_signal(&writerCond);
+		pthread_mutex_unlock(&writerLock);
+
+		if (dropped) {
+			sensorLog(LOG_ERR, "RRD writer falling behind, dropped"
+				  " updates of %s", dropped->file);
+			free(dropped->file);
+			free(dropped->batch.buff);
+			free(dropped->batch.updates);
+			free(dropped);
 		}
 	}
-	if (!ret) {
-		const char *argv[] = {
-			"sensord", sensord_args.rrdFile, rrdBuff, NULL
-		};
-		if ((ret = rrd_update(3, (char **) /* WEAK */ argv))) {
-			sensorLog(LOG_ERR, "Error updating RRD file: %s: %s",
-				  sensord_args.rrdFile, rrd_get_error());
+	rrdPending = 0;
+
+	return ret;
+}
+
+int rrdUpdate(void)
+{
+	char buff[STEP_BUFF];
+	RRDShard *shard;
+	int i, j, ret = 0;
+
+	/* The chips failed to reload */
+	if (!rrdSources)
+		return -1;
+
+	/* Batched updates need an explicit time */
+	snprintf(buff, sizeof(buff), "%ld", (long)time(NULL));
+
+	sensorLog(LOG_DEBUG, "sensor rrd started");
+	for (i = 0; !ret && i < rrdShardCount; i++) {
+		shard = &rrdShards[i];
+		shard->batch.updates[rrdPending] = shard->batch.len;
+		rrdAppend(&shard->batch, buff);
+		for (j = 0; !ret && j < shard->count; j++) {
+			if (rrdSources[shard->first + j].feature)
+				ret = rrdAppendSource(&shard->batch,
+					&rrdSources[shard->first + j]);
+			else
+				ret = rrdAppendLoad(&shard->batch);
 		}
 	}
-	sensorLog(LOG_DEBUG, "sensor rrd updated");
+	sensorLog(LOG_DEBUG, "sensor rrd finished");
+
+	if (ret) {
+		/* Drop the incomplete update */
+		for (j = 0; j < i; j++)
+			rrdShards[j].batch.len =
+				rrdShards[j].batch.updates[rrdPending];
+		return ret;
+	}
+
+	for (i = 0; i < rrdShardCount; i++)
+		rrdShards[i].batch.len++; /* Keep the terminating null */
+	if (++rrdPending == sensord_args.rrdBatch)
+		ret = rrdFlush();
 
 	return ret;
 }
 
+/* Write the pending updates, and forget about the chips */
+void rrdFree(void)
+{
+	rrdFlush();
+	rrdStopWriter();
+	rrdFreeShards();
+	free(rrdSources);
+	rrdSources = NULL;
+	rrdSourceCount = rrdSourceMax = 0;
+	free(rrdLabels);
+	rrdLabels = NULL;
+	rrdLabelMax = 0;
+}
+
 int rrdCGI(void)
 {
 	int ret = 0, i;
@@ -488,11 +940,11 @@ int rrdCGI(void)
 		if (!ret)
 			ret = applyToFeatures(rrdCGI_DEF, graph);
 		if (!ret && sensord_args.doLoad && graph->loadAvg)
-			rrdCGI_DEF(graph, LOADAVG, LOAD_AVERAGE, NULL);
+			rrdCGI_DEF(graph, NULL, LOADAVG, LOAD_AVERAGE, NULL);
 		if (!ret)
 			ret = applyToFeatures(rrdCGI_LINE, graph);
 		if (!ret && sensord_args.doLoad && graph->loadAvg)
-			rrdCGI_LINE(graph, LOADAVG, LOAD_AVERAGE, NULL);
+			rrdCGI_LINE(graph, NULL, LOADAVG, LOAD_AVERAGE, NULL);
 		printf (">\n</p>\n");
 	}
 	printf("<p>\n<small><b>sensord</b> by "
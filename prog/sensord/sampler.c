@@ -0,0 +1,593 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * Background sampling. Each chip is sampled at its own interval by a pool
+ * of worker threads, so that a slow chip only delays the chips sharing
+ * its bus, which can't be read in parallel anyway. The values of each
+ * chip are published in a snapshot protected by a sequence counter, from
+ * which the logging, RRD and metrics code read without ever blocking on
+ * the hardware.
+ *
+ * Only the workers read the hardware: a chip is sampled by one worker at
+ * a time, and libsensors keeps no shared state between chips, so this is
+ * safe without locking the library.
+ *
+ * With a maximum sampling interval, the features which don't change beyond
+ * the deadband of their type are sampled less and less often, down to that
+ * interval, and sampled at the chip interval again as soon as they change
+ * or their alarm is raised. Alarms themselves are sampled at the chip
+ * interval, as well as the subfeatures which belong to no feature.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "args.h"
+#include "sensord.h"
+#include "lib/error.h"
+
+typedef struct {
+	const FeatureDescriptor *feature;
+	int dataSlots[MAX_DATA + 1];	/* Index in numbers, -1 terminated */
+	int alarmSlot;
+	double ref[MAX_DATA];	/* Values at the last change */
+	int refErrors[MAX_DATA];
+	int backoff;		/* Current interval, in chip intervals */
+	int wait;		/* Chip intervals until the next sample */
+} FeatureSample;
+
+struct ChipSample {
+	ChipDescriptor *chip;
+	const sensors_chip_name *name;
+	int *numbers;		/* Subfeatures to sample */
+	int count;
+	int *slots;		/* Index in numbers of each subfeature, or -1 */
+	int slotCount;
+	double *readValues;	/* Owned by the worker sampling the chip */
+	int *readErrors;
+
+	unsigned int seq;	/* Odd while the snapshot is being updated */
+	double *values;
+	int *errors;
+
+	/* Adaptive sampling, owned by the worker sampling the chip */
+	FeatureSample *features;
+	int featureCount;
+	int maxBackoff;		/* 1 if disabled */
+	int *owners;		/* Feature of each subfeature, or -1 if none */
+	int *dueSlots;		/* Subfeatures sampled this time */
+	int *dueNumbers;
+	double *dueValues;
+	int *dueErrors;
+	int dueCount;
+
+	/* Scheduling, under schedLock */
+	int interval;
+	struct timespec due;
+	int bus;
+	int busy;
+};
+
+static ChipSample *samples;
+static int sampleCount;
+static int *busBusy;		/* Per bus, under schedLock */
+
+static pthread_mutex_t schedLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t schedCond;
+static pthread_t *workers;
+static int workerCount;
+static int stopping;
+
+static int timespecBefore(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec ||
+	       (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static int chipInterval(const sensors_chip_name *name)
+{
+	const sensors_chip_name *chip;
+	int i, nr;
+
+	for (i = 0; i < sensord_args.numIntervalChips; i++) {
+		nr = 0;
+		while ((chip = sensors_get_detected_chips(
+				&sensord_args.intervalChips[i], &nr)))
+			if (chip == name)
+				return sensord_args.intervalTimes[i];
+	}
+	return sensord_args.sampleTime;
+}
+
+/* A subfeature shared by several features, or belonging to none, is
+   sampled every time */
+static int addNumber(ChipSample *sample, int number, int owner)
+{
+	int slot;
+
+	if (number < 0)
+		return -1;
+	if ((slot = sample->slots[number]) >= 0) {
+		if (sample->owners[slot] != owner)
+			sample->owners[slot] = -1;
+		return slot;
+	}
+	slot = sample->slots[number] = sample->count;
+	sample->owners[slot] = owner;
+	sample->numbers[sample->count++] = number;
+	return slot;
+}
+
+/* Sample the subfeatures used by the features of a chip, or all readable
+   subfeatures if they are published */
+static int initSample(ChipSample *sample, ChipDescriptor *chip)
+{
+	const FeatureDescriptor *feature;
+	const sensors_feature *feat;
+	const sensors_subfeature *sub;
+	FeatureSample *state;
+	int i, nr, subNr, max = -1, n = 0;
+
+	for (feature = chip->features; feature->format; feature++) {
+		sample->featureCount++;
+		for (i = 0; feature->dataNumbers[i] >= 0; i++, n++)
+			if (feature->dataNumbers[i] > max)
+				max = feature->dataNumbers[i];
+		if (feature->alarmNumber > max)
+			max = feature->alarmNumber;
+		if (feature->beepNumber > max)
+			max = feature->beepNumber;
+		n += 2;
+	}
+	if (sensord_args.snapshotName) {
+		nr = 0;
+		while ((feat = sensors_get_features(chip->name, &nr))) {
+			subNr = 0;
+			while ((sub = sensors_get_all_subfeatures(chip->name,
+							feat, &subNr))) {
+				if (sub->number > max)
+					max = sub->number;
+				n++;
+			}
+		}
+	}
+
+	sample->chip = chip;
+	sample->name = chip->name;
+	sample->slotCount = max + 1;
+	sample->slots = malloc(sample->slotCount * sizeof(int) + 1);
+	sample->numbers = malloc(n * sizeof(int) + 1);
+	sample->readValues = malloc(n * sizeof(double) + 1);
+	sample->readErrors = malloc(n * sizeof(int) + 1);
+	sample->values = malloc(n * sizeof(double) + 1);
+	sample->errors = malloc(n * sizeof(int) + 1);
+	sample->features = calloc(sample->featureCount + 1,
+				  sizeof(FeatureSample));
+	sample->owners = malloc(n * sizeof(int) + 1);
+	sample->dueSlots = malloc(n * sizeof(int) + 1);
+	sample->dueNumbers = malloc(n * sizeof(int) + 1);
+	sample->dueValues = malloc(n * sizeof(double) + 1);
+	sample->dueErrors = malloc(n * sizeof(int) + 1);
+	if (!sample->slots || !sample->numbers || !sample->readValues ||
+	    !sample->readErrors || !sample->values || !sample->errors ||
+	    !sample->features || !sample->owners || !sample->dueSlots ||
+	    !sample->dueNumbers || !sample->dueValues || !sample->dueErrors)
+		return -1;
+
+	for (i = 0; i < sample->slotCount; i++)
+		sample->slots[i] = -1;
+	for (feature = chip->features, state = sample->features;
+	     feature->format; feature++, state++) {
+		state->feature = feature;
+		for (i = 0; feature->dataNumbers[i] >= 0; i++)
+			state->dataSlots[i] = addNumber(sample,
+					feature->dataNumbers[i],
+					state - sample->features);
+		state->dataSlots[i] = -1;
+		addNumber(sample, feature->beepNumber,
+			  state - sample->features);
+	}
+	/* Alarms are added last, so that they always belong to no feature */
+	for (feature = chip->features, state = sample->features;
+	     feature->format; feature++, state++)
+		state->alarmSlot = addNumber(sample, feature->alarmNumber, -1);
+	if (sensord_args.snapshotName) {
+		nr = 0;
+		while ((feat = sensors_get_features(chip->name, &nr))) {
+			subNr = 0;
+			while ((sub = sensors_get_all_subfeatures(chip->name,
+							feat, &subNr)))
+				if ((sub->flags & SENSORS_MODE_R) &&
+				    sample->slots[sub->number] < 0)
+					addNumber(sample, sub->number, -1);
+		}
+	}
+
+	return 0;
+}
+
+static void freeSample(ChipSample *sample)
+{
+	free(sample->slots);
+	free(sample->numbers);
+	free(sample->readValues);
+	free(sample->readErrors);
+	free(sample->values);
+	free(sample->errors);
+	free(sample->features);
+	free(sample->owners);
+	free(sample->dueSlots);
+	free(sample->dueNumbers);
+	free(sample->dueValues);
+	free(sample->dueErrors);
+}
+
+/* Select the subfeatures to sample this time */
+static void selectDue(ChipSample *sample)
+{
+	int i, owner, n = 0;
+
+	for (i = 0; i < sample->count; i++) {
+		owner = sample->owners[i];
+		if (owner >= 0 && sample->features[owner].wait)
+			continue;
+		sample->dueSlots[n] = i;
+		sample->dueNumbers[n++] = sample->numbers[i];
+	}
+	sample->dueCount = n;
+}
+
+static int hasChanged(const ChipSample *sample, const FeatureSample *state)
+{
+	int i, slot;
+
+	for (i = 0; (slot = state->dataSlots[i]) >= 0; i++) {
+		if (sample->readErrors[slot] != state->refErrors[i])
+			return 1;
+		if (!sample->readErrors[slot] &&
+		    !(fabs(sample->readValues[slot] - state->ref[i]) <=
+		      state->feature->deadband))
+			return 1;
+	}
+	return 0;
+}
+
+/* Back off the features which didn't change, snap back the others */
+static void adaptFeatures(ChipSample *sample)
+{
+	FeatureSample *state;
+	int i, slot, alarm;
+
+	for (state = sample->features;
+	     state < sample->features + sample->featureCount; state++) {
+		slot = state->alarmSlot;
+		alarm = slot >= 0 && !sample->readErrors[slot] &&
+			sample->readValues[slot] >= 0.5;
+
+		if (state->wait) {
+			/* Sampled at the next chip interval */
+			if (alarm) {
+				state->backoff = 1;
+				state->wait = 0;
+			} else {
+				state->wait--;
+			}
+			continue;
+		}
+
+		if (!state->backoff || alarm || hasChanged(sample, state)) {
+			for (i = 0; (slot = state->dataSlots[i]) >= 0; i++) {
+				state->ref[i] = sample->readValues[slot];
+				state->refErrors[i] = sample->readErrors[slot];
+			}
+			state->backoff = 1;
+		} else if (state->backoff < sample->maxBackoff) {
+			state->backoff *= 2;
+			if (state->backoff > sample->maxBackoff)
+				state->backoff = sample->maxBackoff;
+		}
+		state->wait = state->backoff - 1;
+	}
+}
+
+/* Read the hardware, then publish the values. There is a single writer
+   per chip, the worker which marked it busy. */
+static void doSample(ChipSample *sample)
+{
+	unsigned int seq;
+	int i;
+
+	if (sample->maxBackoff > 1) {
+		selectDue(sample);
+		sensors_get_values(sample->name, sample->dueNumbers,
+				   sample->dueCount, sample->dueValues,
+				   sample->dueErrors);
+		for (i = 0; i < sample->dueCount; i++) {
+			sample->readValues[sample->dueSlots[i]] =
+				sample->dueValues[i];
+			sample->readErrors[sample->dueSlots[i]] =
+				sample->dueErrors[i];
+		}
+		adaptFeatures(sample);
+	} else {
+		sensors_get_values(sample->name, sample->numbers,
+				   sample->count, sample->readValues,
+				   sample->readErrors);
+	}
+
+	/* Readers may load the values concurrently, and retry if so */
+	seq = sample->seq;
+	__atomic_store_n(&sample->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for (i = 0; i < sample->count; i++) {
+		__atomic_store(&sample->values[i], &sample->readValues[i],
+			       __ATOMIC_RELAXED);
+		__atomic_store(&sample->errors[i], &sample->readErrors[i],
+			       __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&sample->seq, seq + 2, __ATOMIC_RELEASE);
+
+	/* Only what was sampled changed */
+	if (sample->maxBackoff > 1)
+		publishSnapshot(sample->chip, sample->dueNumbers,
+				sample->dueCount, sample->dueValues,
+				sample->dueErrors);
+	else
+		publishSnapshot(sample->chip, sample->numbers, sample->count,
+				sample->readValues, sample->readErrors);
+}
+
+/* Pick the chip which is due first among those whose bus is free */
+static ChipSample *nextSample(void)
+{
+	ChipSample *next = NULL;
+	int i;
+
+	for (i = 0; i < sampleCount; i++) {
+		if (samples[i].busy || busBusy[samples[i].bus])
+			continue;
+		if (!next || timespecBefore(&samples[i].due, &next->due))
+			next = &samples[i];
+	}
+	return next;
+}
+
+static void *sampleWorker(void *data)
+{
+	struct timespec now;
+	ChipSample *sample;
+
+	(void)data;
+	pthread_mutex_lock(&schedLock);
+	while (!stopping) {
+		sample = nextSample();
+		if (!sample) {
+			pthread_cond_wait(&schedCond, &schedLock);
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (timespecBefore(&now, &sample->due)) {
+			pthread_cond_timedwait(&schedCond, &schedLock,
+					       &sample->due);
+			continue;
+		}
+
+		sample->busy = busBusy[sample->bus] = 1;
+		pthread_mutex_unlock(&schedLock);
+
+		doSample(sample);
+
+		pthread_mutex_lock(&schedLock);
+		sample->busy = busBusy[sample->bus] = 0;
+		/* Skip the samples we missed rather than catching up */
+		sample->due.tv_sec += sample->interval;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (timespecBefore(&sample->due, &now)) {
+			sample->due = now;
+			sample->due.tv_sec += sample->interval;
+		}
+		/* Another worker may be waiting for this bus */
+		pthread_cond_broadcast(&schedCond);
+	}
+	pthread_mutex_unlock(&schedLock);
+
+	return NULL;
+}
+
+/* Chips on the same bus are never sampled in parallel */
+static int assignBuses(void)
+{
+	const sensors_bus_id *bus, *other;
+	int i, j, busCount = 0;
+
+	for (i = 0; i < sampleCount; i++) {
+		bus = &samples[i].name->bus;
+		samples[i].bus = -1;
+		for (j = 0; j < i && samples[i].bus < 0; j++) {
+			other = &samples[j].name->bus;
+			if (bus->type == other->type && bus->nr == other->nr)
+				samples[i].bus = samples[j].bus;
+		}
+		if (samples[i].bus < 0)
+			samples[i].bus = busCount++;
+	}
+	return busCount;
+}
+
+void startSampler(void)
+{
+	pthread_condattr_t attr;
+	sigset_t all, old;
+	struct timespec now;
+	int i, n, interval, busCount, err;
+
+	if (!sensord_args.sampleTime)
+		return;
+
+	for (n = 0; knownChips[n].features; n++)
+		;
+	samples = calloc(n + 1, sizeof(ChipSample));
+	if (!samples)
+		goto oom;
+	/* Chips with an interval of 0 are read on demand, as usual */
+	for (i = 0; i < n; i++) {
+		interval = chipInterval(knownChips[i].name);
+		if (!interval)
+			continue;
+		samples[sampleCount].interval = interval;
+		samples[sampleCount].maxBackoff = 1;
+		if (sensord_args.maxSampleTime > interval)
+			samples[sampleCount].maxBackoff =
+				sensord_args.maxSampleTime / interval;
+		if (initSample(&samples[sampleCount++], &knownChips[i]))
+			goto oom;
+	}
+	busCount = assignBuses();
+	busBusy = calloc(busCount + 1, sizeof(int));
+	if (!busBusy)
+		goto oom;
+
+	/* Take a first sample of everything, so that the snapshot is
+	   complete from the start */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < sampleCount; i++) {
+		doSample(&samples[i]);
+		samples[i].due = now;
+		samples[i].due.tv_sec += samples[i].interval;
+		samples[i].chip->sample = &samples[i];
+	}
+
+	/* More workers than buses would only wait for a free bus */
+	workerCount = sensord_args.sampleThreads;
+	if (workerCount > busCount)
+		workerCount = busCount;
+	workers = malloc(workerCount * sizeof(pthread_t) + 1);
+	if (!workers)
+		goto oom;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&schedCond, &attr);
+	pthread_condattr_destroy(&attr);
+	stopping = 0;
+
+	/* Signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (i = 0; i < workerCount; i++) {
+		err = pthread_create(&workers[i], NULL, sampleWorker, NULL);
+		if (err) {
+			/* The snapshot won't be updated as often */
+			sensorLog(LOG_ERR, "Error starting sampler: %s",
+				  strerror(err));
+			break;
+		}
+	}
+	workerCount = i;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	sensorLog(LOG_DEBUG, "Sampling %d chips on %d buses with %d threads",
+		  sampleCount, busCount, workerCount);
+	return;
+
+oom:
+	sensorLog(LOG_ERR, "Out of memory");
+	exit(EXIT_FAILURE);
+}
+
+/* Waits for the chips being sampled, if any */
+void stopSampler(void)
+{
+	int i;
+
+	if (!samples)
+		return;
+
+	pthread_mutex_lock(&schedLock);
+	stopping = 1;
+	pthread_cond_broadcast(&schedCond);
+	pthread_mutex_unlock(&schedLock);
+	for (i = 0; i < workerCount; i++)
+		pthread_join(workers[i], NULL);
+	pthread_cond_destroy(&schedCond);
+	free(workers);
+	workers = NULL;
+	workerCount = 0;
+
+	for (i = 0; i < sampleCount; i++) {
+		samples[i].chip->sample = NULL;
+		freeSample(&samples[i]);
+	}
+	free(samples);
+	samples = NULL;
+	sampleCount = 0;
+	free(busBusy);
+	busBusy = NULL;
+}
+
+/*
+ * Same as sensors_get_values(), but from the last snapshot if the chip is
+ * sampled in the background. Subfeatures which aren't sampled can't be
+ * read then, as the worker threads may be reading the chip.
+ */
+int readValues(const ChipDescriptor *chip, const int *numbers, int count,
+	       double *values, int *errors)
+{
+	const ChipSample *sample = chip->sample;
+	unsigned int seq;
+	int i, slot, res, err;
+
+	if (!sample)
+		return sensors_get_values(chip->name, numbers, count, values,
+					  errors);
+
+	do {
+		while ((seq = __atomic_load_n(&sample->seq,
+					      __ATOMIC_ACQUIRE)) & 1)
+			;
+		err = 0;
+		for (i = 0; i < count; i++) {
+			if (numbers[i] < 0 || numbers[i] >= sample->slotCount ||
+			    (slot = sample->slots[numbers[i]]) < 0) {
+				res = -SENSORS_ERR_NO_ENTRY;
+			} else {
+				__atomic_load(&sample->values[slot],
+					      &values[i], __ATOMIC_RELAXED);
+				__atomic_load(&sample->errors[slot], &res,
+					      __ATOMIC_RELAXED);
+			}
+			if (errors)
+				errors[i] = res;
+			if (res)
+				err = res;
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&sample->seq, __ATOMIC_RELAXED) != seq);
+
+	return err;
+}
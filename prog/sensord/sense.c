@@ -21,10 +21,17 @@
  * MA 02110-1301 USA.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
 
 #include "args.h"
 #include "sensord.h"
@@ -33,11 +40,12 @@
 #define DO_READ 0
 #define DO_SCAN 1
 #define DO_SET 2
-#define DO_RRD 3
 
+/* Each thread has its own buffer, the name remains valid until the next
+   call in the same thread */
 static const char *chipName(const sensors_chip_name *chip)
 {
-	static char buffer[256];
+	static __thread char buffer[256];
 	if (sensors_snprintf_chip_name(buffer, 256, chip) < 0)
 		return NULL;
 	return buffer;
@@ -66,7 +74,7 @@ static int idChip(const sensors_chip_name *chip)
 	return 0;
 }
 
-static int get_flag(const sensors_chip_name *chip, int num)
+static int get_flag(const ChipDescriptor *descriptor, int num)
 {
 	double val;
 	int ret;
@@ -74,57 +82,48 @@ static int get_flag(const sensors_chip_name *chip, int num)
 	if (num == -1)
 		return 0;
 
-	ret = sensors_get_value(chip, num, &val);
+	ret = readValues(descriptor, &num, 1, &val, NULL);
 	if (ret) {
 		sensorLog(LOG_ERR, "Error getting sensor data: %s/#%d: %s",
-			  chip->prefix, num, sensors_strerror(ret));
+			  descriptor->name->prefix, num,
+			  sensors_strerror(ret));
 		return -1;
 	}
 
 	return (int) (val + 0.5);
 }
 
-static int do_features(const sensors_chip_name *chip,
+static int do_features(const ChipDescriptor *descriptor,
 		       const FeatureDescriptor *feature, int action)
 {
-	char *label;
+	const sensors_chip_name *chip = descriptor->name;
+	const char *label;
 	const char *formatted;
-	int i, alrm, beep, ret;
+	int i, n, alrm, beep, ret;
 	double val[MAX_DATA];
+	int err[MAX_DATA];
 
 	/* If only scanning, take a quick exit if alarm is off */
-	alrm = get_flag(chip, feature->alarmNumber);
+	alrm = get_flag(descriptor, feature->alarmNumber);
 	if (alrm == -1)
 		return -1;
 	if (action == DO_SCAN && !alrm)
 		return 0;
 
-	for (i = 0; feature->dataNumbers[i] >= 0; i++) {
-		ret = sensors_get_value(chip, feature->dataNumbers[i],
-					val + i);
-		if (ret) {
-			sensorLog(LOG_ERR,
-				  "Error getting sensor data: %s/#%d: %s",
-				  chip->prefix, feature->dataNumbers[i],
-				  sensors_strerror(ret));
-			return -1;
-		}
-	}
-
-	/* For RRD, we don't need anything else */
-	if (action == DO_RRD) {
-		if (feature->rrd) {
-			const char *rrded = feature->rrd(val);
-
-			sprintf(rrdBuff + strlen(rrdBuff), ":%s",
-				rrded ? rrded : "U");
-		}
-
-		return 0;
+	for (n = 0; feature->dataNumbers[n] >= 0; n++)
+		;
+	ret = readValues(descriptor, feature->dataNumbers, n, val, err);
+	if (ret) {
+		for (i = n - 1; !err[i]; i--)
+			;
+		sensorLog(LOG_ERR, "Error getting sensor data: %s/#%d: %s",
+			  chip->prefix, feature->dataNumbers[i],
+			  sensors_strerror(ret));
+		return -1;
 	}
 
 	/* For scanning and logging, we need extra information */
-	beep = get_flag(chip, feature->beepNumber);
+	beep = get_flag(descriptor, feature->beepNumber);
 	if (beep == -1)
 		return -1;
 
@@ -134,10 +133,7 @@ static int do_features(const sensors_chip_name *chip,
 		return -1;
 	}
 
-	/* FIXME: It would be more efficient to store the label at
-	 * initialization time.
-	 */
-	label = sensors_get_label(chip, feature->feature);
+	label = sensors_get_label_ref(chip, feature->feature);
 	if (!label) {
 		sensorLog(LOG_ERR, "Error getting sensor label: %s/%s",
 			  chip->prefix, feature->feature->name);
@@ -156,8 +152,6 @@ static int do_features(const sensors_chip_name *chip,
 		sensorLog(LOG_ALERT, "Sensor alarm: Chip %s: %s: %s",
 			  chipName(chip), label, formatted);
 
-	free(label);
-
 	return 0;
 }
 
@@ -174,7 +168,10 @@ static int doKnownChip(const sensors_chip_name *chip,
 	}
 
 	for (i = 0; features[i].format; i++) {
-		ret = do_features(chip, features + i, action);
+		/* This alarm will be notified */
+		if (action == DO_SCAN && features[i].alarmEvents)
+			continue;
+		ret = do_features(descriptor, features + i, action);
 		if (ret == -1)
 			break;
 	}
@@ -198,30 +195,34 @@ static int setChip(const sensors_chip_name *chip)
 	return ret;
 }
 
+static ChipDescriptor *lookupKnownChip(const sensors_chip_name *chip)
+{
+	int index0;
+
+	for (index0 = 0; knownChips[index0].features; ++index0) {
+		/*
+		 * Trick: we compare addresses here. We know it works
+		 * because both pointers were returned by
+		 * sensors_get_detected_chips(), so they refer to
+		 * libsensors internal structures, which do not move.
+		 */
+		if (knownChips[index0].name == chip)
+			return &knownChips[index0];
+	}
+	return NULL;
+}
+
 static int doChip(const sensors_chip_name *chip, int action)
 {
+	const ChipDescriptor *descriptor;
 	int ret = 0;
+
 	if (action == DO_SET) {
 		ret = setChip(chip);
 	} else {
-		int index0, chipindex = -1;
-		for (index0 = 0; knownChips[index0].features; ++index0) {
-			/*
-			 * Trick: we compare addresses here. We know it works
-			 * because both pointers were returned by
-			 * sensors_get_detected_chips(), so they refer to
-			 * libsensors internal structures, which do not move.
-			 */
-			if (knownChips[index0].name == chip) {
-				chipindex = index0;
-				break;
-			}
-		}
-
-		if (chipindex >= 0) {
-			ret = doKnownChip(chip, &knownChips[chipindex],
-					  action);
-		}
+		descriptor = lookupKnownChip(chip);
+		if (descriptor)
+			ret = doKnownChip(chip, descriptor, action);
 	}
 	return ret;
 }
@@ -276,17 +277,235 @@ int setChips(void)
 	return ret;
 }
 
-/* TODO: loadavg entry */
+/*
+ * Alarm events: drivers may call sysfs_notify() when an alarm attribute
+ * changes, in which case poll() reports POLLPRI and POLLERR on the open
+ * attribute file. The attribute must be read again to wait for the next
+ * notification. As there is no way to tell in advance whether a driver
+ * notifies, each alarm keeps being scanned until it is notified, and
+ * again once its watch is closed.
+ */
+
+typedef struct {
+	ChipDescriptor *chip;
+	FeatureDescriptor *feature;
+} AlarmWatch;
+
+static AlarmWatch *alarmWatches;
+static struct pollfd *alarmFds;
+static int alarmCount, alarmMax;
 
-int rrdChips(void)
+static int armAlarm(int fd)
 {
-	int ret = 0;
+	char buf[32];
 
-	strcpy(rrdBuff, "N");
+	return pread(fd, buf, sizeof(buf), 0) < 0 ? -1 : 0;
+}
 
-	sensorLog(LOG_DEBUG, "sensor rrd started");
-	ret = doChips(DO_RRD);
-	sensorLog(LOG_DEBUG, "sensor rrd finished");
+static const sensors_subfeature *getSubfeature(const sensors_chip_name *chip,
+					       const sensors_feature *feature,
+					       int number)
+{
+	const sensors_subfeature *sub;
+	int nr = 0;
 
-	return ret;
+	while ((sub = sensors_get_all_subfeatures(chip, feature, &nr)))
+		if (sub->number == number)
+			return sub;
+	return NULL;
+}
+
+static int addAlarmWatch(ChipDescriptor *descriptor,
+			 FeatureDescriptor *feature)
+{
+	const sensors_chip_name *chip = descriptor->name;
+	const sensors_subfeature *sub;
+	char path[PATH_MAX];
+	int fd;
+
+	sub = getSubfeature(chip, feature->feature, feature->alarmNumber);
+	if (!sub || !chip->path)
+		return 0;
+
+	snprintf(path, sizeof(path), "%s/%s", chip->path, sub->name);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || armAlarm(fd)) {
+		/* Not fatal, the chip will be scanned as usual */
+		sensorLog(LOG_DEBUG, "Can't watch %s: %s", path,
+			  strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return errno == EMFILE ? -1 : 0;
+	}
+
+	if (alarmCount == alarmMax) {
+		alarmMax = alarmMax ? alarmMax * 2 : 64;
+		alarmWatches = realloc(alarmWatches,
+				       alarmMax * sizeof(AlarmWatch));
+		/* Plus one for the hotplug socket */
+		alarmFds = realloc(alarmFds,
+				   (alarmMax + 1) * sizeof(struct pollfd));
+		if (!alarmWatches || !alarmFds) {
+			sensorLog(LOG_ERR, "Out of memory");
+			close(fd);
+			return -1;
+		}
+	}
+	alarmWatches[alarmCount].chip = descriptor;
+	alarmWatches[alarmCount].feature = feature;
+	alarmFds[alarmCount].fd = fd;
+	alarmFds[alarmCount].events = POLLPRI;
+	alarmFds[alarmCount].revents = 0;
+	alarmCount++;
+
+	return 0;
+}
+
+void initAlarmEvents(void)
+{
+	const sensors_chip_name *chip, *chip_arg;
+	ChipDescriptor *descriptor;
+	FeatureDescriptor *feature;
+	struct rlimit limit;
+	int i, j;
+
+	if (!sensord_args.alarmEvents)
+		return;
+
+	/* We may need a lot of file descriptors */
+	if (!getrlimit(RLIMIT_NOFILE, &limit) &&
+	    limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	for (j = 0; j < sensord_args.numChipNames; j++) {
+		chip_arg = &sensord_args.chipNames[j];
+		i = 0;
+		while ((chip = sensors_get_detected_chips(chip_arg, &i))) {
+			descriptor = lookupKnownChip(chip);
+			if (!descriptor)
+				continue;
+
+			for (feature = descriptor->features; feature->format;
+			     feature++) {
+				if (feature->alarmNumber < 0)
+					continue;
+				if (addAlarmWatch(descriptor, feature)) {
+					sensorLog(LOG_NOTICE, "Too many alarms,"
+						  " some will only be scanned");
+					return;
+				}
+			}
+		}
+	}
+
+	sensorLog(LOG_DEBUG, "Watching %d alarms", alarmCount);
+}
+
+void freeAlarmEvents(void)
+{
+	int i;
+
+	for (i = 0; i < alarmCount; i++) {
+		if (alarmFds[i].fd >= 0)
+			close(alarmFds[i].fd);
+		alarmWatches[i].feature->alarmEvents = 0;
+	}
+	free(alarmWatches);
+	free(alarmFds);
+	alarmWatches = NULL;
+	alarmFds = NULL;
+	alarmCount = alarmMax = 0;
+}
+
+/* The alarm is scanned again from then on */
+static void closeAlarmWatch(int i)
+{
+	if (alarmFds[i].fd >= 0)
+		close(alarmFds[i].fd);
+	alarmFds[i].fd = -1;
+	alarmWatches[i].feature->alarmEvents = 0;
+}
+
+static void doAlarmEvent(int i)
+{
+	AlarmWatch *watch = &alarmWatches[i];
+
+	if (armAlarm(alarmFds[i].fd)) {
+		/* The device is probably gone, stop watching */
+		sensorLog(LOG_ERR, "Error reading alarm: %s",
+			  strerror(errno));
+		closeAlarmWatch(i);
+		return;
+	}
+
+	if (!watch->feature->alarmEvents) {
+		sensorLog(LOG_DEBUG, "Chip %s notifies alarm %s",
+			  chipName(watch->chip->name),
+			  watch->feature->feature->name);
+		watch->feature->alarmEvents = 1;
+	}
+
+	do_features(watch->chip, watch->feature, DO_SCAN);
+}
+
+static long long elapsedMs(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000LL +
+	       (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/*
+ * Wait for alarm and hotplug events for timeout seconds, or until a signal
+ * is caught or a hotplug event comes. Returns the number of seconds
+ * actually waited.
+ */
+int waitEvents(int timeout)
+{
+	struct pollfd hotplugFd, *fds;
+	struct timespec start;
+	long long left, elapsed = 0;
+	int i, n, count;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (elapsed < timeout * 1000LL) {
+		/* The hotplug socket comes last, after the alarms */
+		fds = alarmFds ? alarmFds : &hotplugFd;
+		count = alarmCount;
+		if (getHotplugFd() >= 0) {
+			fds[count].fd = getHotplugFd();
+			fds[count].events = POLLIN;
+			fds[count].revents = 0;
+			count++;
+		}
+
+		left = timeout * 1000LL - elapsed;
+		n = poll(fds, count, left > INT_MAX ? -1 : left);
+		if (n < 0) {
+			if (errno == EINTR)
+				break;
+			sensorLog(LOG_ERR, "poll: %s", strerror(errno));
+			sleep(timeout - elapsed / 1000);
+			return timeout;
+		}
+
+		for (i = 0; n > 0 && i < alarmCount; i++) {
+			if (!alarmFds[i].revents)
+				continue;
+			n--;
+			if (alarmFds[i].revents & POLLNVAL)
+				closeAlarmWatch(i);
+			else if (alarmFds[i].revents & (POLLPRI | POLLERR))
+				doAlarmEvent(i);
+		}
+		elapsed = elapsedMs(&start);
+		if (n > 0)
+			break;
+	}
+
+	return elapsed / 1000;
 }
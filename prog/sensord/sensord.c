@@ -40,14 +40,16 @@ static int logOpened = 0;
 
 static volatile sig_atomic_t done = 0;
 static volatile sig_atomic_t reload = 0;
+static volatile sig_atomic_t rescan = 0;
 
 #define LOG_BUFFER 4096
 
 #include <stdarg.h>
 
+/* Called from any thread */
 void sensorLog(int priority, const char *fmt, ...)
 {
-	static char buffer[1 + LOG_BUFFER];
+	char buffer[1 + LOG_BUFFER];
 	va_list ap;
 	va_start(ap, fmt);
 	vsnprintf(buffer, LOG_BUFFER, fmt, ap);
@@ -72,13 +74,41 @@ static void signalHandler(int sig)
 	case SIGHUP:
 		reload = 1;
 		break;
+	case SIGUSR1:
+		rescan = 1;
+		break;
 	}
 }
 
+/* Everything which refers to the chips, as opposed to the library */
+static void initChipState(void)
+{
+	initAlarmEvents();
+	initSnapshot();
+	startSampler();
+	initMetrics();
+	initHistory();
+	if (sensord_args.rrdFile)
+		rrdInit();
+}
+
+static void freeChipState(void)
+{
+	freeAlarmEvents();
+	freeMetrics();
+	freeHistoryChips();
+	stopSampler();
+	freeSnapshot();
+	if (sensord_args.rrdFile)
+		rrdFree();
+}
+
 static int sensord(void)
 {
-	int ret = 0;
+	int ret = 0, changes;
 	int scanValue = 0, logValue = 0;
+	int metricsValue = sensord_args.metricsTime;
+	int historyValue = 0;
 	/*
 	 * First RRD update at next RRD timeslot to prevent failures due
 	 * one timeslot updated twice on restart for example.
@@ -87,14 +117,39 @@ static int sensord(void)
 		sensord_args.rrdTime;
 
 	sensorLog(LOG_INFO, "sensord started");
+	initAlarmEvents();
+	initSnapshot();
+	startSampler();
+	initMetrics();
+	startMetrics();
+	initHistory();
+	startHistory();
+	initHotplug();
 
 	while (!done) {
-		if (reload) {
-			ret = reloadLib(sensord_args.cfgFile);
+		if (sensord_args.hotplug && (changes = readHotplug())) {
+			if (changes < 0) {
+				rescan = 1;
+			} else {
+				freeChipState();
+				if (applyHotplug())
+					sensorLog(LOG_NOTICE, "hotplug error");
+				else
+					initChipState();
+			}
+		}
+		if (reload || rescan) {
+			freeChipState();
+			if (rescan)
+				ret = rescanLib(sensord_args.cfgFile);
+			else
+				ret = reloadLib(sensord_args.cfgFile);
 			if (ret)
 				sensorLog(LOG_NOTICE, "configuration reload"
 					  " error");
-			reload = 0;
+			if (knownChips)
+				initChipState();
+			reload = rescan = 0;
 		}
 		if (sensord_args.scanTime && (scanValue <= 0)) {
 			if ((ret = scanChips()))
@@ -121,20 +176,57 @@ static int sensord(void)
 			rrdValue = sensord_args.rrdTime - time(NULL) %
 				sensord_args.rrdTime;
 		}
+		if (sensord_args.metricsAddr && (metricsValue <= 0)) {
+			if ((ret = sampleMetrics()))
+				sensorLog(LOG_DEBUG,
+					  "metrics sample error (%d)", ret);
+			metricsValue += sensord_args.metricsTime;
+		}
+		if (sensord_args.historySocket && (historyValue <= 0)) {
+			if ((ret = sampleHistory()))
+				sensorLog(LOG_DEBUG,
+					  "history sample error (%d)", ret);
+			historyValue += sensord_args.historyTime;
+		}
 		if (!done) {
 			int a = sensord_args.logTime ? logValue : INT_MAX;
 			int b = sensord_args.scanTime ? scanValue : INT_MAX;
 			int c = (sensord_args.rrdTime && sensord_args.rrdFile)
 				? rrdValue : INT_MAX;
+			int d = sensord_args.metricsAddr ? metricsValue :
+				INT_MAX;
+			int e = sensord_args.historySocket ? historyValue :
+				INT_MAX;
 			int sleepTime = (a < b) ? ((a < c) ? a : c) :
 				((b < c) ? b : c);
-			sleep(sleepTime);
+
+			if (d < sleepTime)
+				sleepTime = d;
+			if (e < sleepTime)
+				sleepTime = e;
+
+			if (sensord_args.alarmEvents || sensord_args.hotplug)
+				sleepTime = waitEvents(sleepTime);
+			else
+				sleep(sleepTime);
 			scanValue -= sleepTime;
 			logValue -= sleepTime;
 			rrdValue -= sleepTime;
+			metricsValue -= sleepTime;
+			historyValue -= sleepTime;
 		}
 	}
 
+	freeHotplug();
+	if (sensord_args.rrdFile)
+		rrdFree();
+	closeMetrics();
+	freeMetrics();
+	closeHistory();
+	freeHistory();
+	stopSampler();
+	freeSnapshot();
+	freeAlarmEvents();
 	sensorLog(LOG_INFO, "sensord stopped");
 
 	return ret;
@@ -169,6 +261,13 @@ static void install_sighandler(void)
 			strerror(errno));
 		exit(EXIT_FAILURE);
 	}
+
+	ret = sigaction(SIGUSR1, &new, NULL);
+	if (ret == -1) {
+		fprintf(stderr, "Could not set sighandler for SIGUSR1: %s\n",
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
 }
 
 static void daemonize(void)
@@ -256,6 +355,11 @@ int main(int argc, char **argv)
 	if (sensord_args.doCGI) {
 		ret = rrdCGI();
 	} else {
+		/* Report address errors before going to the background */
+		if (openMetrics() || openHistory()) {
+			freeChips();
+			exit(EXIT_FAILURE);
+		}
 		daemonize();
 		ret = sensord();
 		undaemonize();
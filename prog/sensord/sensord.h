@@ -37,6 +37,7 @@ extern void freeChips(void);
 
 extern int loadLib(const char *cfgPath);
 extern int reloadLib(const char *cfgPath);
+extern int rescanLib(const char *cfgPath);
 extern int unloadLib(void);
 
 /* from sense.c */
@@ -44,14 +45,26 @@ extern int unloadLib(void);
 extern int readChips(void);
 extern int scanChips(void);
 extern int setChips(void);
-extern int rrdChips(void);
+extern void initAlarmEvents(void);
+extern void freeAlarmEvents(void);
+extern int waitEvents(int timeout);
 
-/* from rrd.c */
+/* from hotplug.c */
 
-extern char rrdBuff[];
-extern int rrdInit(void);
-extern int rrdUpdate(void);
-extern int rrdCGI(void);
+extern void initHotplug(void);
+extern void freeHotplug(void);
+extern int getHotplugFd(void);
+extern int readHotplug(void);
+extern int applyHotplug(void);
+
+/* from metrics.c */
+
+extern int openMetrics(void);
+extern void startMetrics(void);
+extern void closeMetrics(void);
+extern void initMetrics(void);
+extern void freeMetrics(void);
+extern int sampleMetrics(void);
 
 /* from chips.c */
 
@@ -73,17 +86,61 @@ typedef struct {
 	FormatterFN format;
 	RRDFN rrd;
 	DataType type;
+	double deadband;	/* Changes ignored when backing off */
 	int alarmNumber;
 	int beepNumber;
+	int alarmEvents;	/* Alarm is notified, no need to scan */
 	const sensors_feature *feature;
 	int dataNumbers[MAX_DATA + 1];
 } FeatureDescriptor;
 
+typedef struct ChipSample ChipSample;
+
 typedef struct {
 	const sensors_chip_name *name;
 	FeatureDescriptor *features;
+	ChipSample *sample;	/* Sampled in the background, or NULL */
 } ChipDescriptor;
 
 extern ChipDescriptor * knownChips;
 extern int initKnownChips(void);
 extern void freeKnownChips(void);
+
+/* from history.c */
+
+extern int openHistory(void);
+extern void startHistory(void);
+extern void closeHistory(void);
+extern void initHistory(void);
+extern void freeHistoryChips(void);
+extern void freeHistory(void);
+extern int sampleHistory(void);
+
+/* from rrd.c */
+
+/* Called for each feature of the chips sensord was asked for, in the
+   order of the RRD file, with a label unique among them */
+typedef void (*FeatureFN) (void *data, const ChipDescriptor *chip,
+			   const char *rawLabel, const char *label,
+			   const FeatureDescriptor *feature);
+
+extern int applyToFeatures(FeatureFN fn, void *data);
+extern int rrdInit(void);
+extern int rrdUpdate(void);
+extern void rrdFree(void);
+extern int rrdCGI(void);
+
+/* from shm.c */
+
+extern void initSnapshot(void);
+extern void freeSnapshot(void);
+extern void publishSnapshot(const ChipDescriptor *chip, const int *numbers,
+			    int count, const double *values,
+			    const int *errors);
+
+/* from sampler.c */
+
+extern void startSampler(void);
+extern void stopSampler(void);
+extern int readValues(const ChipDescriptor *chip, const int *numbers,
+		      int count, double *values, int *errors);
@@ -0,0 +1,185 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * Shared memory snapshot. The values of all readable subfeatures of all
+ * chips are published in a POSIX shared memory segment, read by other
+ * programs with sensors_open_snapshot(). The sampler workers publish the
+ * values of each chip as they sample it. The layout is described in
+ * lib/snapshot.h.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "args.h"
+#include "sensord.h"
+#include "lib/error.h"
+#include "lib/snapshot.h"
+
+static struct sensors_snapshot_header *header;
+static struct sensors_snapshot_chip *shmChips;
+static struct sensors_snapshot_value *shmValues;
+static size_t shmSize;
+
+/* Subfeature numbers are dense, so the count is the highest plus one */
+static int countSubfeatures(const sensors_chip_name *name)
+{
+	const sensors_feature *feature;
+	const sensors_subfeature *sub;
+	int nr = 0, subNr, count = 0;
+
+	while ((feature = sensors_get_features(name, &nr))) {
+		subNr = 0;
+		while ((sub = sensors_get_all_subfeatures(name, feature,
+							  &subNr)))
+			if (sub->number >= count)
+				count = sub->number + 1;
+	}
+	return count;
+}
+
+static int createSegment(const char *name, size_t size)
+{
+	void *map;
+	int fd;
+
+	/* Readers of a previous segment will notice it is stale */
+	shm_unlink(name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	if (fchmod(fd, 0644) || ftruncate(fd, size)) {
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		shm_unlink(name);
+		return -1;
+	}
+
+	header = map;
+	shmSize = size;
+	return 0;
+}
+
+void initSnapshot(void)
+{
+	const sensors_chip_name *name;
+	int i, j, n, valueCount = 0;
+	size_t size;
+
+	if (!sensord_args.snapshotName)
+		return;
+
+	for (n = 0; knownChips[n].features; n++)
+		valueCount += countSubfeatures(knownChips[n].name);
+	size = sizeof(*header) + n * sizeof(*shmChips) +
+	       valueCount * sizeof(*shmValues);
+
+	if (createSegment(sensord_args.snapshotName, size)) {
+		sensorLog(LOG_ERR, "Error creating snapshot %s: %s",
+			  sensord_args.snapshotName, strerror(errno));
+		return;
+	}
+
+	/* One chip per known chip, in the same order */
+	shmChips = (struct sensors_snapshot_chip *)(header + 1);
+	shmValues = (struct sensors_snapshot_value *)(shmChips + n);
+	for (i = 0, valueCount = 0; i < n; i++) {
+		name = knownChips[i].name;
+		/* Chips we can't name are left empty, they can't be found */
+		if (strlen(name->prefix) < SENSORS_SNAPSHOT_PREFIX_MAX) {
+			strcpy(shmChips[i].prefix, name->prefix);
+			shmChips[i].bus_type = name->bus.type;
+			shmChips[i].bus_nr = name->bus.nr;
+			shmChips[i].addr = name->addr;
+			shmChips[i].value_count = countSubfeatures(name);
+		}
+		shmChips[i].first_value = valueCount;
+		for (j = 0; j < (int)shmChips[i].value_count; j++)
+			shmValues[valueCount + j].error =
+				-SENSORS_ERR_NO_ENTRY;
+		valueCount += shmChips[i].value_count;
+	}
+
+	memcpy(header->magic, SENSORS_SNAPSHOT_MAGIC, sizeof(header->magic));
+	header->size = size;
+	header->chip_count = n;
+	header->value_count = valueCount;
+	__atomic_store_n(&header->version, SENSORS_SNAPSHOT_VERSION,
+			 __ATOMIC_RELEASE);
+
+	sensorLog(LOG_DEBUG, "Publishing %d values of %d chips in %s",
+		  valueCount, n, sensord_args.snapshotName);
+}
+
+/* Open readers keep their mapping until they notice the stale flag */
+void freeSnapshot(void)
+{
+	if (!header)
+		return;
+
+	__atomic_store_n(&header->stale, 1, __ATOMIC_RELEASE);
+	shm_unlink(sensord_args.snapshotName);
+	munmap(header, shmSize);
+	header = NULL;
+	shmChips = NULL;
+	shmValues = NULL;
+}
+
+/* Called by the worker sampling the chip, so there is a single writer */
+void publishSnapshot(const ChipDescriptor *chip, const int *numbers,
+		     int count, const double *values, const int *errors)
+{
+	struct sensors_snapshot_chip *shmChip;
+	struct sensors_snapshot_value *value;
+	unsigned int seq;
+	int i;
+
+	if (!header)
+		return;
+
+	shmChip = &shmChips[chip - knownChips];
+	seq = shmChip->seq;
+	__atomic_store_n(&shmChip->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for (i = 0; i < count; i++) {
+		if (numbers[i] >= (int)shmChip->value_count)
+			continue;
+		value = &shmValues[shmChip->first_value + numbers[i]];
+		__atomic_store(&value->value, &values[i], __ATOMIC_RELAXED);
+		__atomic_store_n(&value->error, errors[i], __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&shmChip->time, (int64_t)time(NULL),
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&shmChip->seq, seq + 2, __ATOMIC_RELEASE);
+}
@@ -27,6 +27,7 @@
 
 #include "main.h"
 #include "chips.h"
+#include "writer.h"
 #include "lib/sensors.h"
 #include "lib/error.h"
 
@@ -44,17 +45,18 @@ void print_chip_raw(const sensors_chip_name *name)
 	int a, b, err;
 	const sensors_feature *feature;
 	const sensors_subfeature *sub;
-	char *label;
+	const char *label;
 	double val;
 
 	a = 0;
 	while ((feature = sensors_get_features(name, &a))) {
-		if (!(label = sensors_get_label(name, feature))) {
+		if (!(label = sensors_get_label_ref(name, feature))) {
 			fprintf(stderr, "ERROR: Can't get label of feature "
 				"%s!\n", feature->name);
 			continue;
 		}
-		printf("%s:\n", label);
+		out_str(label);
+		out_str(":\n");
 
 		b = 0;
 		while ((sub = sensors_get_all_subfeatures(name, feature, &b))) {
@@ -68,65 +70,76 @@ void print_chip_raw(const sensors_chip_name *name)
 				else {
 					if (fahrenheit)
 						val = deg_ctof(val);
-					printf("  %s: %.3f\n", sub->name, val);
+					out_str("  ");
+					out_str(sub->name);
+					out_str(": ");
+					out_value(val);
+					out_char('\n');
 				}
-			} else
-				printf("(%s)\n", label);
+			} else {
+				out_char('(');
+				out_str(label);
+				out_str(")\n");
+			}
 		}
-		free(label);
 	}
 }
 
-void print_chip_json(const sensors_chip_name *name)
+/*
+ * cnt is the number of members the caller already printed in the object.
+ * Write-only subfeatures have no value, so they are left out. With
+ * json_lines, the whole object is printed on a single line.
+ */
+void print_chip_json(const sensors_chip_name *name, int cnt)
 {
-	int a, b, cnt, subCnt, err;
+	int a, b, subCnt, err;
 	const sensors_feature *feature;
 	const sensors_subfeature *sub;
-	char *label;
+	const char *label;
 	double val;
 
 	a = 0;
-	cnt = 0;
 	while ((feature = sensors_get_features(name, &a))) {
-		if (!(label = sensors_get_label(name, feature))) {
+		if (!(label = sensors_get_label_ref(name, feature))) {
 			fprintf(stderr, "ERROR: Can't get label of feature "
 				"%s!\n", feature->name);
 			continue;
 		}
 		if (cnt > 0)
-			printf(",\n");
-		printf("      \"%s\":{\n", label);
+			out_str(json_lines ? "," : ",\n");
+		if (!json_lines)
+			out_str("      ");
+		out_json_str(label);
+		out_str(json_lines ? ":{" : ":{\n");
 
 		b = 0;
 		subCnt = 0;
 		while ((sub = sensors_get_all_subfeatures(name, feature, &b))) {
-			if (sub->flags & SENSORS_MODE_R) {
-				if ((err = sensors_get_value(name, sub->number,
-							     &val))) {
-					fprintf(stderr, "ERROR: Can't get "
-						"value of subfeature %s: %s\n",
-						sub->name,
-						sensors_strerror(err));
-				} else {
-					if (subCnt > 0)
-						printf(",\n");
-					if (fahrenheit)
-						val = deg_ctof(val);
-					printf("         \"%s\": %.3f", sub->name, val);
-					subCnt++;
-				}
-
-			} else {
-				printf("(%s)", label);
-				subCnt++;
+			if (!(sub->flags & SENSORS_MODE_R))
+				continue;
+			if ((err = sensors_get_value(name, sub->number,
+						     &val))) {
+				fprintf(stderr, "ERROR: Can't get "
+					"value of subfeature %s: %s\n",
+					sub->name, sensors_strerror(err));
+				continue;
 			}
+			if (subCnt > 0)
+				out_str(json_lines ? "," : ",\n");
+			if (fahrenheit)
+				val = deg_ctof(val);
+			if (!json_lines)
+				out_str("         ");
+			out_json_str(sub->name);
+			out_str(json_lines ? ":" : ": ");
+			out_json_value(val);
+			subCnt++;
 		}
-		free(label);
-		printf("\n      }");
+		out_str(json_lines ? "}" : "\n      }");
 		cnt++;
 	}
-	if (cnt > 0)
-		printf("\n");
+	if (cnt > 0 && !json_lines)
+		out_char('\n');
 }
 
 static const char hyst_str[] = "hyst";
@@ -134,7 +147,7 @@ static const char hyst_str[] = "hyst";
 static void print_label(const char *label, int space)
 {
 	int len = strlen(label)+1;
-	printf("%s:%*s", label, space - len, "");
+	fprintf(output, "%s:%*s", label, space - len, "");
 }
 
 static double get_value(const sensors_chip_name *name,
@@ -167,19 +180,18 @@ static int get_input_value(const sensors_chip_name *name,
 	return err;
 }
 
-static int get_label_size(const sensors_chip_name *name)
+int get_label_size(const sensors_chip_name *name)
 {
 	int i;
 	const sensors_feature *iter;
-	char *label;
+	const char *label;
 	unsigned int max_size = 11;	/* 11 as minimum label width */
 
 	i = 0;
 	while ((iter = sensors_get_features(name, &i))) {
-		if ((label = sensors_get_label(name, iter)) &&
+		if ((label = sensors_get_label_ref(name, iter)) &&
 		    strlen(label) > max_size)
 			max_size = strlen(label);
-		free(label);
 	}
 
 	/* One more for the colon, and one more to guarantee at least one
@@ -192,18 +204,18 @@ static void print_alarms(struct sensor_subfeature_data *alarms, int alarm_count,
 {
 	int i, printed;
 
-	printf("%*s", leading_spaces + 7, "ALARM");
+	fprintf(output, "%*s", leading_spaces + 7, "ALARM");
 	if (alarm_count > 1 || alarms[0].name) {
-		printf(" (");
+		fprintf(output, " (");
 		for (i = printed = 0; i < alarm_count; i++) {
 			if (alarms[i].name) {
 				if (printed)
-					printf(", ");
-				printf("%s", alarms[i].name);
+					fprintf(output, ", ");
+				fprintf(output, "%s", alarms[i].name);
 				printed = 1;
 			}
 		}
-		printf(")");
+		fprintf(output, ")");
 	}
 }
 
@@ -224,20 +236,20 @@ static void print_limits(struct sensor_subfeature_data *limits,
 	for (i = slot = 0; i < limit_count; i++, slot++) {
 		if (!(slot & 1)) {
 			if (slot)
-				printf("\n%*s", label_size + 10, "");
-			printf("(");
+				fprintf(output, "\n%*s", label_size + 10, "");
+			fprintf(output, "(");
 		} else {
-			printf(", ");
+			fprintf(output, ", ");
 		}
-		printf(fmt, limits[i].name, limits[i].value,
-			     limits[i].unit);
+		fprintf(output, fmt, limits[i].name, limits[i].value,
+			limits[i].unit);
 
 		/* If needed, skip one slot to avoid hyst on first column */
 		skip = i + 2 < limit_count && limits[i + 2].name == hyst_str &&
 		       !(slot & 1);
 
 		if (((slot + skip) & 1) || i == limit_count - 1) {
-			printf(")");
+			fprintf(output, ")");
 			if (alarm_count && !alarms_printed) {
 				print_alarms(alarms, alarm_count,
 					     (slot & 1) ? 0 : 16);
@@ -354,30 +366,29 @@ static void print_chip_temp(const sensors_chip_name *name,
 	int sensor_count, alarm_count;
 	const sensors_subfeature *sf;
 	double val;
-	char *label;
+	const char *label;
 	int i;
 
-	if (!(label = sensors_get_label(name, feature))) {
+	if (!(label = sensors_get_label_ref(name, feature))) {
 		fprintf(stderr, "ERROR: Can't get label of feature %s!\n",
 			feature->name);
 		return;
 	}
 	print_label(label, label_size);
-	free(label);
 
 	sf = sensors_get_subfeature(name, feature,
 				    SENSORS_SUBFEATURE_TEMP_FAULT);
 	if (sf && get_value(name, sf)) {
-		printf("   FAULT  ");
+		fprintf(output, "   FAULT  ");
 	} else {
 		sf = sensors_get_subfeature(name, feature,
 					    SENSORS_SUBFEATURE_TEMP_INPUT);
 		if (sf && get_input_value(name, sf, &val) == 0) {
 			if (fahrenheit)
 				val = deg_ctof(val);
-			printf("%+6.1f%s  ", val, degstr);
+			fprintf(output, "%+6.1f%s  ", val, degstr);
 		} else
-			printf("     N/A  ");
+			fprintf(output, "     N/A  ");
 	}
 
 	sensor_count = alarm_count = 0;
@@ -404,15 +415,15 @@ static void print_chip_temp(const sensors_chip_name *name,
 		if (sens > 1000)
 			sens = 4;
 
-		printf("  sensor = %s", sens == 0 ? "disabled" :
-		       sens == 1 ? "CPU diode" :
-		       sens == 2 ? "transistor" :
-		       sens == 3 ? "thermal diode" :
-		       sens == 4 ? "thermistor" :
-		       sens == 5 ? "AMD AMDSI" :
-		       sens == 6 ? "Intel PECI" : "unknown");
+		fprintf(output, "  sensor = %s", sens == 0 ? "disabled" :
+			sens == 1 ? "CPU diode" :
+			sens == 2 ? "transistor" :
+			sens == 3 ? "thermal diode" :
+			sens == 4 ? "thermistor" :
+			sens == 5 ? "AMD AMDSI" :
+			sens == 6 ? "Intel PECI" : "unknown");
 	}
-	printf("\n");
+	fprintf(output, "\n");
 }
 
 static const struct sensor_subfeature_list voltage_sensors[] = {
@@ -439,28 +450,28 @@ static void print_chip_in(const sensors_chip_name *name,
 			  int label_size)
 {
 	const sensors_subfeature *sf;
-	char *label;
+	const char *label;
 	const char *unit;
 	struct sensor_subfeature_data sensors[NUM_IN_SENSORS];
 	struct sensor_subfeature_data alarms[NUM_IN_ALARMS];
 	int sensor_count, alarm_count;
 	double val;
 
-	if (!(label = sensors_get_label(name, feature))) {
+	if (!(label = sensors_get_label_ref(name, feature))) {
 		fprintf(stderr, "ERROR: Can't get label of feature %s!\n",
 			feature->name);
 		return;
 	}
 	print_label(label, label_size);
-	free(label);
 
 	sf = sensors_get_subfeature(name, feature,
 				    SENSORS_SUBFEATURE_IN_INPUT);
 	if (sf && get_input_value(name, sf, &val) == 0) {
 		scale_value(&val, &unit);
-		printf("%6.2f %sV%*s", val, unit, 2 - (int)strlen(unit), "");
+		fprintf(output, "%6.2f %sV%*s", val, unit,
+			2 - (int)strlen(unit), "");
 	} else {
-		printf("     N/A  ");
+		fprintf(output, "     N/A  ");
 	}
 
 	sensor_count = alarm_count = 0;
@@ -470,7 +481,7 @@ static void print_chip_in(const sensors_chip_name *name,
 	print_limits(sensors, sensor_count, alarms, alarm_count, label_size,
 		     "%s = %+6.2f V");
 
-	printf("\n");
+	fprintf(output, "\n");
 }
 
 static void print_chip_fan(const sensors_chip_name *name,
@@ -479,27 +490,26 @@ static void print_chip_fan(const sensors_chip_name *name,
 {
 	const sensors_subfeature *sf, *sfmin, *sfmax, *sfdiv;
 	double val;
-	char *label;
+	const char *label;
 
-	if (!(label = sensors_get_label(name, feature))) {
+	if (!(label = sensors_get_label_ref(name, feature))) {
 		fprintf(stderr, "ERROR: Can't get label of feature %s!\n",
 			feature->name);
 		return;
 	}
 	print_label(label, label_size);
-	free(label);
 
 	sf = sensors_get_subfeature(name, feature,
 				    SENSORS_SUBFEATURE_FAN_FAULT);
 	if (sf && get_value(name, sf))
-		printf("   FAULT");
+		fprintf(output, "   FAULT");
 	else {
 		sf = sensors_get_subfeature(name, feature,
 					    SENSORS_SUBFEATURE_FAN_INPUT);
 		if (sf && get_input_value(name, sf, &val) == 0)
-			printf("%4.0f RPM", val);
+			fprintf(output, "%4.0f RPM", val);
 		else
-			printf("     N/A");
+			fprintf(output, "     N/A");
 	}
 
 	sfmin = sensors_get_subfeature(name, feature,
@@ -509,19 +519,19 @@ static void print_chip_fan(const sensors_chip_name *name,
 	sfdiv = sensors_get_subfeature(name, feature,
 				       SENSORS_SUBFEATURE_FAN_DIV);
 	if (sfmin || sfmax || sfdiv) {
-		printf("  (");
+		fprintf(output, "  (");
 		if (sfmin)
-			printf("min = %4.0f RPM",
-			       get_value(name, sfmin));
+			fprintf(output, "min = %4.0f RPM",
+				get_value(name, sfmin));
 		if (sfmax)
-			printf("%smax = %4.0f RPM",
-			       sfmin ? ", " : "",
-			       get_value(name, sfmax));
+			fprintf(output, "%smax = %4.0f RPM",
+				sfmin ? ", " : "",
+				get_value(name, sfmax));
 		if (sfdiv)
-			printf("%sdiv = %1.0f",
-			       (sfmin || sfmax) ? ", " : "",
-			       get_value(name, sfdiv));
-		printf(")");
+			fprintf(output, "%sdiv = %1.0f",
+				(sfmin || sfmax) ? ", " : "",
+				get_value(name, sfdiv));
+		fprintf(output, ")");
 	}
 
 	sf = sensors_get_subfeature(name, feature,
@@ -533,9 +543,9 @@ static void print_chip_fan(const sensors_chip_name *name,
 	if ((sf && get_value(name, sf)) ||
 	    (sfmin && get_value(name, sfmin)) ||
 	    (sfmax && get_value(name, sfmax)))
-		printf("  ALARM");
+		fprintf(output, "  ALARM");
 
-	printf("\n");
+	fprintf(output, "\n");
 }
 
 struct scale_table {
@@ -620,17 +630,16 @@ static void print_chip_power(const sensors_chip_name *name,
 	struct sensor_subfeature_data sensors[NUM_POWER_SENSORS];
 	struct sensor_subfeature_data alarms[NUM_POWER_ALARMS];
 	int sensor_count, alarm_count;
-	char *label;
+	const char *label;
 	const char *unit;
 	int i;
 
-	if (!(label = sensors_get_label(name, feature))) {
+	if (!(label = sensors_get_label_ref(name, feature))) {
 		fprintf(stderr, "ERROR: Can't get label of feature %s!\n",
 			feature->name);
 		return;
 	}
 	print_label(label, label_size);
-	free(label);
 
 	sensor_count = alarm_count = 0;
 
@@ -655,9 +664,10 @@ static void print_chip_power(const sensors_chip_name *name,
 
 	if (sf && get_input_value(name, sf, &val) == 0) {
 		scale_value(&val, &unit);
-		printf("%6.2f %sW%*s", val, unit, 2 - (int)strlen(unit), "");
+		fprintf(output, "%6.2f %sW%*s", val, unit,
+			2 - (int)strlen(unit), "");
 	} else {
-		printf("     N/A  ");
+		fprintf(output, "     N/A  ");
 	}
 
 	for (i = 0; i < sensor_count; i++) {
@@ -680,7 +690,7 @@ static void print_chip_power(const sensors_chip_name *name,
 	print_limits(sensors, sensor_count, alarms, alarm_count,
 		     label_size, "%s = %6.2f %s");
 
-	printf("\n");
+	fprintf(output, "\n");
 }
 
 static void print_chip_energy(const sensors_chip_name *name,
@@ -689,34 +699,33 @@ static void print_chip_energy(const sensors_chip_name *name,
 {
 	double val;
 	const sensors_subfeature *sf;
-	char *label;
+	const char *label;
 	const char *unit;
 
-	if (!(label = sensors_get_label(name, feature))) {
+	if (!(label = sensors_get_label_ref(name, feature))) {
 		fprintf(stderr, "ERROR: Can't get label of feature %s!\n",
 			feature->name);
 		return;
 	}
 	print_label(label, label_size);
-	free(label);
 
 	sf = sensors_get_subfeature(name, feature,
 				    SENSORS_SUBFEATURE_ENERGY_INPUT);
 	if (sf && get_input_value(name, sf, &val) == 0) {
 		scale_value(&val, &unit);
-		printf("%6.2f %sJ", val, unit);
+		fprintf(output, "%6.2f %sJ", val, unit);
 	} else {
-		printf("     N/A");
+		fprintf(output, "     N/A");
 	}
 
-	printf("\n");
+	fprintf(output, "\n");
 }
 
 static void print_chip_vid(const sensors_chip_name *name,
 			   const sensors_feature *feature,
 			   int label_size)
 {
-	char *label;
+	const char *label;
 	const sensors_subfeature *subfeature;
 	double vid;
 
@@ -725,19 +734,18 @@ static void print_chip_vid(const sensors_chip_name *name,
 	if (!subfeature)
 		return;
 
-	if ((label = sensors_get_label(name, feature))
+	if ((label = sensors_get_label_ref(name, feature))
 	 && !sensors_get_value(name, subfeature->number, &vid)) {
 		print_label(label, label_size);
-		printf("%+6.3f V\n", vid);
+		fprintf(output, "%+6.3f V\n", vid);
 	}
-	free(label);
 }
 
 static void print_chip_humidity(const sensors_chip_name *name,
 				const sensors_feature *feature,
 				int label_size)
 {
-	char *label;
+	const char *label;
 	const sensors_subfeature *subfeature;
 	double humidity;
 
@@ -746,19 +754,18 @@ static void print_chip_humidity(const sensors_chip_name *name,
 	if (!subfeature)
 		return;
 
-	if ((label = sensors_get_label(name, feature))
+	if ((label = sensors_get_label_ref(name, feature))
 	 && !sensors_get_value(name, subfeature->number, &humidity)) {
 		print_label(label, label_size);
-		printf("%6.1f %%RH\n", humidity);
+		fprintf(output, "%6.1f %%RH\n", humidity);
 	}
-	free(label);
 }
 
 static void print_chip_beep_enable(const sensors_chip_name *name,
 				   const sensors_feature *feature,
 				   int label_size)
 {
-	char *label;
+	const char *label;
 	const sensors_subfeature *subfeature;
 	double beep_enable;
 
@@ -767,12 +774,11 @@ static void print_chip_beep_enable(const sensors_chip_name *name,
 	if (!subfeature)
 		return;
 
-	if ((label = sensors_get_label(name, feature))
+	if ((label = sensors_get_label_ref(name, feature))
 	 && !sensors_get_value(name, subfeature->number, &beep_enable)) {
 		print_label(label, label_size);
-		printf("%s\n", beep_enable ? "enabled" : "disabled");
+		fprintf(output, "%s\n", beep_enable ? "enabled" : "disabled");
 	}
-	free(label);
 }
 
 static const struct sensor_subfeature_list current_sensors[] = {
@@ -800,27 +806,27 @@ static void print_chip_curr(const sensors_chip_name *name,
 {
 	const sensors_subfeature *sf;
 	double val;
-	char *label;
+	const char *label;
 	const char *unit;
 	struct sensor_subfeature_data sensors[NUM_CURR_SENSORS];
 	struct sensor_subfeature_data alarms[NUM_CURR_ALARMS];
 	int sensor_count, alarm_count;
 
-	if (!(label = sensors_get_label(name, feature))) {
+	if (!(label = sensors_get_label_ref(name, feature))) {
 		fprintf(stderr, "ERROR: Can't get label of feature %s!\n",
 			feature->name);
 		return;
 	}
 	print_label(label, label_size);
-	free(label);
 
 	sf = sensors_get_subfeature(name, feature,
 				    SENSORS_SUBFEATURE_CURR_INPUT);
 	if (sf && get_input_value(name, sf, &val) == 0) {
 		scale_value(&val, &unit);
-		printf("%6.2f %sA%*s", val, unit, 2 - (int)strlen(unit), "");
+		fprintf(output, "%6.2f %sA%*s", val, unit,
+			2 - (int)strlen(unit), "");
 	} else {
-		printf("     N/A  ");
+		fprintf(output, "     N/A  ");
 	}
 
 	sensor_count = alarm_count = 0;
@@ -830,14 +836,14 @@ static void print_chip_curr(const sensors_chip_name *name,
 	print_limits(sensors, sensor_count, alarms, alarm_count, label_size,
 		     "%s = %+6.2f A");
 
-	printf("\n");
+	fprintf(output, "\n");
 }
 
 static void print_chip_intrusion(const sensors_chip_name *name,
 				 const sensors_feature *feature,
 				 int label_size)
 {
-	char *label;
+	const char *label;
 	const sensors_subfeature *subfeature;
 	double alarm;
 
@@ -846,20 +852,18 @@ static void print_chip_intrusion(const sensors_chip_name *name,
 	if (!subfeature)
 		return;
 
-	if ((label = sensors_get_label(name, feature))
+	if ((label = sensors_get_label_ref(name, feature))
 	 && !sensors_get_value(name, subfeature->number, &alarm)) {
 		print_label(label, label_size);
-		printf("%s\n", alarm ? "ALARM" : "OK");
+		fprintf(output, "%s\n", alarm ? "ALARM" : "OK");
 	}
-	free(label);
 }
 
-void print_chip(const sensors_chip_name *name)
+/* label_size is computed once per chip by get_label_size() */
+void print_chip(const sensors_chip_name *name, int label_size)
 {
 	const sensors_feature *feature;
-	int i, label_size;
-
-	label_size = get_label_size(name);
+	int i;
 
 	i = 0;
 	while ((feature = sensors_get_features(name, &i))) {
@@ -26,6 +26,9 @@
 #include <errno.h>
 #include <locale.h>
 #include <langinfo.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
 
 #ifndef __UCLIBC__
 #include <iconv.h>
@@ -36,15 +39,19 @@
 #include "lib/error.h"
 #include "main.h"
 #include "chips.h"
+#include "writer.h"
 #include "version.h"
 
 #define PROGRAM			"sensors"
 #define VERSION			LM_VERSION
 
-static int do_sets, do_raw, do_json, hide_adapter;
+static int do_sets, do_raw, do_json, do_stats, hide_adapter;
+static double watch_interval;
 
 int fahrenheit;
 char degstr[5]; /* store the correct string to print degrees */
+int json_lines;
+FILE *output;
 
 static void print_short_help(void)
 {
@@ -55,6 +62,8 @@ static void print_long_help(void)
 {
 	printf("Usage: %s [OPTION]... [CHIP]...\n", PROGRAM);
 	puts("  -c, --config-file     Specify a config file\n"
+	     "      --cache-file      Cache the detected chips in a file\n"
+	     "      --compile-config  Compile the config file and exit\n"
 	     "  -h, --help            Display this help text\n"
 	     "  -s, --set             Execute `set' statements (root only)\n"
 	     "  -f, --fahrenheit      Show temperatures in degrees fahrenheit\n"
@@ -62,6 +71,10 @@ static void print_long_help(void)
 	     "      --bus-list        Generate bus statements for sensors.conf\n"
 	     "  -u                    Raw output\n"
 	     "  -j                    Json output\n"
+	     "      --watch=SECONDS   Print the values again every SECONDS\n"
+	     "      --stats           Print access statistics on exit\n"
+	     "      --read-deadline=[CHIP=]SECONDS\n"
+	     "                        Fail the reads taking longer\n"
 	     "  -v, --version         Display the program version\n"
 	     "\n"
 	     "Use `-' after `-c' to read the config file from stdin.\n"
@@ -83,27 +96,94 @@ static void print_version(void)
 }
 
 /* Return 0 on success, and an exit error code otherwise */
-static int read_config_file(const char *config_file_name)
+static int open_config_file(const char *config_file_name, FILE **config_file)
 {
-	FILE *config_file;
-	int err;
-
 	if (config_file_name) {
 		if (!strcmp(config_file_name, "-"))
-			config_file = stdin;
+			*config_file = stdin;
 		else
-			config_file = fopen(config_file_name, "r");
+			*config_file = fopen(config_file_name, "r");
 
-		if (!config_file) {
+		if (!*config_file) {
 			fprintf(stderr, "Could not open config file\n");
 			perror(config_file_name);
 			return 1;
 		}
 	} else {
 		/* Use libsensors default */
-		config_file = NULL;
+		*config_file = NULL;
 	}
+	return 0;
+}
+
+/* Return 0 on success, and an exit error code otherwise */
+static int compile_config_file(const char *config_file_name,
+			       const char *compiled_file_name)
+{
+	FILE *config_file;
+	int err;
 
+	err = open_config_file(config_file_name, &config_file);
+	if (err)
+		return err;
+
+	err = sensors_compile_config(config_file, compiled_file_name);
+	if (config_file)
+		fclose(config_file);
+	if (err) {
+		fprintf(stderr, "sensors_compile_config: %s\n",
+			sensors_strerror(err));
+		return 1;
+	}
+	return 0;
+}
+
+/* Parse [chip=]seconds. Return 0 on success, and an exit error code
+   otherwise */
+static int set_read_deadline(char *arg)
+{
+	sensors_chip_name chip;
+	char *sep = strrchr(arg, '='), *end;
+	double deadline;
+	int err;
+
+	deadline = strtod(sep ? sep + 1 : arg, &end);
+	if (end == (sep ? sep + 1 : arg) || *end || !(deadline >= 0)) {
+		fprintf(stderr, "Invalid read deadline `%s'\n", arg);
+		return 1;
+	}
+	if (!sep) {
+		sensors_set_read_deadline(NULL, deadline);
+		return 0;
+	}
+
+	*sep = '\0';
+	err = sensors_parse_chip_name(arg, &chip);
+	*sep = '=';
+	if (err) {
+		fprintf(stderr, "Parse error in chip name `%s'\n", arg);
+		return 1;
+	}
+	sensors_set_read_deadline(&chip, deadline);
+	sensors_free_chip_name(&chip);
+	return 0;
+}
+
+/* Return 0 on success, and an exit error code otherwise */
+static int read_config_file(const char *config_file_name)
+{
+	FILE *config_file;
+	int err;
+
+	err = open_config_file(config_file_name, &config_file);
+	if (err)
+		return err;
+
+	/* Startup time matters for an interactive tool, and in watch mode
+	   the same attribute files are read again and again */
+	sensors_set_flags(SENSORS_FLAG_PARALLEL_SCAN |
+			  (watch_interval ? SENSORS_FLAG_KEEP_FDS : 0) |
+			  (do_stats ? SENSORS_FLAG_STATS : 0));
 	err = sensors_init(config_file);
 	if (err) {
 		fprintf(stderr, "sensors_init: %s\n", sensors_strerror(err));
@@ -157,35 +237,57 @@ static const char *sprintf_chip_name(const sensors_chip_name *name)
 	return buf;
 }
 
-static void do_a_print(const sensors_chip_name *name)
+static void do_a_print(const sensors_chip_name *name, int label_size)
 {
-	printf("%s\n", sprintf_chip_name(name));
+	fprintf(output, "%s\n", sprintf_chip_name(name));
 	if (!hide_adapter) {
 		const char *adap = sensors_get_adapter_name(&name->bus);
 		if (adap)
-			printf("Adapter: %s\n", adap);
+			fprintf(output, "Adapter: %s\n", adap);
 		else
 			fprintf(stderr, "Can't get adapter name\n");
 	}
-	if (do_raw)
-		print_chip_raw(name);
-	else
-		print_chip(name);
-	printf("\n");
+	print_chip(name, label_size);
+	fprintf(output, "\n");
+}
+
+static void do_a_raw_print(const sensors_chip_name *name)
+{
+	out_str(sprintf_chip_name(name));
+	out_char('\n');
+	if (!hide_adapter) {
+		const char *adap = sensors_get_adapter_name(&name->bus);
+		if (adap) {
+			out_str("Adapter: ");
+			out_str(adap);
+			out_char('\n');
+		} else
+			fprintf(stderr, "Can't get adapter name\n");
+	}
+	print_chip_raw(name);
+	out_char('\n');
 }
 
 static void do_a_json_print(const sensors_chip_name *name)
 {
-	printf("   \"%s\":{\n", sprintf_chip_name(name));
+	int cnt = 0;
+
+	if (!json_lines)
+		out_str("   ");
+	out_json_str(sprintf_chip_name(name));
+	out_str(json_lines ? ":{" : ":{\n");
 	if (!hide_adapter) {
 		const char *adap = sensors_get_adapter_name(&name->bus);
-		if (adap)
-			printf("      \"Adapter\": \"%s\",\n", adap);
-		else
+		if (adap) {
+			out_str(json_lines ? "\"Adapter\":" :
+				"      \"Adapter\": ");
+			out_json_str(adap);
+			cnt++;
+		} else
 			fprintf(stderr, "Can't get adapter name\n");
 	}
-	print_chip_json(name);
-	printf("   }");
+	print_chip_json(name, cnt);
+	out_str(json_lines ? "}" : "   }");
 }
 
 /* returns 1 on error */
@@ -220,7 +322,7 @@ static int do_the_real_work(const sensors_chip_name *match, int *err)
 	int cnt = 0;
 
 	if (do_json)
-		printf("{\n");
+		out_str("{\n");
 	chip_nr = 0;
 	while ((chip = sensors_get_detected_chips(match, &chip_nr))) {
 		if (do_sets) {
@@ -229,19 +331,77 @@ static int do_the_real_work(const sensors_chip_name *match, int *err)
 		} else {
 			if (do_json) {
 				if (cnt > 0)
-					printf(",\n");
+					out_str(",\n");
 				do_a_json_print(chip);
+			} else if (do_raw) {
+				do_a_raw_print(chip);
 			} else {
-				do_a_print(chip);
+				do_a_print(chip, get_label_size(chip));
 			}
 		}
 		cnt++;
 	}
 	if (do_json)
-		printf("\n}\n");
+		out_str("\n}\n");
 	return cnt;
 }
 
+static const char *stats_buckets[SENSORS_STATS_BUCKETS] = {
+	"<10us", "<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s"
+};
+
+/* Print the access statistics of the subfeatures of all detected chips
+   which were accessed, on stderr so that any output format can be used */
+static void print_stats(void)
+{
+	const sensors_chip_name *chip;
+	const sensors_feature *feature;
+	const sensors_subfeature *sub;
+	sensors_stats stats;
+	unsigned long count;
+	int chip_nr, f, s, i;
+
+	chip_nr = 0;
+	while ((chip = sensors_get_detected_chips(NULL, &chip_nr))) {
+		fprintf(stderr, "%s\n", sprintf_chip_name(chip));
+		f = 0;
+		while ((feature = sensors_get_features(chip, &f))) {
+			s = 0;
+			while ((sub = sensors_get_all_subfeatures(chip,
+							feature, &s))) {
+				if (sensors_get_stats(chip, sub->number,
+						      &stats))
+					continue;
+				count = stats.reads + stats.writes;
+				if (!count)
+					continue;
+
+				fprintf(stderr, "  %s: %lu reads, %lu writes, "
+					"%lu errors, latency %.1f us average, "
+					"%.1f us max, %.1f us last\n",
+					sub->name, stats.reads, stats.writes,
+					stats.errors[0],
+					stats.total_latency / count * 1e6,
+					stats.max_latency * 1e6,
+					stats.last_latency * 1e6);
+				for (i = 1; i < SENSORS_STATS_ERRORS; i++)
+					if (stats.errors[i])
+						fprintf(stderr, "    %s: %lu\n",
+							sensors_strerror(-i),
+							stats.errors[i]);
+				fprintf(stderr, "   ");
+				for (i = 0; i < SENSORS_STATS_BUCKETS; i++)
+					if (stats.histogram[i])
+						fprintf(stderr, " %s: %lu",
+							stats_buckets[i],
+							stats.histogram[i]);
+				fprintf(stderr, "\n");
+			}
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
 /* List the buses in a format suitable for sensors.conf. We only list
    bus types for which bus statements are actually useful and supported.
    Known bug: i2c buses with number >= 32 or 64 could be listed several
@@ -268,10 +428,211 @@ static void print_bus_list(void)
 	}
 }
 
+/*
+ * Watch mode. The library is initialized once, and the chips to print as
+ * well as their layout are determined once, then only the values are read
+ * again on every tick. On a terminal, only the lines which changed since
+ * the previous tick are written again, in a single write.
+ */
+
+struct watched_chip {
+	const sensors_chip_name *name;
+	int label_size;
+};
+
+static struct watched_chip *watched;
+static int watched_count;
+static volatile sig_atomic_t watch_done;
+
+static void watch_signal(int sig)
+{
+	(void)sig;
+	watch_done = 1;
+}
+
+/* returns number of chips added */
+static int add_watched_chips(const sensors_chip_name *match)
+{
+	const sensors_chip_name *chip;
+	int chip_nr, cnt = 0;
+
+	chip_nr = 0;
+	while ((chip = sensors_get_detected_chips(match, &chip_nr))) {
+		watched = realloc(watched,
+				  (watched_count + 1) * sizeof(*watched));
+		if (!watched) {
+			perror("realloc");
+			exit(1);
+		}
+		watched[watched_count].name = chip;
+		watched[watched_count].label_size = get_label_size(chip);
+		watched_count++;
+		cnt++;
+	}
+	return cnt;
+}
+
+static void print_watched_json(void)
+{
+	int i;
+
+	out_char('{');
+	for (i = 0; i < watched_count; i++) {
+		if (i > 0)
+			out_char(',');
+		do_a_json_print(watched[i].name);
+	}
+	out_str("}\n");
+}
+
+static void print_watched(void)
+{
+	int i;
+
+	for (i = 0; i < watched_count; i++) {
+		if (do_raw)
+			do_a_raw_print(watched[i].name);
+		else
+			do_a_print(watched[i].name, watched[i].label_size);
+	}
+	out_flush();
+}
+
+/* Return the length of the line starting at p, not counting the newline */
+static int line_length(const char *p, const char *end)
+{
+	const char *nl = memchr(p, '\n', end - p);
+
+	return (nl ? nl : end) - p;
+}
+
+/* Rewrite the lines of the terminal which differ from the previous frame */
+static void update_screen(const char *old, size_t old_size,
+			  const char *new, size_t new_size)
+{
+	const char *old_end = old + old_size, *new_end = new + new_size;
+	int row, old_len, new_len;
+
+	for (row = 1; new < new_end; row++) {
+		new_len = line_length(new, new_end);
+		old_len = old < old_end ? line_length(old, old_end) : -1;
+		if (new_len != old_len || memcmp(old, new, new_len))
+			printf("\033[%d;1H%.*s\033[K", row, new_len, new);
+		new += new_len + 1;
+		if (old < old_end)
+			old += old_len + 1;
+	}
+	/* Clear what remains of a longer previous frame, and leave the
+	   cursor below the frame */
+	printf("\033[%d;1H", row);
+	if (old < old_end)
+		printf("\033[J");
+	fflush(stdout);
+}
+
+/* returns 1 on error */
+static int do_watch(int argc, char *argv[])
+{
+	struct sigaction sa;
+	struct timespec next, now;
+	sensors_chip_name chip;
+	char *frame = NULL, *prev = NULL;
+	size_t frame_size = 0, prev_size = 0;
+	int i, tty;
+
+	if (argc == 0) {
+		if (!add_watched_chips(NULL)) {
+			fprintf(stderr,
+				"No sensors found!\n"
+				"Make sure you loaded all the kernel drivers you need.\n"
+				"Try sensors-detect to find out which these are.\n");
+			return 1;
+		}
+	} else {
+		for (i = 0; i < argc; i++) {
+			if (sensors_parse_chip_name(argv[i], &chip)) {
+				fprintf(stderr,
+					"Parse error in chip name `%s'\n",
+					argv[i]);
+				print_short_help();
+				return 1;
+			}
+			add_watched_chips(&chip);
+			sensors_free_chip_name(&chip);
+		}
+		if (!watched_count) {
+			fprintf(stderr, "Specified sensor(s) not found!\n");
+			return 1;
+		}
+	}
+
+	/* Stop cleanly between two ticks */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = watch_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	tty = !do_json && isatty(STDOUT_FILENO);
+	json_lines = do_json;
+	/* One write per tick */
+	setvbuf(stdout, NULL, _IOFBF, 65536);
+	if (tty)
+		printf("\033[H\033[2J");
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!watch_done) {
+		if (do_json) {
+			print_watched_json();
+			out_flush();
+		} else if (tty) {
+			output = open_memstream(&frame, &frame_size);
+			if (!output) {
+				perror("open_memstream");
+				return 1;
+			}
+			print_watched();
+			fclose(output);
+			output = stdout;
+			update_screen(prev ? prev : "", prev_size,
+				      frame, frame_size);
+			free(prev);
+			prev = frame;
+			prev_size = frame_size;
+		} else {
+			print_watched();
+			fflush(stdout);
+		}
+
+		/* Ticks are kept on a fixed schedule, unless we fell behind */
+		next.tv_sec += (time_t)watch_interval;
+		next.tv_nsec += (long)((watch_interval - (time_t)watch_interval)
+				       * 1e9);
+		if (next.tv_nsec >= 1000000000) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > next.tv_sec ||
+		    (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec))
+			next = now;
+		while (!watch_done && clock_nanosleep(CLOCK_MONOTONIC,
+						      TIMER_ABSTIME, &next,
+						      NULL) == EINTR)
+			;
+	}
+
+	free(prev);
+	free(watched);
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
-	int c, i, err, do_bus_list;
+	int c, i, err, do_bus_list, do_compile;
 	const char *config_file_name = NULL;
+	const char *compiled_file_name = NULL;
+	char *end;
 
 	struct option long_opts[] =  {
 		{ "help", no_argument, NULL, 'h' },
@@ -281,15 +642,23 @@ int main(int argc, char *argv[])
 		{ "no-adapter", no_argument, NULL, 'A' },
 		{ "config-file", required_argument, NULL, 'c' },
 		{ "bus-list", no_argument, NULL, 'B' },
+		{ "cache-file", required_argument, NULL, 'C' },
+		{ "compile-config", optional_argument, NULL, 'P' },
+		{ "watch", required_argument, NULL, 'W' },
+		{ "stats", no_argument, NULL, 'T' },
+		{ "read-deadline", required_argument, NULL, 'R' },
 		{ 0, 0, 0, 0 }
 	};
 
 	setlocale(LC_CTYPE, "");
+	output = stdout;
 
 	do_raw = 0;
 	do_json = 0;
 	do_sets = 0;
+	do_stats = 0;
 	do_bus_list = 0;
+	do_compile = 0;
 	hide_adapter = 0;
 	while (1) {
 		c = getopt_long(argc, argv, "hsvfAc:uj", long_opts, NULL);
@@ -327,6 +696,28 @@ int main(int argc, char *argv[])
 		case 'B':
 			do_bus_list = 1;
 			break;
+		case 'C':
+			sensors_set_cache_file(optarg);
+			break;
+		case 'P':
+			do_compile = 1;
+			compiled_file_name = optarg;
+			break;
+		case 'T':
+			do_stats = 1;
+			break;
+		case 'R':
+			if (set_read_deadline(optarg))
+				exit(1);
+			break;
+		case 'W':
+			watch_interval = strtod(optarg, &end);
+			if (*end || !(watch_interval > 0)) {
+				fprintf(stderr, "Invalid watch interval `%s'\n",
+					optarg);
+				exit(1);
+			}
+			break;
 		default:
 			fprintf(stderr,
 				"Internal error while parsing options!\n");
@@ -334,6 +725,15 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (watch_interval && (do_sets || do_bus_list)) {
+		fprintf(stderr, "Option --watch can't be combined with -s or "
+			"--bus-list\n");
+		exit(1);
+	}
+
+	if (do_compile)
+		exit(compile_config_file(config_file_name, compiled_file_name));
+
 	err = read_config_file(config_file_name);
 	if (err)
 		exit(err);
@@ -343,6 +743,8 @@ int main(int argc, char *argv[])
 
 	if (do_bus_list) {
 		print_bus_list();
+	} else if (watch_interval) {
+		err = do_watch(argc - optind, argv + optind);
 	} else if (optind == argc) { /* No chip name on command line */
 		if (!do_the_real_work(NULL, &err)) {
 			fprintf(stderr,
@@ -375,6 +777,9 @@ int main(int argc, char *argv[])
 	}
 
 exit:
+	out_flush();
+	if (do_stats)
+		print_stats();
 	sensors_cleanup();
 	exit(err);
 }
@@ -21,7 +21,11 @@
 #ifndef PROG_SENSORS_MAIN_H
 #define PROG_SENSORS_MAIN_H
 
+#include <stdio.h>
+
 extern int fahrenheit;
 extern char degstr[5];
+extern int json_lines;	/* One JSON object per line */
+extern FILE *output;	/* Stream all chip data is printed to */
 
 #endif /* PROG_SENSORS_MAIN_H */
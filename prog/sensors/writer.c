@@ -0,0 +1,181 @@
+/*
+    writer.c - Part of sensors, a user-space program for hardware monitoring
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "writer.h"
+
+/* Large enough for the output of all chips of most systems */
+#define OUT_BUF_SIZE	65536
+
+static char out_buf[OUT_BUF_SIZE];
+static size_t out_len;
+
+/* Output on stdout is written directly, to get a single write() call.
+   Other streams, such as the frames of watch mode, go through stdio. */
+void out_flush(void)
+{
+	const char *p = out_buf;
+	ssize_t ret;
+
+	if (output != stdout) {
+		fwrite(out_buf, 1, out_len, output);
+		out_len = 0;
+		return;
+	}
+
+	fflush(stdout);
+	while (out_len) {
+		ret = write(STDOUT_FILENO, p, out_len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		p += ret;
+		out_len -= ret;
+	}
+	out_len = 0;
+}
+
+static void out_mem(const char *s, size_t len)
+{
+	size_t n;
+
+	while (len) {
+		if (out_len == OUT_BUF_SIZE)
+			out_flush();
+		n = OUT_BUF_SIZE - out_len;
+		if (n > len)
+			n = len;
+		memcpy(out_buf + out_len, s, n);
+		out_len += n;
+		s += n;
+		len -= n;
+	}
+}
+
+void out_char(char c)
+{
+	if (out_len == OUT_BUF_SIZE)
+		out_flush();
+	out_buf[out_len++] = c;
+}
+
+void out_str(const char *s)
+{
+	out_mem(s, strlen(s));
+}
+
+void out_json_str(const char *s)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *p;
+	char esc[6];
+
+	out_char('"');
+	for (p = s; *p; p++) {
+		unsigned char c = *p;
+
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+		/* Copy the run of characters which need no escaping at once */
+		out_mem(s, p - s);
+		s = p + 1;
+		esc[0] = '\\';
+		switch (c) {
+		case '"':
+		case '\\':
+			esc[1] = c;
+			break;
+		case '\b':
+			esc[1] = 'b';
+			break;
+		case '\f':
+			esc[1] = 'f';
+			break;
+		case '\n':
+			esc[1] = 'n';
+			break;
+		case '\r':
+			esc[1] = 'r';
+			break;
+		case '\t':
+			esc[1] = 't';
+			break;
+		default:
+			memcpy(esc + 1, "u00", 3);
+			esc[4] = hex[c >> 4];
+			esc[5] = hex[c & 0xf];
+			out_mem(esc, 6);
+			continue;
+		}
+		out_mem(esc, 2);
+	}
+	out_mem(s, p - s);
+	out_char('"');
+}
+
+void out_value(double value)
+{
+	char buf[32], *p = buf + sizeof(buf);
+	unsigned long long n;
+	double scaled;
+	int i;
+
+	/*
+	 * Round to an integer number of thousandths. This gives the same
+	 * result as printf, except for huge values and for values which
+	 * are about halfway between two outputs (because of the rounding
+	 * of the multiplication), which are left to printf.
+	 */
+	scaled = fabs(value) * 1000;
+	if (!(scaled < 1e15) || fabs(scaled - floor(scaled) - 0.5) < 1e-6) {
+		snprintf(buf, sizeof(buf), "%.3f", value);
+		out_str(buf);
+		return;
+	}
+
+	n = (unsigned long long)(scaled + 0.5);
+	for (i = 0; i < 3; i++) {
+		*--p = '0' + n % 10;
+		n /= 10;
+	}
+	*--p = '.';
+	do {
+		*--p = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	if (signbit(value))
+		*--p = '-';
+	out_mem(p, buf + sizeof(buf) - p);
+}
+
+void out_json_value(double value)
+{
+	if (isfinite(value))
+		out_value(value);
+	else
+		out_str("null");
+}
@@ -0,0 +1,39 @@
+/*
+    writer.h - Part of sensors, a user-space program for hardware monitoring
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef PROG_SENSORS_WRITER_H
+#define PROG_SENSORS_WRITER_H
+
+/*
+ * Buffered writer for the raw and JSON outputs. Everything is gathered in
+ * a buffer, which is written to the output stream by out_flush(), or when
+ * it is full.
+ */
+
+void out_char(char c);
+void out_str(const char *s);
+/* Print a string as a quoted JSON string */
+void out_json_str(const char *s);
+/* Print a value with 3 decimals, the same way as printf("%.3f") */
+void out_value(double value);
+/* Same, but non-finite values, which JSON can't represent, print as null */
+void out_json_value(double value);
+void out_flush(void);
+
+#endif /* def PROG_SENSORS_WRITER_H */